@@ -0,0 +1,466 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+// latency and throughput of the metadata and data hot paths across directory sizes, tree depths,
+// image sizes and cold vs warm caches, printed as JSON for comparing runs,
+// usage: fs_bench [-b stdio|pread|mmap] [-q] [-n] [-c] [-o file] [dir]
+//   -q  quick, a smaller grid for CI, -n  no journal, -c  no metadata checksums,
+//   -o  JSON to file instead of stdout
+//
+// cold means the buffer, inode and dentry caches are dropped by a remount before every single
+// op (the remount isn't timed, the OS page cache stays warm), warm means the same op ran before.
+// a run with -c next to one without gives what checksum verification costs each op
+
+#include "../include/FileSystemStructure.h"
+#include "../include/FileManagement.h"
+#include "../include/Directories.h"
+#include "../include/Files.h"
+#include "../include/Paths.h"
+#include "../include/Checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RESULTS 128
+#define IO_CHUNK (64 * 1024)
+
+typedef struct {
+    const char *name;
+    char params[96];    // JSON members, no braces
+    uint32_t ops;
+    double ops_per_s;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+} Result;
+
+static Result results[MAX_RESULTS];
+static int num_results = 0;
+
+static char image[4096];
+static FsOptions opts;
+static int quick = 0;
+
+static uint64_t *lat = NULL;        // latencies of the running case
+static uint32_t lat_cap = 0;
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift, same sequence every run
+static uint32_t pick(uint32_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng % n);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void need(uint32_t ops) {
+    if (ops <= lat_cap) return;
+    free(lat);
+    lat = malloc(ops * sizeof(uint64_t));
+    lat_cap = lat ? ops : 0;
+    if (!lat) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+}
+
+// files the latencies of ops timed ops under name and params
+static void record(const char *name, const char *params, uint32_t ops) {
+    if (num_results == MAX_RESULTS || ops == 0) return;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < ops; i++) total += lat[i];
+    qsort(lat, ops, sizeof(uint64_t), compare_u64);
+
+    Result *r = &results[num_results++];
+    r->name = name;
+    snprintf(r->params, sizeof(r->params), "%s", params);
+    r->ops = ops;
+    r->ops_per_s = total ? ops / (total / 1e9) : 0;
+    r->p50_ns = lat[ops / 2];
+    r->p99_ns = lat[(uint64_t)ops * 99 / 100];
+    fprintf(stderr, "%-12s %-56s %10.0f ops/s  p50 %8llu ns  p99 %8llu ns\n", name, params, r->ops_per_s,
+            (unsigned long long)r->p50_ns, (unsigned long long)r->p99_ns);
+}
+
+static void fail(const char *what) {
+    fprintf(stderr, "benchmark failed: %s\n", what);
+    unmount_disk();
+    remove(image);
+    exit(1);
+}
+
+static void fresh(uint32_t blocks) {
+    if (format_disk_opts(image, blocks, &opts) == -1) fail("format");
+}
+
+// drops every in-memory cache of the image
+static void remount() {
+    unmount_disk();
+    if (mount_disk_opts(image, &opts) == -1) fail("mount");
+}
+
+static const char *cache_name(int cold) {
+    return cold ? "cold" : "warm";
+}
+
+// ---------- directories ----------
+
+// one directory of size entries: adding them, then looking up random ones
+static void bench_dir(uint32_t size) {
+    char name[NAME_MAX], params[96];
+    fresh(16 * 1024);
+    char dname[] = "d";
+    int dir = mkdir(fs.sb.root_inode, dname);
+    if (dir == -1) fail("mkdir");
+
+    need(size);
+    for (uint32_t i = 0; i < size; i++) {
+        int child = create_inode(IREG | IRUSR | IWUSR);
+        if (child == -1) fail("create_inode");
+        snprintf(name, sizeof(name), "f%u", i);
+        uint64_t t = ns();
+        if (dir_add((uint32_t)dir, name, (uint32_t)child, IREG) == -1) fail("dir_add");
+        lat[i] = ns() - t;
+    }
+    snprintf(params, sizeof(params), "\"dir_size\": %u", size);
+    record("dir_add", params, size);
+
+    for (int cold = 0; cold <= 1; cold++) {
+        uint32_t ops = cold ? (quick ? 20 : 100) : (quick ? 1000 : 10000);
+        need(ops);
+        if (!cold) {
+            for (uint32_t i = 0; i < size; i++) { // warm up every entry block
+                snprintf(name, sizeof(name), "f%u", i);
+                dir_lookup((uint32_t)dir, name);
+            }
+        }
+        for (uint32_t i = 0; i < ops; i++) {
+            if (cold) remount();
+            snprintf(name, sizeof(name), "f%u", pick(size));
+            uint64_t t = ns();
+            if (dir_lookup((uint32_t)dir, name) < 0) fail("dir_lookup");
+            lat[i] = ns() - t;
+        }
+        snprintf(params, sizeof(params), "\"dir_size\": %u, \"cache\": \"%s\"", size, cache_name(cold));
+        record("dir_lookup", params, ops);
+    }
+    unmount_disk();
+}
+
+static void scan_name(char *name, uint32_t len, uint32_t n, int shared_prefix) {
+    if (shared_prefix) snprintf(name, NAME_MAX, "%0*u", (int)len, n);
+    else snprintf(name, NAME_MAX, "%-*u", (int)len, n);
+}
+
+// dirent_find over one full dir block of same length names, shared_prefix puts the digits that
+// tell them apart at the end instead of the start, a random one of them is looked for
+static void bench_scan(uint32_t name_len, int shared_prefix) {
+    uint8_t block[BLOCK_SIZE];
+    char name[NAME_MAX], params[96];
+    DirEntry entry;
+    dirent_init(block, BLOCK_SIZE);
+
+    uint32_t n = 0;
+    for (;; n++) {
+        memset(&entry, 0, sizeof(entry));
+        scan_name(entry.name, name_len, n, shared_prefix);
+        entry.name_len = (uint8_t)name_len;
+        entry.inode_num = n;
+        entry.type = IREG;
+        if (dirent_insert(block, BLOCK_SIZE, &entry) == -1) break;
+    }
+
+    uint32_t ops = quick ? 20000 : 200000;
+    need(ops);
+    for (uint32_t i = 0; i < ops; i++) {
+        scan_name(name, name_len, pick(n), shared_prefix);
+        uint64_t t = ns();
+        if (dirent_find(block, BLOCK_SIZE, name, NULL) < 0) fail("dirent_find");
+        lat[i] = ns() - t;
+    }
+    snprintf(params, sizeof(params), "\"name_len\": %u, \"entries\": %u, \"shared_prefix\": %s", name_len,
+             n, shared_prefix ? "true" : "false");
+    record("dir_scan", params, ops);
+}
+
+// creat and mkdir filling one directory up to size entries
+static void bench_create(uint32_t size) {
+    char name[NAME_MAX], params[96];
+    snprintf(params, sizeof(params), "\"dir_size\": %u", size);
+    need(size);
+
+    for (int dirs = 0; dirs <= 1; dirs++) {
+        fresh(64 * 1024);
+        char dname[] = "d";
+        int dir = mkdir(fs.sb.root_inode, dname);
+        if (dir == -1) fail("mkdir");
+
+        for (uint32_t i = 0; i < size; i++) {
+            snprintf(name, sizeof(name), "e%u", i);
+            uint64_t t = ns();
+            int inum = dirs ? mkdir((uint32_t)dir, name) : creat((uint32_t)dir, name, IREG | IRUSR | IWUSR);
+            lat[i] = ns() - t;
+            if (inum == -1) fail(dirs ? "mkdir" : "creat");
+        }
+        record(dirs ? "mkdir" : "creat", params, size);
+        unmount_disk();
+    }
+}
+
+// whole paths depth components deep, every component a lookup in its parent
+static void bench_path(uint32_t depth) {
+    char path[4096] = "", params[96];
+    fresh(16 * 1024);
+
+    uint32_t dir = fs.sb.root_inode;
+    for (uint32_t i = 0; i < depth; i++) {
+        char name[NAME_MAX];
+        snprintf(name, sizeof(name), "d%u", i);
+        int child = mkdir(dir, name);
+        if (child == -1) fail("mkdir");
+        dir = (uint32_t)child;
+        strcat(path, "/");
+        strcat(path, name);
+    }
+
+    for (int cold = 0; cold <= 1; cold++) {
+        uint32_t ops = cold ? (quick ? 20 : 100) : (quick ? 2000 : 20000);
+        need(ops);
+        path_resolve(fs.sb.root_inode, path);
+        for (uint32_t i = 0; i < ops; i++) {
+            if (cold) remount();
+            uint64_t t = ns();
+            if (path_resolve(fs.sb.root_inode, path) != (long)dir) fail("path_resolve");
+            lat[i] = ns() - t;
+        }
+        snprintf(params, sizeof(params), "\"depth\": %u, \"cache\": \"%s\"", depth, cache_name(cold));
+        record("path_resolve", params, ops);
+    }
+    unmount_disk();
+}
+
+// CRC32C over one block, the instruction set's and the tables' (what a CPU without it pays)
+static void bench_crc() {
+    uint8_t block[BLOCK_SIZE];
+    char params[96];
+    for (size_t i = 0; i < BLOCK_SIZE; i++) block[i] = (uint8_t)(i * 31 + 7);
+
+    uint32_t ops = quick ? 20000 : 200000;
+    need(ops);
+    for (int portable = 0; portable <= 1; portable++) {
+        volatile uint32_t crc = 0; // keeps the loop from being optimized out
+        for (uint32_t i = 0; i < ops; i++) {
+            uint64_t t = ns();
+            crc = portable ? crc32c_portable(crc, block, BLOCK_SIZE) : crc32c(crc, block, BLOCK_SIZE);
+            lat[i] = ns() - t;
+        }
+        snprintf(params, sizeof(params), "\"bytes\": %u, \"impl\": \"%s\"", BLOCK_SIZE,
+                 portable ? "table" : crc32c_accelerated() ? "sse4.2" : "table");
+        record("crc32c", params, ops);
+    }
+}
+
+// ---------- allocation and inodes ----------
+
+static void bench_alloc(uint32_t blocks) {
+    char params[96];
+    snprintf(params, sizeof(params), "\"image_mib\": %u", blocks / (1024 * 1024 / BLOCK_SIZE));
+    fresh(blocks);
+
+    uint32_t ops = quick ? 2000 : 20000;
+    if (ops > fs.sb.free_blocks / 2) ops = fs.sb.free_blocks / 2; // the small image fills up
+    need(ops);
+    for (uint32_t i = 0; i < ops; i++) {
+        uint64_t t = ns();
+        if (alloc_block() == -1) fail("alloc_block");
+        lat[i] = ns() - t;
+    }
+    record("alloc_block", params, ops);
+
+    ops = quick ? 1000 : 5000;
+    if (ops > fs.sb.free_inodes) ops = fs.sb.free_inodes;
+    for (uint32_t i = 0; i < ops; i++) {
+        uint64_t t = ns();
+        if (alloc_inode() == -1) fail("alloc_inode");
+        lat[i] = ns() - t;
+    }
+    record("alloc_inode", params, ops);
+    unmount_disk();
+}
+
+// random inodes of a populated table, reads cold and warm, writes warm
+static void bench_inode() {
+    char params[96];
+    fresh(64 * 1024);
+
+    uint32_t count = quick ? 500 : 4000;
+    uint32_t *inums = malloc(count * sizeof(uint32_t));
+    if (!inums) fail("out of memory");
+    for (uint32_t i = 0; i < count; i++) {
+        int inum = create_inode(IREG | IRUSR | IWUSR);
+        if (inum == -1) fail("create_inode");
+        inums[i] = (uint32_t)inum;
+    }
+
+    Inode inode;
+    for (int cold = 0; cold <= 1; cold++) {
+        uint32_t ops = cold ? (quick ? 20 : 100) : (quick ? 5000 : 50000);
+        need(ops);
+        for (uint32_t i = 0; i < count && !cold; i++) read_inode(inums[i], &inode);
+        for (uint32_t i = 0; i < ops; i++) {
+            if (cold) remount();
+            uint32_t inum = inums[pick(count)];
+            uint64_t t = ns();
+            if (read_inode(inum, &inode) == -1) fail("read_inode");
+            lat[i] = ns() - t;
+        }
+        snprintf(params, sizeof(params), "\"inodes\": %u, \"cache\": \"%s\"", count, cache_name(cold));
+        record("read_inode", params, ops);
+    }
+
+    uint32_t ops = quick ? 5000 : 50000;
+    need(ops);
+    for (uint32_t i = 0; i < ops; i++) {
+        uint32_t inum = inums[pick(count)];
+        read_inode(inum, &inode);
+        inode.mtime++;
+        uint64_t t = ns();
+        if (write_inode(inum, &inode) == -1) fail("write_inode");
+        lat[i] = ns() - t;
+    }
+    snprintf(params, sizeof(params), "\"inodes\": %u, \"cache\": \"warm\"", count);
+    record("write_inode", params, ops);
+
+    free(inums);
+    unmount_disk();
+}
+
+// ---------- file data ----------
+
+// one file of mib MiB in IO_CHUNK requests, written then read back cold and warm
+static void bench_file(uint32_t blocks, uint32_t mib) {
+    char params[96], name[] = "f";
+    fresh(blocks);
+    int file = creat(fs.sb.root_inode, name, IREG | IRUSR | IWUSR);
+    if (file == -1) fail("creat");
+
+    uint8_t *buf;
+    if (posix_memalign((void **)&buf, BDEV_ALIGN, IO_CHUNK) != 0) fail("out of memory");
+    for (size_t i = 0; i < IO_CHUNK; i++) buf[i] = (uint8_t)(i * 31 + 7);
+
+    uint32_t chunks = (uint32_t)((uint64_t)mib * 1024 * 1024 / IO_CHUNK);
+    need(chunks);
+    for (uint32_t i = 0; i < chunks; i++) {
+        uint64_t t = ns();
+        if (fs_write((uint32_t)file, (uint64_t)i * IO_CHUNK, buf, IO_CHUNK) != IO_CHUNK) fail("fs_write");
+        lat[i] = ns() - t;
+    }
+    snprintf(params, sizeof(params), "\"image_mib\": %u, \"request_kib\": %u",
+             blocks / (1024 * 1024 / BLOCK_SIZE), IO_CHUNK / 1024);
+    record("fs_write", params, chunks);
+
+    for (int cold = 0; cold <= 1; cold++) {
+        uint32_t ops = cold ? (chunks < 100 ? chunks : 100) : chunks;
+        for (uint32_t i = 0; i < ops; i++) {
+            if (cold) remount();
+            uint64_t off = (uint64_t)(cold ? pick(chunks) : i) * IO_CHUNK;
+            uint64_t t = ns();
+            if (fs_read((uint32_t)file, off, buf, IO_CHUNK) != IO_CHUNK) fail("fs_read");
+            lat[i] = ns() - t;
+        }
+        snprintf(params, sizeof(params), "\"image_mib\": %u, \"request_kib\": %u, \"cache\": \"%s\"",
+                 blocks / (1024 * 1024 / BLOCK_SIZE), IO_CHUNK / 1024, cache_name(cold));
+        record("fs_read", params, ops);
+    }
+
+    free(buf);
+    unmount_disk();
+}
+
+static void print_json(FILE *out) {
+    fprintf(out, "{\n  \"benchmark\": \"fs_bench\",\n  \"backend\": \"%s\",\n  \"journal\": %s,\n"
+                 "  \"checksums\": %s,\n  \"quick\": %s,\n  \"results\": [\n",
+            bdev_type_name(opts.backend), opts.journal ? "true" : "false", opts.checksums ? "true" : "false",
+            quick ? "true" : "false");
+    for (int i = 0; i < num_results; i++) {
+        const Result *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"params\": {%s}, \"ops\": %u, \"ops_per_s\": %.1f, "
+                     "\"p50_ns\": %llu, \"p99_ns\": %llu}%s\n",
+                r->name, r->params, r->ops, r->ops_per_s, (unsigned long long)r->p50_ns,
+                (unsigned long long)r->p99_ns, i + 1 < num_results ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    fs_default_options(&opts);
+    const char *out_path = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "b:qnco:")) != -1) {
+        switch (c) {
+            case 'b':
+                if (bdev_parse_type(optarg, &opts.backend) == -1) {
+                    fprintf(stderr, "unknown backend %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'q': quick = 1; break;
+            case 'n': opts.journal = 0; break;
+            case 'c': opts.checksums = 0; break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-b stdio|pread|mmap] [-q] [-n] [-c] [-o file] [dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    const char *dir = optind < argc ? argv[optind] : ".";
+    snprintf(image, sizeof(image), "%s/fs_bench.bin", dir);
+
+    // progress goes to stderr and the JSON to the real stdout, format's own line nowhere
+    int json_fd = dup(STDOUT_FILENO);
+    if (json_fd == -1 || freopen("/dev/null", "w", stdout) == NULL) return 1;
+
+    const uint32_t dir_sizes[] = {16, 256, 4096};
+    const uint32_t depths[] = {1, 8, 32};
+    const uint32_t images[] = {16 * 1024, 1024 * 1024};   // 64 MiB, 4 GiB (sparse, 32 groups)
+    int grid = quick ? 2 : 3;
+
+    const uint32_t name_lens[] = {12, 64, 200};
+    for (int i = 0; i < grid; i++) bench_dir(dir_sizes[i]);
+    for (int i = 0; i < 3; i++) {
+        bench_scan(name_lens[i], 0);
+        bench_scan(name_lens[i], 1);
+    }
+    for (int i = 0; i < grid; i++) bench_create(dir_sizes[i]);
+    for (int i = 0; i < grid; i++) bench_path(depths[i]);
+    for (int i = 0; i < 2; i++) bench_alloc(images[i]);
+    bench_inode();
+    bench_crc();
+    for (int i = 0; i < 2; i++) bench_file(images[i], quick ? 8 : 32);
+    remove(image);
+    free(lat);
+
+    FILE *out = out_path ? fopen(out_path, "w") : fdopen(json_fd, "w");
+    if (!out) {
+        fprintf(stderr, "can't write the results\n");
+        return 1;
+    }
+    print_json(out);
+    fclose(out);
+    return 0;
+}
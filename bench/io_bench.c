@@ -0,0 +1,140 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+// sequential write and read bandwidth of fs_write / fs_read next to the same backend used
+// raw, usage: io_bench [-b stdio|pread|mmap] [-d] [-s MiB] [-c chunk KiB] [-x] [dir]
+//   -d  O_DIRECT (pread backend), -x  classic block pointers instead of extents
+
+#include "../include/FileSystemStructure.h"
+#include "../include/BlockDevice.h"
+#include "../include/Files.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double mib_per_s(uint64_t bytes, double seconds) {
+    return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0;
+}
+
+// plain device writes and reads of the same size and chunking, the upper bound for the fs
+static int raw_pass(const char *path, const FsOptions *opts, uint8_t *buf, uint64_t total, size_t chunk,
+                    double *write_s, double *read_s) {
+    uint64_t blocks = total / BLOCK_SIZE;
+    uint32_t per_chunk = chunk / BLOCK_SIZE;
+    BlockDevice *dev = bdev_open(path, opts->backend, BDEV_CREATE | (opts->direct_io ? BDEV_DIRECT : 0), blocks);
+    if (!dev) return -1;
+
+    double t = now();
+    for (uint64_t b = 0; b < blocks; b += per_chunk) {
+        if (bdev_write(dev, b, per_chunk, buf) == -1) return -1;
+    }
+    if (bdev_sync(dev) == -1) return -1;
+    *write_s = now() - t;
+
+    t = now();
+    for (uint64_t b = 0; b < blocks; b += per_chunk) {
+        if (bdev_read(dev, b, per_chunk, buf) == -1) return -1;
+    }
+    *read_s = now() - t;
+
+    bdev_close(dev);
+    return 0;
+}
+
+static int fs_pass(const char *path, const FsOptions *opts, uint8_t *buf, uint64_t total, size_t chunk,
+                   double *write_s, double *read_s) {
+    // room for the data plus metadata and the journal
+    uint64_t blocks = total / BLOCK_SIZE + total / BLOCK_SIZE / 8 + 4 * BITS_PER_BLOCK;
+    if (format_disk_opts(path, (uint32_t)blocks, opts) == -1) return -1;
+
+    char name[] = "bench";
+    int file = creat(fs.sb.root_inode, name, IREG | IRUSR | IWUSR);
+    if (file == -1) return -1;
+
+    double t = now();
+    for (uint64_t off = 0; off < total; off += chunk) {
+        if (fs_write(file, off, buf, chunk) != (long)chunk) return -1;
+    }
+    if (fs_sync() == -1 || bdev_sync(fs.dev) == -1) return -1;
+    *write_s = now() - t;
+
+    t = now();
+    for (uint64_t off = 0; off < total; off += chunk) {
+        if (fs_read(file, off, buf, chunk) != (long)chunk) return -1;
+    }
+    *read_s = now() - t;
+
+    unmount_disk();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    FsOptions opts;
+    fs_default_options(&opts);
+    uint64_t total = 256ull << 20;
+    size_t chunk = 1u << 20;
+
+    int c;
+    while ((c = getopt(argc, argv, "b:ds:c:xn")) != -1) {
+        switch (c) {
+            case 'b':
+                if (bdev_parse_type(optarg, &opts.backend) == -1) {
+                    fprintf(stderr, "unknown backend %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd': opts.direct_io = 1; break;
+            case 's': total = strtoull(optarg, NULL, 10) << 20; break;
+            case 'c': chunk = strtoul(optarg, NULL, 10) << 10; break;
+            case 'x': opts.extents = 0; break;
+            case 'n': opts.journal = 0; break;
+            default:
+                fprintf(stderr, "usage: %s [-b stdio|pread|mmap] [-d] [-s MiB] [-c KiB] [-x] [dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (chunk < BLOCK_SIZE || chunk % BLOCK_SIZE || total < chunk) {
+        fprintf(stderr, "chunk must be whole blocks and no larger than the total\n");
+        return 1;
+    }
+    total -= total % chunk;
+
+    const char *dir = optind < argc ? argv[optind] : ".";
+    char raw_path[4096], fs_path[4096];
+    snprintf(raw_path, sizeof(raw_path), "%s/io_bench_raw.bin", dir);
+    snprintf(fs_path, sizeof(fs_path), "%s/io_bench_fs.bin", dir);
+
+    uint8_t *buf;
+    if (posix_memalign((void **)&buf, BDEV_ALIGN, chunk) != 0) return 1;
+    for (size_t i = 0; i < chunk; i++) buf[i] = (uint8_t)(i * 31 + 7);
+
+    double raw_w, raw_r, fs_w, fs_r;
+    int rc = raw_pass(raw_path, &opts, buf, total, chunk, &raw_w, &raw_r);
+    if (rc == 0) rc = fs_pass(fs_path, &opts, buf, total, chunk, &fs_w, &fs_r);
+    remove(raw_path);
+    remove(fs_path);
+    free(buf);
+    if (rc == -1) {
+        fprintf(stderr, "benchmark failed\n");
+        return 1;
+    }
+
+    printf("backend %s%s, %s, %llu MiB in %zu KiB requests\n", bdev_type_name(opts.backend),
+           opts.direct_io ? " (O_DIRECT)" : "", opts.extents ? "extents" : "block pointers",
+           (unsigned long long)(total >> 20), chunk >> 10);
+    printf("%-6s %12s %12s %8s\n", "", "raw MiB/s", "fs MiB/s", "fs/raw");
+    printf("%-6s %12.1f %12.1f %7.0f%%\n", "write", mib_per_s(total, raw_w), mib_per_s(total, fs_w),
+           100.0 * raw_w / fs_w);
+    printf("%-6s %12.1f %12.1f %7.0f%%\n", "read", mib_per_s(total, raw_r), mib_per_s(total, fs_r),
+           100.0 * raw_r / fs_r);
+    return 0;
+}
@@ -0,0 +1,128 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+// metadata throughput of 1, 2, 4 ... threads sharing one mounted image, each thread in its own
+// top-level directory, usage: mt_bench [-b stdio|pread|mmap] [-t max threads] [-f files] [-n] [dir]
+//   -f  files per thread, -n  no journal
+
+#include "../include/FileSystemStructure.h"
+#include "../include/Directories.h"
+#include "../include/Files.h"
+#include "../include/Paths.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    int id;
+    int files;
+    int failed;
+} Worker;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a directory per thread, files and subdirectories in it, then every name resolved twice
+static void *work(void *arg) {
+    Worker *w = arg;
+    char name[NAME_MAX], path[64];
+    snprintf(name, sizeof(name), "t%d", w->id);
+    int dir = mkdir(fs.sb.root_inode, name);
+    if (dir == -1) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    for (int i = 0; i < w->files && !w->failed; i++) {
+        snprintf(name, sizeof(name), "%c%d", i % 8 ? 'f' : 'd', i);
+        int inum = i % 8 ? creat((uint32_t)dir, name, IREG | IRUSR | IWUSR) : mkdir((uint32_t)dir, name);
+        if (inum == -1) w->failed = 1;
+    }
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < w->files && !w->failed; i++) {
+            snprintf(path, sizeof(path), "/t%d/%c%d", w->id, i % 8 ? 'f' : 'd', i);
+            if (path_resolve(fs.sb.root_inode, path) == -1) w->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+// one fresh image per thread count, returns the seconds taken or -1
+static double pass(const char *path, const FsOptions *opts, int threads, int files) {
+    if (format_disk_opts(path, 8 * BITS_PER_BLOCK, opts) == -1) return -1;
+
+    pthread_t tids[threads];
+    Worker workers[threads];
+    double t = now();
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (Worker){.id = i, .files = files};
+        pthread_create(&tids[i], NULL, work, &workers[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        failed |= workers[i].failed;
+    }
+    if (fs_sync() == -1) failed = 1;
+    t = now() - t;
+
+    unmount_disk();
+    return failed ? -1 : t;
+}
+
+int main(int argc, char **argv) {
+    FsOptions opts;
+    fs_default_options(&opts);
+    int max_threads = 8, files = 2000;
+
+    int c;
+    while ((c = getopt(argc, argv, "b:t:f:n")) != -1) {
+        switch (c) {
+            case 'b':
+                if (bdev_parse_type(optarg, &opts.backend) == -1) {
+                    fprintf(stderr, "unknown backend %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'f': files = atoi(optarg); break;
+            case 'n': opts.journal = 0; break;
+            default:
+                fprintf(stderr, "usage: %s [-b stdio|pread|mmap] [-t threads] [-f files] [-n] [dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (max_threads < 1 || files < 1) {
+        fprintf(stderr, "need at least one thread and one file\n");
+        return 1;
+    }
+
+    const char *dir = optind < argc ? argv[optind] : ".";
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/mt_bench.bin", dir);
+
+    printf("backend %s, %s, %d creates and %d lookups per thread, %ld cpus\n", bdev_type_name(opts.backend),
+           opts.journal ? "journal" : "no journal", files, 2 * files, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %12s %10s\n", "threads", "ops/s", "speedup");
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double s = pass(path, &opts, threads, files);
+        if (s < 0) {
+            fprintf(stderr, "benchmark failed at %d threads\n", threads);
+            remove(path);
+            return 1;
+        }
+        double ops = (double)threads * (1 + 3 * files) / s;
+        if (threads == 1) base = ops;
+        printf("%-8d %12.0f %9.2fx\n", threads, ops, ops / base);
+    }
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,68 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+#include <stdint.h>
+#include "BlockDevice.h"
+
+#define AIO_DEFAULT_DEPTH 64    // transfers a queue keeps in flight
+#define AIO_DEFAULT_WORKERS 4   // threads of the worker pool engine
+#define AIO_MAX_MERGE 64        // requests one vectored transfer carries at most
+#define AIO_MAX_TRANSFER (1u << 30) // bytes per transfer, a ring completion reports its length in an int
+
+typedef enum {
+    AIO_READ = 0,
+    AIO_WRITE
+} AioOp;
+
+typedef enum {
+    AIO_ENGINE_THREADS = 0,     // worker threads doing the blocking device calls
+    AIO_ENGINE_URING            // io_uring on the device fd, BDEV_PREAD only
+} AioEngine;
+
+typedef struct AioRequest AioRequest;
+
+typedef void (*AioCallback)(AioRequest *req);
+
+// filled in by the caller, belongs to the queue from aio_submit until it is complete
+struct AioRequest {
+    AioOp op;
+    uint64_t block;
+    uint32_t count;             // blocks
+    void *buf;                  // count * BLOCK_SIZE bytes
+    AioCallback done;           // optional, runs on the thread that reaps the completion
+    void *arg;                  // for the callback
+    int result;                 // 0 or -1 once complete
+    int complete;               // set after the callback returned
+    AioRequest *next;           // next request of the same transfer
+};
+
+typedef struct {
+    uint64_t submitted;         // requests
+    uint64_t transfers;         // device operations the requests were merged into
+    uint64_t completed;
+    uint64_t failed;
+    uint32_t max_in_flight;     // most transfers outstanding at once
+} AioStats;
+
+typedef struct AioQueue AioQueue;
+
+AioQueue *aio_open(BlockDevice *dev, AioEngine engine, uint32_t depth, uint32_t workers);
+
+void aio_close(AioQueue *q);
+
+AioEngine aio_engine(const AioQueue *q);
+
+const char *aio_engine_name(AioEngine engine);
+
+int aio_submit(AioQueue *q, AioRequest *reqs, uint32_t n);
+
+int aio_poll(AioQueue *q, uint32_t min);
+
+int aio_wait(AioQueue *q, AioRequest *reqs, uint32_t n);
+
+void aio_stats(AioQueue *q, AioStats *out);
+
+#endif //ASYNCIO_H
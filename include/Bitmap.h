@@ -0,0 +1,46 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef BITMAP_H
+#define BITMAP_H
+#include <stdint.h>
+
+#define BITMAP_CHUNK_BITS 4096                      // bits summarised by one free counter
+#define BITMAP_CHUNK_WORDS (BITMAP_CHUNK_BITS / 64)
+
+// bit-packed allocation bitmap, bit i lives in byte i / 8 at bit i % 8 (same as on disk)
+typedef struct {
+    uint64_t *words;
+    uint32_t nbits;
+    uint32_t nwords;
+    uint32_t *chunk_free;   // free bits per BITMAP_CHUNK_BITS chunk, full chunks are skipped
+    uint32_t nchunks;
+    uint32_t free_bits;
+    uint32_t hint;          // next-fit: searches start where the last one ended
+    uint64_t words_scanned; // words examined by searches, for measuring allocator cost
+} Bitmap;
+
+int bitmap_init(Bitmap *bm, uint32_t nbits);
+
+void bitmap_destroy(Bitmap *bm);
+
+void bitmap_load(Bitmap *bm, const void *bytes);
+
+int bitmap_test(const Bitmap *bm, uint32_t bit);
+
+void bitmap_set(Bitmap *bm, uint32_t bit);
+
+void bitmap_clear(Bitmap *bm, uint32_t bit);
+
+void bitmap_set_run(Bitmap *bm, uint32_t first, uint32_t count);
+
+long bitmap_alloc(Bitmap *bm, uint32_t min_bit);
+
+long bitmap_alloc_run(Bitmap *bm, uint32_t min_bit, uint32_t count);
+
+long bitmap_alloc_range(Bitmap *bm, uint32_t goal, uint32_t from, uint32_t to, uint32_t count);
+
+long bitmap_alloc_upto(Bitmap *bm, uint32_t goal, uint32_t from, uint32_t to, uint32_t max, uint32_t *got);
+
+#endif //BITMAP_H
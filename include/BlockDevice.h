@@ -0,0 +1,78 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef BLOCKDEVICE_H
+#define BLOCKDEVICE_H
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define BDEV_ALIGN 4096 // buffer and offset alignment O_DIRECT needs
+
+// bdev_open flags
+#define BDEV_CREATE 0x1 // create or truncate the image, sized to num_blocks
+#define BDEV_DIRECT 0x2 // bypass the page cache (BDEV_PREAD only)
+
+typedef enum {
+    BDEV_STDIO = 0,     // FILE* with fseeko + fread/fwrite
+    BDEV_PREAD,         // pread/pwrite on a file descriptor, optional O_DIRECT
+    BDEV_MMAP           // whole image mapped, reads can be served without a copy
+} BlockDeviceType;
+
+typedef struct BlockDevice BlockDevice;
+
+typedef struct {
+    int (*read)(BlockDevice *dev, uint64_t block, uint32_t count, void *buf);
+    int (*write)(BlockDevice *dev, uint64_t block, uint32_t count, const void *buf);
+    // whole blocks from block on into / out of several buffers, NULL falls back to one call each
+    int (*readv)(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt);
+    int (*writev)(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt);
+    const void *(*map)(BlockDevice *dev, uint64_t block);  // NULL when the backend can't map
+    int (*flush)(BlockDevice *dev);                         // hand buffered writes to the OS
+    int (*sync)(BlockDevice *dev);                          // make written blocks durable
+    void (*close)(BlockDevice *dev);
+} BlockDeviceOps;
+
+struct BlockDevice {
+    const BlockDeviceOps *ops;
+    BlockDeviceType type;
+    uint64_t num_blocks;    // image size in blocks
+
+    FILE *file;             // BDEV_STDIO
+    uint64_t pos;           // BDEV_STDIO stream position, skips redundant seeks
+    int last_write;         // BDEV_STDIO direction of the last access
+    pthread_mutex_t lock;   // BDEV_STDIO, keeps a seek and its transfer together
+
+    int fd;                 // BDEV_PREAD, BDEV_MMAP
+    int direct;             // opened with O_DIRECT, unaligned callers are staged on the stack
+
+    uint8_t *base;          // BDEV_MMAP mapping
+    size_t map_len;
+};
+
+BlockDevice *bdev_open(const char *filename, BlockDeviceType type, int flags, uint64_t num_blocks);
+
+void bdev_close(BlockDevice *dev);
+
+int bdev_read(BlockDevice *dev, uint64_t block, uint32_t count, void *buf);
+
+int bdev_write(BlockDevice *dev, uint64_t block, uint32_t count, const void *buf);
+
+int bdev_readv(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt);
+
+int bdev_writev(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt);
+
+const void *bdev_map(BlockDevice *dev, uint64_t block);
+
+int bdev_flush(BlockDevice *dev);
+
+int bdev_sync(BlockDevice *dev);
+
+const char *bdev_type_name(BlockDeviceType type);
+
+int bdev_parse_type(const char *name, BlockDeviceType *out);
+
+#endif //BLOCKDEVICE_H
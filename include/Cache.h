@@ -0,0 +1,82 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef CACHE_H
+#define CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "FileSystemStructure.h"
+#include "Checksum.h"
+
+#define CACHE_DEFAULT_BUFFERS 256 // 1 MiB of block buffers
+#define CACHE_READAHEAD_MAX 32    // blocks one cache_readahead call loads
+
+typedef struct Buffer {
+    uint32_t block_num;         // disk block held by this buffer
+    uint32_t pins;              // buffer can't be evicted while pinned
+    uint8_t valid;              // data holds the block contents
+    uint8_t dirty;              // data differs from disk
+    uint8_t referenced;         // CLOCK second chance bit
+    uint8_t tracked;            // dirtied inside the open transaction, pinned until commit
+    uint8_t kind;               // CSUM_* the contents were verified as and get sealed as on write back
+    struct Buffer *hash_next;   // chain in the block number hash table
+    uint8_t *data;              // BLOCK_SIZE bytes, BDEV_ALIGN aligned for O_DIRECT
+} Buffer;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t readahead;         // blocks loaded ahead of their first bread, counted as misses too
+    uint64_t csum_errors;       // metadata blocks refused because their checksum didn't match
+} CacheStats;
+
+int cache_init(uint32_t num_buffers);
+
+void cache_destroy();
+
+Buffer *bread(uint32_t block_num);
+
+Buffer *bget(uint32_t block_num);
+
+Buffer *bread_as(uint32_t block_num, uint8_t kind);
+
+Buffer *bget_as(uint32_t block_num, uint8_t kind);
+
+void bpin(Buffer *b);
+
+void brelse(Buffer *b);
+
+void bdirty(Buffer *b);
+
+void bseal(Buffer *b);
+
+void cache_discard(uint32_t block_num);
+
+void cache_update(uint32_t block_num, const void *data);
+
+void cache_readahead(const uint32_t *blocks, uint32_t n);
+
+int cache_flush();
+
+int cache_read(uint64_t offset, void *buf, size_t len);
+
+int cache_write(uint64_t offset, const void *buf, size_t len);
+
+void cache_stats(CacheStats *out);
+
+void cache_track_begin();
+
+int cache_track_commit();
+
+uint32_t cache_track_take(Buffer ***out);
+
+uint32_t cache_tracked();
+
+void cache_untrack(Buffer *b);
+
+uint32_t cache_capacity();
+
+#endif //CACHE_H
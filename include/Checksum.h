@@ -0,0 +1,30 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+#include <stddef.h>
+#include <stdint.h>
+
+// what a metadata block's checksum covers and where it is kept (FEATURE_METADATA_CSUM)
+#define CSUM_NONE 0
+#define CSUM_SUPER 1    // superblock, in its checksum field
+#define CSUM_ITABLE 2   // inode table block, in the CSUM_TAIL bytes past the last inode
+#define CSUM_DIR 3      // directory block (records or index root), in its last CSUM_TAIL bytes
+
+#define CSUM_TAIL 4     // bytes table and directory blocks give up for their checksum
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+uint32_t crc32c_portable(uint32_t crc, const void *data, size_t len);
+
+int crc32c_accelerated();
+
+uint16_t csum_bitmap(const void *bytes, uint32_t len, uint32_t pad);
+
+void csum_seal(uint32_t block_num, uint8_t *block, int kind);
+
+int csum_verify(uint32_t block_num, const uint8_t *block, int kind);
+
+#endif //CHECKSUM_H
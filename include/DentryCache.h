@@ -0,0 +1,45 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef DENTRYCACHE_H
+#define DENTRYCACHE_H
+#include <stdint.h>
+#include "Directories.h"
+
+#define DCACHE_DEFAULT_ENTRIES 4096
+#define DCACHE_NEGATIVE (-1L)   // cached "no such entry"
+#define DCACHE_NAME_MAX 40      // longer names are looked up in the directory every time
+
+typedef struct Dentry {
+    uint32_t parent;            // directory the name lives in
+    uint32_t hash;              // of (parent, name), checked before the name compare
+    long inum;                  // child inode, DCACHE_NEGATIVE when the name is known to be absent
+    uint16_t type;              // IDIR or IREG of a positive entry
+    uint8_t valid;
+    uint8_t referenced;         // CLOCK second chance bit
+    struct Dentry *hash_next;   // chain in the (parent, name) hash table
+    char name[DCACHE_NAME_MAX];
+} Dentry;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t negative_hits;     // hits that answered "absent" without a directory scan
+    uint64_t misses;            // each miss is one dir_lookup
+    uint64_t evictions;
+    uint64_t invalidations;
+} DCacheStats;
+
+int dcache_init(uint32_t num_entries);
+
+void dcache_destroy();
+
+long dcache_lookup(uint32_t parent, const char *name, uint16_t *type);
+
+void dcache_add(uint32_t parent, const char *name);
+
+void dcache_invalidate(uint32_t parent, const char *name);
+
+void dcache_stats(DCacheStats *out);
+
+#endif //DENTRYCACHE_H
@@ -0,0 +1,48 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+#include <stdint.h>
+#include "Directories.h"
+#include "InodeCache.h"
+
+#define DX_MAGIC 0x31495844             // "DXI1", marks an index root block
+#define DX_THRESHOLD_BLOCKS 1           // linear dir converts once this many blocks are full
+#define DX_BUILD_FILL (BLOCK_SIZE * 3 / 4) // leaf bytes dx_build packs, the rest takes adds without a split
+
+#define DIR_BLOCK_ENTRIES (BLOCK_SIZE / DIRENT_LEN(1))   // most records a block holds, one byte names
+
+typedef struct {
+    uint32_t hash;      // lowest name hash stored in the leaf
+    uint32_t block;     // leaf block, records like a linear dir block
+} DxEntry;
+
+// the last entry stops short of the CSUM_TAIL a checksummed image keeps at the end of the block
+#define DX_MAX_LEAVES ((BLOCK_SIZE - 2 * sizeof(uint32_t) - CSUM_TAIL) / sizeof(DxEntry))
+
+// index root, lives in direct[0] of an INODE_INDEX dir, entries sorted by hash
+typedef struct {
+    uint32_t magic;
+    uint32_t count;                     // used leaf entries
+    DxEntry entries[DX_MAX_LEAVES];
+} DxRoot;
+
+uint32_t dx_hash(const char *name);
+
+long dx_lookup(const Inode *dir, const char *name);
+
+long dx_add(InodeHandle *dir, const DirEntry *entry);
+
+long dx_remove(InodeHandle *dir, const char *name, DirEntry *out);
+
+void dx_release(const Inode *dir);
+
+int dx_convert(InodeHandle *dir);
+
+int dx_build(InodeHandle *dir, const uint8_t *records, uint32_t len);
+
+int dx_iterate(const Inode *dir, dir_visit_fn visit, void *arg);
+
+#endif //DIRINDEX_H
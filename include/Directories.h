@@ -5,42 +5,94 @@
 #ifndef DIRECTORIES_H
 #define DIRECTORIES_H
 #include "FileSystemStructure.h"
+#include "InodeCache.h"
+#include "Checksum.h"
 #include <stdint.h>
 
-#define NAME_MAX 32
+#define NAME_MAX 256 // name buffer size, stored names are 1 to 255 bytes
 
+// record bytes of a dir block, on FEATURE_METADATA_CSUM images its checksum takes the tail
+#define DIR_AREA ((uint32_t)(BLOCK_SIZE - (fs.sb.features & FEATURE_METADATA_CSUM ? CSUM_TAIL : 0)))
+
+// an entry as lookups and dir_iterate hand it out
 typedef struct {
     uint32_t inode_num;
     uint16_t type; // IDIR or IREG
-    uint8_t used; // USED or FREE
+    uint8_t name_len;
     uint8_t _pad; // rounds bytes
-    char name[NAME_MAX]; // entry name, user visible
+    char name[NAME_MAX]; // entry name, user visible, NUL terminated
 } DirEntry;
 
-long dir_lookup(uint32_t dir_num, const char *entry_name);
+// on disk, ext2 style: records follow each other through an area (a dir block, a leaf or the
+// inline area), rec_len of the last one reaches the end of it, slack behind a record is free
+typedef struct {
+    uint32_t inode_num;
+    uint16_t rec_len;   // bytes to the next record
+    uint8_t name_len;   // 0 marks free space
+    uint8_t type;       // mode type bits >> 12
+    char name[];        // name_len bytes, no NUL
+} DirRecord;
+
+#define DIRENT_HEADER 8
+#define DIRENT_LEN(name_len) ((DIRENT_HEADER + (uint32_t)(name_len) + 3) & ~3u) // 4 byte aligned
 
-int read_dir_entry(uint32_t offset, DirEntry *entry);
+// called per entry by dir_iterate, non zero return stops the walk
+typedef int (*dir_visit_fn)(const DirEntry *entry, void *arg);
 
-int write_dir_entry(uint32_t offset, DirEntry *entry);
+long dir_lookup(uint32_t dir_num, const char *entry_name);
 
-int dir_block_full(uint32_t bnum);
+int read_dir_entry(uint64_t offset, DirEntry *entry);
 
-uint32_t read_num_of_dir_entries(uint32_t bnum);
+int write_dir_entry(uint64_t offset, DirEntry *entry);
 
-long alloc_dir_entry(uint32_t dir_inum);
+long alloc_dir_entry(uint32_t dir_inum, uint32_t name_len);
 
 long dir_add(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type);
 
-int write_num_of_dir_entries(uint32_t bnum, uint32_t count);
+long dir_remove(uint32_t dir_inum, const char *name);
+
+long dir_remove_expect(uint32_t dir_inum, const char *name, uint32_t expect);
+
+long dir_drop_entry(uint32_t dir_inum, const char *name);
+
+long dir_set_parent(uint32_t dir_inum, uint32_t parent_inum);
+
+void dirent_init(uint8_t *area, uint32_t len);
+
+const DirRecord *dirent_first(const uint8_t *area, uint32_t len);
+
+const DirRecord *dirent_next(const uint8_t *area, uint32_t len, const DirRecord *r);
 
-int dir_block_update_count(uint32_t bnum, int operation);
+void dirent_get(const DirRecord *r, DirEntry *entry);
+
+long dirent_reserve(uint8_t *area, uint32_t len, uint32_t name_len);
+
+void dirent_put(uint8_t *record, const DirEntry *entry);
+
+long dirent_insert(uint8_t *area, uint32_t len, const DirEntry *entry);
+
+long dirent_find(const uint8_t *area, uint32_t len, const char *name, DirEntry *out);
+
+long dirent_remove(uint8_t *area, uint32_t len, const char *name, DirEntry *out);
+
+uint32_t dirent_room(const uint8_t *area, uint32_t len);
+
+int dirent_walk(const uint8_t *area, uint32_t len, dir_visit_fn visit, void *arg);
 
 int is_dir(uint32_t inum);
 
 int create_dir(uint16_t mode);
 
+int create_dir_in(uint32_t parent_inum, uint16_t mode);
+
 int mkdir(uint32_t parent_inum, char *child);
 
+int fs_rmdir(uint32_t parent_inum, char *child);
+
 int dir_list(uint32_t dir_inum);
 
+int dir_iterate(uint32_t dir_inum, dir_visit_fn visit, void *arg);
+
+int dir_build(InodeHandle *dir, uint32_t parent_inum, const DirEntry *entries, uint32_t n);
+
 #endif //DIRECTORIES_H
@@ -0,0 +1,56 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef EXTENTS_H
+#define EXTENTS_H
+#include <stdint.h>
+#include "FileSystemStructure.h"
+#include "InodeCache.h"
+
+#define EXT_MAGIC 0xF30A
+#define EXT_MAX_DEPTH 5
+
+// node header, at the start of the inode's pointer area (root) or of a tree block
+typedef struct {
+    uint16_t magic;
+    uint16_t entries;   // used entries after the header
+    uint16_t max;       // entries that fit in this node
+    uint16_t depth;     // 0 = entries are Extents, else ExtentIdx pointing one level down
+} ExtentHeader;
+
+// logical blocks [logical, logical + len) live at physical [start, start + len)
+typedef struct {
+    uint32_t logical;
+    uint32_t start;
+    uint32_t len;
+} Extent;
+
+// child node covering logical blocks from logical up to the next entry's
+typedef struct {
+    uint32_t logical;
+    uint32_t block;
+} ExtentIdx;
+
+// direct[], indirect and double_indirect hold the root of an INODE_EXTENTS inode
+#define EXT_ROOT_BYTES (sizeof(uint32_t) * (DIRECT_PTRS + 2))
+#define EXT_ROOT_LEAVES ((EXT_ROOT_BYTES - sizeof(ExtentHeader)) / sizeof(Extent))
+#define EXT_ROOT_INDEXES ((EXT_ROOT_BYTES - sizeof(ExtentHeader)) / sizeof(ExtentIdx))
+#define EXT_BLOCK_LEAVES ((BLOCK_SIZE - sizeof(ExtentHeader)) / sizeof(Extent))
+#define EXT_BLOCK_INDEXES ((BLOCK_SIZE - sizeof(ExtentHeader)) / sizeof(ExtentIdx))
+
+void ext_init(Inode *inode);
+
+long ext_map(const Inode *inode, uint32_t logical, uint32_t *run);
+
+long ext_end(const Inode *inode);
+
+long ext_alloc(InodeHandle *h, uint32_t logical, uint32_t count, uint32_t *got);
+
+int ext_insert(InodeHandle *h, uint32_t logical, uint32_t start, uint32_t len);
+
+int ext_truncate(InodeHandle *h, uint32_t keep);
+
+int ext_count(const Inode *inode, uint32_t *extents, uint32_t *tree_blocks);
+
+#endif //EXTENTS_H
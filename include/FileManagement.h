@@ -6,25 +6,46 @@
 #define FILEMANAGEMENT_H
 #include <stdint.h>
 #include "FileSystemStructure.h"
+#include "InodeCache.h"
 
 void read_block(uint32_t block_num, void *buf);
 
 void write_block(uint32_t block_num, const void *buf);
 
+void sync_superblock();
+
+void write_superblock();
+
 int alloc_block();
 
+int alloc_block_near(uint32_t goal);
+
+long alloc_block_run(uint32_t count);
+
+long alloc_block_extent(uint32_t goal, uint32_t max, uint32_t *got);
+
 int alloc_inode();
 
+int alloc_inode_near(uint32_t parent_inum, int is_dir);
+
 void free_block(uint32_t b);
 
+void free_block_run(uint32_t first, uint32_t count);
+
 void free_inode(uint32_t i);
 
 int create_inode(uint16_t mode);
 
+int create_inode_in(uint32_t parent_inum, uint16_t mode);
+
+uint32_t create_inodes_in(uint32_t parent_inum, uint16_t mode, uint32_t count, uint32_t *out);
+
 int write_inode(uint32_t inode_num, Inode *new_inode);
 
 int read_inode(uint32_t inode_num, Inode *out_inode);
 
 int alloc_direct_inode_block(uint32_t inum);
 
+int alloc_direct_block(InodeHandle *h);
+
 #endif //FILEMANAGEMENT_H
@@ -7,9 +7,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
+#include "BlockDevice.h"
+#include "AsyncIo.h"
+#include "Bitmap.h"
 
 #define BLOCK_SIZE 4096 // in bytes
-#define MAX_INODES 512
+#define BITS_PER_BLOCK (BLOCK_SIZE * 8)     // bitmap bits one block holds
+#define DEFAULT_INODE_RATIO 16384           // image bytes per inode when formatting
 
 typedef struct
 {
@@ -18,14 +22,31 @@ typedef struct
     uint32_t free_inodes;
     uint32_t free_blocks;
     uint32_t block_size;
-    uint32_t inode_start;           // block number where inode table starts
-    uint32_t block_bitmap_start;    // block number where block bitmap is located
-    uint32_t inode_bitmap_start;    // block number where inode bitmap is located
-    uint32_t data_block_start;      // block number where data starts
+    uint32_t inode_start;           // block number where group 0's inode table starts
+    uint32_t block_bitmap_start;    // block number of group 0's block bitmap
+    uint32_t inode_bitmap_start;    // block number of group 0's inode bitmap
+    uint32_t data_block_start;      // block number where group 0's data starts
     uint32_t root_inode;            // inode number of the root inode
+    uint32_t journal_start;         // block number where the metadata journal starts
+    uint32_t journal_blocks;        // journal size, 0 when the image has no journal
+    uint32_t blocks_per_group;      // blocks one group covers, one bitmap block's worth
+    uint32_t inodes_per_group;
+    uint32_t inode_table_blocks;    // inode table size of each group
+    uint32_t groups_count;
+    uint32_t group_desc_blocks;     // descriptor table, right after the superblock
+    uint32_t features;              // FEATURE_* picked at format time
+    uint32_t snap_table;            // block of the snapshot table (Snapshot.h), 0 when there are none
+    uint32_t checksum;              // CRC32C of the fields above (FEATURE_METADATA_CSUM), stays last
 } Superblock;
 
+// Superblock features
+#define FEATURE_EXTENTS 0x0001  // new regular files map their data with an extent tree
+#define FEATURE_LAZY_ITABLE 0x0002  // inode tables past a group's itable_zeroed hold stale bytes
+#define FEATURE_INLINE_DATA 0x0004  // tiny dirs and small files keep their contents in the inode
+#define FEATURE_METADATA_CSUM 0x0008  // superblock, bitmaps, inode tables and dir blocks carry a CRC32C (Checksum.h)
+
 #define DIRECT_PTRS 12  // number of direct pointers an inode has to blocks
+#define PTRS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))  // block pointers one indirect block holds
 
 #define USED 1
 #define FREE 0
@@ -41,10 +62,16 @@ typedef struct
 #define IWUSR 0x0080   // owner write
 #define IXUSR 0x0040   // owner execute
 
+// Inode flags
+#define INODE_INDEX 0x0001   // directory entries are reached through a hashed index
+#define INODE_EXTENTS 0x0002 // block pointers hold the root of an extent tree (Extents.h)
+#define INODE_INLINE 0x0004  // block pointers hold the contents themselves, no blocks mapped
+
 typedef struct {
     uint16_t mode;              // permissions / type
     uint16_t links_count;
-    uint32_t size;              // in bytes
+    uint32_t flags;             // INODE_* layout flags
+    uint64_t size;              // in bytes
     time_t atime;             // access
     time_t mtime;             // modify
     time_t ctime;             // create
@@ -54,23 +81,103 @@ typedef struct {
     uint32_t double_indirect;       // double indirect
 } Inode;
 
-uint8_t block_bitmap[BLOCK_SIZE]; // global variable simulates bitmap "kept in cache"
-uint8_t inode_bitmap[MAX_INODES]; // global variable simulates bitmap "kept in cache"
+#define INODES_PER_BLOCK (BLOCK_SIZE / sizeof(Inode))  // inodes never straddle table blocks
+#define INLINE_DATA_MAX (sizeof(uint32_t) * (DIRECT_PTRS + 2))  // direct[] through double_indirect
+
+// ext2 style block group: bitmaps, inode table slice and data blocks kept close together
+typedef struct {
+    uint32_t block_bitmap;      // block number of the group's block bitmap
+    uint32_t inode_bitmap;      // block number of the group's inode bitmap
+    uint32_t inode_table;       // first block of the group's inode table slice
+    uint32_t free_blocks;
+    uint32_t free_inodes;
+    uint32_t used_dirs;         // directories with their inode in this group
+    uint32_t itable_zeroed;     // inode table blocks zeroed so far, the rest on first use (FEATURE_LAZY_ITABLE)
+    uint16_t block_bitmap_csum; // low 16 bits of the bitmaps' CRC32C (FEATURE_METADATA_CSUM),
+    uint16_t inode_bitmap_csum; // 32 bytes, 128 descriptors per block
+} GroupDesc;
+
+#define GROUP_DESC_PER_BLOCK (BLOCK_SIZE / sizeof(GroupDesc))
+#define MAX_BLOCKS 0x80000000u  // 8 TiB, keeps bitmap bit math inside uint32_t
+#define MAX_INODES MAX_BLOCKS
+
+extern Bitmap block_bitmap; // global variable simulates bitmap "kept in cache"
+extern Bitmap inode_bitmap; // global variable simulates bitmap "kept in cache"
 
 typedef struct {
     Superblock sb;     // global variable simulates superblock "kept in cache"
-    FILE *disk;        // "virtual disk" file
+    BlockDevice *dev;  // "virtual disk" behind the chosen backend
+    AioQueue *aio;     // keeps flushes, readahead and big file I/O in flight, NULL = all synchronous
+    GroupDesc *groups; // descriptor table "kept in cache"
     char mounted;
 } FileSystem;
 
-FileSystem fs;
+extern FileSystem fs;
+
+// picked per format or mount, not stored in the image
+typedef struct {
+    BlockDeviceType backend;    // BDEV_STDIO, BDEV_PREAD or BDEV_MMAP
+    int direct_io;              // open with O_DIRECT, BDEV_PREAD only
+    uint32_t inode_ratio;       // format: image bytes per inode, sizes the inode table
+    int journal;                // format: reserve a metadata journal at the end of the image
+    uint32_t journal_blocks;    // format: journal size, 0 picks one from the image size
+    uint32_t commit_batch;      // transactions sharing one journal record (and sync), 1 = every commit
+    uint32_t commit_window_us;  // a batch is also written once its first commit is this old, 0 = off
+    int extents;                // format: map regular files with extent trees instead of block pointers
+    uint32_t io_depth;          // transfers the async queue keeps in flight, 0 = synchronous I/O only
+    uint32_t io_workers;        // worker pool size when io_uring isn't used
+    int io_uring;               // BDEV_PREAD: queue through io_uring when the kernel has it
+    int inline_data;            // format: keep tiny dirs and small files in the inode (FEATURE_INLINE_DATA)
+    int lazy_init;              // format: write only what the fresh sparse image doesn't read as zero,
+                                // inode tables get zeroed block by block as inodes are handed out
+    int checksums;              // format: checksum the metadata, verified as it is read (FEATURE_METADATA_CSUM)
+    int repair;                 // mount: load bitmaps that fail their checksum, fs_fsck rebuilds them
+} FsOptions;
+
+void fs_default_options(FsOptions *opts);
 
 void format_disk(const char *filename, uint32_t num_blocks);
 
+int format_disk_opts(const char *filename, uint32_t num_blocks, const FsOptions *opts);
+
+int mount_disk(const char *filename);
+
+int mount_disk_opts(const char *filename, const FsOptions *opts);
+
+void unmount_disk();
+
+int fs_sync();
+
 void initialize_bitmap();
 
 int update_inode_bitmap(uint32_t inode_num, uint8_t used);
 
 int update_block_bitmap(uint32_t block_num, uint8_t used);
 
+int update_block_bitmap_run(uint32_t first, uint32_t count, uint8_t used);
+
+void flush_bitmaps();
+
+int rewrite_groups();
+
+uint32_t group_of_block(uint32_t block_num);
+
+uint32_t group_of_inode(uint32_t inode_num);
+
+uint32_t group_data_start(uint32_t group);
+
+uint32_t group_end(uint32_t group);
+
+uint64_t inode_disk_offset(uint32_t inode_num);
+
+void group_adjust(uint32_t group, int blocks, int inodes, int dirs);
+
+int group_init_itable(uint32_t group, uint32_t index);
+
+void group_lock(uint32_t group);
+
+void group_unlock(uint32_t group);
+
+void sb_adjust(int blocks, int inodes);
+
 #endif //FILESYSTEMSTRUCTURE_H
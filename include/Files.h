@@ -5,8 +5,24 @@
 #ifndef FILES_H
 #define FILES_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "InodeCache.h"
+
+#define FILE_TX_BLOCKS 4096 // data blocks allocated per transaction by a large write
 
 int creat(uint32_t parent, char *name, uint16_t mode);
 
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+
+int fs_truncate(uint32_t inum, uint64_t size);
+
+int fs_unlink(uint32_t parent, char *name);
+
+uint64_t fs_max_file_size(uint32_t inum);
+
+int file_map_run(InodeHandle *h, uint32_t logical, uint32_t first, uint32_t count);
+
 #endif //FILES_H
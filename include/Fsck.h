@@ -0,0 +1,40 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef FSCK_H
+#define FSCK_H
+#include <stdint.h>
+#include "FileSystemStructure.h"
+
+#define FSCK_THREADS 8              // inode table chunks and dirs worked on in parallel
+#define FSCK_CHUNK_BLOCKS 64        // inode table blocks a thread claims and reads at once
+#define FSCK_TX_INODES 1024         // link counts fixed per transaction
+#define FSCK_PRINT_MAX 10           // problems of one kind printed, the rest only counted
+
+// fs_fsck results, e2fsck's exit codes
+#define FSCK_CLEAN 0
+#define FSCK_FIXED 1                // problems were found and every one of them repaired
+#define FSCK_ERRORS 4               // problems are left: only checked, or ones fsck can't repair
+
+typedef struct {
+    uint64_t inodes;        // in use once the check is done, dirs included
+    uint64_t dirs;
+    uint64_t blocks;        // in use, metadata included
+    uint64_t orphans;       // in use but in no dir, linked into /lost+found as "#<inum>"
+    uint64_t unlinked;      // still allocated with no links and no name, freed
+    uint64_t dangling;      // dir entries naming an inode that isn't in use, removed
+    uint64_t cross_linked;  // blocks mapped a second time, reported only
+    uint64_t bad_blocks;    // block pointers past the end of the image, reported only
+    uint64_t unreadable;    // table, dir and map blocks failing their checksum or making no sense,
+                            // nothing gets repaired while there are any
+    uint64_t link_fixes;    // inodes whose links_count disagrees with the entries naming them
+    uint64_t block_bits;    // block bitmap bits that were wrong
+    uint64_t inode_bits;
+    uint64_t counter_fixes; // free counts of the groups and the superblock that were off
+    uint64_t repaired;      // problems fixed
+} FsckReport;
+
+int fs_fsck(const char *image, const FsOptions *opts, int repair, FsckReport *out);
+
+#endif //FSCK_H
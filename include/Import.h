@@ -0,0 +1,27 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef IMPORT_H
+#define IMPORT_H
+#include <stdint.h>
+#include "FileSystemStructure.h"
+
+#define IMPORT_SCAN_THREADS 8       // host dirs read in parallel while scanning
+#define IMPORT_RUN_BLOCKS 1024      // file data staged per device write, files this big or bigger go alone
+#define IMPORT_TX_INODES 1024       // inodes created per transaction
+#define IMPORT_MIN_BLOCKS 4096      // smallest image the import formats
+
+typedef struct {
+    uint64_t dirs;              // the top dir included, it becomes the root
+    uint64_t files;
+    uint64_t bytes;             // file contents
+    uint64_t skipped;           // symlinks, devices, names too long for a dir entry
+    uint64_t data_blocks;       // blocks file contents take, inline files none
+    uint64_t meta_blocks;       // dir blocks and block pointer blocks, estimated by the scan
+    uint32_t image_blocks;      // size the image was formatted with
+} ImportStats;
+
+int fs_import(const char *host_dir, const char *image, const FsOptions *opts, ImportStats *out);
+
+#endif //IMPORT_H
@@ -0,0 +1,55 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef INODECACHE_H
+#define INODECACHE_H
+#include <pthread.h>
+#include <stdint.h>
+#include "FileSystemStructure.h"
+
+#define ICACHE_DEFAULT_INODES 1024
+
+typedef struct InodeHandle {
+    uint32_t inum;                  // inode number held by this slot
+    uint32_t refs;                  // handles given out by iget, slot can't be evicted while > 0
+    uint8_t valid;                  // inode holds the on-disk contents
+    uint8_t dirty;                  // inode differs from the inode table
+    uint8_t referenced;             // CLOCK second chance bit
+    struct InodeHandle *hash_next;  // chain in the inode number hash table
+    pthread_rwlock_t lock;          // ilock / ilock_shared, guards inode and the blocks it maps
+    Inode inode;
+    uint16_t dir_room[DIRECT_PTRS]; // linear dir: longest record each block still takes, under ilock
+    uint8_t dir_room_known;         // dir_room was filled since the inode was loaded
+} InodeHandle;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;        // each miss is one read of the inode table
+    uint64_t evictions;
+    uint64_t writebacks;    // each writeback is one write to the inode table
+} ICacheStats;
+
+int icache_init(uint32_t num_inodes);
+
+void icache_destroy();
+
+InodeHandle *iget(uint32_t inum);
+
+InodeHandle *iget_new(uint32_t inum);
+
+void iput(InodeHandle *h);
+
+void idirty(InodeHandle *h);
+
+void ilock(InodeHandle *h);
+
+void ilock_shared(InodeHandle *h);
+
+void iunlock(InodeHandle *h);
+
+int icache_flush();
+
+void icache_stats(ICacheStats *out);
+
+#endif //INODECACHE_H
@@ -0,0 +1,72 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+#include <stdint.h>
+#include "BlockDevice.h"
+#include "Cache.h"
+
+#define JOURNAL_MAGIC 0x4C4E524A    // "JRNL"
+#define JOURNAL_MIN_BLOCKS 8
+#define JOURNAL_MAX_BLOCKS 1024
+#define JOURNAL_DEFAULT_RATIO 16    // default journal is 1/16 of the image
+
+// record block types
+#define JOURNAL_DESCRIPTOR 1
+#define JOURNAL_COMMIT 2
+
+// first block of the journal region
+typedef struct {
+    uint32_t magic;
+    uint32_t blocks;        // journal region size, this block included
+    uint32_t start;         // first live record, 0 when everything is checkpointed
+    uint32_t sequence;      // sequence of the record at start
+} JournalSuper;
+
+// a record is one descriptor, count block images, one commit block
+typedef struct {
+    uint32_t magic;
+    uint32_t type;          // JOURNAL_DESCRIPTOR or JOURNAL_COMMIT
+    uint32_t sequence;
+    uint32_t count;         // num of block images in the record
+    uint32_t checksum;      // commit block only, over tags and images
+    uint32_t tags[];        // descriptor only, home block of each image
+} JournalHeader;
+
+#define JOURNAL_MAX_TAGS ((BLOCK_SIZE - sizeof(JournalHeader)) / sizeof(uint32_t))
+
+typedef struct {
+    uint64_t records;           // records written, one device sync each
+    uint64_t transactions;      // transactions carried by those records
+    uint64_t blocks_logged;     // block images written to the journal
+    uint64_t bytes_written;     // everything written to the journal region
+    uint64_t commit_ns;         // total time spent writing and syncing records
+    uint64_t max_commit_ns;
+    uint64_t checkpoints;
+    uint64_t replayed_records;  // committed records applied at mount
+    uint64_t replayed_blocks;
+} JournalStats;
+
+uint32_t journal_default_blocks(uint32_t total_blocks);
+
+int journal_format(BlockDevice *dev, uint32_t start, uint32_t blocks);
+
+int journal_replay(BlockDevice *dev, uint32_t start, uint32_t blocks);
+
+int journal_open(uint32_t start, uint32_t blocks, uint32_t commit_batch, uint32_t commit_window_us);
+
+void journal_close();
+
+int journal_enabled();
+
+int journal_commit(Buffer **bufs, uint32_t count, int lazy);
+
+int journal_flush();
+
+int journal_checkpoint();
+
+void journal_stats(JournalStats *out);
+
+#endif //JOURNAL_H
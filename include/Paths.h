@@ -4,5 +4,18 @@
 
 #ifndef PATHS_H
 #define PATHS_H
+#include <stdint.h>
+
+long path_resolve(uint32_t cwd, const char *path);
+
+long path_resolve_parent(uint32_t cwd, const char *path, char *name);
+
+long path_lookup(const char *path);
+
+int path_chdir(const char *path);
+
+uint32_t path_cwd();
+
+void path_reset();
 
 #endif //PATHS_H
@@ -0,0 +1,96 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stdint.h>
+#include <time.h>
+#include "FileSystemStructure.h"
+
+#define SNAP_MAGIC 0x50414E53       // "SNAP"
+#define SNAP_MAX 16                 // snapshots one image keeps at a time
+#define SNAP_CHUNK_SLOTS 255        // copy blocks allocated right after each chunk's map block
+#define SNAP_RESERVE 128            // copies the open chunks keep room for between transactions
+#define SNAP_DEAD UINT32_MAX        // home of a pair nobody reads any more
+
+// snapshot flags
+#define SNAP_BROKEN 0x1             // a block couldn't be preserved, its contents are lost
+
+// live block home was preserved at copy: a slot of the chunk, or home itself once the live
+// image freed it (the block is kept instead of copied)
+typedef struct {
+    uint32_t home;
+    uint32_t copy;
+} SnapPair;
+
+#define SNAP_CHUNK_PAIRS ((BLOCK_SIZE - 8 * sizeof(uint32_t)) / sizeof(SnapPair))
+
+// map block at the start of a chunk, the chunks of a snapshot form a list
+typedef struct {
+    uint32_t magic;
+    uint32_t next;              // map block of the snapshot's next chunk, 0 for its last
+    uint32_t born;              // next snapshot id when the chunk was allocated
+    uint32_t owner;             // snapshot that was newest while pairs went in
+    uint32_t slots;             // copy blocks right after this one
+    uint32_t used;              // slots holding a copy
+    uint32_t count;             // pairs
+    uint32_t _pad;
+    SnapPair pairs[SNAP_CHUNK_PAIRS];
+} SnapChunk;
+
+typedef struct {
+    uint32_t id;
+    uint32_t first;             // map block of its first chunk
+    uint32_t flags;             // SNAP_*
+    uint32_t _pad;
+    int64_t created;
+} SnapEntry;
+
+// one block, Superblock.snap_table points at it
+typedef struct {
+    uint32_t magic;
+    uint32_t count;             // entries in use, oldest first
+    uint32_t next_id;
+    uint32_t _pad;
+    SnapEntry entries[SNAP_MAX];
+} SnapTable;
+
+typedef struct {
+    uint32_t id;
+    time_t created;
+    uint32_t copies;            // blocks it holds for the live image's changes since
+    uint32_t blocks;            // copies plus the chunks' map blocks and unused slots
+    int broken;
+} SnapshotInfo;
+
+// read on every hook, a predictable branch while the image has no snapshots
+extern int snap_live;
+
+int snap_load();
+
+void snap_unload();
+
+void snap_cow(uint32_t block);
+
+void snap_cow_run(uint32_t first, uint32_t count);
+
+int snap_keep(uint32_t block);
+
+void snap_reserve();
+
+void snap_barrier();
+
+void snap_owned(uint64_t *bits);
+
+int fs_snapshot_create();
+
+int fs_snapshot_delete(uint32_t id);
+
+uint32_t fs_snapshot_list(SnapshotInfo *out, uint32_t max);
+
+int fs_snapshot_read(uint32_t id, uint32_t block, void *buf);
+
+int fs_snapshot_export(uint32_t id, const char *image);
+
+#endif //SNAPSHOT_H
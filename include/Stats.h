@@ -0,0 +1,109 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef STATS_H
+#define STATS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_BUCKETS 32    // latency histogram, bucket i counts calls of [2^i, 2^(i+1)) ns, the last one up
+
+// high-level calls, nested ones (a mkdir's dir_add) count towards the outermost
+typedef enum {
+    OP_FORMAT = 0,
+    OP_MOUNT,
+    OP_UNMOUNT,
+    OP_SYNC,
+    OP_MKDIR,
+    OP_CREAT,
+    OP_DIR_ADD,
+    OP_DIR_LOOKUP,
+    OP_RESOLVE,
+    OP_READ,
+    OP_WRITE,
+    OP_TRUNCATE,
+    OP_DIR_REMOVE,
+    OP_UNLINK,
+    OP_RMDIR,
+    OP_COUNT
+} FsOp;
+
+// every field a uint64_t, STATS_COUNT indexes them as an array
+typedef struct {
+    uint64_t dev_reads;         // read requests to the device, one per bdev call or async transfer
+    uint64_t dev_writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t seeks;             // fseeko calls of the stdio backend
+    uint64_t cache_hits;        // buffer cache
+    uint64_t cache_misses;
+    uint64_t icache_hits;
+    uint64_t icache_misses;
+    uint64_t allocs;            // block and inode allocator calls
+    uint64_t alloc_words;       // bitmap words those calls scanned
+    uint64_t sb_syncs;          // superblock writes and commit marks
+} IoCounters;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t latency[STATS_BUCKETS];
+    IoCounters io;              // caused by calls of this op, on the calling thread
+} OpStats;
+
+typedef struct {
+    IoCounters io;              // everything, inside an op or not
+    OpStats ops[OP_COUNT];
+} FsStats;
+
+typedef struct {
+    int op;                     // -1 when not counted (off, or nested)
+    uint64_t start_ns;
+} StatsSpan;
+
+// read on every hook, a predictable branch when stats are off
+extern int stats_on;
+
+void stats_enable(int on);
+
+void stats_reset();
+
+void stats_snapshot(FsStats *out);
+
+const char *stats_op_name(FsOp op);
+
+uint64_t stats_percentile(const OpStats *op, double p);
+
+void stats_print(FILE *out);
+
+// ---------- hooks ----------
+
+void stats_count(size_t field, uint64_t n);
+
+StatsSpan stats_begin_slow(FsOp op);
+
+void stats_end_slow(StatsSpan span);
+
+int stats_adopt(int op);
+
+int stats_current();
+
+#define STATS_ON() __builtin_expect(__atomic_load_n(&stats_on, __ATOMIC_RELAXED), 0)
+
+#define STATS_COUNT(field, n) do { \
+    if (STATS_ON()) stats_count(offsetof(IoCounters, field) / sizeof(uint64_t), (n)); \
+} while (0)
+
+static inline StatsSpan stats_begin(FsOp op) {
+    if (STATS_ON()) return stats_begin_slow(op);
+    return (StatsSpan){ -1, 0 };
+}
+
+static inline void stats_end(StatsSpan span) {
+    if (span.op >= 0) stats_end_slow(span);
+}
+
+#endif //STATS_H
@@ -0,0 +1,33 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+#include <stdint.h>
+
+typedef struct {
+    uint64_t commits;
+    uint64_t blocks_written;        // metadata blocks written (or handed to the journal) by commits
+    uint64_t superblock_writes;     // superblock copies put into the cache by commits
+} TxStats;
+
+// threads share the running transaction: take inode locks only after tx_begin and drop them
+// before the outermost tx_commit, which may wait for the other threads to leave
+void tx_begin();
+
+int tx_commit();
+
+int tx_active();
+
+void tx_mark_superblock();
+
+void tx_mark_lazy();
+
+void tx_freeze();
+
+void tx_thaw();
+
+void tx_stats(TxStats *out);
+
+#endif //TRANSACTION_H
@@ -0,0 +1,529 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#define _GNU_SOURCE
+
+// first, <linux/fs.h> comes along and defines a BLOCK_SIZE of its own
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define AIO_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#undef BLOCK_SIZE
+#endif
+
+#include "../include/AsyncIo.h"
+#include "../include/FileSystemStructure.h"
+#include "../include/Stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RETRY (-2)                  // the ring moved fewer bytes than asked, redo it plainly
+
+// requests merged into one device operation, queued for a worker or the ring, then reaped
+typedef struct Transfer {
+    AioOp op;
+    uint64_t block;
+    uint64_t bytes;
+    AioRequest *first;          // chained through next
+    int result;                 // 0, -1 or RETRY
+    int stats_op;               // op of the submitting thread, the worker counts towards it
+    struct Transfer *next;      // pending or done list
+    int iovcnt;
+    struct iovec iov[];
+} Transfer;
+
+struct AioQueue {
+    BlockDevice *dev;
+    AioEngine engine;
+    uint32_t depth;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // a transfer finished, was reaped, or a reaper left the kernel
+    pthread_cond_t work;        // a transfer waits for a worker
+    uint32_t in_flight;         // transfers submitted and not reaped yet
+    Transfer *pending, *pending_tail;   // AIO_ENGINE_THREADS, not picked up yet
+    Transfer *done, *done_tail;         // finished, waiting for a reaper
+    AioStats stats;
+
+    pthread_t *workers;
+    uint32_t num_workers;
+    int stopping;
+
+    int ring_fd;
+#ifdef AIO_HAVE_URING
+    uint32_t in_ring;           // handed to the sq ring, completion not harvested yet
+    uint32_t unsubmitted;       // in the sq ring, io_uring_enter not called for them yet
+    int in_kernel;              // one reaper sleeps in io_uring_enter, the others wait for it
+    uint8_t *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqes_len;
+    struct io_uring_sqe *sqes;
+    uint32_t *sq_tail, *sq_mask, *sq_array;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+#endif
+};
+
+static int run(BlockDevice *dev, Transfer *t) {
+    return t->op == AIO_READ ? bdev_readv(dev, t->block, t->iov, t->iovcnt)
+                             : bdev_writev(dev, t->block, t->iov, t->iovcnt);
+}
+
+// queue locked
+static void push_done(AioQueue *q, Transfer *t) {
+    t->next = NULL;
+    if (q->done_tail) q->done_tail->next = t;
+    else q->done = t;
+    q->done_tail = t;
+    pthread_cond_broadcast(&q->changed);
+}
+
+// ---------- worker pool ----------
+
+static void *worker(void *arg) {
+    AioQueue *q = arg;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->pending && !q->stopping) pthread_cond_wait(&q->work, &q->lock);
+        Transfer *t = q->pending;
+        if (!t) break; // stopping and nothing left
+
+        q->pending = t->next;
+        if (!q->pending) q->pending_tail = NULL;
+        pthread_mutex_unlock(&q->lock);
+        int prev = stats_adopt(t->stats_op);
+        t->result = run(q->dev, t);
+        stats_adopt(prev);
+        pthread_mutex_lock(&q->lock);
+        push_done(q, t);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static int start_workers(AioQueue *q, uint32_t n) {
+    q->workers = malloc(n * sizeof(pthread_t));
+    if (!q->workers) return -1;
+    for (uint32_t i = 0; i < n; i++) {
+        if (pthread_create(&q->workers[i], NULL, worker, q) != 0) break;
+        q->num_workers++;
+    }
+    return q->num_workers ? 0 : -1;
+}
+
+static void stop_workers(AioQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->stopping = 1;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    for (uint32_t i = 0; i < q->num_workers; i++) pthread_join(q->workers[i], NULL);
+    free(q->workers);
+    q->workers = NULL;
+    q->num_workers = 0;
+}
+
+// ---------- io_uring ----------
+
+#ifdef AIO_HAVE_URING
+
+static void ring_teardown(AioQueue *q) {
+    if (q->sqes) munmap(q->sqes, q->sqes_len);
+    if (q->cq_map && q->cq_map != q->sq_map) munmap(q->cq_map, q->cq_len);
+    if (q->sq_map) munmap(q->sq_map, q->sq_len);
+    if (q->ring_fd != -1) close(q->ring_fd);
+    q->sqes = NULL;
+    q->sq_map = q->cq_map = NULL;
+    q->ring_fd = -1;
+}
+
+static void *map_ring(AioQueue *q, size_t len, off_t what) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->ring_fd, what);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// raw syscalls, no liburing needed. returns 0, or -1 when the kernel (or a seccomp filter) says no
+static int ring_setup(AioQueue *q) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    q->ring_fd = (int)syscall(__NR_io_uring_setup, q->depth, &p);
+    if (q->ring_fd < 0) {
+        q->ring_fd = -1;
+        return -1;
+    }
+
+    q->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    q->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && q->cq_len > q->sq_len) q->sq_len = q->cq_len;
+
+    q->sq_map = map_ring(q, q->sq_len, IORING_OFF_SQ_RING);
+    q->cq_map = single ? q->sq_map : map_ring(q, q->cq_len, IORING_OFF_CQ_RING);
+    q->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = map_ring(q, q->sqes_len, IORING_OFF_SQES);
+    if (!q->sq_map || !q->cq_map || !q->sqes) {
+        ring_teardown(q);
+        return -1;
+    }
+
+    q->sq_tail = (uint32_t *)(q->sq_map + p.sq_off.tail);
+    q->sq_mask = (uint32_t *)(q->sq_map + p.sq_off.ring_mask);
+    q->sq_array = (uint32_t *)(q->sq_map + p.sq_off.array);
+    q->cq_head = (uint32_t *)(q->cq_map + p.cq_off.head);
+    q->cq_tail = (uint32_t *)(q->cq_map + p.cq_off.tail);
+    q->cq_mask = (uint32_t *)(q->cq_map + p.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)(q->cq_map + p.cq_off.cqes);
+    return 0;
+}
+
+static int ring_enter(AioQueue *q, uint32_t submit, uint32_t wait) {
+    return (int)syscall(__NR_io_uring_enter, q->ring_fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// O_DIRECT wants aligned memory, the plain path stages it, the ring can't
+static int ring_takes(AioQueue *q, const Transfer *t) {
+    if (!q->dev->direct) return 1;
+    for (int i = 0; i < t->iovcnt; i++) {
+        if ((uintptr_t)t->iov[i].iov_base & (BDEV_ALIGN - 1)) return 0;
+    }
+    return 1;
+}
+
+// puts t into the sq ring, queue locked. in_flight stays below depth, so there is a free slot
+static void ring_queue(AioQueue *q, Transfer *t) {
+    uint32_t tail = *q->sq_tail;
+    uint32_t idx = tail & *q->sq_mask;
+    struct io_uring_sqe *sqe = &q->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = t->op == AIO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = q->dev->fd;
+    sqe->off = t->block * BLOCK_SIZE;
+    sqe->addr = (uint64_t)(uintptr_t)t->iov;
+    sqe->len = (uint32_t)t->iovcnt;
+    sqe->user_data = (uint64_t)(uintptr_t)t;
+    q->sq_array[idx] = idx;
+    if (t->op == AIO_READ) {
+        STATS_COUNT(dev_reads, 1);
+        STATS_COUNT(bytes_read, t->bytes);
+    } else {
+        STATS_COUNT(dev_writes, 1);
+        STATS_COUNT(bytes_written, t->bytes);
+    }
+    __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    q->unsubmitted++;
+    q->in_ring++;
+}
+
+// hands everything queued in the sq ring to the kernel with one call, queue locked
+static void ring_submit(AioQueue *q) {
+    while (q->unsubmitted > 0) {
+        int n = ring_enter(q, q->unsubmitted, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            return; // left in the ring, the next call tries again
+        }
+        q->unsubmitted -= (uint32_t)n;
+    }
+}
+
+// moves completions from the cq ring to the done list, queue locked
+static void ring_harvest(AioQueue *q) {
+    uint32_t head = *q->cq_head;
+    uint32_t tail = __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+        Transfer *t = (Transfer *)(uintptr_t)cqe->user_data;
+        t->result = cqe->res >= 0 && (uint64_t)cqe->res == t->bytes ? 0 : RETRY;
+        push_done(q, t);
+        head++;
+        q->in_ring--;
+    }
+    __atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#else
+
+static int ring_setup(AioQueue *q) {
+    (void)q;
+    return -1;
+}
+
+#endif
+
+// ---------- completion ----------
+
+// completes reaped transfers outside the lock: the callback first, then the complete flag,
+// after which the owner may reuse the request. adds to the counters, returns num of transfers
+static uint32_t finish(AioQueue *q, Transfer *t, uint32_t *reqs, uint32_t *failed) {
+    uint32_t transfers = 0;
+    while (t) {
+        Transfer *next = t->next;
+        if (t->result == RETRY) t->result = run(q->dev, t);
+        for (AioRequest *r = t->first; r;) {
+            AioRequest *following = r->next;
+            r->result = t->result;
+            if (r->done) r->done(r);
+            __atomic_store_n(&r->complete, 1, __ATOMIC_RELEASE);
+            (*reqs)++;
+            if (t->result == -1) (*failed)++;
+            r = following;
+        }
+        free(t);
+        transfers++;
+        t = next;
+    }
+    return transfers;
+}
+
+// takes whatever has finished and completes it, queue locked on entry and return,
+// returns num of requests completed
+static uint32_t reap_ready(AioQueue *q) {
+#ifdef AIO_HAVE_URING
+    if (q->engine == AIO_ENGINE_URING) {
+        ring_submit(q);
+        ring_harvest(q);
+    }
+#endif
+    Transfer *t = q->done;
+    if (!t) return 0;
+    q->done = q->done_tail = NULL;
+
+    pthread_mutex_unlock(&q->lock);
+    uint32_t reqs = 0, failed = 0;
+    uint32_t transfers = finish(q, t, &reqs, &failed);
+    pthread_mutex_lock(&q->lock);
+
+    q->in_flight -= transfers;
+    q->stats.completed += reqs;
+    q->stats.failed += failed;
+    pthread_cond_broadcast(&q->changed);
+    return reqs;
+}
+
+// sleeps until something may have finished, queue locked on entry and return
+static void wait_ready(AioQueue *q) {
+#ifdef AIO_HAVE_URING
+    if (q->engine == AIO_ENGINE_URING && q->in_ring > 0 && !q->in_kernel) {
+        q->in_kernel = 1;
+        pthread_mutex_unlock(&q->lock);
+        ring_enter(q, 0, 1);
+        pthread_mutex_lock(&q->lock);
+        q->in_kernel = 0;
+        pthread_cond_broadcast(&q->changed);
+        return;
+    }
+#endif
+    pthread_cond_wait(&q->changed, &q->lock);
+}
+
+// ---------- public ----------
+
+// opens a queue on dev, AIO_ENGINE_URING falls back to the worker pool when the backend has no
+// plain fd or the kernel has no io_uring, 0 picks the default depth and worker count
+AioQueue *aio_open(BlockDevice *dev, AioEngine engine, uint32_t depth, uint32_t workers) {
+    AioQueue *q = calloc(1, sizeof(AioQueue));
+    if (!q) return NULL;
+    q->dev = dev;
+    q->depth = depth ? depth : AIO_DEFAULT_DEPTH;
+    q->ring_fd = -1;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    pthread_cond_init(&q->work, NULL);
+
+    if (engine == AIO_ENGINE_URING && dev->type == BDEV_PREAD && ring_setup(q) == 0) {
+        q->engine = AIO_ENGINE_URING;
+        return q;
+    }
+    q->engine = AIO_ENGINE_THREADS;
+    if (start_workers(q, workers ? workers : AIO_DEFAULT_WORKERS) == -1) {
+        aio_close(q);
+        return NULL;
+    }
+    return q;
+}
+
+static int drained(AioQueue *q) {
+    return q->in_flight == 0;
+}
+
+// waits for everything in flight, then stops the engine
+void aio_close(AioQueue *q) {
+    if (!q) return;
+    pthread_mutex_lock(&q->lock);
+    while (!drained(q)) {
+        if (reap_ready(q) == 0 && !drained(q)) wait_ready(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (q->num_workers) stop_workers(q);
+    free(q->workers);
+#ifdef AIO_HAVE_URING
+    ring_teardown(q);
+#endif
+    pthread_cond_destroy(&q->work);
+    pthread_cond_destroy(&q->changed);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+AioEngine aio_engine(const AioQueue *q) {
+    return q->engine;
+}
+
+const char *aio_engine_name(AioEngine engine) {
+    return engine == AIO_ENGINE_URING ? "io_uring" : "threads";
+}
+
+// starts one transfer, waiting (and reaping) while depth transfers are already in flight
+static void start(AioQueue *q, Transfer *t) {
+#ifdef AIO_HAVE_URING
+    if (q->engine == AIO_ENGINE_URING && !ring_takes(q, t)) {
+        t->result = run(q->dev, t); // done before it is queued, reaped like any other
+        pthread_mutex_lock(&q->lock);
+        q->in_flight++;
+        q->stats.transfers++;
+        push_done(q, t);
+        pthread_mutex_unlock(&q->lock);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&q->lock);
+    while (q->in_flight >= q->depth) {
+        if (reap_ready(q) == 0 && q->in_flight >= q->depth) wait_ready(q);
+    }
+    q->in_flight++;
+    q->stats.transfers++;
+    if (q->in_flight > q->stats.max_in_flight) q->stats.max_in_flight = q->in_flight;
+
+#ifdef AIO_HAVE_URING
+    if (q->engine == AIO_ENGINE_URING) {
+        ring_queue(q, t);
+        pthread_mutex_unlock(&q->lock);
+        return;
+    }
+#endif
+    t->next = NULL;
+    if (q->pending_tail) q->pending_tail->next = t;
+    else q->pending = t;
+    q->pending_tail = t;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// a transfer that couldn't be allocated completes its requests right here, one by one
+static void run_alone(AioQueue *q, AioRequest *r) {
+    struct iovec iov = { r->buf, (size_t)r->count * BLOCK_SIZE };
+    r->result = r->op == AIO_READ ? bdev_readv(q->dev, r->block, &iov, 1) : bdev_writev(q->dev, r->block, &iov, 1);
+    r->next = NULL;
+    if (r->done) r->done(r);
+    __atomic_store_n(&r->complete, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&q->lock);
+    q->stats.transfers++;
+    q->stats.completed++;
+    if (r->result == -1) q->stats.failed++;
+    pthread_mutex_unlock(&q->lock);
+}
+
+// queues n requests, consecutive ones of the same kind on adjacent blocks go to the device as one
+// vectored transfer, so callers wanting that pass them in block order. blocks while the queue is
+// full, returns 0 or -1 (nothing queued) for a malformed request
+int aio_submit(AioQueue *q, AioRequest *reqs, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        if (!reqs[i].buf || reqs[i].count == 0 || (uint64_t)reqs[i].count * BLOCK_SIZE > AIO_MAX_TRANSFER) return -1;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->stats.submitted += n;
+    pthread_mutex_unlock(&q->lock);
+
+    for (uint32_t i = 0; i < n;) {
+        uint32_t k = 1;
+        uint64_t bytes = (uint64_t)reqs[i].count * BLOCK_SIZE;
+        while (i + k < n && k < AIO_MAX_MERGE) {
+            const AioRequest *prev = &reqs[i + k - 1], *cur = &reqs[i + k];
+            uint64_t more = (uint64_t)cur->count * BLOCK_SIZE;
+            if (cur->op != prev->op || cur->block != prev->block + prev->count || bytes + more > AIO_MAX_TRANSFER) break;
+            bytes += more;
+            k++;
+        }
+
+        for (uint32_t j = 0; j < k; j++) {
+            reqs[i + j].result = 0;
+            reqs[i + j].complete = 0;
+            reqs[i + j].next = j + 1 < k ? &reqs[i + j + 1] : NULL;
+        }
+
+        Transfer *t = malloc(sizeof(Transfer) + k * sizeof(struct iovec));
+        if (!t) {
+            for (uint32_t j = 0; j < k; j++) run_alone(q, &reqs[i + j]);
+            i += k;
+            continue;
+        }
+        t->op = reqs[i].op;
+        t->block = reqs[i].block;
+        t->bytes = bytes;
+        t->first = &reqs[i];
+        t->result = 0;
+        t->stats_op = stats_current();
+        t->next = NULL;
+        t->iovcnt = (int)k;
+        for (uint32_t j = 0; j < k; j++) {
+            t->iov[j].iov_base = reqs[i + j].buf;
+            t->iov[j].iov_len = (size_t)reqs[i + j].count * BLOCK_SIZE;
+        }
+        start(q, t);
+        i += k;
+    }
+
+#ifdef AIO_HAVE_URING
+    if (q->engine == AIO_ENGINE_URING) {
+        pthread_mutex_lock(&q->lock);
+        ring_submit(q);
+        pthread_mutex_unlock(&q->lock);
+    }
+#endif
+    return 0;
+}
+
+// completes whatever has finished, waiting until at least min requests were completed by this
+// call or nothing is left in flight, returns num of requests completed
+int aio_poll(AioQueue *q, uint32_t min) {
+    pthread_mutex_lock(&q->lock);
+    uint32_t reaped = reap_ready(q);
+    while (reaped < min && !drained(q)) {
+        uint32_t got = reap_ready(q);
+        if (got == 0) wait_ready(q);
+        reaped += got;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return (int)reaped;
+}
+
+// waits until every one of the n requests is complete, completing other callers' requests
+// along the way, returns 0 or -1 if any of them failed
+int aio_wait(AioQueue *q, AioRequest *reqs, uint32_t n) {
+    uint32_t first = 0; // requests before it are known to be complete
+    int rc = 0;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (first < n && __atomic_load_n(&reqs[first].complete, __ATOMIC_ACQUIRE)) {
+            if (reqs[first].result == -1) rc = -1;
+            first++;
+        }
+        if (first == n) break;
+        if (reap_ready(q) == 0) wait_ready(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return rc;
+}
+
+void aio_stats(AioQueue *q, AioStats *out) {
+    pthread_mutex_lock(&q->lock);
+    *out = q->stats;
+    pthread_mutex_unlock(&q->lock);
+}
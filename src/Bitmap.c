@@ -0,0 +1,296 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Bitmap.h"
+#include "../include/Stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define FULL_WORD (~(uint64_t)0)
+
+static uint32_t chunk_of(uint32_t word) {
+    return word / BITMAP_CHUNK_WORDS;
+}
+
+// bits past nbits in the last word are kept set so they are never handed out
+static void mark_padding(Bitmap *bm) {
+    uint32_t tail = bm->nbits % 64;
+    if (tail) bm->words[bm->nwords - 1] |= FULL_WORD << tail;
+}
+
+static void recount(Bitmap *bm) {
+    bm->free_bits = 0;
+    for (uint32_t c = 0; c < bm->nchunks; c++) {
+        uint32_t first = c * BITMAP_CHUNK_WORDS;
+        uint32_t last = first + BITMAP_CHUNK_WORDS;
+        if (last > bm->nwords) last = bm->nwords;
+
+        uint32_t free_bits = 0;
+        for (uint32_t w = first; w < last; w++) free_bits += 64 - __builtin_popcountll(bm->words[w]);
+        bm->chunk_free[c] = free_bits;
+        bm->free_bits += free_bits;
+    }
+}
+
+int bitmap_init(Bitmap *bm, uint32_t nbits) {
+    memset(bm, 0, sizeof(Bitmap));
+    bm->nbits = nbits;
+    bm->nwords = (nbits + 63) / 64;
+    bm->nchunks = (bm->nwords + BITMAP_CHUNK_WORDS - 1) / BITMAP_CHUNK_WORDS;
+
+    bm->words = calloc(bm->nwords ? bm->nwords : 1, sizeof(uint64_t));
+    bm->chunk_free = calloc(bm->nchunks ? bm->nchunks : 1, sizeof(uint32_t));
+    if (!bm->words || !bm->chunk_free) {
+        bitmap_destroy(bm);
+        return -1;
+    }
+
+    if (bm->nwords) mark_padding(bm);
+    recount(bm);
+    return 0;
+}
+
+void bitmap_destroy(Bitmap *bm) {
+    free(bm->words);
+    free(bm->chunk_free);
+    memset(bm, 0, sizeof(Bitmap));
+}
+
+// replaces contents with the (nbits + 7) / 8 on-disk bytes
+void bitmap_load(Bitmap *bm, const void *bytes) {
+    memset(bm->words, 0, (size_t)bm->nwords * sizeof(uint64_t));
+    memcpy(bm->words, bytes, (bm->nbits + 7) / 8);
+    if (bm->nwords) mark_padding(bm);
+    recount(bm);
+    bm->hint = 0;
+}
+
+int bitmap_test(const Bitmap *bm, uint32_t bit) {
+    return (__atomic_load_n(&bm->words[bit / 64], __ATOMIC_RELAXED) >> (bit % 64)) & 1;
+}
+
+// changes below are atomic per word and counter, so threads working on disjoint bit ranges
+// (one group each) may share a bitmap even where a word or chunk straddles two ranges.
+// searches read words and counters the same way, the neighbour may be changing its half
+static uint64_t word_at(const Bitmap *bm, uint32_t w) {
+    return __atomic_load_n(&bm->words[w], __ATOMIC_RELAXED);
+}
+
+static uint32_t free_in_chunk(const Bitmap *bm, uint32_t c) {
+    return __atomic_load_n(&bm->chunk_free[c], __ATOMIC_RELAXED);
+}
+
+static uint32_t free_total(const Bitmap *bm) {
+    return __atomic_load_n(&bm->free_bits, __ATOMIC_RELAXED);
+}
+
+static void count_free(Bitmap *bm, uint32_t word, int delta) {
+    __atomic_fetch_add(&bm->chunk_free[chunk_of(word)], (uint32_t)delta, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bm->free_bits, (uint32_t)delta, __ATOMIC_RELAXED);
+}
+
+void bitmap_set(Bitmap *bm, uint32_t bit) {
+    uint64_t mask = (uint64_t)1 << (bit % 64);
+    uint64_t old = __atomic_fetch_or(&bm->words[bit / 64], mask, __ATOMIC_RELAXED);
+    if (!(old & mask)) count_free(bm, bit / 64, -1);
+}
+
+void bitmap_clear(Bitmap *bm, uint32_t bit) {
+    uint64_t mask = (uint64_t)1 << (bit % 64);
+    uint64_t old = __atomic_fetch_and(&bm->words[bit / 64], ~mask, __ATOMIC_RELAXED);
+    if (old & mask) count_free(bm, bit / 64, 1);
+}
+
+// sets [first, first + count) a word at a time
+void bitmap_set_run(Bitmap *bm, uint32_t first, uint32_t count) {
+    uint32_t bit = first;
+    uint32_t end = first + count;
+    while (bit < end) {
+        uint32_t w = bit / 64;
+        uint32_t lo = bit % 64;
+        uint32_t n = 64 - lo < end - bit ? 64 - lo : end - bit;
+        uint64_t mask = (n == 64 ? FULL_WORD : (((uint64_t)1 << n) - 1)) << lo;
+
+        uint64_t old = __atomic_fetch_or(&bm->words[w], mask, __ATOMIC_RELAXED);
+        uint32_t newly = __builtin_popcountll(mask & ~old);
+        if (newly) count_free(bm, w, -(int)newly);
+        bit += n;
+    }
+}
+
+static void scanned(Bitmap *bm, uint32_t words) {
+    __atomic_fetch_add(&bm->words_scanned, words, __ATOMIC_RELAXED);
+    STATS_COUNT(alloc_words, words);
+}
+
+// first word in [w, limit) with a free bit, limit if none
+static uint32_t skip_full_words(Bitmap *bm, uint32_t w, uint32_t limit) {
+    uint32_t start = w;
+#if defined(__AVX2__)
+    const __m256i full = _mm256_set1_epi64x(-1);
+    while (w + 4 <= limit) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&bm->words[w]);
+        int eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, full)));
+        if (eq != 0xF) {
+            w += __builtin_ctz(~eq & 0xF);
+            scanned(bm, w - start + 1);
+            return w;
+        }
+        w += 4;
+    }
+#elif defined(__SSE2__)
+    const __m128i full = _mm_set1_epi32(-1);
+    while (w + 2 <= limit) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&bm->words[w]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, full)) != 0xFFFF) {
+            if (word_at(bm, w) == FULL_WORD) w++;
+            scanned(bm, w - start + 1);
+            return w;
+        }
+        w += 2;
+    }
+#endif
+    while (w < limit && word_at(bm, w) == FULL_WORD) w++;
+    scanned(bm, w - start + (w < limit));
+    return w;
+}
+
+// first free bit in [from, to), -1 if none
+static long find_zero(Bitmap *bm, uint32_t from, uint32_t to) {
+    if (from >= to) return -1;
+
+    uint32_t w = from / 64;
+    uint32_t end = (to + 63) / 64;
+
+    // first word may be partial
+    uint64_t free_mask = ~word_at(bm, w) & (FULL_WORD << (from % 64));
+    scanned(bm, 1);
+    if (free_mask) {
+        uint32_t bit = w * 64 + __builtin_ctzll(free_mask);
+        return bit < to ? (long)bit : -1;
+    }
+    w++;
+
+    while (w < end) {
+        // a chunk with no free bits costs one counter read
+        uint32_t c = chunk_of(w);
+        if (free_in_chunk(bm, c) == 0) {
+            w = (c + 1) * BITMAP_CHUNK_WORDS;
+            continue;
+        }
+
+        uint32_t limit = (c + 1) * BITMAP_CHUNK_WORDS;
+        if (limit > end) limit = end;
+
+        w = skip_full_words(bm, w, limit);
+        if (w == limit) continue;
+
+        uint32_t bit = w * 64 + __builtin_ctzll(~word_at(bm, w));
+        return bit < to ? (long)bit : -1;
+    }
+    return -1;
+}
+
+// first used bit in [from, to), -1 if all free
+static long find_one(Bitmap *bm, uint32_t from, uint32_t to) {
+    uint32_t bit = from;
+    while (bit < to) {
+        uint32_t w = bit / 64;
+        uint64_t used = word_at(bm, w) & (FULL_WORD << (bit % 64));
+        scanned(bm, 1);
+        if (used) {
+            uint32_t found = w * 64 + __builtin_ctzll(used);
+            return found < to ? (long)found : -1;
+        }
+        bit = (w + 1) * 64;
+    }
+    return -1;
+}
+
+// start of the first count long free run in [from, to), -1 if none
+static long find_run(Bitmap *bm, uint32_t from, uint32_t to, uint32_t count) {
+    uint32_t pos = from;
+    while (pos < to) {
+        long z = find_zero(bm, pos, to);
+        if (z == -1 || (uint64_t)z + count > to) return -1;
+
+        long used = find_one(bm, (uint32_t)z, (uint32_t)z + count);
+        if (used == -1) return z;
+        pos = (uint32_t)used + 1;
+    }
+    return -1;
+}
+
+// allocates one free bit >= min_bit, next-fit from the hint, returns bit or -1.
+// the hint is shared, so only one thread may use the whole-bitmap allocators at a time
+long bitmap_alloc(Bitmap *bm, uint32_t min_bit) {
+    return bitmap_alloc_run(bm, min_bit, 1);
+}
+
+// allocates count contiguous free bits >= min_bit, returns the first or -1
+long bitmap_alloc_run(Bitmap *bm, uint32_t min_bit, uint32_t count) {
+    if (count == 0 || free_total(bm) < count) return -1;
+
+    uint32_t start = bm->hint > min_bit ? bm->hint : min_bit;
+    long bit = count == 1 ? find_zero(bm, start, bm->nbits) : find_run(bm, start, bm->nbits, count);
+
+    // wrap around, the run may also straddle the hint
+    if (bit == -1 && start > min_bit) {
+        uint32_t to = start + count - 1 < bm->nbits ? start + count - 1 : bm->nbits;
+        bit = count == 1 ? find_zero(bm, min_bit, to) : find_run(bm, min_bit, to, count);
+    }
+    if (bit == -1) return -1;
+
+    if (count == 1) bitmap_set(bm, (uint32_t)bit);
+    else bitmap_set_run(bm, (uint32_t)bit, count);
+
+    bm->hint = (uint32_t)bit + count;
+    if (bm->hint >= bm->nbits) bm->hint = 0;
+    return bit;
+}
+
+// allocates count contiguous free bits in [from, to), searching from goal first and wrapping
+// back to from, leaves the next-fit hint alone, returns the first bit or -1
+long bitmap_alloc_range(Bitmap *bm, uint32_t goal, uint32_t from, uint32_t to, uint32_t count) {
+    if (count == 0 || free_total(bm) < count || from >= to) return -1;
+    if (to > bm->nbits) to = bm->nbits;
+    if (goal < from || goal >= to) goal = from;
+
+    long bit = count == 1 ? find_zero(bm, goal, to) : find_run(bm, goal, to, count);
+    if (bit == -1 && goal > from) {
+        uint32_t stop = goal + count - 1 < to ? goal + count - 1 : to;
+        bit = count == 1 ? find_zero(bm, from, stop) : find_run(bm, from, stop, count);
+    }
+    if (bit == -1) return -1;
+
+    if (count == 1) bitmap_set(bm, (uint32_t)bit);
+    else bitmap_set_run(bm, (uint32_t)bit, count);
+    return bit;
+}
+
+// allocates the first free bit in [from, to) at or after goal (wrapping back to from) plus up to
+// max - 1 free bits right after it, stores the run length in got, returns the first bit or -1
+long bitmap_alloc_upto(Bitmap *bm, uint32_t goal, uint32_t from, uint32_t to, uint32_t max, uint32_t *got) {
+    if (max == 0 || free_total(bm) == 0 || from >= to) return -1;
+    if (to > bm->nbits) to = bm->nbits;
+    if (goal < from || goal >= to) goal = from;
+
+    long bit = find_zero(bm, goal, to);
+    if (bit == -1 && goal > from) bit = find_zero(bm, from, goal);
+    if (bit == -1) return -1;
+
+    // grow the run until the next used bit
+    uint32_t limit = (uint64_t)bit + max < to ? (uint32_t)bit + max : to;
+    long used = find_one(bm, (uint32_t)bit, limit);
+    uint32_t count = (used == -1 ? limit : (uint32_t)used) - (uint32_t)bit;
+
+    bitmap_set_run(bm, (uint32_t)bit, count);
+    *got = count;
+    return bit;
+}
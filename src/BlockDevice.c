@@ -0,0 +1,405 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#define _GNU_SOURCE // O_DIRECT
+#include "../include/BlockDevice.h"
+#include "../include/FileSystemStructure.h"
+#include "../include/Stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// each buffer in turn through the plain ops, for backends without vectored I/O
+static int transfer_each(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt, int writing) {
+    for (int i = 0; i < iovcnt; i++) {
+        uint32_t count = (uint32_t)(iov[i].iov_len / BLOCK_SIZE);
+        int rc = writing ? dev->ops->write(dev, block, count, iov[i].iov_base)
+                         : dev->ops->read(dev, block, count, iov[i].iov_base);
+        if (rc == -1) return -1;
+        block += count;
+    }
+    return 0;
+}
+
+// ---------- stdio ----------
+
+// the stream position is shared, so a seek and its transfer happen under the device lock
+
+static int stdio_seek(BlockDevice *dev, uint64_t offset, int writing) {
+    // a read after a write (or the other way round) needs a seek in between anyway
+    if (dev->pos == offset && dev->last_write == writing) return 0;
+    STATS_COUNT(seeks, 1);
+    if (fseeko(dev->file, (off_t)offset, SEEK_SET) != 0) return -1;
+    dev->pos = offset;
+    dev->last_write = writing;
+    return 0;
+}
+
+static int stdio_read(BlockDevice *dev, uint64_t block, uint32_t count, void *buf) {
+    uint64_t offset = block * BLOCK_SIZE;
+    size_t len = (size_t)count * BLOCK_SIZE;
+    pthread_mutex_lock(&dev->lock);
+    if (stdio_seek(dev, offset, 0) == -1) {
+        pthread_mutex_unlock(&dev->lock);
+        return -1;
+    }
+
+    size_t got = fread(buf, 1, len, dev->file);
+    dev->pos += got;
+    if (got < len) {
+        memset((uint8_t *)buf + got, 0, len - got); // past end of image
+        clearerr(dev->file);
+        dev->pos = UINT64_MAX; // position unknown after a short read
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+static int stdio_write(BlockDevice *dev, uint64_t block, uint32_t count, const void *buf) {
+    uint64_t offset = block * BLOCK_SIZE;
+    size_t len = (size_t)count * BLOCK_SIZE;
+    pthread_mutex_lock(&dev->lock);
+    if (stdio_seek(dev, offset, 1) == -1) {
+        pthread_mutex_unlock(&dev->lock);
+        return -1;
+    }
+
+    size_t put = fwrite(buf, 1, len, dev->file);
+    dev->pos += put;
+    pthread_mutex_unlock(&dev->lock);
+    return put == len ? 0 : -1;
+}
+
+static int stdio_flush(BlockDevice *dev) {
+    pthread_mutex_lock(&dev->lock);
+    int rc = fflush(dev->file);
+    pthread_mutex_unlock(&dev->lock);
+    return rc;
+}
+
+static int stdio_sync(BlockDevice *dev) {
+    if (stdio_flush(dev) != 0) return -1;
+    return fdatasync(fileno(dev->file));
+}
+
+static void stdio_close(BlockDevice *dev) {
+    fclose(dev->file);
+}
+
+static const BlockDeviceOps stdio_ops = {
+    stdio_read, stdio_write, NULL, NULL, NULL, stdio_flush, stdio_sync, stdio_close
+};
+
+// ---------- pread/pwrite ----------
+
+// no shared position, threads read and write concurrently without a lock
+
+static int aligned(const void *buf) {
+    return ((uintptr_t)buf & (BDEV_ALIGN - 1)) == 0;
+}
+
+static int pread_full(int fd, void *buf, size_t len, off_t offset) {
+    uint8_t *out = buf;
+    while (len > 0) {
+        ssize_t got = pread(fd, out, len, offset);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) {
+            memset(out, 0, len); // past end of image
+            return 0;
+        }
+        out += got;
+        offset += got;
+        len -= (size_t)got;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const void *buf, size_t len, off_t offset) {
+    const uint8_t *in = buf;
+    while (len > 0) {
+        ssize_t put = pwrite(fd, in, len, offset);
+        if (put < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        in += put;
+        offset += put;
+        len -= (size_t)put;
+    }
+    return 0;
+}
+
+static int pread_read(BlockDevice *dev, uint64_t block, uint32_t count, void *buf) {
+    off_t offset = (off_t)(block * BLOCK_SIZE);
+    if (!dev->direct || aligned(buf)) return pread_full(dev->fd, buf, (size_t)count * BLOCK_SIZE, offset);
+
+    // O_DIRECT wants aligned memory, stage unaligned callers one block at a time
+    _Alignas(BDEV_ALIGN) uint8_t bounce[BLOCK_SIZE];
+    for (uint32_t i = 0; i < count; i++) {
+        if (pread_full(dev->fd, bounce, BLOCK_SIZE, offset + (off_t)i * BLOCK_SIZE) == -1) return -1;
+        memcpy((uint8_t *)buf + (size_t)i * BLOCK_SIZE, bounce, BLOCK_SIZE);
+    }
+    return 0;
+}
+
+static int pread_write(BlockDevice *dev, uint64_t block, uint32_t count, const void *buf) {
+    off_t offset = (off_t)(block * BLOCK_SIZE);
+    if (!dev->direct || aligned(buf)) return pwrite_full(dev->fd, buf, (size_t)count * BLOCK_SIZE, offset);
+
+    _Alignas(BDEV_ALIGN) uint8_t bounce[BLOCK_SIZE];
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(bounce, (const uint8_t *)buf + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        if (pwrite_full(dev->fd, bounce, BLOCK_SIZE, offset + (off_t)i * BLOCK_SIZE) == -1) return -1;
+    }
+    return 0;
+}
+
+// one preadv / pwritev per call where the kernel takes it whole, partial transfers resume
+// inside the iovec they stopped in
+static int transfer_vec(int fd, const struct iovec *iov, int iovcnt, off_t offset, int writing) {
+    struct iovec left[IOV_MAX];
+    if (iovcnt > IOV_MAX) return -1;
+    memcpy(left, iov, (size_t)iovcnt * sizeof(struct iovec));
+
+    struct iovec *cur = left;
+    while (iovcnt > 0) {
+        ssize_t n = writing ? pwritev(fd, cur, iovcnt, offset) : preadv(fd, cur, iovcnt, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            if (writing) return -1;
+            for (int i = 0; i < iovcnt; i++) memset(cur[i].iov_base, 0, cur[i].iov_len); // past end of image
+            return 0;
+        }
+        offset += n;
+        while (iovcnt > 0 && (size_t)n >= cur->iov_len) {
+            n -= (ssize_t)cur->iov_len;
+            cur++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            cur->iov_base = (uint8_t *)cur->iov_base + n;
+            cur->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+static int vec_aligned(const struct iovec *iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        if (!aligned(iov[i].iov_base)) return 0;
+    }
+    return 1;
+}
+
+static int pread_readv(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt) {
+    // O_DIRECT with unaligned memory is staged one buffer at a time
+    if (dev->direct && !vec_aligned(iov, iovcnt)) return transfer_each(dev, block, iov, iovcnt, 0);
+    return transfer_vec(dev->fd, iov, iovcnt, (off_t)(block * BLOCK_SIZE), 0);
+}
+
+static int pread_writev(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt) {
+    if (dev->direct && !vec_aligned(iov, iovcnt)) return transfer_each(dev, block, iov, iovcnt, 1);
+    return transfer_vec(dev->fd, iov, iovcnt, (off_t)(block * BLOCK_SIZE), 1);
+}
+
+static int fd_flush(BlockDevice *dev) {
+    (void)dev;
+    return 0; // nothing buffered in user space
+}
+
+static int fd_sync(BlockDevice *dev) {
+    return fdatasync(dev->fd);
+}
+
+static void fd_close(BlockDevice *dev) {
+    close(dev->fd);
+}
+
+static const BlockDeviceOps pread_ops = {
+    pread_read, pread_write, pread_readv, pread_writev, NULL, fd_flush, fd_sync, fd_close
+};
+
+// ---------- mmap ----------
+
+static int mmap_read(BlockDevice *dev, uint64_t block, uint32_t count, void *buf) {
+    if (block + count > dev->num_blocks) return -1;
+    memcpy(buf, dev->base + block * BLOCK_SIZE, (size_t)count * BLOCK_SIZE);
+    return 0;
+}
+
+static int mmap_write(BlockDevice *dev, uint64_t block, uint32_t count, const void *buf) {
+    if (block + count > dev->num_blocks) return -1;
+    memcpy(dev->base + block * BLOCK_SIZE, buf, (size_t)count * BLOCK_SIZE);
+    return 0;
+}
+
+// the block itself, valid until the device is closed
+static const void *mmap_map(BlockDevice *dev, uint64_t block) {
+    if (block >= dev->num_blocks) return NULL;
+    return dev->base + block * BLOCK_SIZE;
+}
+
+static int mmap_sync(BlockDevice *dev) {
+    return msync(dev->base, dev->map_len, MS_SYNC);
+}
+
+static void mmap_close(BlockDevice *dev) {
+    munmap(dev->base, dev->map_len);
+    close(dev->fd);
+}
+
+static const BlockDeviceOps mmap_ops = {
+    mmap_read, mmap_write, NULL, NULL, mmap_map, fd_flush, mmap_sync, mmap_close
+};
+
+// ---------- common ----------
+
+static int open_fd(const char *filename, int flags, int *direct) {
+    int oflags = O_RDWR | ((flags & BDEV_CREATE) ? O_CREAT | O_TRUNC : 0);
+
+    if (flags & BDEV_DIRECT) {
+        int fd = open(filename, oflags | O_DIRECT, 0644);
+        if (fd != -1) {
+            *direct = 1;
+            return fd;
+        }
+        if (errno != EINVAL) return -1;
+        // filesystem doesn't do O_DIRECT (tmpfs), fall back to buffered I/O
+    }
+    *direct = 0;
+    return open(filename, oflags, 0644);
+}
+
+// opens filename with the chosen backend, BDEV_CREATE sizes a fresh image to num_blocks
+BlockDevice *bdev_open(const char *filename, BlockDeviceType type, int flags, uint64_t num_blocks) {
+    BlockDevice *dev = calloc(1, sizeof(BlockDevice));
+    if (!dev) return NULL;
+    dev->type = type;
+    dev->fd = -1;
+    pthread_mutex_init(&dev->lock, NULL);
+
+    if (type == BDEV_STDIO) {
+        dev->file = fopen(filename, (flags & BDEV_CREATE) ? "wb+" : "rb+");
+        if (!dev->file) goto fail;
+        dev->ops = &stdio_ops;
+        dev->pos = UINT64_MAX;
+        if ((flags & BDEV_CREATE) && ftruncate(fileno(dev->file), (off_t)(num_blocks * BLOCK_SIZE)) == -1) goto fail;
+
+        struct stat st;
+        if (fstat(fileno(dev->file), &st) == 0) dev->num_blocks = (uint64_t)st.st_size / BLOCK_SIZE;
+    } else {
+        dev->fd = open_fd(filename, flags, &dev->direct);
+        if (dev->fd == -1) goto fail;
+        if ((flags & BDEV_CREATE) && ftruncate(dev->fd, (off_t)(num_blocks * BLOCK_SIZE)) == -1) goto fail;
+
+        struct stat st;
+        if (fstat(dev->fd, &st) == -1) goto fail;
+        dev->num_blocks = (uint64_t)st.st_size / BLOCK_SIZE;
+
+        if (type == BDEV_PREAD) {
+            dev->ops = &pread_ops;
+        } else {
+            dev->ops = &mmap_ops;
+            dev->map_len = dev->num_blocks * BLOCK_SIZE;
+            if (dev->map_len == 0) goto fail;
+            dev->base = mmap(NULL, dev->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+            if (dev->base == MAP_FAILED) goto fail;
+        }
+    }
+
+    if (flags & BDEV_CREATE) dev->num_blocks = num_blocks;
+    return dev;
+
+fail:
+    perror(filename);
+    if (dev->file) fclose(dev->file);
+    if (dev->fd != -1) close(dev->fd);
+    pthread_mutex_destroy(&dev->lock);
+    free(dev);
+    return NULL;
+}
+
+void bdev_close(BlockDevice *dev) {
+    if (!dev) return;
+    dev->ops->close(dev);
+    pthread_mutex_destroy(&dev->lock);
+    free(dev);
+}
+
+int bdev_read(BlockDevice *dev, uint64_t block, uint32_t count, void *buf) {
+    STATS_COUNT(dev_reads, 1);
+    STATS_COUNT(bytes_read, (uint64_t)count * BLOCK_SIZE);
+    return dev->ops->read(dev, block, count, buf);
+}
+
+int bdev_write(BlockDevice *dev, uint64_t block, uint32_t count, const void *buf) {
+    STATS_COUNT(dev_writes, 1);
+    STATS_COUNT(bytes_written, (uint64_t)count * BLOCK_SIZE);
+    return dev->ops->write(dev, block, count, buf);
+}
+
+static uint64_t vec_bytes(const struct iovec *iov, int iovcnt) {
+    uint64_t bytes = 0;
+    for (int i = 0; i < iovcnt; i++) bytes += iov[i].iov_len;
+    return bytes;
+}
+
+// reads consecutive blocks from block on into iovcnt buffers of whole blocks, returns 0 or -1
+int bdev_readv(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt) {
+    STATS_COUNT(dev_reads, 1);
+    if (STATS_ON()) STATS_COUNT(bytes_read, vec_bytes(iov, iovcnt));
+    if (!dev->ops->readv) return transfer_each(dev, block, iov, iovcnt, 0);
+    return dev->ops->readv(dev, block, iov, iovcnt);
+}
+
+int bdev_writev(BlockDevice *dev, uint64_t block, const struct iovec *iov, int iovcnt) {
+    STATS_COUNT(dev_writes, 1);
+    if (STATS_ON()) STATS_COUNT(bytes_written, vec_bytes(iov, iovcnt));
+    if (!dev->ops->writev) return transfer_each(dev, block, iov, iovcnt, 1);
+    return dev->ops->writev(dev, block, iov, iovcnt);
+}
+
+// zero copy view of a block, NULL if the backend has to copy
+const void *bdev_map(BlockDevice *dev, uint64_t block) {
+    return dev->ops->map ? dev->ops->map(dev, block) : NULL;
+}
+
+int bdev_flush(BlockDevice *dev) {
+    return dev->ops->flush(dev);
+}
+
+int bdev_sync(BlockDevice *dev) {
+    return dev->ops->sync(dev);
+}
+
+static const char *type_names[] = { "stdio", "pread", "mmap" };
+
+const char *bdev_type_name(BlockDeviceType type) {
+    return type <= BDEV_MMAP ? type_names[type] : "unknown";
+}
+
+// "stdio", "pread" or "mmap" -> backend, returns 0 or -1
+int bdev_parse_type(const char *name, BlockDeviceType *out) {
+    for (int t = BDEV_STDIO; t <= BDEV_MMAP; t++) {
+        if (strcmp(name, type_names[t]) == 0) {
+            *out = (BlockDeviceType)t;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,537 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Cache.h"
+#include "../include/Stats.h"
+#include "../include/Snapshot.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+static Buffer *buffers = NULL;      // fixed pool, the whole memory budget
+static uint8_t *pool = NULL;        // block data of every buffer, one aligned allocation
+static uint32_t num_buffers = 0;
+static Buffer **hash_table = NULL;  // block number -> buffer chains
+static uint32_t hash_mask = 0;
+static uint32_t clock_hand = 0;     // next eviction candidate
+static CacheStats stats;
+
+// hits only need the table shared (pins, referenced bits and stats are atomic),
+// a miss, eviction or discard takes it exclusively and does its disk read under it
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static Buffer **tracked = NULL;     // buffers dirtied since cache_track_begin
+static uint32_t num_tracked = 0;
+static uint32_t tracked_cap = 0;
+static int tracking = 0;
+static pthread_mutex_t track_lock = PTHREAD_MUTEX_INITIALIZER; // threads of one transaction dirty concurrently
+
+static int compare_block_num(const void *a, const void *b);
+
+static uint32_t hash_block(uint32_t block_num) {
+    return (block_num * 2654435761u) & hash_mask;
+}
+
+static void disk_read(uint32_t block_num, void *buf) {
+    if (bdev_read(fs.dev, block_num, 1, buf) == -1) memset(buf, 0, BLOCK_SIZE); // past end of image
+}
+
+static void disk_write(uint32_t block_num, const void *buf) {
+    bdev_write(fs.dev, block_num, 1, buf);
+}
+
+// checksum kind a block has by its place alone, dir blocks are named by whoever reads them
+static uint8_t kind_of(uint32_t block_num) {
+    if (!(fs.sb.features & FEATURE_METADATA_CSUM) || !fs.groups) return CSUM_NONE;
+    if (block_num == 0) return CSUM_SUPER;
+    uint32_t g = block_num / fs.sb.blocks_per_group;
+    if (g >= fs.sb.groups_count) return CSUM_NONE;
+    uint32_t table = fs.groups[g].inode_table;
+    return block_num >= table && block_num - table < fs.sb.inode_table_blocks ? CSUM_ITABLE : CSUM_NONE;
+}
+
+// 1 if the buffer's fresh disk contents check out as kind, mount loads what it checks itself.
+// a failure is only counted, the caller's read fails and it reports what it was after
+static int verify(const Buffer *b, uint8_t kind) {
+    if (!fs.mounted || csum_verify(b->block_num, b->data, kind)) return 1;
+    __atomic_fetch_add(&stats.csum_errors, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void writeback(Buffer *b) {
+    snap_barrier();
+    bseal(b);
+    disk_write(b->block_num, b->data);
+    b->dirty = 0;
+    __atomic_fetch_add(&stats.writebacks, 1, __ATOMIC_RELAXED);
+}
+
+// writes n buffers back, passed in block order, all in flight at once on the async queue
+// where adjacent blocks merge into one vectored transfer
+static void writeback_all(Buffer **bufs, uint32_t n) {
+    AioRequest *reqs = fs.aio && n > 1 ? malloc(n * sizeof(AioRequest)) : NULL;
+    if (!reqs) {
+        for (uint32_t i = 0; i < n; i++) writeback(bufs[i]);
+        return;
+    }
+    snap_barrier();
+
+    for (uint32_t i = 0; i < n; i++) {
+        bseal(bufs[i]);
+        reqs[i] = (AioRequest){ .op = AIO_WRITE, .block = bufs[i]->block_num, .count = 1, .buf = bufs[i]->data };
+    }
+    aio_submit(fs.aio, reqs, n);
+    aio_wait(fs.aio, reqs, n);
+    for (uint32_t i = 0; i < n; i++) bufs[i]->dirty = 0;
+    __atomic_fetch_add(&stats.writebacks, n, __ATOMIC_RELAXED);
+    free(reqs);
+}
+
+static void hash_remove(Buffer *b) {
+    Buffer **link = &hash_table[hash_block(b->block_num)];
+    while (*link) {
+        if (*link == b) {
+            *link = b->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    b->hash_next = NULL;
+}
+
+static Buffer *hash_find(uint32_t block_num) {
+    for (Buffer *b = hash_table[hash_block(block_num)]; b; b = b->hash_next) {
+        if (b->block_num == block_num) return b;
+    }
+    return NULL;
+}
+
+// CLOCK: sweep the pool giving referenced buffers a second chance
+static Buffer *pick_victim() {
+    for (uint32_t scanned = 0; scanned < 2 * num_buffers; scanned++) {
+        Buffer *b = &buffers[clock_hand];
+        clock_hand = (clock_hand + 1) % num_buffers;
+
+        if (__atomic_load_n(&b->pins, __ATOMIC_ACQUIRE) > 0) continue; // in use, never evicted
+        if (!b->valid) return b;            // never used slot
+        if (b->referenced) {
+            b->referenced = 0;
+            continue;
+        }
+
+        if (b->dirty) writeback(b);
+        hash_remove(b);
+        b->valid = 0;
+        __atomic_fetch_add(&stats.evictions, 1, __ATOMIC_RELAXED);
+        return b;
+    }
+    return NULL; // every buffer is pinned
+}
+
+// pins the hashed buffer of block_num, NULL if it isn't cached, table held at least shared
+static Buffer *pin_cached(uint32_t block_num) {
+    Buffer *b = hash_find(block_num);
+    if (!b) return NULL;
+    __atomic_fetch_add(&b->pins, 1, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&b->referenced, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.hits, 1, __ATOMIC_RELAXED);
+    STATS_COUNT(cache_hits, 1);
+    return b;
+}
+
+// returns pinned buffer for block with valid contents, read from disk (or zeroed when
+// zero_fill is set) on a miss, the load happens under the exclusive table lock so no other
+// thread sees the buffer half filled. a block read as a checksummed kind is verified once per
+// load, NULL if it doesn't check out
+static Buffer *claim(uint32_t block_num, int zero_fill, uint8_t kind) {
+    if (!buffers && cache_init(CACHE_DEFAULT_BUFFERS) == -1) return NULL;
+
+    pthread_rwlock_rdlock(&table_lock);
+    Buffer *b = pin_cached(block_num);
+    pthread_rwlock_unlock(&table_lock);
+    if (b) return b;
+
+    pthread_rwlock_wrlock(&table_lock);
+    b = pin_cached(block_num); // another thread may have loaded it in between
+    if (b) {
+        pthread_rwlock_unlock(&table_lock);
+        return b;
+    }
+
+    __atomic_fetch_add(&stats.misses, 1, __ATOMIC_RELAXED);
+    STATS_COUNT(cache_misses, 1);
+    b = pick_victim();
+    if (!b) {
+        pthread_rwlock_unlock(&table_lock);
+        return NULL;
+    }
+
+    b->block_num = block_num;
+    b->pins = 1;
+    b->dirty = 0;
+    b->referenced = 1;
+    b->kind = kind ? kind : fs.mounted ? kind_of(block_num) : CSUM_NONE;
+    uint32_t h = hash_block(block_num);
+    b->hash_next = hash_table[h];
+    hash_table[h] = b;
+
+    if (zero_fill) memset(b->data, 0, BLOCK_SIZE);
+    else disk_read(block_num, b->data);
+    if (!zero_fill && !verify(b, b->kind)) {
+        hash_remove(b); // the next read tries the disk again
+        b->pins = 0;
+        pthread_rwlock_unlock(&table_lock);
+        return NULL;
+    }
+    b->valid = 1;
+    pthread_rwlock_unlock(&table_lock);
+    return b;
+}
+
+// a cached block asked for as kind for the first time: what came from the disk is verified
+// now, what was written since is ours and gets sealed as kind. NULL if it doesn't check out
+static Buffer *as_kind(Buffer *b, uint8_t kind, int zero_fill) {
+    if (!b || __atomic_load_n(&b->kind, __ATOMIC_RELAXED) == kind) return b; // the warm path, one compare
+    if (!zero_fill && !__atomic_load_n(&b->dirty, __ATOMIC_RELAXED) && !verify(b, kind)) {
+        brelse(b);
+        return NULL;
+    }
+    __atomic_store_n(&b->kind, kind, __ATOMIC_RELAXED);
+    return b;
+}
+
+// sets up a pool of num_buffers blocks, drops whatever was cached before
+int cache_init(uint32_t n) {
+    free(buffers);
+    free(pool);
+    free(hash_table);
+    pool = NULL;
+
+    if (n == 0) n = CACHE_DEFAULT_BUFFERS;
+
+    uint32_t buckets = 1;
+    while (buckets < 2 * n) buckets <<= 1;
+
+    buffers = calloc(n, sizeof(Buffer));
+    hash_table = calloc(buckets, sizeof(Buffer *));
+    if (posix_memalign((void **)&pool, BDEV_ALIGN, (size_t)n * BLOCK_SIZE) != 0) pool = NULL;
+    if (!buffers || !hash_table || !pool) {
+        free(buffers);
+        free(pool);
+        free(hash_table);
+        buffers = NULL;
+        pool = NULL;
+        hash_table = NULL;
+        num_buffers = 0;
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) buffers[i].data = pool + (size_t)i * BLOCK_SIZE;
+
+    num_buffers = n;
+    hash_mask = buckets - 1;
+    clock_hand = 0;
+    num_tracked = 0;
+    memset(&stats, 0, sizeof(stats));
+    return 0;
+}
+
+// writes back everything and releases the pool
+void cache_destroy() {
+    if (!buffers) return;
+    if (fs.dev) cache_flush();
+
+    free(buffers);
+    free(pool);
+    free(hash_table);
+    buffers = NULL;
+    pool = NULL;
+    hash_table = NULL;
+    num_buffers = 0;
+}
+
+// returns pinned buffer with block contents, release with brelse
+Buffer *bread(uint32_t block_num) {
+    return claim(block_num, 0, CSUM_NONE);
+}
+
+// like bread but skips the disk read, for callers overwriting the whole block
+Buffer *bget(uint32_t block_num) {
+    return claim(block_num, 1, CSUM_NONE);
+}
+
+// bread of a block the caller knows to be of a checksummed kind (CSUM_DIR), NULL when its
+// checksum doesn't match
+Buffer *bread_as(uint32_t block_num, uint8_t kind) {
+    if (!(fs.sb.features & FEATURE_METADATA_CSUM)) return bread(block_num);
+    return as_kind(claim(block_num, 0, kind), kind, 0);
+}
+
+Buffer *bget_as(uint32_t block_num, uint8_t kind) {
+    if (!(fs.sb.features & FEATURE_METADATA_CSUM)) return bget(block_num);
+    return as_kind(claim(block_num, 1, kind), kind, 1);
+}
+
+void bpin(Buffer *b) {
+    __atomic_fetch_add(&b->pins, 1, __ATOMIC_ACQUIRE);
+}
+
+void brelse(Buffer *b) {
+    if (b) __atomic_fetch_sub(&b->pins, 1, __ATOMIC_RELEASE);
+}
+
+// marks buffer to be written back on flush or eviction
+void bdirty(Buffer *b) {
+    if (snap_live) snap_cow(b->block_num); // a snapshot's old contents leave home first
+    __atomic_store_n(&b->dirty, 1, __ATOMIC_RELAXED);
+
+    // inside a transaction the block stays pinned until commit writes it exactly once
+    pthread_mutex_lock(&track_lock);
+    if (tracking && !b->tracked) {
+        if (num_tracked == tracked_cap) {
+            uint32_t cap = tracked_cap ? 2 * tracked_cap : 64;
+            Buffer **grown = realloc(tracked, cap * sizeof(Buffer *));
+            if (!grown) { // untracked, still written back on flush
+                pthread_mutex_unlock(&track_lock);
+                return;
+            }
+            tracked = grown;
+            tracked_cap = cap;
+        }
+        b->tracked = 1;
+        bpin(b);
+        tracked[num_tracked++] = b;
+    }
+    pthread_mutex_unlock(&track_lock);
+}
+
+// stores the checksum of the buffer's contents in them before they go to the disk or the journal
+void bseal(Buffer *b) {
+    if (!(fs.sb.features & FEATURE_METADATA_CSUM)) return;
+    csum_seal(b->block_num, b->data, b->kind ? b->kind : kind_of(b->block_num));
+}
+
+// forgets a freed block so a stale dirty copy never lands on whatever reuses it,
+// a buffer that is still pinned only stops being dirty (and being metadata)
+void cache_discard(uint32_t block_num) {
+    if (!buffers) return;
+    pthread_rwlock_wrlock(&table_lock);
+    Buffer *b = hash_find(block_num);
+    if (b) {
+        b->dirty = 0;
+        b->kind = CSUM_NONE;
+        if (__atomic_load_n(&b->pins, __ATOMIC_ACQUIRE) == 0) {
+            hash_remove(b);
+            b->valid = 0;
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+}
+
+// block_num was written to the device behind the cache, a copy still held (a freed block pinned
+// by its transaction) takes the new contents so it is neither read nor logged stale
+void cache_update(uint32_t block_num, const void *data) {
+    if (!buffers) return;
+    pthread_rwlock_wrlock(&table_lock);
+    Buffer *b = hash_find(block_num);
+    if (b && b->valid) memcpy(b->data, data, BLOCK_SIZE);
+    pthread_rwlock_unlock(&table_lock);
+}
+
+static int compare_block_num(const void *a, const void *b) {
+    uint32_t x = (*(Buffer * const *)a)->block_num;
+    uint32_t y = (*(Buffer * const *)b)->block_num;
+    return (x > y) - (x < y);
+}
+
+// writes all dirty buffers to disk in block order, returns num written
+int cache_flush() {
+    if (!buffers) return 0;
+
+    Buffer **dirty = malloc(num_buffers * sizeof(Buffer *));
+    if (!dirty) return -1;
+
+    // no claims while buffers are picked and written, callers keep transactions out (tx_freeze)
+    pthread_rwlock_wrlock(&table_lock);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < num_buffers; i++) {
+        // tracked buffers belong to an uncommitted (or unlogged) transaction
+        if (buffers[i].valid && buffers[i].dirty && !buffers[i].tracked) dirty[count++] = &buffers[i];
+    }
+
+    // ascending order turns the write back into one sequential sweep
+    qsort(dirty, count, sizeof(Buffer *), compare_block_num);
+    writeback_all(dirty, count);
+    pthread_rwlock_unlock(&table_lock);
+    free(dirty);
+
+    bdev_flush(fs.dev);
+    return (int)count;
+}
+
+// loads the blocks of the list that aren't cached yet with their reads in flight together, so a
+// walk over them right after only hits. best effort: at most a quarter of the cache, nothing
+// without an async queue (the walk reads them one by one anyway)
+void cache_readahead(const uint32_t *blocks, uint32_t n) {
+    if (!fs.aio || n < 2) return;
+    if (!buffers && cache_init(CACHE_DEFAULT_BUFFERS) == -1) return;
+    if (n > CACHE_READAHEAD_MAX) n = CACHE_READAHEAD_MAX;
+    if (n > num_buffers / 4) n = num_buffers / 4;
+
+    Buffer *loading[CACHE_READAHEAD_MAX];
+    AioRequest reqs[CACHE_READAHEAD_MAX];
+    uint32_t count = 0;
+
+    // like a miss in claim, the buffers fill under the exclusive table lock and nobody sees them half read
+    pthread_rwlock_wrlock(&table_lock);
+    for (uint32_t i = 0; i < n; i++) {
+        if (hash_find(blocks[i])) continue;
+        Buffer *b = pick_victim();
+        if (!b) break;
+
+        b->block_num = blocks[i];
+        b->pins = 1; // the sweep of a later pick must not hand it out while its read is in flight
+        b->dirty = 0;
+        b->kind = CSUM_NONE; // verified by the first bread_as of it
+        b->referenced = 1;
+        uint32_t h = hash_block(blocks[i]);
+        b->hash_next = hash_table[h];
+        hash_table[h] = b;
+        loading[count++] = b;
+    }
+
+    qsort(loading, count, sizeof(Buffer *), compare_block_num);
+    for (uint32_t i = 0; i < count; i++) {
+        reqs[i] = (AioRequest){ .op = AIO_READ, .block = loading[i]->block_num, .count = 1, .buf = loading[i]->data };
+    }
+    aio_submit(fs.aio, reqs, count);
+    aio_wait(fs.aio, reqs, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        // a failed read is left to the next bread, which zero fills past the end of the image
+        if (reqs[i].result == 0) loading[i]->valid = 1;
+        else hash_remove(loading[i]);
+        loading[i]->pins = 0;
+    }
+    __atomic_fetch_add(&stats.misses, count, __ATOMIC_RELAXED);
+    STATS_COUNT(cache_misses, count);
+    __atomic_fetch_add(&stats.readahead, count, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&table_lock);
+}
+
+// copies len bytes at disk offset into buf, may span blocks
+int cache_read(uint64_t offset, void *buf, size_t len) {
+    uint8_t *out = buf;
+    while (len > 0) {
+        uint32_t block_num = offset / BLOCK_SIZE;
+        uint32_t in_block = offset % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - in_block;
+        if (chunk > len) chunk = len;
+
+        Buffer *b = bread(block_num);
+        if (!b) return -1;
+        memcpy(out, b->data + in_block, chunk);
+        brelse(b);
+
+        out += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// copies len bytes from buf to disk offset through the cache, may span blocks
+int cache_write(uint64_t offset, const void *buf, size_t len) {
+    const uint8_t *in = buf;
+    while (len > 0) {
+        uint32_t block_num = offset / BLOCK_SIZE;
+        uint32_t in_block = offset % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - in_block;
+        if (chunk > len) chunk = len;
+
+        // a full block overwrite doesn't need the old contents
+        Buffer *b = chunk == BLOCK_SIZE ? bget(block_num) : bread(block_num);
+        if (!b) return -1;
+        memcpy(b->data + in_block, in, chunk);
+        bdirty(b);
+        brelse(b);
+
+        in += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+void cache_stats(CacheStats *out) {
+    *out = stats;
+}
+
+// from here on every newly dirtied buffer is remembered and kept in memory
+void cache_track_begin() {
+    pthread_mutex_lock(&track_lock);
+    tracking = 1;
+    pthread_mutex_unlock(&track_lock);
+}
+
+// stops tracking and hands out the tracked buffers, still pinned and dirty, returns how many.
+// the list stays valid until the next cache_track_begin, release each with cache_untrack
+uint32_t cache_track_take(Buffer ***out) {
+    pthread_mutex_lock(&track_lock);
+    tracking = 0;
+    *out = tracked;
+    uint32_t n = num_tracked;
+    num_tracked = 0;
+    pthread_mutex_unlock(&track_lock);
+    return n;
+}
+
+// buffers the open transaction keeps pinned so far
+uint32_t cache_tracked() {
+    pthread_mutex_lock(&track_lock);
+    uint32_t n = num_tracked;
+    pthread_mutex_unlock(&track_lock);
+    return n;
+}
+
+// ends tracking of one taken buffer, it stays dirty for the next flush or eviction
+void cache_untrack(Buffer *b) {
+    b->tracked = 0;
+    brelse(b);
+}
+
+uint32_t cache_capacity() {
+    return num_buffers;
+}
+
+// writes each tracked block once in block order and unpins it, returns num written
+int cache_track_commit() {
+    pthread_mutex_lock(&track_lock);
+    tracking = 0;
+    pthread_mutex_unlock(&track_lock);
+    if (num_tracked == 0) return 0;
+
+    qsort(tracked, num_tracked, sizeof(Buffer *), compare_block_num);
+    Buffer **dirty = malloc(num_tracked * sizeof(Buffer *));
+    uint32_t written = 0;
+    for (uint32_t i = 0; i < num_tracked; i++) {
+        Buffer *b = tracked[i];
+        if (!b->dirty) continue;
+        if (dirty) dirty[written] = b;
+        else writeback(b);
+        written++;
+    }
+    if (dirty) writeback_all(dirty, written);
+    free(dirty);
+
+    for (uint32_t i = 0; i < num_tracked; i++) {
+        tracked[i]->tracked = 0;
+        brelse(tracked[i]);
+    }
+    num_tracked = 0;
+
+    bdev_flush(fs.dev);
+    return (int)written;
+}
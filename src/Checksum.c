@@ -0,0 +1,176 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Checksum.h"
+#include "../include/FileSystemStructure.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u     // Castagnoli, bit reflected
+#define CRC32C_LANE 256             // bytes per stream when three run side by side
+
+static uint32_t table[8][256];      // slice-by-8
+static uint32_t (*update)(uint32_t crc, const uint8_t *p, size_t len);
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+// crc is the raw register (no pre or post inversion) in both update paths
+static uint32_t update_portable(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = table[7][word & 0xFF] ^ table[6][(word >> 8) & 0xFF] ^ table[5][(word >> 16) & 0xFF] ^
+              table[4][(word >> 24) & 0xFF] ^ table[3][(word >> 32) & 0xFF] ^ table[2][(word >> 40) & 0xFF] ^
+              table[1][(word >> 48) & 0xFF] ^ table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+// x^(8 * CRC32C_LANE * n - 33) mod P for n = 1, 2: a carry-less multiply by one of them and a
+// crc32 of the 64 bit product moves a register n lanes further along
+#define SHIFT_1_LANE 0xB9E02B86u
+#define SHIFT_2_LANES 0xDD7E3B0Cu
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t shift(uint32_t crc, uint32_t k) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi32_si128((int)k), 0);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+// three independent crc32 streams hide the instruction's latency, their registers are
+// merged by shifting the first two over the lanes that follow them
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t update_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c0 = crc;
+    while (len && ((uintptr_t)p & 7)) {
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+        len--;
+    }
+    while (len >= 3 * CRC32C_LANE) {
+        uint64_t c1 = 0, c2 = 0;
+        for (size_t i = 0; i < CRC32C_LANE; i += 8) {
+            uint64_t a, b, c;
+            memcpy(&a, p + i, 8);
+            memcpy(&b, p + CRC32C_LANE + i, 8);
+            memcpy(&c, p + 2 * CRC32C_LANE + i, 8);
+            c0 = _mm_crc32_u64(c0, a);
+            c1 = _mm_crc32_u64(c1, b);
+            c2 = _mm_crc32_u64(c2, c);
+        }
+        c0 = shift((uint32_t)c0, SHIFT_2_LANES) ^ shift((uint32_t)c1, SHIFT_1_LANE) ^ c2;
+        p += 3 * CRC32C_LANE;
+        len -= 3 * CRC32C_LANE;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c0 = _mm_crc32_u64(c0, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+    return (uint32_t)c0;
+}
+#endif
+
+static void init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int s = 1; s < 8; s++) table[s][i] = table[0][table[s - 1][i] & 0xFF] ^ (table[s - 1][i] >> 8);
+    }
+
+    update = update_portable;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) update = update_sse42;
+#endif
+}
+
+// CRC32C of data continuing from crc (0 to start), the instruction set's when the CPU has it
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&once, init);
+    return ~update(~crc, data, len);
+}
+
+// same result from the tables alone, for checking and measuring the fast path
+uint32_t crc32c_portable(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&once, init);
+    return ~update_portable(~crc, data, len);
+}
+
+int crc32c_accelerated() {
+    pthread_once(&once, init);
+    return update != update_portable;
+}
+
+// bitmap bytes followed by pad zero bytes as stored in their block, cut to the 16 bits the
+// group descriptor has room for (like ext4's 32 byte descriptors)
+uint16_t csum_bitmap(const void *bytes, uint32_t len, uint32_t pad) {
+    static const uint8_t zero[BLOCK_SIZE];
+    uint32_t crc = crc32c(0, bytes, len);
+    while (pad > 0) {
+        uint32_t n = pad < BLOCK_SIZE ? pad : BLOCK_SIZE;
+        crc = crc32c(crc, zero, n);
+        pad -= n;
+    }
+    return (uint16_t)crc;
+}
+
+// bytes of a block the checksum covers, the checksum itself sits right after them
+static size_t covered(int kind) {
+    return kind == CSUM_SUPER ? offsetof(Superblock, checksum) : BLOCK_SIZE - CSUM_TAIL;
+}
+
+// the block number goes in first, so a block written to the wrong place doesn't check out
+static uint32_t block_crc(uint32_t block_num, const uint8_t *block, int kind) {
+    return crc32c(crc32c(0, &block_num, sizeof(block_num)), block, covered(kind));
+}
+
+void csum_seal(uint32_t block_num, uint8_t *block, int kind) {
+    if (kind == CSUM_NONE) return;
+    uint32_t crc = block_crc(block_num, block, kind);
+    memcpy(block + covered(kind), &crc, sizeof(crc));
+}
+
+// inode table block past its group's itable_zeroed, a lazy format never wrote it
+static int unwritten_table(uint32_t block_num) {
+    if (!fs.groups || !(fs.sb.features & FEATURE_LAZY_ITABLE)) return 0;
+    uint32_t g = group_of_block(block_num);
+    if (g >= fs.sb.groups_count) return 0;
+    uint32_t table = fs.groups[g].inode_table;
+    return block_num >= table && block_num - table < fs.sb.inode_table_blocks &&
+           block_num - table >= fs.groups[g].itable_zeroed;
+}
+
+// 1 when the block holds the checksum of its contents, an unwritten inode table block may
+// still be all zero instead
+int csum_verify(uint32_t block_num, const uint8_t *block, int kind) {
+    if (kind == CSUM_NONE) return 1;
+    uint32_t stored;
+    memcpy(&stored, block + covered(kind), sizeof(stored));
+    if (stored == block_crc(block_num, block, kind)) return 1;
+    if (stored != 0 || kind != CSUM_ITABLE || !unwritten_table(block_num)) return 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        if (block[i]) return 0;
+    }
+    return 1;
+}
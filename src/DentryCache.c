@@ -0,0 +1,219 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/DentryCache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEQ_STRIPES 64  // change counters, a directory maps to one by its inode number
+
+static Dentry *entries = NULL;      // fixed pool, the whole memory budget
+static uint32_t num_entries = 0;
+static Dentry **hash_table = NULL;  // (parent, name) -> entry chains
+static uint32_t hash_mask = 0;
+static uint32_t clock_hand = 0;     // next eviction candidate
+static DCacheStats stats;
+
+// hits share the table (referenced bits and stats are atomic), inserts and invalidations own it
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// bumped by every add or invalidation under a directory, a miss only remembers what it found
+// if its stripe didn't move while it was scanning the directory
+static uint32_t seqs[SEQ_STRIPES];
+
+static uint32_t *seq_of(uint32_t parent) {
+    return &seqs[parent % SEQ_STRIPES];
+}
+
+// FNV-1a over the parent inode number and the name
+static uint32_t hash_name(uint32_t parent, const char *name) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 4; i++) {
+        h ^= (parent >> (8 * i)) & 0xFF;
+        h *= 16777619u;
+    }
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// long names are rare, they bypass the cache instead of sizing every entry for them
+static int cacheable(const char *name) {
+    return strlen(name) < DCACHE_NAME_MAX;
+}
+
+static void hash_remove(Dentry *d) {
+    Dentry **link = &hash_table[d->hash & hash_mask];
+    while (*link) {
+        if (*link == d) {
+            *link = d->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    d->hash_next = NULL;
+}
+
+static Dentry *hash_find(uint32_t parent, const char *name, uint32_t hash) {
+    for (Dentry *d = hash_table[hash & hash_mask]; d; d = d->hash_next) {
+        if (d->hash == hash && d->parent == parent && strcmp(d->name, name) == 0) return d;
+    }
+    return NULL;
+}
+
+// CLOCK over the pool, same policy as the buffer and inode caches
+static Dentry *pick_victim() {
+    for (uint32_t scanned = 0; scanned < 2 * num_entries; scanned++) {
+        Dentry *d = &entries[clock_hand];
+        clock_hand = (clock_hand + 1) % num_entries;
+
+        if (!d->valid) return d;
+        if (d->referenced) {
+            d->referenced = 0;
+            continue;
+        }
+
+        hash_remove(d);
+        d->valid = 0;
+        __atomic_fetch_add(&stats.evictions, 1, __ATOMIC_RELAXED);
+        return d;
+    }
+    return NULL;
+}
+
+// sets up a pool of num_entries dentries, drops whatever was cached before
+int dcache_init(uint32_t n) {
+    pthread_rwlock_wrlock(&table_lock);
+    free(entries);
+    free(hash_table);
+
+    if (n == 0) n = DCACHE_DEFAULT_ENTRIES;
+
+    uint32_t buckets = 1;
+    while (buckets < 2 * n) buckets <<= 1;
+
+    entries = calloc(n, sizeof(Dentry));
+    hash_table = calloc(buckets, sizeof(Dentry *));
+    if (!entries || !hash_table) {
+        free(entries);
+        free(hash_table);
+        entries = NULL;
+        hash_table = NULL;
+        num_entries = 0;
+        pthread_rwlock_unlock(&table_lock);
+        return -1;
+    }
+
+    num_entries = n;
+    hash_mask = buckets - 1;
+    clock_hand = 0;
+    memset(&stats, 0, sizeof(stats));
+    pthread_rwlock_unlock(&table_lock);
+    return 0;
+}
+
+void dcache_destroy() {
+    pthread_rwlock_wrlock(&table_lock);
+    free(entries);
+    free(hash_table);
+    entries = NULL;
+    hash_table = NULL;
+    num_entries = 0;
+    pthread_rwlock_unlock(&table_lock);
+}
+
+// remembers parent/name -> inum (DCACHE_NEGATIVE for absent), replacing what was cached,
+// table held exclusively
+static void remember(uint32_t parent, const char *name, long inum, uint16_t type) {
+    uint32_t hash = hash_name(parent, name);
+    Dentry *d = hash_find(parent, name, hash);
+    if (!d) {
+        d = pick_victim();
+        if (!d) return;
+        d->parent = parent;
+        d->hash = hash;
+        strcpy(d->name, name);
+        d->hash_next = hash_table[hash & hash_mask];
+        hash_table[hash & hash_mask] = d;
+        d->valid = 1;
+    }
+    d->inum = inum;
+    d->type = type;
+    d->referenced = 1;
+}
+
+// inum of name in parent (type gets IDIR or IREG) or -1, a cached answer, positive or negative,
+// costs no block or inode access
+long dcache_lookup(uint32_t parent, const char *name, uint16_t *type) {
+    pthread_rwlock_rdlock(&table_lock);
+    Dentry *d = entries && cacheable(name) ? hash_find(parent, name, hash_name(parent, name)) : NULL;
+    if (d) {
+        __atomic_store_n(&d->referenced, 1, __ATOMIC_RELAXED);
+        long inum = d->inum;
+        uint16_t found = d->type;
+        pthread_rwlock_unlock(&table_lock);
+        if (inum == DCACHE_NEGATIVE) {
+            __atomic_fetch_add(&stats.negative_hits, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        __atomic_fetch_add(&stats.hits, 1, __ATOMIC_RELAXED);
+        if (type) *type = found;
+        return inum;
+    }
+    pthread_rwlock_unlock(&table_lock);
+
+    __atomic_fetch_add(&stats.misses, 1, __ATOMIC_RELAXED);
+    uint32_t seq = __atomic_load_n(seq_of(parent), __ATOMIC_ACQUIRE);
+    long inum = dir_lookup(parent, name);
+    uint16_t found = 0;
+    if (inum != -1) found = is_dir((uint32_t)inum) ? IDIR : IREG;
+
+    if (!cacheable(name) || (!entries && dcache_init(DCACHE_DEFAULT_ENTRIES) == -1)) {
+        if (type) *type = found;
+        return inum;
+    }
+    pthread_rwlock_wrlock(&table_lock);
+    // an add or invalidation that raced the scan may have made the answer stale already
+    if (__atomic_load_n(seq_of(parent), __ATOMIC_ACQUIRE) == seq) {
+        remember(parent, name, inum == -1 ? DCACHE_NEGATIVE : inum, found);
+    }
+    pthread_rwlock_unlock(&table_lock);
+
+    if (type) *type = found;
+    return inum;
+}
+
+// bumps parent's stripe and drops what is cached for name, returns 1 if there was an entry
+static int forget(uint32_t parent, const char *name) {
+    pthread_rwlock_wrlock(&table_lock);
+    __atomic_fetch_add(seq_of(parent), 1, __ATOMIC_RELEASE);
+    Dentry *d = entries ? hash_find(parent, name, hash_name(parent, name)) : NULL;
+    if (d) {
+        hash_remove(d);
+        d->valid = 0;
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return d != NULL;
+}
+
+// name was just linked into parent, drops a negative entry for it. the new entry isn't cached
+// here: called with the dir unlocked, an unlink may have removed the name again already, the
+// next lookup fills the cache through the seq checked miss instead
+void dcache_add(uint32_t parent, const char *name) {
+    if (cacheable(name)) forget(parent, name);
+}
+
+// name left parent (or is about to point elsewhere), the next lookup goes to the directory.
+// call it after the directory changed, so a lookup racing the change can't cache the old answer
+void dcache_invalidate(uint32_t parent, const char *name) {
+    if (cacheable(name) && forget(parent, name)) __atomic_fetch_add(&stats.invalidations, 1, __ATOMIC_RELAXED);
+}
+
+void dcache_stats(DCacheStats *out) {
+    *out = stats;
+}
@@ -0,0 +1,474 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/DirIndex.h"
+#include "../include/FileManagement.h"
+#include "../include/Cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t hash;
+    const DirRecord *rec;   // into a copy of the blocks being rebuilt
+} HashedRecord;
+
+static uint32_t hash_bytes(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// FNV-1a, good enough spread for names and cheap to compute
+uint32_t dx_hash(const char *name) {
+    return hash_bytes(name, strlen(name));
+}
+
+// index of the root entry whose hash range holds hash
+static uint32_t find_leaf(const DxRoot *root, uint32_t hash) {
+    uint32_t lo = 0, hi = root->count; // entries[0].hash is always 0
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (root->entries[mid].hash <= hash) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int compare_hash(const void *a, const void *b) {
+    uint32_t x = ((const HashedRecord *)a)->hash;
+    uint32_t y = ((const HashedRecord *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+// appends the used records of area to out, returns how many
+static uint32_t collect(const uint8_t *area, uint32_t len, HashedRecord *out) {
+    uint32_t n = 0;
+    for (const DirRecord *r = dirent_first(area, len); r; r = dirent_next(area, len, r)) {
+        out[n].hash = hash_bytes(r->name, r->name_len);
+        out[n].rec = r;
+        n++;
+    }
+    return n;
+}
+
+// rewrites area with the given records, returns 0 or -1 if they don't fit
+static int fill(uint8_t *area, const HashedRecord *recs, uint32_t n) {
+    DirEntry entry;
+    dirent_init(area, DIR_AREA);
+    for (uint32_t i = 0; i < n; i++) {
+        dirent_get(recs[i].rec, &entry);
+        if (dirent_insert(area, DIR_AREA, &entry) == -1) return -1;
+    }
+    return 0;
+}
+
+// root block + one leaf block, whatever the directory size
+long dx_lookup(const Inode *dir, const char *name) {
+    uint32_t hash = dx_hash(name);
+
+    Buffer *rb = bread_as(dir->direct[0], CSUM_DIR);
+    if (!rb) return -1;
+    const DxRoot *root = (const DxRoot *)rb->data;
+    uint32_t leaf = root->entries[find_leaf(root, hash)].block;
+    brelse(rb);
+
+    Buffer *lb = bread_as(leaf, CSUM_DIR);
+    if (!lb) return -1;
+    long inum = dirent_find(lb->data, DIR_AREA, name, NULL);
+    brelse(lb);
+    return inum;
+}
+
+// moves the upper hash half of a full leaf into a new block, returns 0 or -1
+static int split_leaf(InodeHandle *dir, DxRoot *root, uint32_t slot) {
+    if (root->count == DX_MAX_LEAVES) return -1; // index is full
+
+    Buffer *lb = bread_as(root->entries[slot].block, CSUM_DIR);
+    if (!lb) return -1;
+
+    uint8_t copy[BLOCK_SIZE];
+    memcpy(copy, lb->data, BLOCK_SIZE);
+    HashedRecord sorted[DIR_BLOCK_ENTRIES];
+    uint32_t n = collect(copy, DIR_AREA, sorted);
+    qsort(sorted, n, sizeof(HashedRecord), compare_hash);
+
+    // half the bytes each, split on a hash boundary so equal hashes always share a leaf
+    uint32_t total = 0, bytes = 0, mid = 0;
+    for (uint32_t i = 0; i < n; i++) total += DIRENT_LEN(sorted[i].rec->name_len);
+    while (mid < n && bytes < total / 2) bytes += DIRENT_LEN(sorted[mid++].rec->name_len);
+    if (mid == 0) mid = 1;
+    uint32_t half = mid;
+    while (mid < n && sorted[mid].hash == sorted[mid - 1].hash) mid++;
+    if (mid == n) {
+        mid = half;
+        while (mid > 0 && sorted[mid].hash == sorted[mid - 1].hash) mid--;
+    }
+    if (mid == 0 || mid == n) {
+        brelse(lb);
+        return -1; // whole leaf is one hash, can't split
+    }
+
+    int nb = alloc_block_near(root->entries[slot].block); // next to the leaf it splits
+    if (nb == -1) {
+        brelse(lb);
+        return -1;
+    }
+
+    Buffer *nbuf = bget_as(nb, CSUM_DIR);
+    if (!nbuf) {
+        free_block(nb);
+        brelse(lb);
+        return -1;
+    }
+
+    fill(lb->data, sorted, mid); // each half held before, together
+    fill(nbuf->data, sorted + mid, n - mid);
+    bdirty(lb);
+    bdirty(nbuf);
+    brelse(lb);
+    brelse(nbuf);
+
+    // new leaf goes right after the one it was split from
+    memmove(&root->entries[slot + 2], &root->entries[slot + 1],
+            (root->count - slot - 1) * sizeof(DxEntry));
+    root->entries[slot + 1].hash = sorted[mid].hash;
+    root->entries[slot + 1].block = (uint32_t)nb;
+    root->count++;
+
+    dir->inode.size += BLOCK_SIZE;
+    idirty(dir);
+    return 0;
+}
+
+// inserts entry into the leaf its hash maps to, returns entry disk address or -1
+long dx_add(InodeHandle *dir, const DirEntry *entry) {
+    uint32_t hash = dx_hash(entry->name);
+
+    Buffer *rb = bread_as(dir->inode.direct[0], CSUM_DIR);
+    if (!rb) return -1;
+    DxRoot *root = (DxRoot *)rb->data;
+
+    long address = -1;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        uint32_t slot = find_leaf(root, hash);
+        uint32_t leaf = root->entries[slot].block;
+
+        Buffer *lb = bread_as(leaf, CSUM_DIR);
+        if (!lb) break;
+
+        long off = dirent_insert(lb->data, DIR_AREA, entry);
+        if (off != -1) {
+            address = (long)leaf * BLOCK_SIZE + off;
+            bdirty(lb);
+            brelse(lb);
+            break;
+        }
+        brelse(lb);
+
+        // leaf full, split once and retry
+        if (split_leaf(dir, root, slot) == -1) break;
+        bdirty(rb);
+    }
+
+    brelse(rb);
+    return address;
+}
+
+// bytes the records of a leaf take
+static uint32_t used_bytes(const uint8_t *area) {
+    uint32_t bytes = 0;
+    for (const DirRecord *r = dirent_first(area, DIR_AREA); r; r = dirent_next(area, DIR_AREA, r)) {
+        bytes += DIRENT_LEN(r->name_len);
+    }
+    return bytes;
+}
+
+// folds the leaf at slot and a neighbour into one block once either is empty or both fit in
+// half of it, splitting at full and merging at half keeps churn from bouncing between the two,
+// returns 1 if the root changed, else 0
+static int merge_leaves(InodeHandle *dir, DxRoot *root, uint32_t slot) {
+    if (root->count < 2) return 0;
+    uint32_t lo = slot + 1 < root->count ? slot : slot - 1; // the upper one of lo, lo + 1 goes
+
+    Buffer *lb = bread_as(root->entries[lo].block, CSUM_DIR);
+    if (!lb) return 0;
+    Buffer *ub = bread_as(root->entries[lo + 1].block, CSUM_DIR);
+    if (!ub) {
+        brelse(lb);
+        return 0;
+    }
+
+    uint32_t lower = used_bytes(lb->data), upper = used_bytes(ub->data);
+    if (lower && upper && lower + upper > BLOCK_SIZE / 2) {
+        brelse(lb);
+        brelse(ub);
+        return 0;
+    }
+
+    // both leaves together never take more than a block, packed afresh they fit
+    uint8_t *copy = malloc(2 * BLOCK_SIZE);
+    HashedRecord *recs = malloc(2 * DIR_BLOCK_ENTRIES * sizeof(HashedRecord));
+    int merged = copy && recs;
+    if (merged) {
+        memcpy(copy, lb->data, BLOCK_SIZE);
+        memcpy(copy + BLOCK_SIZE, ub->data, BLOCK_SIZE);
+        uint32_t n = collect(copy, DIR_AREA, recs);
+        n += collect(copy + BLOCK_SIZE, DIR_AREA, recs + n);
+        merged = fill(lb->data, recs, n) == 0;
+        if (merged) bdirty(lb);
+        else memcpy(lb->data, copy, BLOCK_SIZE);
+    }
+    free(recs);
+    free(copy);
+    uint32_t freed = root->entries[lo + 1].block;
+    brelse(lb);
+    brelse(ub);
+    if (!merged) return 0;
+
+    // lo takes over the hash range of the leaf that went
+    memmove(&root->entries[lo + 1], &root->entries[lo + 2], (root->count - lo - 2) * sizeof(DxEntry));
+    root->count--;
+    free_block(freed);
+
+    dir->inode.size -= BLOCK_SIZE;
+    idirty(dir);
+    return 1;
+}
+
+// unlinks name from the leaf its hash maps to, out gets the removed entry,
+// returns its inode num or -1
+long dx_remove(InodeHandle *dir, const char *name, DirEntry *out) {
+    uint32_t hash = dx_hash(name);
+
+    Buffer *rb = bread_as(dir->inode.direct[0], CSUM_DIR);
+    if (!rb) return -1;
+    DxRoot *root = (DxRoot *)rb->data;
+    uint32_t slot = find_leaf(root, hash);
+
+    Buffer *lb = bread_as(root->entries[slot].block, CSUM_DIR);
+    if (!lb) {
+        brelse(rb);
+        return -1;
+    }
+    long off = dirent_remove(lb->data, DIR_AREA, name, out);
+    if (off != -1) bdirty(lb);
+    brelse(lb);
+
+    if (off != -1 && merge_leaves(dir, root, slot)) bdirty(rb);
+    brelse(rb);
+    return off == -1 ? -1 : (long)out->inode_num;
+}
+
+// frees the root and every leaf of an index, the dir's pointers are the caller's to reset
+void dx_release(const Inode *dir) {
+    Buffer *rb = bread_as(dir->direct[0], CSUM_DIR);
+    if (rb) {
+        const DxRoot *root = (const DxRoot *)rb->data;
+        for (uint32_t l = 0; l < root->count && l < DX_MAX_LEAVES; l++) free_block(root->entries[l].block);
+        brelse(rb);
+    }
+    free_block(dir->direct[0]);
+}
+
+// cuts hash sorted records into leaves of at least fill bytes, a hash run is never cut (an empty
+// dir still gets its one leaf), starts gets each leaf's first record and n after the last,
+// returns the leaf count or 0 if a hash run overflows a leaf or the root can't hold them all
+static uint32_t plan_leaves(const HashedRecord *all, uint32_t n, uint32_t fill, uint32_t *starts) {
+    uint32_t num_leaves = 0, next = 0;
+    do {
+        if (num_leaves == DX_MAX_LEAVES) return 0;
+        starts[num_leaves++] = next;
+        uint32_t bytes = 0;
+        while (next < n && bytes < fill) bytes += DIRENT_LEN(all[next++].rec->name_len);
+        while (next < n && next > 0 && all[next].hash == all[next - 1].hash) {
+            bytes += DIRENT_LEN(all[next++].rec->name_len);
+            if (bytes > DIR_AREA) return 0; // one hash run can't fill a whole leaf
+        }
+    } while (next < n);
+    starts[num_leaves] = n;
+    return num_leaves;
+}
+
+// rebuilds a full linear dir as index root + half full leaves, returns 0 or -1
+int dx_convert(InodeHandle *dir) {
+    Inode *inode = &dir->inode;
+
+    // copy the linear blocks, they get reused as leaves below
+    uint32_t old_blocks[DIRECT_PTRS];
+    uint32_t num_old = 0;
+    uint8_t *copy = malloc(DIRECT_PTRS * BLOCK_SIZE);
+    HashedRecord *all = malloc(DIRECT_PTRS * DIR_BLOCK_ENTRIES * sizeof(HashedRecord));
+    uint32_t *starts = malloc((DIRECT_PTRS * DIR_BLOCK_ENTRIES + 2) * sizeof(uint32_t));
+    uint32_t *blocks = NULL;
+    uint32_t n = 0;
+    int rc = -1;
+    if (!copy || !all || !starts) goto out;
+
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        if (inode->direct[i] == 0) continue;
+        Buffer *b = bread_as(inode->direct[i], CSUM_DIR);
+        if (!b) goto out;
+        memcpy(copy + num_old * BLOCK_SIZE, b->data, BLOCK_SIZE);
+        brelse(b);
+        n += collect(copy + num_old * BLOCK_SIZE, DIR_AREA, all + n);
+        old_blocks[num_old++] = inode->direct[i];
+    }
+    qsort(all, n, sizeof(HashedRecord), compare_hash);
+
+    // leaves start half full so the next inserts don't split right away
+    uint32_t num_leaves = plan_leaves(all, n, BLOCK_SIZE / 2, starts);
+    if (num_leaves == 0) goto out;
+
+    // old blocks are reused, everything else is allocated before touching the dir
+    uint32_t num_new = num_leaves + 1 > num_old ? num_leaves + 1 - num_old : 0;
+    blocks = malloc((num_old + num_new) * sizeof(uint32_t));
+    if (!blocks) goto out;
+    memcpy(blocks, old_blocks, num_old * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_new; i++) {
+        // keep the index next to the old blocks
+        int b = alloc_block_near(num_old + i > 0 ? blocks[num_old + i - 1] : 0);
+        if (b == -1) {
+            for (uint32_t k = 0; k < i; k++) free_block(blocks[num_old + k]);
+            goto out;
+        }
+        blocks[num_old + i] = (uint32_t)b;
+    }
+
+    uint32_t root_block = blocks[0];
+    Buffer *rb = bget_as(root_block, CSUM_DIR);
+    if (!rb) {
+        for (uint32_t i = 0; i < num_new; i++) free_block(blocks[num_old + i]);
+        goto out;
+    }
+    DxRoot *root = (DxRoot *)rb->data;
+    memset(root, 0, BLOCK_SIZE);
+    root->magic = DX_MAGIC;
+
+    for (uint32_t l = 0; l < num_leaves; l++) {
+        uint32_t leaf = blocks[l + 1];
+        Buffer *lb = bget_as(leaf, CSUM_DIR);
+        if (!lb) break;
+        fill(lb->data, all + starts[l], starts[l + 1] - starts[l]);
+        bdirty(lb);
+        brelse(lb);
+
+        root->entries[root->count].hash = l == 0 ? 0 : all[starts[l]].hash;
+        root->entries[root->count].block = leaf;
+        root->count++;
+    }
+    uint32_t num_used = root->count;
+    bdirty(rb);
+    brelse(rb);
+
+    // blocks that didn't become part of the index
+    for (uint32_t i = num_used + 1; i < num_old + num_new; i++) free_block(blocks[i]);
+
+    memset(inode->direct, 0, sizeof(inode->direct));
+    inode->direct[0] = root_block;
+    inode->flags |= INODE_INDEX;
+    inode->size = (uint64_t)(1 + num_used) * BLOCK_SIZE;
+    idirty(dir);
+    rc = 0;
+
+out:
+    free(blocks);
+    free(starts);
+    free(all);
+    free(copy);
+    return rc;
+}
+
+// builds the index of a dir left without blocks out of len bytes of records laid back to back,
+// leaves DX_BUILD_FILL full, root and leaves put together in memory and written with one device
+// write per contiguous run, before the transaction maps them. h is locked inside a transaction,
+// returns 0 or -1
+int dx_build(InodeHandle *dir, const uint8_t *records, uint32_t len) {
+    HashedRecord *all = malloc(((size_t)len / DIRENT_LEN(1) + 1) * sizeof(HashedRecord));
+    uint32_t *starts = malloc((DX_MAX_LEAVES + 1) * sizeof(uint32_t));
+    uint32_t *blocks = malloc((DX_MAX_LEAVES + 1) * sizeof(uint32_t));
+    uint8_t *image = NULL;
+    uint32_t num_blocks = 0; // allocated so far
+    int rc = -1;
+    if (!all || !starts || !blocks) goto out;
+
+    uint32_t n = collect(records, len, all);
+    qsort(all, n, sizeof(HashedRecord), compare_hash);
+    uint32_t num_leaves = plan_leaves(all, n, DX_BUILD_FILL, starts);
+    if (num_leaves == 0) goto out;
+    uint32_t total = num_leaves + 1;
+
+    // as few runs as the free space allows, the root entries need every leaf's block
+    uint32_t goal = group_data_start(group_of_inode(dir->inum));
+    while (num_blocks < total) {
+        uint32_t got;
+        long first = alloc_block_extent(goal, total - num_blocks, &got);
+        if (first == -1) goto out;
+        for (uint32_t i = 0; i < got; i++) blocks[num_blocks++] = (uint32_t)first + i;
+        goal = (uint32_t)first + got;
+    }
+
+    if (posix_memalign((void **)&image, BDEV_ALIGN, (size_t)total * BLOCK_SIZE) != 0) {
+        image = NULL;
+        goto out;
+    }
+    DxRoot *root = (DxRoot *)image;
+    memset(root, 0, BLOCK_SIZE);
+    root->magic = DX_MAGIC;
+    for (uint32_t l = 0; l < num_leaves; l++) {
+        fill(image + (size_t)(l + 1) * BLOCK_SIZE, all + starts[l], starts[l + 1] - starts[l]);
+        root->entries[l].hash = l == 0 ? 0 : all[starts[l]].hash;
+        root->entries[l].block = blocks[l + 1];
+    }
+    root->count = num_leaves;
+    if (fs.sb.features & FEATURE_METADATA_CSUM) { // past the cache, sealed here
+        for (uint32_t i = 0; i < total; i++) csum_seal(blocks[i], image + (size_t)i * BLOCK_SIZE, CSUM_DIR);
+    }
+
+    for (uint32_t i = 0; i < total;) {
+        uint32_t j = i + 1;
+        while (j < total && blocks[j] == blocks[j - 1] + 1) j++;
+        if (bdev_write(fs.dev, blocks[i], j - i, image + (size_t)i * BLOCK_SIZE) == -1) goto out;
+        i = j;
+    }
+    for (uint32_t i = 0; i < total; i++) cache_update(blocks[i], image + (size_t)i * BLOCK_SIZE);
+
+    Inode *inode = &dir->inode;
+    memset(inode->direct, 0, sizeof(inode->direct));
+    inode->direct[0] = blocks[0];
+    inode->flags |= INODE_INDEX;
+    inode->size = (uint64_t)total * BLOCK_SIZE;
+    idirty(dir);
+    rc = 0;
+
+out:
+    if (rc == -1) {
+        for (uint32_t i = 0; i < num_blocks; i++) free_block(blocks[i]);
+    }
+    free(image);
+    free(blocks);
+    free(starts);
+    free(all);
+    return rc;
+}
+
+// calls visit for every entry in leaf order, stops early if visit returns non zero
+int dx_iterate(const Inode *dir, dir_visit_fn visit, void *arg) {
+    Buffer *rb = bread_as(dir->direct[0], CSUM_DIR);
+    if (!rb) return -1;
+    DxRoot root = *(const DxRoot *)rb->data;
+    brelse(rb);
+
+    for (uint32_t l = 0; l < root.count; l++) {
+        Buffer *lb = bread_as(root.entries[l].block, CSUM_DIR);
+        if (!lb) return -1;
+        int stopped = dirent_walk(lb->data, DIR_AREA, visit, arg);
+        brelse(lb);
+        if (stopped) return 1;
+    }
+    return 0;
+}
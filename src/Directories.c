@@ -4,222 +4,933 @@
 
 #include "../include/Directories.h"
 #include "../include/FileManagement.h"
-
+#include "../include/Cache.h"
+#include "../include/DirIndex.h"
+#include "../include/Transaction.h"
+#include "../include/DentryCache.h"
+#include "../include/Stats.h"
+
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
-long dir_lookup(uint32_t dir_num, const char *entry_name) {
-    // read dir's inode to cache
-    Inode dir;
-    read_inode(dir_num, &dir);
+#define INLINE_DOT 0x1
+#define INLINE_DOTDOT 0x2
+#define INLINE_RECORDS (INLINE_DATA_MAX - 2 * sizeof(uint32_t))
+
+// an INODE_INLINE dir's pointer area, "." and ".." take no record of their own
+typedef struct {
+    uint32_t parent;                    // inum of "..", once INLINE_DOTDOT is set
+    uint32_t dots;                      // which of "." and ".." were added
+    uint8_t records[INLINE_RECORDS];    // laid out like a dir block
+} InlineDir;
+
+// ---------- records ----------
+
+// first used record at or after off, NULL at the end of the area (or where the chain breaks)
+static const DirRecord *used_from(const uint8_t *area, uint32_t len, uint32_t off) {
+    while (off + DIRENT_HEADER <= len) {
+        const DirRecord *r = (const DirRecord *)(area + off);
+        if (r->rec_len < DIRENT_HEADER || r->rec_len % 4 || off + r->rec_len > len) return NULL;
+        if (r->name_len) return r->rec_len >= DIRENT_LEN(r->name_len) ? r : NULL;
+        off += r->rec_len;
+    }
+    return NULL;
+}
 
-    // loop through each block the inode points to
-    for (uint32_t i = 0; i < DIRECT_PTRS; i++) {
-        uint32_t block_num = dir.direct[i];
+const DirRecord *dirent_first(const uint8_t *area, uint32_t len) {
+    return used_from(area, len, 0);
+}
 
-        // loop through block DirEntries
-        if (block_num != 0) {
-            for (uint32_t j = 0; j < BLOCK_SIZE/sizeof(DirEntry); j++) {
+const DirRecord *dirent_next(const uint8_t *area, uint32_t len, const DirRecord *r) {
+    return used_from(area, len, (uint32_t)((const uint8_t *)r - area) + r->rec_len);
+}
 
-                // read dir entry
-                DirEntry entry;
-                uint32_t offset = block_num * BLOCK_SIZE + sizeof(uint32_t) + j * sizeof(DirEntry);
-                read_dir_entry(offset, &entry);
+// an empty area is one free record spanning all of it
+void dirent_init(uint8_t *area, uint32_t len) {
+    memset(area, 0, len);
+    ((DirRecord *)area)->rec_len = (uint16_t)len;
+}
+
+void dirent_get(const DirRecord *r, DirEntry *entry) {
+    entry->inode_num = r->inode_num;
+    entry->type = (uint16_t)(r->type << 12);
+    entry->name_len = r->name_len;
+    entry->_pad = 0;
+    memcpy(entry->name, r->name, r->name_len);
+    entry->name[r->name_len] = '\0';
+}
 
-                // check if entry exists
-                if (entry.used == FREE) return -1; // end of dir entry array
+// fills the record at record with entry, keeping its rec_len
+void dirent_put(uint8_t *record, const DirEntry *entry) {
+    DirRecord *r = (DirRecord *)record;
+    r->inode_num = entry->inode_num;
+    r->name_len = entry->name_len;
+    r->type = (uint8_t)(entry->type >> 12);
+    memcpy(r->name, entry->name, entry->name_len);
+}
 
-                // check if matches key
-                if (strcmp(entry.name, entry_name) == 0) {
-                    return entry.inode_num; // if yes, entry found
-                }
+// claims a record for a name of name_len bytes out of the first slack big enough, it counts
+// as used from here on, dirent_put fills it in, returns its offset in area or -1 if there's no room
+long dirent_reserve(uint8_t *area, uint32_t len, uint32_t name_len) {
+    uint32_t need = DIRENT_LEN(name_len);
+    for (uint32_t off = 0; off + DIRENT_HEADER <= len;) {
+        DirRecord *r = (DirRecord *)(area + off);
+        if (r->rec_len < DIRENT_HEADER || r->rec_len % 4 || off + r->rec_len > len) return -1;
+
+        uint32_t used = r->name_len ? DIRENT_LEN(r->name_len) : 0;
+        if (r->rec_len - used >= need) {
+            if (used) { // split the slack off
+                DirRecord *n = (DirRecord *)(area + off + used);
+                n->rec_len = (uint16_t)(r->rec_len - used);
+                r->rec_len = (uint16_t)used;
+                off += used;
+                r = n;
             }
+            r->inode_num = 0;
+            r->name_len = (uint8_t)name_len;
+            r->type = 0;
+            return off;
         }
+        off += r->rec_len;
     }
-    return -1; // no entry found
+    return -1;
 }
 
-// adds entry to dir
-long dir_add(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type) {
+// stores entry in area, returns its offset or -1 if it doesn't fit
+long dirent_insert(uint8_t *area, uint32_t len, const DirEntry *entry) {
+    long off = dirent_reserve(area, len, entry->name_len);
+    if (off != -1) dirent_put(area + off, entry);
+    return off;
+}
 
-    if (dir_lookup(dir_inum, name) != -1) return -1; // entry with this name already exists
+// inum of name in area or -1, out gets the whole entry when not NULL
+// one pass over the area, name_len and the first and last four name bytes (a word compare each)
+// rule out nearly every other record before memcmp runs, names of up to 8 bytes need no more
+long dirent_find(const uint8_t *area, uint32_t len, const char *name, DirEntry *out) {
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len >= NAME_MAX) return -1;
+
+    // every record has at least 4 name bytes (DIRENT_LEN rounds up), short names are masked
+    uint8_t head_bytes[4] = {0}, mask_bytes[4] = {0};
+    for (size_t i = 0; i < 4 && i < name_len; i++) {
+        head_bytes[i] = (uint8_t)name[i];
+        mask_bytes[i] = 0xFF;
+    }
+    uint32_t head, mask, tail = 0;
+    memcpy(&head, head_bytes, 4);
+    memcpy(&mask, mask_bytes, 4);
+    size_t tail_at = name_len > 4 ? name_len - 4 : 0;
+    if (tail_at) memcpy(&tail, name + tail_at, 4);
+    size_t middle = name_len > 8 ? name_len - 8 : 0;
+
+    for (uint32_t off = 0; off + DIRENT_HEADER <= len;) {
+        const DirRecord *r = (const DirRecord *)(area + off);
+        if (r->rec_len < DIRENT_HEADER || r->rec_len % 4 || off + r->rec_len > len) break;
+        if (r->name_len && r->rec_len < DIRENT_LEN(r->name_len)) break;
+
+        if (r->name_len == name_len) {
+            uint32_t h, t = 0;
+            memcpy(&h, r->name, 4);
+            if (tail_at) memcpy(&t, r->name + tail_at, 4);
+            if ((h & mask) == head && t == tail && (middle == 0 || memcmp(r->name + 4, name + 4, middle) == 0)) {
+                if (out) dirent_get(r, out);
+                return r->inode_num;
+            }
+        }
+        off += r->rec_len;
+    }
+    return -1;
+}
 
-    // initialize dir entry
-    DirEntry entry = {0};
-    entry.inode_num = child_inum;
-    entry.type = type;
-    entry.used = USED;
-    strncpy(entry.name, name, sizeof(entry.name)-1);
+// unlinks the record of name, its bytes join the record before it (ext2 style), the first
+// record of the area stays behind as a free one, returns its old offset or -1
+long dirent_remove(uint8_t *area, uint32_t len, const char *name, DirEntry *out) {
+    size_t name_len = strlen(name);
+    DirRecord *prev = NULL;
+    for (uint32_t off = 0; off + DIRENT_HEADER <= len;) {
+        DirRecord *r = (DirRecord *)(area + off);
+        if (r->rec_len < DIRENT_HEADER || r->rec_len % 4 || off + r->rec_len > len) return -1;
+
+        if (r->name_len == name_len && memcmp(r->name, name, name_len) == 0) {
+            if (out) dirent_get(r, out);
+            if (prev) prev->rec_len = (uint16_t)(prev->rec_len + r->rec_len);
+            else r->name_len = 0;
+            return off;
+        }
+        prev = r;
+        off += r->rec_len;
+    }
+    return -1;
+}
 
-    // allocates dir space
-    long dir_entry_address = alloc_dir_entry(dir_inum);
+// longest record dirent_reserve can still carve out of area, 0 when it's full
+uint32_t dirent_room(const uint8_t *area, uint32_t len) {
+    uint32_t room = 0;
+    for (uint32_t off = 0; off + DIRENT_HEADER <= len;) {
+        const DirRecord *r = (const DirRecord *)(area + off);
+        if (r->rec_len < DIRENT_HEADER || r->rec_len % 4 || off + r->rec_len > len) break;
+        uint32_t slack = r->rec_len - (r->name_len ? DIRENT_LEN(r->name_len) : 0);
+        if (slack > room) room = slack;
+        off += r->rec_len;
+    }
+    return room;
+}
 
-    // validate allocation
-    if (dir_entry_address == -1) return -1;
+// calls visit for every record of area, returns 1 if visit stopped the walk, else 0
+int dirent_walk(const uint8_t *area, uint32_t len, dir_visit_fn visit, void *arg) {
+    DirEntry entry;
+    for (const DirRecord *r = dirent_first(area, len); r; r = dirent_next(area, len, r)) {
+        dirent_get(r, &entry);
+        if (visit(&entry, arg)) return 1;
+    }
+    return 0;
+}
 
-    // write dir entry
-    write_dir_entry(dir_entry_address, &entry);
+// ---------- inline dirs ----------
 
-    // update entry inode
-    Inode child;
-    read_inode(child_inum, &child);
-    child.links_count++;
-    write_inode(child_inum, &child);
+static InlineDir *inline_dir(const Inode *dir) {
+    return (InlineDir *)dir->direct; // direct[], indirect and double_indirect are contiguous
+}
 
-    // update inode
-    Inode dir;
-    read_inode(dir_inum, &dir);
-    dir.size += sizeof(DirEntry);
-    write_inode(dir_inum, &dir);
+static void dot_entry(DirEntry *entry, const char *name, uint32_t inum) {
+    memset(entry, 0, sizeof(DirEntry));
+    entry->inode_num = inum;
+    entry->type = IDIR;
+    entry->name_len = (uint8_t)strlen(name);
+    strcpy(entry->name, name);
+}
 
-    // increment entry count in block
-    dir_block_update_count(dir_entry_address / BLOCK_SIZE, INCREMENT);
+// calls visit for the inline dir's entries, "." and ".." first like in a block, returns 1 if stopped
+static int inline_iterate(uint32_t inum, const Inode *dir, dir_visit_fn visit, void *arg) {
+    const InlineDir *in = inline_dir(dir);
+    DirEntry dot;
+    if (in->dots & INLINE_DOT) {
+        dot_entry(&dot, ".", inum);
+        if (visit(&dot, arg)) return 1;
+    }
+    if (in->dots & INLINE_DOTDOT) {
+        dot_entry(&dot, "..", in->parent);
+        if (visit(&dot, arg)) return 1;
+    }
+    return dirent_walk(in->records, INLINE_RECORDS, visit, arg);
+}
 
-    return dir_entry_address;
+static long inline_lookup(uint32_t inum, const Inode *dir, const char *name) {
+    const InlineDir *in = inline_dir(dir);
+    if ((in->dots & INLINE_DOT) && strcmp(name, ".") == 0) return inum;
+    if ((in->dots & INLINE_DOTDOT) && strcmp(name, "..") == 0) return in->parent;
+    return dirent_find(in->records, INLINE_RECORDS, name, NULL);
+}
+
+// stores entry in the inline dir, returns 0, or -1 when it doesn't fit
+static int inline_add(InodeHandle *dir, const DirEntry *entry) {
+    InlineDir *in = inline_dir(&dir->inode);
+    if (strcmp(entry->name, ".") == 0 && entry->inode_num == dir->inum) {
+        in->dots |= INLINE_DOT;
+        return 0;
+    }
+    if (strcmp(entry->name, "..") == 0) {
+        in->parent = entry->inode_num;
+        in->dots |= INLINE_DOTDOT;
+        return 0;
+    }
+    return dirent_insert(in->records, INLINE_RECORDS, entry) == -1 ? -1 : 0;
 }
 
-// returns the !! disk relative !! index of next free DirEntry slot
-long alloc_dir_entry(uint32_t dir_inum) {
-    Inode dir;
-    read_inode(dir_inum, &dir);
+typedef struct {
+    uint8_t *block;
+    int failed;
+} Promotion;
+
+static int copy_out(const DirEntry *entry, void *arg) {
+    Promotion *p = arg;
+    if (dirent_insert(p->block, DIR_AREA, entry) == -1) p->failed = 1;
+    return 0;
+}
+
+// moves an inline dir's entries into a block of its own, h is locked, returns 0 or -1
+static int promote_dir(InodeHandle *dir) {
+    InlineDir saved = *inline_dir(&dir->inode);
+    Inode copy = dir->inode;
+
+    memset(inline_dir(&dir->inode), 0, INLINE_DATA_MAX);
+    dir->inode.flags &= ~INODE_INLINE;
+    int bnum = alloc_direct_block(dir);
+    Buffer *b = bnum == -1 ? NULL : bget_as(bnum, CSUM_DIR);
+    if (!b) {
+        if (bnum != -1) free_block(bnum);
+        *inline_dir(&dir->inode) = saved;
+        dir->inode.flags |= INODE_INLINE;
+        return -1;
+    }
+
+    Promotion p = { b->data, 0 };
+    dirent_init(b->data, DIR_AREA);
+    inline_iterate(dir->inum, &copy, copy_out, &p); // a handful of small records, they fit
+    bdirty(b);
+    brelse(b);
+
+    dir->inode.size = BLOCK_SIZE;
+    idirty(dir);
+    return p.failed ? -1 : 0;
+}
+
+// ---------- linear dirs ----------
+
+// searches the dir's blocks for entry_name, returns its inode num or -1
+static long lookup_entry(const InodeHandle *h, const char *entry_name) {
+    const Inode *dir = &h->inode;
+    if (dir->flags & INODE_INLINE) return inline_lookup(h->inum, dir, entry_name);
+
+    // large dirs go straight to the one leaf the name hashes to
+    if (dir->flags & INODE_INDEX) return dx_lookup(dir, entry_name);
+
+    // loop through each block the inode points to
+    for (uint32_t i = 0; i < DIRECT_PTRS; i++) {
+        if (dir->direct[i] == 0) continue;
+
+        Buffer *b = bread_as(dir->direct[i], CSUM_DIR);
+        if (!b) return -1;
+        long inum = dirent_find(b->data, DIR_AREA, entry_name, NULL);
+        brelse(b);
+        if (inum != -1) return inum; // entry found
+    }
+    return -1; // no entry found
+}
+
+long dir_lookup(uint32_t dir_num, const char *entry_name) {
+    StatsSpan span = stats_begin(OP_DIR_LOOKUP);
+    long inum = -1;
+
+    // dir's inode is held in the inode cache for the whole scan, adds wait for it
+    InodeHandle *dir = iget(dir_num);
+    if (dir) {
+        ilock_shared(dir);
+        inum = lookup_entry(dir, entry_name);
+        iunlock(dir);
+        iput(dir);
+    }
+    stats_end(span);
+    return inum;
+}
+
+// free-slot map of a linear dir, each block is read once per load of the inode, after that
+// an insert goes straight to a block with room and a full dir is known without any read
+static void load_room(InodeHandle *dir) {
+    if (dir->dir_room_known) return;
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        dir->dir_room[i] = 0;
+        if (dir->inode.direct[i] == 0) continue;
+        Buffer *b = bread_as(dir->inode.direct[i], CSUM_DIR);
+        if (!b) continue; // unreadable, never picked for an insert
+        dir->dir_room[i] = (uint16_t)dirent_room(b->data, DIR_AREA);
+        brelse(b);
+    }
+    dir->dir_room_known = 1;
+}
+
+// returns the !! disk relative !! address of a free record with room for a name_len byte name
+static long alloc_entry(InodeHandle *dir, uint32_t name_len) {
+    // an inline dir has no record on disk, it gets its first block
+    if (dir->inode.flags & INODE_INLINE) {
+        if (promote_dir(dir) == -1) return -1;
+        dir->dir_room_known = 0;
+    }
+    load_room(dir);
+
+    // first block the map says has room, holes left by removals included
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        uint32_t bnum = dir->inode.direct[i];
+        if (bnum == 0 || dir->dir_room[i] < DIRENT_LEN(name_len)) continue;
+
+        Buffer *b = bread_as(bnum, CSUM_DIR);
+        if (!b) return -1;
+        long off = dirent_reserve(b->data, DIR_AREA, name_len);
+        dir->dir_room[i] = (uint16_t)dirent_room(b->data, DIR_AREA);
+        if (off != -1) bdirty(b);
+        brelse(b);
+        if (off != -1) return (long)bnum * BLOCK_SIZE + off;
+    }
+
+    // if no block has room try to allocate new one
+    int bnum = alloc_direct_block(dir);
+    if (bnum == -1) return -1; // allocation failed
+
+    Buffer *b = bget_as(bnum, CSUM_DIR);
+    if (!b) return -1;
+    dirent_init(b->data, DIR_AREA);
+    long off = dirent_reserve(b->data, DIR_AREA, name_len);
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        if (dir->inode.direct[i] == (uint32_t)bnum) dir->dir_room[i] = (uint16_t)dirent_room(b->data, DIR_AREA);
+    }
+    bdirty(b);
+    brelse(b);
+    dir->inode.size += BLOCK_SIZE;
+    idirty(dir);
+    return (long)bnum * BLOCK_SIZE + off;
+}
+
+// true once the first DX_THRESHOLD_BLOCKS linear blocks have no room left for the name
+static int needs_index(InodeHandle *dir, uint32_t name_len) {
+    if (dir->inode.flags & INODE_INLINE) return 0;
+    load_room(dir);
+    uint32_t blocks = 0;
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        if (dir->inode.direct[i] == 0) continue;
+        if (dir->dir_room[i] >= DIRENT_LEN(name_len)) return 0;
+        blocks++;
+    }
+    return blocks >= DX_THRESHOLD_BLOCKS;
+}
+
+// unlinks name from the locked dir, returns the inode num it named or -1,
+// a linear block left without entries goes back to the allocator
+static long remove_entry(InodeHandle *dir, const char *name) {
+    // "." and ".." go only with the dir itself
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+
+    DirEntry entry;
+    if (dir->inode.flags & INODE_INLINE) {
+        if (dirent_remove(inline_dir(&dir->inode)->records, INLINE_RECORDS, name, &entry) == -1) return -1;
+        idirty(dir);
+        return entry.inode_num;
+    }
+    if (dir->inode.flags & INODE_INDEX) return dx_remove(dir, name, &entry);
 
-    // loop through each direct block
+    load_room(dir);
     for (int i = 0; i < DIRECT_PTRS; i++) {
-        if (dir.direct[i] == 0) continue; // skip if block not allocated
-        if (dir_block_full(dir.direct[i])) continue; // skip if block full
+        uint32_t bnum = dir->inode.direct[i];
+        if (bnum == 0) continue;
+
+        Buffer *b = bread_as(bnum, CSUM_DIR);
+        if (!b) return -1;
+        if (dirent_remove(b->data, DIR_AREA, name, &entry) == -1) {
+            brelse(b);
+            continue;
+        }
+        int empty = dirent_first(b->data, DIR_AREA) == NULL;
+        dir->dir_room[i] = (uint16_t)dirent_room(b->data, DIR_AREA);
+        bdirty(b);
+        brelse(b);
+
+        if (empty) {
+            free_block(bnum);
+            dir->inode.direct[i] = 0;
+            dir->dir_room[i] = 0;
+            dir->inode.size -= BLOCK_SIZE;
+            idirty(dir);
+        }
+        return entry.inode_num;
+    }
+    return -1;
+}
 
-        // if block not full return mem address
+// a name linking to inum came or went, a count already at 0 stays there
+static void adjust_links(uint32_t inum, int delta) {
+    InodeHandle *h = iget(inum);
+    if (!h) return;
+    ilock(h);
+    if (delta >= 0 || h->inode.links_count >= -delta) {
+        h->inode.links_count = (uint16_t)(h->inode.links_count + delta);
+        idirty(h);
+    }
+    iunlock(h);
+    iput(h);
+}
 
-        long new_entry_address = dir.direct[i] * BLOCK_SIZE  // block number
-                + sizeof(uint32_t) // holds num of entries
-                + read_num_of_dir_entries(dir.direct[i]) * sizeof(DirEntry); // used block space
+static long add_entry(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type) {
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len >= NAME_MAX) return -1; // nothing to store or too long to store
 
-        return new_entry_address;
+    // one handle serves the lookup, the slot allocation and the size update
+    InodeHandle *dir = iget(dir_inum);
+    if (!dir) return -1;
+
+    // check and insert under one exclusive hold, two threads can't both add the name
+    ilock(dir);
+    if (lookup_entry(dir, name) != -1) { // entry with this name already exists
+        iunlock(dir);
+        iput(dir);
+        return -1;
     }
 
-    // if no free block found try to allocate new one
-    int bnum = alloc_direct_inode_block(dir_inum);
-    if (bnum > -1 ) {
-        // return DirEntry index 0
-        long new_entry_address = bnum * BLOCK_SIZE  // block number
-                + sizeof(uint32_t); // holds num of entries
-        Inode dir;
-        read_inode(dir_inum, &dir);
-        dir.size += sizeof(uint32_t); // header
-        write_inode(dir_inum, &dir);
+    // initialize dir entry
+    DirEntry entry;
+    entry.inode_num = child_inum;
+    entry.type = type;
+    entry.name_len = (uint8_t)name_len;
+    entry._pad = 0;
+    memcpy(entry.name, name, name_len + 1);
+
+    // linear dir that outgrew the threshold switches to the hashed index first
+    if (!(dir->inode.flags & INODE_INDEX) && needs_index(dir, entry.name_len) && dx_convert(dir) == -1) {
+        iunlock(dir);
+        iput(dir);
+        return -1;
+    }
 
-        return new_entry_address;
+    long dir_entry_address;
+    if ((dir->inode.flags & INODE_INLINE) && inline_add(dir, &entry) == 0) {
+        // kept in the inode, the address of its slot there
+        dir_entry_address = (long)inode_disk_offset(dir->inum) + offsetof(Inode, direct);
+        idirty(dir);
+    } else if (dir->inode.flags & INODE_INDEX) {
+        // leaf the name hashes to, split when full
+        dir_entry_address = dx_add(dir, &entry);
+    } else {
+        // reserves a record and fills it in
+        dir_entry_address = alloc_entry(dir, entry.name_len);
+        if (dir_entry_address != -1) write_dir_entry(dir_entry_address, &entry);
     }
 
-    return -1; // allocation failed
+    iunlock(dir);
+    iput(dir);
+
+    // validate allocation
+    if (dir_entry_address == -1) return -1;
+
+    // update entry inode, never with the dir still locked ("." and ".." are the dir or its parent)
+    adjust_links(child_inum, INCREMENT);
+
+    return dir_entry_address;
 }
 
-int read_dir_entry(uint32_t offset, DirEntry *entry) {
-    fseek(fs.disk, offset, SEEK_SET);
-    fread(entry, sizeof(DirEntry), 1, fs.disk);
+// adds entry to dir
+long dir_add(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type) {
+    StatsSpan span = stats_begin(OP_DIR_ADD);
+    tx_begin();
+    long address = add_entry(dir_inum, name, child_inum, type);
+    tx_commit();
+
+    // drops a cached "absent" answer for the name
+    if (address != -1) dcache_add(dir_inum, name);
+    stats_end(span);
+    return address;
 }
 
-int write_dir_entry(uint32_t offset, DirEntry *entry) {
-    fseek(fs.disk, offset, SEEK_SET);
-    fwrite(entry, sizeof(DirEntry), 1, fs.disk);
+// unlinks name from dir, expect != -1 only removes it while it still names that inode,
+// returns the inode num it named or -1
+static long unlink_entry(InodeHandle *dir, const char *name, long expect) {
+    ilock(dir);
+    long inum = expect == -1 || lookup_entry(dir, name) == expect ? remove_entry(dir, name) : -1;
+    iunlock(dir);
+    return inum;
 }
 
-// returns true if all DirEntry's at that block are used
-int dir_block_full(uint32_t bnum) {
-    // get num of entries
-    uint32_t num_of_entries = read_num_of_dir_entries(bnum);
+// removes name from dir while it still names expect (-1 for whatever it names), drop says
+// whether the link it held goes too, returns the inode num it named or -1
+static long remove_name(uint32_t dir_inum, const char *name, long expect, int drop) {
+    StatsSpan span = stats_begin(OP_DIR_REMOVE);
+    long inum = -1;
+    InodeHandle *dir = iget(dir_inum);
+    if (dir) {
+        tx_begin();
+        inum = unlink_entry(dir, name, expect);
+        iput(dir);
+        if (inum != -1 && drop) adjust_links((uint32_t)inum, DECREMENT);
+        tx_commit();
+    }
 
-    // check if it equals the theoretical maximum of entries in a block
-    if (num_of_entries == (BLOCK_SIZE - sizeof(uint32_t)) / sizeof(DirEntry)) return 1;
-    return 0;
+    // after the change, a lookup racing it can't cache the old answer
+    if (inum != -1) dcache_invalidate(dir_inum, name);
+    stats_end(span);
+    return inum;
 }
 
-// returns 1 if directory has no DirEntry's at that block
-int dir_block_empty(uint32_t bnum) {
-    uint32_t num_of_entries = read_num_of_dir_entries(bnum);
+// removes name from dir and drops the link it held, returns the inode num it named or -1,
+// the inode itself stays, whether it goes is up to the caller
+long dir_remove(uint32_t dir_inum, const char *name) {
+    return remove_name(dir_inum, name, -1, 1);
+}
 
-    if (num_of_entries == 0) return 1;
-    return 0;
+// dir_remove that leaves name alone unless it still names expect
+long dir_remove_expect(uint32_t dir_inum, const char *name, uint32_t expect) {
+    return remove_name(dir_inum, name, expect, 1);
 }
 
-// returns number of used DirEnry's in the directory block
-uint32_t read_num_of_dir_entries(uint32_t bnum) {
-    uint32_t num_of_entries;
-    fseek(fs.disk, bnum * BLOCK_SIZE, SEEK_SET);
-    fread(&num_of_entries, sizeof(uint32_t), 1, fs.disk);
-    return num_of_entries;
+// removes the record only, the inode it names keeps its links (it isn't in use to have any)
+long dir_drop_entry(uint32_t dir_inum, const char *name) {
+    return remove_name(dir_inum, name, -1, 0);
 }
 
-// returns number of used DirEnry's in the directory block
-int write_num_of_dir_entries(uint32_t bnum, uint32_t count) {
-    fseek(fs.disk, bnum * BLOCK_SIZE, SEEK_SET);
-    fwrite(&count, sizeof(uint32_t), 1, fs.disk);
-    return 0;
+// the ".." record of a dir block, NULL when the block has none
+static DirRecord *dotdot_record(uint8_t *area, uint32_t len) {
+    for (const DirRecord *r = dirent_first(area, len); r; r = dirent_next(area, len, r)) {
+        if (r->name_len == 2 && memcmp(r->name, "..", 2) == 0) return (DirRecord *)r;
+    }
+    return NULL;
+}
+
+// points the dir's ".." at parent_inum, the link it holds moves along (fs_fsck hanging an
+// orphan dir into lost+found), returns the old parent or -1 when the dir has no ".."
+long dir_set_parent(uint32_t dir_inum, uint32_t parent_inum) {
+    InodeHandle *dir = iget(dir_inum);
+    if (!dir) return -1;
+
+    tx_begin();
+    ilock(dir);
+    long old = -1;
+    if (dir->inode.flags & INODE_INLINE) {
+        InlineDir *in = inline_dir(&dir->inode);
+        if (in->dots & INLINE_DOTDOT) {
+            old = in->parent;
+            in->parent = parent_inum;
+            idirty(dir);
+        }
+    } else {
+        // the record sits in the first block of a linear dir, in one of the leaves of an index
+        uint32_t blocks[DX_MAX_LEAVES];
+        uint32_t n = 0;
+        if (dir->inode.flags & INODE_INDEX) {
+            Buffer *rb = bread_as(dir->inode.direct[0], CSUM_DIR);
+            const DxRoot *root = rb ? (const DxRoot *)rb->data : NULL;
+            for (uint32_t l = 0; root && l < root->count && l < DX_MAX_LEAVES; l++) blocks[n++] = root->entries[l].block;
+            if (rb) brelse(rb);
+        } else {
+            for (int i = 0; i < DIRECT_PTRS; i++) {
+                if (dir->inode.direct[i]) blocks[n++] = dir->inode.direct[i];
+            }
+        }
+        for (uint32_t i = 0; i < n && old == -1; i++) {
+            Buffer *b = bread_as(blocks[i], CSUM_DIR);
+            if (!b) break;
+            DirRecord *r = dotdot_record(b->data, DIR_AREA);
+            if (r) {
+                old = r->inode_num;
+                r->inode_num = parent_inum;
+                bdirty(b);
+            }
+            brelse(b);
+        }
+    }
+    iunlock(dir);
+    iput(dir);
+
+    if (old != -1) {
+        adjust_links(parent_inum, INCREMENT);
+        adjust_links((uint32_t)old, DECREMENT);
+    }
+    tx_commit();
+    if (old != -1) dcache_invalidate(dir_inum, "..");
+    return old;
 }
 
-// INCREMENT or DECREMENT dir entry count
-int dir_block_update_count(uint32_t bnum, int operation) {
-    uint32_t count = read_num_of_dir_entries(bnum);
-    count += operation;
+// reserves a record for a name_len byte name, fill it in with write_dir_entry
+long alloc_dir_entry(uint32_t dir_inum, uint32_t name_len) {
+    if (name_len == 0 || name_len >= NAME_MAX) return -1;
+    InodeHandle *dir = iget(dir_inum);
+    if (!dir) return -1;
+
+    ilock(dir);
+    long address = alloc_entry(dir, name_len);
+    iunlock(dir);
+    iput(dir);
+    return address;
+}
 
-    write_num_of_dir_entries(bnum, count);
+// decodes the record at the disk offset, returns 0 or -1 (also for free space)
+int read_dir_entry(uint64_t offset, DirEntry *entry) {
+    uint32_t off = offset % BLOCK_SIZE;
+    if (off + DIRENT_HEADER > DIR_AREA) return -1;
+    Buffer *b = bread_as((uint32_t)(offset / BLOCK_SIZE), CSUM_DIR); // records never straddle blocks
+    if (!b) return -1;
+    const DirRecord *r = (const DirRecord *)(b->data + off);
+    int rc = r->name_len == 0 || off + DIRENT_HEADER + r->name_len > DIR_AREA ? -1 : 0;
+    if (rc == 0) dirent_get(r, entry);
+    brelse(b);
+    return rc;
 }
 
+// fills the record at the disk offset, its rec_len stays
+int write_dir_entry(uint64_t offset, DirEntry *entry) {
+    uint32_t off = offset % BLOCK_SIZE;
+    if (off + DIRENT_HEADER + entry->name_len > DIR_AREA) return -1;
+    Buffer *b = bread_as((uint32_t)(offset / BLOCK_SIZE), CSUM_DIR);
+    if (!b) return -1;
+    dirent_put(b->data + off, entry);
+    bdirty(b);
+    brelse(b);
+    return 0;
+}
+
+static void drop_new_dir(uint32_t dir_inum, uint32_t parent_inum, int linked);
+
 // make a new directory in parent, return 0 on success, -1 else
 int mkdir(uint32_t parent_inum, char *child) {
+    StatsSpan span = stats_begin(OP_MKDIR);
+
     // check if parent is dir
-    if (!is_dir(parent_inum)) return -1;
+    if (!is_dir(parent_inum)) {
+        stats_end(span);
+        return -1;
+    }
 
-    int child_inum = create_dir(IDIR|IRUSR|IWUSR|IXUSR);
+    // every block mkdir touches is written once, on commit
+    tx_begin();
+    int child_inum = create_dir_in(parent_inum, IDIR|IRUSR|IWUSR|IXUSR);
 
     // add parent as child second entry '..'
-    if (dir_add(child_inum, "..", parent_inum, IDIR) == -1) return -1;
-
-    // add child as directory entry to parent
-    if (dir_add(parent_inum, child, child_inum, IDIR) == -1) return -1;
+    int linked = child_inum != -1 && dir_add(child_inum, "..", parent_inum, IDIR) != -1;
+
+    // add child as directory entry to parent, a name taken by now (a racing mkdir) undoes the rest
+    if (child_inum != -1 && (!linked || dir_add(parent_inum, child, child_inum, IDIR) == -1)) {
+        drop_new_dir((uint32_t)child_inum, parent_inum, linked);
+        tx_commit();
+        dcache_invalidate((uint32_t)child_inum, ".");
+        dcache_invalidate((uint32_t)child_inum, "..");
+        stats_end(span);
+        return -1;
+    }
+    tx_commit();
 
-    return child_inum; // success
+    stats_end(span);
+    return child_inum; // success or -1
 }
 
 // returns 1 if inode is directory, 0 else
 int is_dir(uint32_t inum) {
-    Inode inode;
-    read_inode(inum, &inode);
+    InodeHandle *h = iget(inum);
+    if (!h) return 0;
 
     // keep only first 4 bits and compare to IDIR
-    return (inode.mode & 0xF000) == IDIR ? 1 : 0;
+    int dir = (h->inode.mode & 0xF000) == IDIR ? 1 : 0;
+    iput(h);
+    return dir;
 }
 
 // alloc new dir inode and adds itself as first entry
 int create_dir(uint16_t mode) {
+    return create_dir_in(fs.sb.root_inode, mode);
+}
+
+// like create_dir, the inode is placed for a subdir of parent_inum
+int create_dir_in(uint32_t parent_inum, uint16_t mode) {
+    tx_begin();
+
     // allocate new dir full control inode
-    int inum = create_inode(mode);
-    if (inum == -1) return -1;
+    int inum = create_inode_in(parent_inum, mode);
+
+    // an inline dir's record area starts out as one free record, like a fresh block
+    InodeHandle *h = inum == -1 ? NULL : iget(inum);
+    if (h) {
+        ilock(h);
+        if (h->inode.flags & INODE_INLINE) {
+            dirent_init(inline_dir(&h->inode)->records, INLINE_RECORDS);
+            h->inode.size = INLINE_DATA_MAX;
+            idirty(h);
+        }
+        iunlock(h);
+        iput(h);
+    }
 
     // add itself as first entry
-    dir_add(inum, ".", inum, IDIR);
+    if (inum != -1) dir_add(inum, ".", inum, IDIR);
 
+    tx_commit();
     return inum;
 }
 
-int dir_list(uint32_t dir_inum) {
-    Inode dir;
-    read_inode(dir_inum, &dir);
+// dir_iterate on a dir the caller holds locked
+static int iterate_locked(InodeHandle *h, dir_visit_fn visit, void *arg) {
+    const Inode *dir = &h->inode;
+    if (dir->flags & INODE_INLINE) return inline_iterate(h->inum, dir, visit, arg);
+    if (dir->flags & INODE_INDEX) return dx_iterate(dir, visit, arg);
 
+    // all entry blocks in flight at once before the walk reads them one by one
+    uint32_t blocks[DIRECT_PTRS];
+    uint32_t n = 0;
     for (int i = 0; i < DIRECT_PTRS; i++) {
-        // skip if block not alloc
-        if (dir.direct[i] == 0) continue;
-        // skip if block emtpy
-        if (dir_block_empty(dir.direct[i])) continue;
+        if (dir->direct[i]) blocks[n++] = dir->direct[i];
+    }
+    cache_readahead(blocks, n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        Buffer *b = bread_as(blocks[i], CSUM_DIR);
+        if (!b) return -1;
+        int stopped = dirent_walk(b->data, DIR_AREA, visit, arg);
+        brelse(b);
+        if (stopped) return 1;
+    }
+    return 0;
+}
 
-        uint32_t offset = sizeof(uint32_t) + dir.direct[i] * BLOCK_SIZE;
+// calls visit for every entry of the dir, linear or indexed
+// the dir is held shared for the whole walk, visit must not add to it
+int dir_iterate(uint32_t dir_inum, dir_visit_fn visit, void *arg) {
+    InodeHandle *h = iget(dir_inum);
+    if (!h) return -1;
+    ilock_shared(h);
+    int rc = iterate_locked(h, visit, arg);
+    iunlock(h);
+    iput(h);
+    return rc;
+}
 
-        DirEntry entry;
-        read_dir_entry(offset, &entry);
+static int not_dot(const DirEntry *entry, void *arg) {
+    (void)arg;
+    return strcmp(entry->name, ".") != 0 && strcmp(entry->name, "..") != 0;
+}
 
-        while (entry.used == USED) {
-            printf("%s\n", entry.name);
-            offset += sizeof(DirEntry);
-            read_dir_entry(offset, &entry);
+// gives back every block of a locked dir that has no entries left
+static void release_dir(InodeHandle *dir) {
+    if (dir->inode.flags & INODE_INDEX) {
+        dx_release(&dir->inode);
+    } else if (!(dir->inode.flags & INODE_INLINE)) {
+        for (int i = 0; i < DIRECT_PTRS; i++) {
+            if (dir->inode.direct[i]) free_block(dir->inode.direct[i]);
         }
     }
-}
\ No newline at end of file
+    memset(dir->inode.direct, 0, INLINE_DATA_MAX);
+    dir->inode.flags &= ~(INODE_INDEX | INODE_INLINE);
+    dir->inode.size = 0;
+    dir->inode.links_count = 0;
+    dir->dir_room_known = 0;
+    idirty(dir);
+}
+
+// undoes a mkdir that got no name: the dir's blocks and inode go back, and the parent's link
+// its ".." held when it got linked. inside the mkdir's transaction
+static void drop_new_dir(uint32_t dir_inum, uint32_t parent_inum, int linked) {
+    InodeHandle *h = iget(dir_inum);
+    if (h) {
+        ilock(h);
+        release_dir(h);
+        iunlock(h);
+        iput(h);
+    }
+    free_inode(dir_inum);
+    if (linked) adjust_links(parent_inum, DECREMENT);
+}
+
+// removes the empty dir child from parent, return 0 on success, -1 else
+int fs_rmdir(uint32_t parent_inum, char *child) {
+    StatsSpan span = stats_begin(OP_RMDIR);
+    long inum = dir_lookup(parent_inum, child);
+    InodeHandle *h = inum == -1 || inum == fs.sb.root_inode || inum == parent_inum ? NULL : iget(inum);
+    InodeHandle *parent = h ? iget(parent_inum) : NULL; // both taken before any inode lock is held
+    if (!parent) {
+        if (h) iput(h);
+        stats_end(span);
+        return -1;
+    }
+
+    // held until the dir is gone, an add to it waits and then finds it unlinked,
+    // a dir is locked before its parent, never the other way around
+    tx_begin();
+    ilock(h);
+    int rc = -1;
+    if ((h->inode.mode & 0xF000) == IDIR && iterate_locked(h, not_dot, NULL) == 0 &&
+        unlink_entry(parent, child, inum) == inum) {
+        release_dir(h);
+        rc = 0;
+    }
+    iunlock(h);
+    iput(h);
+    iput(parent);
+
+    if (rc == 0) {
+        free_inode((uint32_t)inum);
+        adjust_links(parent_inum, DECREMENT); // its ".."
+    }
+    tx_commit();
+
+    if (rc == 0) {
+        dcache_invalidate(parent_inum, child);
+        dcache_invalidate((uint32_t)inum, ".");
+        dcache_invalidate((uint32_t)inum, "..");
+    }
+    stats_end(span);
+    return rc;
+}
+
+// ---------- bulk ----------
+
+// lays out a dir that holds nothing but "." and ".." afresh with n more entries of distinct names
+// in one pass, no lookups: inline when they fit, else one block, else an index built in memory
+// and written to the device directly like file data, before the transaction maps it.
+// h is locked inside a transaction, links are the caller's to set, returns 0 or -1
+int dir_build(InodeHandle *dir, uint32_t parent_inum, const DirEntry *entries, uint32_t n) {
+    Inode *inode = &dir->inode;
+    if (inode->flags & INODE_INDEX) return -1; // holds more than the dots
+    // a linear dir's block of dots is reused or freed, nothing else is mapped yet
+    uint32_t old = (inode->flags & INODE_INLINE) ? 0 : inode->direct[0];
+
+    if (fs.sb.features & FEATURE_INLINE_DATA) {
+        InlineDir in = { parent_inum, INLINE_DOT | INLINE_DOTDOT, {0} };
+        dirent_init(in.records, INLINE_RECORDS);
+        uint32_t i = 0;
+        while (i < n && dirent_insert(in.records, INLINE_RECORDS, &entries[i]) != -1) i++;
+        if (i == n) {
+            if (old) free_block(old);
+            *inline_dir(inode) = in;
+            inode->flags |= INODE_INLINE;
+            inode->size = INLINE_DATA_MAX;
+            idirty(dir);
+            return 0;
+        }
+    }
+
+    DirEntry dots[2];
+    dot_entry(&dots[0], ".", dir->inum);
+    dot_entry(&dots[1], "..", parent_inum);
+    uint64_t total = DIRENT_LEN(1) + DIRENT_LEN(2);
+    for (uint32_t i = 0; i < n; i++) total += DIRENT_LEN(entries[i].name_len);
+
+    if (total <= DIR_AREA) {
+        int bnum = old ? (int)old : alloc_block_near(group_data_start(group_of_inode(dir->inum)));
+        Buffer *b = bnum == -1 ? NULL : bget_as(bnum, CSUM_DIR);
+        if (!b) {
+            if (bnum != -1 && !old) free_block(bnum);
+            return -1;
+        }
+        dirent_init(b->data, DIR_AREA);
+        dirent_insert(b->data, DIR_AREA, &dots[0]);
+        dirent_insert(b->data, DIR_AREA, &dots[1]);
+        for (uint32_t i = 0; i < n; i++) dirent_insert(b->data, DIR_AREA, &entries[i]); // they fit, total says
+        bdirty(b);
+        brelse(b);
+
+        memset(inline_dir(inode), 0, INLINE_DATA_MAX);
+        inode->flags &= ~INODE_INLINE;
+        inode->direct[0] = (uint32_t)bnum;
+        inode->size = BLOCK_SIZE;
+        dir->dir_room_known = 0;
+        idirty(dir);
+        return 0;
+    }
+
+    // too big for a block: every record back to back, the index sorts them into leaves
+    uint8_t *area = total <= UINT32_MAX ? malloc(total) : NULL;
+    if (!area) return -1;
+    uint32_t off = 0;
+    for (uint32_t i = 0; i < n + 2; i++) {
+        const DirEntry *e = i < 2 ? &dots[i] : &entries[i - 2];
+        DirRecord *r = (DirRecord *)(area + off);
+        dirent_put(area + off, e);
+        r->rec_len = (uint16_t)DIRENT_LEN(e->name_len);
+        off += r->rec_len;
+    }
+    int rc = dx_build(dir, area, (uint32_t)total);
+    free(area);
+    if (rc == -1) return -1;
+
+    // the old block goes only now, dx_build must not get it back for a direct write
+    if (old) free_block(old);
+    inode->flags &= ~INODE_INLINE;
+    inode->indirect = 0;
+    inode->double_indirect = 0;
+    dir->dir_room_known = 0;
+    idirty(dir);
+    return 0;
+}
+
+static int print_entry(const DirEntry *entry, void *arg) {
+    (void)arg;
+    printf("%s\n", entry->name);
+    return 0;
+}
+
+int dir_list(uint32_t dir_inum) {
+    return dir_iterate(dir_inum, print_entry, NULL) == -1 ? -1 : 0;
+}
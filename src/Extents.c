@@ -0,0 +1,407 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Extents.h"
+#include "../include/FileManagement.h"
+#include "../include/Cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Extent *extents;
+    uint32_t num_extents;
+    uint32_t cap_extents;
+    uint32_t *blocks;       // tree blocks below the root
+    uint32_t num_blocks;
+    uint32_t cap_blocks;
+} Collected;
+
+static ExtentHeader *root_of(Inode *inode) {
+    return (ExtentHeader *)inode->direct; // direct[], indirect and double_indirect are contiguous
+}
+
+static size_t entry_size(const ExtentHeader *hdr) {
+    return hdr->depth ? sizeof(ExtentIdx) : sizeof(Extent);
+}
+
+static uint8_t *entry_at(ExtentHeader *hdr, uint32_t i) {
+    return (uint8_t *)(hdr + 1) + i * entry_size(hdr);
+}
+
+// both entry types start with their first logical block
+static uint32_t logical_at(const ExtentHeader *hdr, uint32_t i) {
+    return *(const uint32_t *)((const uint8_t *)(hdr + 1) + i * entry_size(hdr));
+}
+
+static void init_node(ExtentHeader *hdr, uint16_t depth, int in_inode) {
+    hdr->magic = EXT_MAGIC;
+    hdr->entries = 0;
+    hdr->depth = depth;
+    if (in_inode) hdr->max = depth ? EXT_ROOT_INDEXES : EXT_ROOT_LEAVES;
+    else hdr->max = depth ? EXT_BLOCK_INDEXES : EXT_BLOCK_LEAVES;
+}
+
+// last entry starting at or before logical, -1 if logical is before all of them
+static long search(const ExtentHeader *hdr, uint32_t logical) {
+    uint32_t lo = 0, hi = hdr->entries;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (logical_at(hdr, mid) <= logical) lo = mid + 1;
+        else hi = mid;
+    }
+    return (long)lo - 1;
+}
+
+static void node_dirty(InodeHandle *h, Buffer *self) {
+    if (self) bdirty(self);
+    else idirty(h);
+}
+
+// switches inode to an empty extent tree held in its block pointers
+void ext_init(Inode *inode) {
+    memset(inode->direct, 0, sizeof(inode->direct));
+    inode->indirect = 0;
+    inode->double_indirect = 0;
+    init_node(root_of(inode), 0, 1);
+    inode->flags |= INODE_EXTENTS;
+}
+
+// physical block holding logical, 0 for a hole, -1 on error, run gets the blocks left in the
+// extent (or hole) from logical on, one binary search per tree level
+long ext_map(const Inode *inode, uint32_t logical, uint32_t *run) {
+    const ExtentHeader *hdr = (const ExtentHeader *)inode->direct;
+    uint32_t bound = UINT32_MAX; // first logical block past the subtree being searched
+    Buffer *b = NULL;
+    long result = -1;
+
+    for (int level = 0; level <= EXT_MAX_DEPTH && hdr->magic == EXT_MAGIC; level++) {
+        long i = search(hdr, logical);
+        if (i + 1 < hdr->entries && logical_at(hdr, (uint32_t)i + 1) < bound) bound = logical_at(hdr, (uint32_t)i + 1);
+
+        if (hdr->depth == 0) {
+            const Extent *e = (const Extent *)(hdr + 1);
+            if (i >= 0 && logical - e[i].logical < e[i].len) {
+                if (run) *run = e[i].len - (logical - e[i].logical);
+                result = (long)e[i].start + (logical - e[i].logical);
+            } else {
+                if (run) *run = bound - logical;
+                result = 0;
+            }
+            break;
+        }
+
+        if (i < 0) { // before the first child, a hole
+            if (run) *run = bound - logical;
+            result = 0;
+            break;
+        }
+
+        uint32_t child = ((const ExtentIdx *)(hdr + 1))[i].block;
+        if (b) brelse(b);
+        b = bread(child);
+        if (!b) break;
+        hdr = (const ExtentHeader *)b->data;
+    }
+
+    if (b) brelse(b);
+    return result;
+}
+
+// logical block right after the last mapped one, 0 for an empty tree, -1 on error
+long ext_end(const Inode *inode) {
+    const ExtentHeader *hdr = (const ExtentHeader *)inode->direct;
+    Buffer *b = NULL;
+    long end = -1;
+
+    // rightmost path down to the last leaf
+    for (int level = 0; level <= EXT_MAX_DEPTH && hdr->magic == EXT_MAGIC; level++) {
+        if (hdr->entries == 0) {
+            end = 0;
+            break;
+        }
+        if (hdr->depth == 0) {
+            const Extent *last = (const Extent *)(hdr + 1) + hdr->entries - 1;
+            end = (long)last->logical + last->len;
+            break;
+        }
+
+        uint32_t child = ((const ExtentIdx *)(hdr + 1))[hdr->entries - 1].block;
+        if (b) brelse(b);
+        b = bread(child);
+        if (!b) break;
+        hdr = (const ExtentHeader *)b->data;
+    }
+
+    if (b) brelse(b);
+    return end;
+}
+
+// moves the root's entries into a new block one level down, returns 0 or -1
+static int grow_root(InodeHandle *h) {
+    ExtentHeader *root = root_of(&h->inode);
+    if (root->depth >= EXT_MAX_DEPTH) return -1;
+
+    int nb = alloc_block_near(group_data_start(group_of_inode(h->inum)));
+    if (nb == -1) return -1;
+    Buffer *b = bget(nb);
+    if (!b) {
+        free_block(nb);
+        return -1;
+    }
+    memset(b->data, 0, BLOCK_SIZE);
+
+    ExtentHeader *child = (ExtentHeader *)b->data;
+    init_node(child, root->depth, 0);
+    child->entries = root->entries;
+    memcpy(child + 1, root + 1, root->entries * entry_size(root));
+    uint32_t first = root->entries ? logical_at(root, 0) : 0;
+    bdirty(b);
+    brelse(b);
+
+    init_node(root, root->depth + 1, 1);
+    root->entries = 1;
+    ExtentIdx *idx = (ExtentIdx *)(root + 1);
+    idx[0].logical = first;
+    idx[0].block = (uint32_t)nb;
+    idirty(h);
+    return 0;
+}
+
+// puts entry at pos of a node, a full block node is split and the new right sibling is
+// returned through split, returns 0, 1 after a split or -1
+static int node_insert(InodeHandle *h, ExtentHeader *hdr, Buffer *self, uint32_t pos, const void *entry,
+                       ExtentIdx *split) {
+    size_t size = entry_size(hdr);
+
+    if (hdr->entries < hdr->max) {
+        memmove(entry_at(hdr, pos + 1), entry_at(hdr, pos), (hdr->entries - pos) * size);
+        memcpy(entry_at(hdr, pos), entry, size);
+        hdr->entries++;
+        node_dirty(h, self);
+        return 0;
+    }
+
+    if (!self) {
+        // full root: push it down, the new block has room for one more
+        if (grow_root(h) == -1) return -1;
+        ExtentHeader *root = root_of(&h->inode);
+        ExtentIdx *idx = (ExtentIdx *)(root + 1);
+        Buffer *cb = bread(idx[0].block);
+        if (!cb) return -1;
+        int rc = node_insert(h, (ExtentHeader *)cb->data, cb, pos, entry, split);
+        if (rc == 0 && pos == 0) idx[0].logical = *(const uint32_t *)entry;
+        brelse(cb);
+        return rc;
+    }
+
+    int nb = alloc_block_near(self->block_num); // siblings next to each other
+    if (nb == -1) return -1;
+    Buffer *rb = bget(nb);
+    if (!rb) {
+        free_block(nb);
+        return -1;
+    }
+    memset(rb->data, 0, BLOCK_SIZE);
+    ExtentHeader *right = (ExtentHeader *)rb->data;
+    init_node(right, hdr->depth, 0);
+
+    // appends leave the left node full, so sequentially written files pack their nodes densely
+    uint32_t n = hdr->entries;
+    uint32_t keep = pos == n ? n : n / 2;
+    memcpy(entry_at(right, 0), entry_at(hdr, keep), (n - keep) * size);
+    right->entries = n - keep;
+    hdr->entries = keep;
+
+    if (pos <= keep && pos != n) node_insert(h, hdr, self, pos, entry, NULL);
+    else node_insert(h, right, rb, pos - keep, entry, NULL);
+
+    split->logical = logical_at(right, 0);
+    split->block = (uint32_t)nb;
+    bdirty(self);
+    bdirty(rb);
+    brelse(rb);
+    return 1;
+}
+
+// adds ext below hdr, merging it with a neighbour when the blocks continue on disk
+static int insert_rec(InodeHandle *h, ExtentHeader *hdr, Buffer *self, const Extent *ext, ExtentIdx *split) {
+    long i = search(hdr, ext->logical);
+
+    if (hdr->depth == 0) {
+        Extent *e = (Extent *)(hdr + 1);
+        uint32_t n = hdr->entries;
+        uint32_t end = ext->logical + ext->len;
+
+        if (i >= 0 && e[i].logical + e[i].len == ext->logical && e[i].start + e[i].len == ext->start) {
+            e[i].len += ext->len;
+            // the new blocks may also close the gap to the next extent
+            if (i + 1 < n && e[i + 1].logical == end && e[i + 1].start == ext->start + ext->len) {
+                e[i].len += e[i + 1].len;
+                memmove(&e[i + 1], &e[i + 2], (n - i - 2) * sizeof(Extent));
+                hdr->entries--;
+            }
+            node_dirty(h, self);
+            return 0;
+        }
+        if (i + 1 < n && e[i + 1].logical == end && e[i + 1].start == ext->start + ext->len) {
+            e[i + 1].logical = ext->logical;
+            e[i + 1].start = ext->start;
+            e[i + 1].len += ext->len;
+            node_dirty(h, self);
+            return 0;
+        }
+        return node_insert(h, hdr, self, (uint32_t)(i + 1), ext, split);
+    }
+
+    ExtentIdx *idx = (ExtentIdx *)(hdr + 1);
+    if (i < 0) {
+        // new lowest block of the subtree
+        i = 0;
+        idx[0].logical = ext->logical;
+        node_dirty(h, self);
+    }
+
+    Buffer *cb = bread(idx[i].block);
+    if (!cb) return -1;
+    ExtentIdx child_split;
+    int rc = insert_rec(h, (ExtentHeader *)cb->data, cb, ext, &child_split);
+    brelse(cb);
+    if (rc != 1) return rc;
+
+    return node_insert(h, hdr, self, (uint32_t)i + 1, &child_split, split);
+}
+
+// maps logical blocks [logical, logical + len) to physical [start, start + len), the range
+// must be a hole, returns 0 or -1
+int ext_insert(InodeHandle *h, uint32_t logical, uint32_t start, uint32_t len) {
+    if (len == 0) return 0;
+    Extent ext = { logical, start, len };
+    ExtentIdx split;
+    // the root never splits, it grows a level instead
+    return insert_rec(h, root_of(&h->inode), NULL, &ext, &split) == -1 ? -1 : 0;
+}
+
+// allocates up to count blocks for the hole at logical, contiguous with the block before it
+// when possible, stores how many in got, returns the first physical block or -1
+long ext_alloc(InodeHandle *h, uint32_t logical, uint32_t count, uint32_t *got) {
+    uint32_t hole = 0;
+    if (ext_map(&h->inode, logical, &hole) != 0) return -1; // mapped already or unreadable
+    if (count > hole) count = hole;
+
+    uint32_t goal = group_data_start(group_of_inode(h->inum));
+    if (logical > 0) {
+        long prev = ext_map(&h->inode, logical - 1, NULL);
+        if (prev > 0) goal = (uint32_t)prev + 1;
+    }
+
+    long first = alloc_block_extent(goal, count, got);
+    if (first == -1) return -1;
+
+    if (ext_insert(h, logical, (uint32_t)first, *got) == -1) {
+        free_block_run((uint32_t)first, *got);
+        return -1;
+    }
+    return first;
+}
+
+static int push_extent(Collected *c, const Extent *e) {
+    if (c->num_extents == c->cap_extents) {
+        uint32_t cap = c->cap_extents ? c->cap_extents * 2 : 64;
+        Extent *grown = realloc(c->extents, cap * sizeof(Extent));
+        if (!grown) return -1;
+        c->extents = grown;
+        c->cap_extents = cap;
+    }
+    c->extents[c->num_extents++] = *e;
+    return 0;
+}
+
+static int push_block(Collected *c, uint32_t block) {
+    if (c->num_blocks == c->cap_blocks) {
+        uint32_t cap = c->cap_blocks ? c->cap_blocks * 2 : 16;
+        uint32_t *grown = realloc(c->blocks, cap * sizeof(uint32_t));
+        if (!grown) return -1;
+        c->blocks = grown;
+        c->cap_blocks = cap;
+    }
+    c->blocks[c->num_blocks++] = block;
+    return 0;
+}
+
+// every extent in logical order plus every tree block below hdr
+static int collect(const ExtentHeader *hdr, Collected *c, int levels_left) {
+    if (hdr->magic != EXT_MAGIC || levels_left < 0) return -1;
+
+    if (hdr->depth == 0) {
+        const Extent *e = (const Extent *)(hdr + 1);
+        for (uint32_t i = 0; i < hdr->entries; i++) {
+            if (push_extent(c, &e[i]) == -1) return -1;
+        }
+        return 0;
+    }
+
+    const ExtentIdx *idx = (const ExtentIdx *)(hdr + 1);
+    for (uint32_t i = 0; i < hdr->entries; i++) {
+        if (push_block(c, idx[i].block) == -1) return -1;
+        Buffer *b = bread(idx[i].block);
+        if (!b) return -1;
+        int rc = collect((const ExtentHeader *)b->data, c, levels_left - 1);
+        brelse(b);
+        if (rc == -1) return -1;
+    }
+    return 0;
+}
+
+static void release(Collected *c) {
+    free(c->extents);
+    free(c->blocks);
+}
+
+// number of extents and of tree blocks outside the inode, returns 0 or -1
+int ext_count(const Inode *inode, uint32_t *extents, uint32_t *tree_blocks) {
+    Collected c = {0};
+    int rc = collect((const ExtentHeader *)inode->direct, &c, EXT_MAX_DEPTH);
+    if (extents) *extents = c.num_extents;
+    if (tree_blocks) *tree_blocks = c.num_blocks;
+    release(&c);
+    return rc;
+}
+
+// frees every block from logical block keep on and rebuilds the tree around what is left,
+// returns 0 or -1
+int ext_truncate(InodeHandle *h, uint32_t keep) {
+    Collected c = {0};
+    if (collect(root_of(&h->inode), &c, EXT_MAX_DEPTH) == -1) {
+        release(&c);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < c.num_blocks; i++) free_block(c.blocks[i]);
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < c.num_extents; i++) {
+        Extent e = c.extents[i];
+        uint64_t end = (uint64_t)e.logical + e.len;
+        if (e.logical >= keep) {
+            free_block_run(e.start, e.len);
+            continue;
+        }
+        if (end > keep) {
+            uint32_t cut = (uint32_t)(end - keep);
+            free_block_run(e.start + e.len - cut, cut);
+            e.len -= cut;
+        }
+        c.extents[kept++] = e;
+    }
+
+    ext_init(&h->inode);
+    idirty(h);
+    int rc = 0;
+    for (uint32_t i = 0; i < kept && rc == 0; i++) {
+        rc = ext_insert(h, c.extents[i].logical, c.extents[i].start, c.extents[i].len);
+    }
+    release(&c);
+    return rc;
+}
@@ -3,148 +3,442 @@
 //
 
 #include "../include/FileManagement.h"
+#include "../include/Cache.h"
+#include "../include/InodeCache.h"
+#include "../include/Transaction.h"
+#include "../include/Extents.h"
+#include "../include/Stats.h"
+#include "../include/Snapshot.h"
 
 #include <time.h>
 #include <string.h>
 
 void read_block(uint32_t block_num, void *buf) {
-    fseek(fs.disk, block_num * BLOCK_SIZE, SEEK_SET);
-    fread(buf, BLOCK_SIZE, 1, fs.disk);
+    cache_read((uint64_t)block_num * BLOCK_SIZE, buf, BLOCK_SIZE);
 }
 
 void write_block(uint32_t block_num, const void *buf) {
-    fseek(fs.disk, block_num * BLOCK_SIZE, SEEK_SET);
-    fwrite(buf, BLOCK_SIZE, 1, fs.disk);
+    cache_write((uint64_t)block_num * BLOCK_SIZE, buf, BLOCK_SIZE);
 }
 
 // writes current superblock state stored in cache to disk
+void write_superblock() {
+    cache_write(0, &fs.sb, sizeof(fs.sb)); // superblock lives at start of block 0
+}
+
+// inside a transaction the superblock is only marked, commit writes it once
 void sync_superblock() {
-    fseek(fs.disk, 0, SEEK_SET); // set file pointer to first block
-    fwrite(&fs.sb, sizeof(fs.sb), 1, fs.disk); // write superblock
+    STATS_COUNT(sb_syncs, 1);
+    if (tx_active()) {
+        tx_mark_superblock();
+        return;
+    }
+    write_superblock();
+}
+
+static uint32_t block_rotor = 0;    // where the last goal-less allocation ended
+
+// free counters are read without the group lock to pick a group, the lock holder re-checks
+#define PEEK(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static uint32_t free_blocks_of(uint32_t g) {
+    return PEEK(fs.groups[g].free_blocks);
 }
 
-// finds free block, allocates it and returns the block number
+// count contiguous free blocks at or after goal in goal's group, then in the following groups,
+// marks them used and returns the first one or -1
+static long alloc_blocks_near(uint32_t goal, uint32_t count) {
+    STATS_COUNT(allocs, 1);
+    if (count == 0 || PEEK(fs.sb.free_blocks) < count) return -1;
+    if (goal < fs.sb.data_block_start || goal >= fs.sb.total_blocks) goal = fs.sb.data_block_start;
+
+    uint32_t home = group_of_block(goal);
+    for (uint32_t i = 0; i < fs.sb.groups_count; i++) {
+        uint32_t g = (home + i) % fs.sb.groups_count;
+        if (free_blocks_of(g) < count) continue; // full group costs one counter read
+
+        // word scan of the group's slice of the bitmap, skips full chunks
+        group_lock(g);
+        long first = fs.groups[g].free_blocks < count ? -1 :
+                     bitmap_alloc_range(&block_bitmap, i == 0 ? goal : 0, group_data_start(g), group_end(g), count);
+        if (first != -1) {
+            update_block_bitmap_run((uint32_t)first, count, USED); // write the bitmap bytes back
+            group_adjust(g, -(int)count, 0, 0);
+        }
+        group_unlock(g);
+        if (first == -1) continue;
+
+        sb_adjust(-(int)count, 0);
+        sync_superblock();
+        return first;
+    }
+    return -1; // no free run that long in any group
+}
+
+// allocates a free block as close after goal as possible, returns the block number or -1
+int alloc_block_near(uint32_t goal) {
+    return (int)alloc_blocks_near(goal, 1);
+}
+
+// allocates a block with no locality preference, next-fit over the whole image
 int alloc_block() {
-    // check if there are any free blocks
-    if (fs.sb.free_blocks > 0) {
-        // start at data blocks, as before are taken at disk formating
-        // iterate through bitmap
-        for (int i = fs.sb.data_block_start; i < fs.sb.total_blocks; i++) {
-            // check if block free
-            if (block_bitmap[i] == 0) {
-                update_block_bitmap(i , 1); // mark used in bitmap
-                fs.sb.free_blocks--;          // decrement num of free blocks
-                sync_superblock();
-                return i;   // block number
-            }
+    int b = alloc_block_near(__atomic_load_n(&block_rotor, __ATOMIC_RELAXED));
+    if (b != -1) __atomic_store_n(&block_rotor, (uint32_t)b + 1, __ATOMIC_RELAXED);
+    return b;
+}
+
+// allocates count physically contiguous blocks inside one group, returns the first one or -1
+long alloc_block_run(uint32_t count) {
+    long first = alloc_blocks_near(__atomic_load_n(&block_rotor, __ATOMIC_RELAXED), count);
+    if (first != -1) __atomic_store_n(&block_rotor, (uint32_t)first + count, __ATOMIC_RELAXED);
+    return first;
+}
+
+// allocates between 1 and max contiguous blocks starting at the first free block at or after
+// goal (goal's group first, then the following ones), stores the length in got, returns the first or -1
+long alloc_block_extent(uint32_t goal, uint32_t max, uint32_t *got) {
+    STATS_COUNT(allocs, 1);
+    if (max == 0 || PEEK(fs.sb.free_blocks) == 0) return -1;
+    if (goal < fs.sb.data_block_start || goal >= fs.sb.total_blocks) goal = fs.sb.data_block_start;
+
+    uint32_t home = group_of_block(goal);
+    for (uint32_t i = 0; i < fs.sb.groups_count; i++) {
+        uint32_t g = (home + i) % fs.sb.groups_count;
+        if (free_blocks_of(g) == 0) continue;
+
+        uint32_t count = 0;
+        group_lock(g);
+        long first = fs.groups[g].free_blocks == 0 ? -1 :
+                     bitmap_alloc_upto(&block_bitmap, i == 0 ? goal : 0, group_data_start(g), group_end(g), max, &count);
+        if (first != -1) {
+            update_block_bitmap_run((uint32_t)first, count, USED);
+            group_adjust(g, -(int)count, 0, 0);
         }
+        group_unlock(g);
+        if (first == -1) continue;
+
+        sb_adjust(-(int)count, 0);
+        sync_superblock();
+        *got = count;
+        return first;
     }
-    return -1; // if no free blocks found
+    return -1;
 }
 
-// finds free inode, allocates it and returns the inode number
-int alloc_inode() {
-    // check if there are any free inodes
-    if (fs.sb.free_inodes > 0) {
-        // iterate through bitmap
-        for (int i = 0; i < fs.sb.total_inodes; i++) {
-            // check if inode free
-            if (inode_bitmap[i] == 0) {
-                update_inode_bitmap(i, 1); // mark inode as used
-                fs.sb.free_inodes--; // decrement amount of free inodes
-                sync_superblock();
-                return i;
-            }
+// takes up to max of the lowest free inodes of group under one hold of its lock, stores them in
+// out and returns how many (0 if the group has none)
+static uint32_t take_inodes(uint32_t g, int is_dir, uint32_t max, uint32_t *out) {
+    group_lock(g);
+    uint32_t n = 0;
+    uint32_t first = g * fs.sb.inodes_per_group;
+    uint32_t from = first;
+    while (n < max && fs.groups[g].free_inodes > n) {
+        long i = bitmap_alloc_range(&inode_bitmap, from, first, first + fs.sb.inodes_per_group, 1);
+        if (i == -1) break;
+        if (group_init_itable(g, (uint32_t)i - first) == -1) {
+            bitmap_clear(&inode_bitmap, (uint32_t)i); // no buffer for the table block, give it back
+            break;
         }
+        update_inode_bitmap((uint32_t)i, USED); // mark inode as used
+        out[n++] = (uint32_t)i;
+        from = (uint32_t)i + 1;
     }
-    return -1; // if no free inodes are found
+    if (n > 0) group_adjust(g, 0, -(int)n, is_dir ? (int)n : 0);
+    group_unlock(g);
+    if (n == 0) return 0;
+
+    sb_adjust(0, -(int)n); // decrement amount of free inodes
+    sync_superblock();
+    return n;
+}
+
+// takes the lowest free inode of group, -1 if the group has none
+static long take_inode(uint32_t g, int is_dir) {
+    uint32_t i;
+    return take_inodes(g, is_dir, 1, &i) ? (long)i : -1;
+}
+
+// Orlov: top-level dirs go to the emptiest group with the fewest dirs, so unrelated trees spread,
+// subdirs stay with their parent while its group is not crowded. the counters are read unlocked,
+// a group that filled up in the meantime makes take_inode fail and the caller look again
+static long find_group_dir(uint32_t parent_group, int top_level) {
+    uint32_t n = fs.sb.groups_count;
+    uint64_t avg_inodes = PEEK(fs.sb.free_inodes) / n;
+    uint64_t avg_blocks = PEEK(fs.sb.free_blocks) / n;
+
+    if (top_level) {
+        static uint32_t spread = 0; // rotate the starting point so ties don't pile up in one group
+        uint32_t from = PEEK(spread);
+        while (!__atomic_compare_exchange_n(&spread, &from, (from + 1) % n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        long best = -1;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t g = (from + i) % n;
+            const GroupDesc *gd = &fs.groups[g];
+            if (PEEK(gd->free_inodes) == 0 || PEEK(gd->free_inodes) < avg_inodes || PEEK(gd->free_blocks) < avg_blocks) continue;
+            if (best == -1 || PEEK(gd->used_dirs) < PEEK(fs.groups[best].used_dirs)) best = g;
+        }
+        if (best != -1) return best;
+    } else {
+        uint64_t used_dirs = 0;
+        for (uint32_t g = 0; g < n; g++) used_dirs += PEEK(fs.groups[g].used_dirs);
+        uint64_t max_dirs = used_dirs / n + fs.sb.inodes_per_group / 16;
+        uint64_t min_inodes = avg_inodes > fs.sb.inodes_per_group / 4 ? avg_inodes - fs.sb.inodes_per_group / 4 : 1;
+        uint64_t min_blocks = avg_blocks > fs.sb.blocks_per_group / 4 ? avg_blocks - fs.sb.blocks_per_group / 4 : 1;
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t g = (parent_group + i) % n;
+            const GroupDesc *gd = &fs.groups[g];
+            if (PEEK(gd->used_dirs) < max_dirs && PEEK(gd->free_inodes) >= min_inodes && PEEK(gd->free_blocks) >= min_blocks) return g;
+        }
+    }
+
+    // everything is crowded, any group with a free inode
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t g = (parent_group + i) % n;
+        if (PEEK(fs.groups[g].free_inodes)) return g;
+    }
+    return -1;
+}
+
+// files go next to their parent, else the first group found by quadratic probing that has
+// room for data as well, like ext2's find_group_other
+static long find_group_file(uint32_t parent_group) {
+    uint32_t n = fs.sb.groups_count;
+    const GroupDesc *home = &fs.groups[parent_group];
+    if (PEEK(home->free_inodes) && PEEK(home->free_blocks)) return parent_group;
+
+    uint32_t g = parent_group;
+    for (uint32_t step = 1; step < n; step <<= 1) {
+        g = (g + step) % n;
+        if (PEEK(fs.groups[g].free_inodes) && PEEK(fs.groups[g].free_blocks)) return g;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        g = (parent_group + i) % n;
+        if (PEEK(fs.groups[g].free_inodes)) return g;
+    }
+    return -1;
+}
+
+// allocates an inode for a new child of parent, returns the inode number or -1
+int alloc_inode_near(uint32_t parent_inum, int is_dir) {
+    STATS_COUNT(allocs, 1);
+    uint32_t parent_group = parent_inum < fs.sb.total_inodes ? group_of_inode(parent_inum) : 0;
+    // the root itself (still unallocated while formatting) stays in group 0
+    int top_level = parent_inum == fs.sb.root_inode && bitmap_test(&inode_bitmap, parent_inum);
+
+    // a group picked from stale counters may be taken by another thread first, pick again
+    for (uint32_t attempt = 0; attempt <= fs.sb.groups_count; attempt++) {
+        // check if there are any free inodes
+        if (PEEK(fs.sb.free_inodes) == 0) return -1;
+
+        long g = is_dir ? find_group_dir(parent_group, top_level) : find_group_file(parent_group);
+        if (g == -1) return -1; // if no free inodes are found
+
+        long i = take_inode((uint32_t)g, is_dir);
+        if (i != -1) return (int)i;
+    }
+    return -1;
+}
+
+// finds free inode next to the root, allocates it and returns the inode number
+int alloc_inode() {
+    return alloc_inode_near(fs.sb.root_inode, 0);
 }
 
 void free_block(uint32_t b) {
-    block_bitmap[b] = 0; // mark block free
-    fs.sb.free_blocks++; // increment amount of free blocks
+    if (snap_live && snap_keep(b)) return; // a snapshot still reads it, it stays allocated as theirs
+    cache_discard(b); // old contents must not be written over the next owner's
+    uint32_t g = group_of_block(b);
+    group_lock(g);
+    update_block_bitmap(b, FREE); // mark block free
+    group_adjust(g, 1, 0, 0);
+    group_unlock(g);
+    sb_adjust(1, 0); // increment amount of free blocks
     sync_superblock();
 }
 
-void free_inode(uint32_t i) {
-    inode_bitmap[i] = 0; // mark inode free
-    fs.sb.free_inodes++; // increment amount of free inodes
+// frees count blocks from first, one bitmap write and counter update per group the run touches
+static void release_run(uint32_t first, uint32_t count) {
+    while (count > 0) {
+        uint32_t g = group_of_block(first);
+        uint32_t n = group_end(g) - first < count ? group_end(g) - first : count;
+
+        for (uint32_t b = first; b < first + n; b++) cache_discard(b);
+        group_lock(g);
+        update_block_bitmap_run(first, n, FREE);
+        group_adjust(g, (int)n, 0, 0);
+        group_unlock(g);
+        sb_adjust((int)n, 0);
+        first += n;
+        count -= n;
+    }
     sync_superblock();
 }
 
+void free_block_run(uint32_t first, uint32_t count) {
+    if (!snap_live) {
+        release_run(first, count);
+        return;
+    }
+    // blocks a snapshot still reads are kept, the ones between them are freed as runs
+    uint32_t from = first;
+    for (uint32_t b = first; b < first + count; b++) {
+        if (!snap_keep(b)) continue;
+        if (b > from) release_run(from, b - from);
+        from = b + 1;
+    }
+    if (first + count > from) release_run(from, first + count - from);
+}
+
+// gives inode i back to its group, dir says whether it counted as one of the group's dirs
+static void release_inode(uint32_t i, int dir) {
+    uint32_t g = group_of_inode(i);
+    group_lock(g);
+    update_inode_bitmap(i, FREE); // mark inode free
+    group_adjust(g, 0, 1, dir ? -1 : 0);
+    group_unlock(g);
+    sb_adjust(0, 1); // increment amount of free inodes
+    sync_superblock();
+}
+
+void free_inode(uint32_t i) {
+    // a dir leaving its group makes room for the next Orlov placement
+    int dir = 0;
+    InodeHandle *h = iget(i);
+    if (h) {
+        dir = (h->inode.mode & 0xF000) == IDIR;
+        iput(h);
+    }
+    release_inode(i, dir);
+}
+
 // returns inum of the new inode or -1 if failed
 int create_inode(uint16_t mode)
 {
-    int inode_num = alloc_inode(); // allocate new inode and store num
-
-    if (inode_num == -1) return -1; // if alloc unsuccessful
+    return create_inode_in(fs.sb.root_inode, mode);
+}
 
-    Inode new_inode;
-    memset(&new_inode, 0, sizeof(Inode)); // set inode fields to zero
+// fresh in-core inode for a just allocated inode_num, zeroed and dirty, no need to read the old
+// table slot, returns 0 or -1
+static int init_inode(uint32_t inode_num, uint16_t mode) {
+    InodeHandle *h = iget_new(inode_num);
+    if (!h) return -1;
 
-    new_inode.mode = mode;
+    h->inode.mode = mode;
+    // directories keep block pointers, their blocks are reached through DirIndex anyway
+    if ((mode & 0xF000) == IREG && (fs.sb.features & FEATURE_EXTENTS)) ext_init(&h->inode);
+    // a new dir holds its first entries itself until they outgrow the pointer area
+    if ((mode & 0xF000) == IDIR && (fs.sb.features & FEATURE_INLINE_DATA)) h->inode.flags |= INODE_INLINE;
 
     time_t now = time(NULL);
-    new_inode.atime = now;
-    new_inode.mtime = now;
-    new_inode.ctime = now;
+    h->inode.atime = now;
+    h->inode.mtime = now;
+    h->inode.ctime = now;
+    iput(h);
+    return 0;
+}
 
-    // write inode to inode table
-    write_inode(inode_num, &new_inode);
+// new inode placed for a child of parent_inum, returns its inum or -1
+int create_inode_in(uint32_t parent_inum, uint16_t mode)
+{
+    // allocate new inode and store num
+    int is_dir = (mode & 0xF000) == IDIR;
+    int inode_num = alloc_inode_near(parent_inum, is_dir);
+
+    if (inode_num == -1) return -1; // if alloc unsuccessful
+    if (init_inode(inode_num, mode) == -1) {
+        // no in-core inode to be had, the one just taken goes back
+        release_inode((uint32_t)inode_num, is_dir);
+        return -1;
+    }
 
     return inode_num;
 }
 
-int alloc_direct_inode_block(uint32_t inum) {
-    Inode inode;
-    read_inode(inum, &inode);
+// count new regular file inodes for children of parent_inum, taken a group at a time with one
+// lock hold and one superblock update per group instead of per inode, for bulk creation.
+// stores their numbers in out, returns how many were created (fewer once the image runs out)
+uint32_t create_inodes_in(uint32_t parent_inum, uint16_t mode, uint32_t count, uint32_t *out) {
+    STATS_COUNT(allocs, 1);
+    uint32_t parent_group = parent_inum < fs.sb.total_inodes ? group_of_inode(parent_inum) : 0;
+    uint32_t n = 0;
+    for (uint32_t attempt = 0; n < count && attempt <= fs.sb.groups_count; attempt++) {
+        if (PEEK(fs.sb.free_inodes) == 0) break;
+        long g = find_group_file(parent_group);
+        if (g == -1) break;
+        n += take_inodes((uint32_t)g, 0, count - n, out + n);
+    }
+
+    // an inode whose in-core copy can't be set up is handed back, the rest close up
+    uint32_t made = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (init_inode(out[i], mode) == -1) free_inode(out[i]);
+        else out[made++] = out[i];
+    }
+    return made;
+}
 
+// attaches a new block to the first empty direct pointer (or the end of the extent tree),
+// h is locked by the caller, returns block num or -1
+int alloc_direct_block(InodeHandle *h) {
+    if (h->inode.flags & INODE_INLINE) return -1; // its owner moves the inline contents out first
+    if (h->inode.flags & INODE_EXTENTS) {
+        // block pointers hold an extent tree, append after its last mapped block
+        long end = ext_end(&h->inode);
+        uint32_t got;
+        return end == -1 ? -1 : (int)ext_alloc(h, (uint32_t)end, 1, &got);
+    }
+    // data right after the file's previous block, or at the start of its inode's group
+    uint32_t goal = group_data_start(group_of_inode(h->inum));
     for (int i = 0; i < DIRECT_PTRS; i++) {
-        if (inode.direct[i] == 0) {
-            int new_block = alloc_block();
+        if (h->inode.direct[i] == 0) {
+            int new_block = alloc_block_near(goal);
             if (new_block != -1) {
                 // allocate new block and validate
-                inode.direct[i] = new_block; // store new blocks address
-                write_inode(inum, &inode);
+                h->inode.direct[i] = new_block; // store new blocks address
+                idirty(h);
                 return new_block;
             }
             return -1;
         }
+        goal = h->inode.direct[i] + 1;
     }
+    return -1; // all direct pointers in use
 }
 
-int write_inode(uint32_t inode_num, Inode *new_inode) {
-    int inode_per_block = BLOCK_SIZE / sizeof(Inode); // num of inodes in a block
-
-    // index of the inode in the respective block
-    uint32_t inode_idx = inode_num % inode_per_block;
+int alloc_direct_inode_block(uint32_t inum) {
+    InodeHandle *h = iget(inum);
+    if (!h) return -1;
 
-    // the block in which the inode is
-    uint32_t block_idx = inode_num / inode_per_block + fs.sb.inode_start;
+    ilock(h);
+    int new_block = alloc_direct_block(h);
+    iunlock(h);
+    iput(h);
+    return new_block;
+}
 
-    // scale to bytes of the disk
-    uint32_t offset = block_idx * BLOCK_SIZE + inode_idx * sizeof(Inode);
+// updates the in-core inode, it reaches the inode table on flush or eviction
+int write_inode(uint32_t inode_num, Inode *new_inode) {
+    InodeHandle *h = iget(inode_num);
+    if (!h) return -1;
 
-    fseek(fs.disk, offset, SEEK_SET);
-    fwrite(new_inode, sizeof(Inode), 1, fs.disk);
+    ilock(h);
+    h->inode = *new_inode;
+    idirty(h);
+    iunlock(h);
+    iput(h);
 
     return 0;
 }
 
 int read_inode(uint32_t inode_num, Inode *out_inode) {
-    int inode_per_block = BLOCK_SIZE / sizeof(Inode); // num of inodes in a block
-
-    // index of the inode in the respective block
-    uint32_t inode_idx = inode_num % inode_per_block;
-
-    // the block in which the inode is
-    uint32_t block_idx = inode_num / inode_per_block + fs.sb.inode_start;
+    InodeHandle *h = iget(inode_num);
+    if (!h) return -1;
 
-    // scale to bytes of the disk
-    uint32_t offset = block_idx * BLOCK_SIZE + inode_idx * sizeof(Inode);
-
-    fseek(fs.disk, offset, SEEK_SET);
-    fread(out_inode, sizeof(Inode), 1, fs.disk);
+    ilock_shared(h);
+    *out_inode = h->inode;
+    iunlock(h);
+    iput(h);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -3,80 +3,743 @@
 //
 #include "../include/FileSystemStructure.h"
 #include "../include/FileManagement.h"
+#include "../include/Cache.h"
+#include "../include/InodeCache.h"
+#include "../include/Transaction.h"
+#include "../include/Journal.h"
+#include "../include/DentryCache.h"
+#include "../include/Paths.h"
+#include "../include/Stats.h"
+#include "../include/Snapshot.h"
+#include "../include/Checksum.h"
 
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "Inode.h"
 
+Bitmap block_bitmap;
+Bitmap inode_bitmap;
+FileSystem fs;
+
+static pthread_mutex_t *group_locks = NULL; // per group, guards its descriptor and bitmap slices
+static uint32_t num_group_locks = 0;
+
+void fs_default_options(FsOptions *opts) {
+    memset(opts, 0, sizeof(FsOptions));
+    opts->backend = BDEV_STDIO;
+    opts->inode_ratio = DEFAULT_INODE_RATIO;
+    opts->journal = 1;
+    opts->commit_batch = 1;
+    opts->extents = 1;
+    opts->io_depth = AIO_DEFAULT_DEPTH;
+    opts->io_workers = AIO_DEFAULT_WORKERS;
+    opts->io_uring = 1;
+    opts->inline_data = 1;
+    opts->lazy_init = 1;
+    opts->checksums = 1;
+}
+
+static int open_flags(const FsOptions *opts) {
+    return opts->direct_io ? BDEV_DIRECT : 0;
+}
+
+// the async queue of a freshly opened fs.dev, NULL when opts ask for synchronous I/O (or it fails)
+static AioQueue *open_queue(const FsOptions *opts) {
+    if (opts->io_depth == 0) return NULL;
+    AioEngine engine = opts->io_uring ? AIO_ENGINE_URING : AIO_ENGINE_THREADS;
+    return aio_open(fs.dev, engine, opts->io_depth, opts->io_workers);
+}
+
+static uint32_t blocks_for(uint64_t items, uint64_t per_block) {
+    return (uint32_t)((items + per_block - 1) / per_block);
+}
+
+// superblock, group descriptors, then per group: block bitmap, inode bitmap, inode table, data.
+// the journal sits at the end of the last group.
+// returns -1 if the image can't hold the metadata plus a root dir block
+static int plan_layout(Superblock *sb, uint32_t num_blocks, uint32_t inode_ratio, uint32_t journal_blocks) {
+    if (inode_ratio == 0) inode_ratio = DEFAULT_INODE_RATIO;
+    uint32_t per_group = BITS_PER_BLOCK;
+    uint32_t groups = blocks_for(num_blocks, per_group);
+
+    // same inode count in every group, whole table blocks, byte aligned bitmap slices
+    uint64_t inodes = (uint64_t)num_blocks * BLOCK_SIZE / inode_ratio;
+    uint64_t per_group_inodes = blocks_for(inodes ? inodes : 1, groups);
+    uint32_t table_blocks = blocks_for(per_group_inodes, INODES_PER_BLOCK);
+    uint32_t ipg = table_blocks * INODES_PER_BLOCK / 8 * 8;
+    if (ipg > BITS_PER_BLOCK) {
+        ipg = BITS_PER_BLOCK;
+        table_blocks = blocks_for(ipg, INODES_PER_BLOCK);
+    }
+
+    uint32_t desc_blocks = blocks_for(groups, GROUP_DESC_PER_BLOCK);
+    uint32_t group_meta = 2 + table_blocks;
+
+    // a last group too small for its own metadata and the journal is left out, like mke2fs does
+    uint32_t last = num_blocks - (groups - 1) * per_group;
+    uint32_t last_meta = group_meta + (groups == 1 ? 1 + desc_blocks : 0);
+    if ((uint64_t)last_meta + journal_blocks + 1 > last) {
+        if (groups == 1) return -1;
+        groups--;
+        num_blocks = groups * per_group;
+    }
+
+    memset(sb, 0, sizeof(Superblock));
+    sb->total_blocks = num_blocks;
+    sb->block_size = BLOCK_SIZE;
+    sb->blocks_per_group = per_group;
+    sb->inodes_per_group = ipg;
+    sb->inode_table_blocks = table_blocks;
+    sb->groups_count = groups;
+    sb->group_desc_blocks = desc_blocks;
+    sb->total_inodes = groups * ipg;
+    sb->free_inodes = sb->total_inodes;
+
+    sb->block_bitmap_start = 1 + desc_blocks;
+    sb->inode_bitmap_start = sb->block_bitmap_start + 1;
+    sb->inode_start = sb->inode_bitmap_start + 1;
+    sb->data_block_start = sb->inode_start + table_blocks;
+
+    sb->journal_blocks = journal_blocks;
+    sb->journal_start = journal_blocks ? num_blocks - journal_blocks : 0;
+    sb->free_blocks = num_blocks - 1 - desc_blocks - groups * group_meta - journal_blocks;
+    return 0;
+}
+
+// writes zeros over count blocks from first, a few blocks per device call
+static int zero_blocks(uint32_t first, uint32_t count, int kind) {
+    const uint32_t chunk = 64;
+    uint8_t *zero;
+    if (posix_memalign((void **)&zero, BDEV_ALIGN, (size_t)chunk * BLOCK_SIZE) != 0) return -1;
+    memset(zero, 0, (size_t)chunk * BLOCK_SIZE);
+
+    // sealed zero blocks of a checksummed kind, each seal covers its block number
+    int rc = 0;
+    for (uint32_t done = 0; done < count && rc == 0; done += chunk) {
+        uint32_t n = count - done < chunk ? count - done : chunk;
+        for (uint32_t i = 0; i < n && kind != CSUM_NONE; i++) csum_seal(first + done + i, zero + (size_t)i * BLOCK_SIZE, kind);
+        rc = bdev_write(fs.dev, (uint64_t)first + done, n, zero);
+    }
+    free(zero);
+    return rc;
+}
+
+static uint32_t group_first_block(uint32_t group) {
+    return group * fs.sb.blocks_per_group;
+}
+
+uint32_t group_of_block(uint32_t block_num) {
+    return block_num / fs.sb.blocks_per_group;
+}
+
+uint32_t group_of_inode(uint32_t inode_num) {
+    return inode_num / fs.sb.inodes_per_group;
+}
+
+// first block after the group's inode table
+uint32_t group_data_start(uint32_t group) {
+    return fs.groups[group].inode_table + fs.sb.inode_table_blocks;
+}
+
+// one past the group's last block
+uint32_t group_end(uint32_t group) {
+    uint64_t end = (uint64_t)(group + 1) * fs.sb.blocks_per_group;
+    return end < fs.sb.total_blocks ? (uint32_t)end : fs.sb.total_blocks;
+}
+
+// changes the superblock free counters, threads allocating in different groups race on them
+void sb_adjust(int blocks, int inodes) {
+    if (blocks) __atomic_fetch_add(&fs.sb.free_blocks, (uint32_t)blocks, __ATOMIC_RELAXED);
+    if (inodes) __atomic_fetch_add(&fs.sb.free_inodes, (uint32_t)inodes, __ATOMIC_RELAXED);
+}
+
+// disk byte offset of the inode in its group's table slice
+uint64_t inode_disk_offset(uint32_t inode_num) {
+    uint32_t index = inode_num % fs.sb.inodes_per_group;
+    uint64_t block = fs.groups[group_of_inode(inode_num)].inode_table + index / INODES_PER_BLOCK;
+    return block * BLOCK_SIZE + (index % INODES_PER_BLOCK) * sizeof(Inode);
+}
+
+static void destroy_group_locks() {
+    for (uint32_t g = 0; g < num_group_locks; g++) pthread_mutex_destroy(&group_locks[g]);
+    free(group_locks);
+    group_locks = NULL;
+    num_group_locks = 0;
+}
+
+static int init_group_locks() {
+    destroy_group_locks();
+    group_locks = malloc(fs.sb.groups_count * sizeof(pthread_mutex_t));
+    if (!group_locks) return -1;
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) pthread_mutex_init(&group_locks[g], NULL);
+    num_group_locks = fs.sb.groups_count;
+    return 0;
+}
+
+// allocators of different groups run in parallel, a group's counters, bitmap bits and dirty
+// ranges only change with its lock held
+void group_lock(uint32_t group) {
+    pthread_mutex_lock(&group_locks[group]);
+}
+
+void group_unlock(uint32_t group) {
+    pthread_mutex_unlock(&group_locks[group]);
+}
+
+// fills the descriptor table for a fresh layout, metadata marked used in the block bitmap
+static int init_groups() {
+    free(fs.groups);
+    fs.groups = calloc(fs.sb.groups_count, sizeof(GroupDesc));
+    if (!fs.groups || init_group_locks() == -1) return -1;
+
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        GroupDesc *gd = &fs.groups[g];
+        uint32_t first = group_first_block(g);
+        gd->block_bitmap = g == 0 ? fs.sb.block_bitmap_start : first;
+        gd->inode_bitmap = gd->block_bitmap + 1;
+        gd->inode_table = gd->inode_bitmap + 1;
+        gd->free_inodes = fs.sb.inodes_per_group;
+        gd->itable_zeroed = fs.sb.features & FEATURE_LAZY_ITABLE ? 0 : fs.sb.inode_table_blocks;
+
+        uint32_t meta = group_data_start(g) - first;
+        bitmap_set_run(&block_bitmap, first, meta);
+        gd->free_blocks = group_end(g) - first - meta;
+    }
+    return 0;
+}
+
+// checksum of a group's slice of bm as its bitmap block holds it, bytes past the in-memory
+// words (the end of the image) are zero on disk
+static uint16_t bitmap_slice_csum(const Bitmap *bm, uint32_t group, uint32_t bytes_per_group) {
+    uint64_t from = (uint64_t)group * bytes_per_group;
+    uint64_t have = (uint64_t)bm->nwords * sizeof(uint64_t);
+    uint32_t avail = from >= have ? 0 : have - from < bytes_per_group ? (uint32_t)(have - from) : bytes_per_group;
+    return csum_bitmap((const uint8_t *)bm->words + from, avail, bytes_per_group - avail);
+}
+
+// refreshes the descriptor's checksums of the group's bitmaps, FEATURE_METADATA_CSUM only
+static void group_csum(uint32_t group) {
+    if (!(fs.sb.features & FEATURE_METADATA_CSUM)) return;
+    fs.groups[group].block_bitmap_csum = bitmap_slice_csum(&block_bitmap, group, fs.sb.blocks_per_group / 8);
+    fs.groups[group].inode_bitmap_csum = bitmap_slice_csum(&inode_bitmap, group, fs.sb.inodes_per_group / 8);
+}
+
+static int all_zero(const uint8_t *block) {
+    const uint64_t *words = (const uint64_t *)block;
+    for (size_t i = 0; i < BLOCK_SIZE / sizeof(uint64_t); i++) if (words[i]) return 0;
+    return 1;
+}
+
+// writes every group's bitmaps and the descriptor table straight to the device,
+// too many blocks on a big image for one transaction. on a fresh image empty bitmaps are
+// skipped, it (or zero_blocks) already has them zero, else cached copies take the new contents
+static int write_groups(int fresh) {
+    uint32_t bitmap_bytes = fs.sb.blocks_per_group / 8;
+    uint32_t inode_bytes = fs.sb.inodes_per_group / 8;
+    uint8_t *block;
+    if (posix_memalign((void **)&block, BDEV_ALIGN, BLOCK_SIZE) != 0) return -1;
+
+    int rc = 0;
+    for (uint32_t g = 0; g < fs.sb.groups_count && rc == 0; g++) {
+        // bits past the end of the image are never read back, the last group's copy may be short
+        uint64_t from = (uint64_t)g * bitmap_bytes;
+        uint64_t avail = (uint64_t)block_bitmap.nwords * sizeof(uint64_t) - from;
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, (const uint8_t *)block_bitmap.words + from, avail < bitmap_bytes ? avail : bitmap_bytes);
+        if (!fresh || !all_zero(block)) rc = bdev_write(fs.dev, fs.groups[g].block_bitmap, 1, block);
+        if (!fresh) cache_update(fs.groups[g].block_bitmap, block);
+
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, (const uint8_t *)inode_bitmap.words + (uint64_t)g * inode_bytes, inode_bytes);
+        if (rc == 0 && (!fresh || !all_zero(block))) rc = bdev_write(fs.dev, fs.groups[g].inode_bitmap, 1, block);
+        if (!fresh) cache_update(fs.groups[g].inode_bitmap, block);
+    }
+
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) group_csum(g);
+    for (uint32_t d = 0; d < fs.sb.group_desc_blocks && rc == 0; d++) {
+        uint32_t first = d * GROUP_DESC_PER_BLOCK;
+        uint32_t n = fs.sb.groups_count - first < GROUP_DESC_PER_BLOCK ? fs.sb.groups_count - first
+                                                                      : (uint32_t)GROUP_DESC_PER_BLOCK;
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, &fs.groups[first], n * sizeof(GroupDesc));
+        rc = bdev_write(fs.dev, 1 + d, 1, block);
+        if (!fresh) cache_update(1 + d, block);
+    }
+    free(block);
+    return rc;
+}
+
+// puts the in-memory bitmaps and descriptors of a mounted image on disk wholesale, past the
+// journal, which holds nothing once fs_sync checkpointed it (fs_fsck). returns 0 or -1
+int rewrite_groups() {
+    if (fs_sync() == -1) return -1;
+    tx_freeze();
+    int rc = write_groups(0);
+    if (rc == 0) rc = bdev_sync(fs.dev);
+    tx_thaw();
+    return rc;
+}
+
 void format_disk(const char *filename, uint32_t num_blocks) {
-    fs.disk = fopen(filename, "wb+");
-    if (!fs.disk) {
-        perror("fopen");
-        exit(1);
+    if (format_disk_opts(filename, num_blocks, NULL) == -1) exit(1);
+}
+
+static int format_image(const char *filename, uint32_t num_blocks, const FsOptions *opts) {
+    FsOptions defaults;
+    if (!opts) {
+        fs_default_options(&defaults);
+        opts = &defaults;
     }
 
-    // Step 1: zero-fill the disk
-    uint8_t zero_block[BLOCK_SIZE] = {0};
-    for (uint32_t i = 0; i < num_blocks; i++) {
-        fwrite(zero_block, BLOCK_SIZE, 1,fs.disk);
+    if (num_blocks > MAX_BLOCKS) {
+        fprintf(stderr, "format: %u blocks exceed the %u supported\n", num_blocks, MAX_BLOCKS);
+        return -1;
     }
 
-    // Step 2: initialize superblock
-   fs.sb.total_blocks = num_blocks;
-   fs.sb.block_size = BLOCK_SIZE;
-   fs.sb.total_inodes = MAX_INODES;
-   fs.sb.free_blocks = num_blocks - 7;    // 7 reserved
-   fs.sb.free_inodes = MAX_INODES;
-   fs.sb.block_bitmap_start = 1;
-   fs.sb.inode_bitmap_start = 2;
-   fs.sb.inode_start = 3;
-   fs.sb.data_block_start = 6;
+    uint32_t journal_blocks = 0;
+    if (opts->journal) {
+        journal_blocks = opts->journal_blocks ? opts->journal_blocks : journal_default_blocks(num_blocks);
+        if (journal_blocks < JOURNAL_MIN_BLOCKS) {
+            fprintf(stderr, "format: journal needs at least %u blocks\n", JOURNAL_MIN_BLOCKS);
+            return -1;
+        }
+    }
 
-    // Step 3: write superblock at block 0
-    fseek(fs.disk, 0, SEEK_SET);
-    fwrite(&fs.sb, sizeof(Superblock), 1,fs.disk);
+    // Step 1: size bitmaps and inode table for this image
+    Superblock sb;
+    if (plan_layout(&sb, num_blocks, opts->inode_ratio, journal_blocks) == -1) {
+        fprintf(stderr, "format: %u blocks too small for the metadata\n", num_blocks);
+        return -1;
+    }
+    if (opts->extents) sb.features |= FEATURE_EXTENTS;
+    if (opts->inline_data) sb.features |= FEATURE_INLINE_DATA;
+    if (opts->lazy_init) sb.features |= FEATURE_LAZY_ITABLE;
+    if (opts->checksums) sb.features |= FEATURE_METADATA_CSUM;
+
+    fs.dev = bdev_open(filename, opts->backend, BDEV_CREATE | open_flags(opts), num_blocks);
+    if (!fs.dev) return -1;
+    fs.aio = open_queue(opts);
+
+    // Step 2: zero the metadata, the fresh image is already zero everywhere else. a lazy format
+    // trusts the sparse image for all of it: the journal is only read past its super, and inode
+    // tables get zeroed by group_init_itable before an inode of theirs is handed out
+    int rc = 0;
+    if (!opts->lazy_init) {
+        int table = opts->checksums ? CSUM_ITABLE : CSUM_NONE;
+        rc = zero_blocks(0, 1 + sb.group_desc_blocks, CSUM_NONE);
+        for (uint32_t g = 0; g < sb.groups_count && rc == 0; g++) {
+            uint32_t first = g * sb.blocks_per_group;
+            uint32_t meta_first = g == 0 ? sb.block_bitmap_start : first;
+            rc = zero_blocks(meta_first, 2, CSUM_NONE);
+            if (rc == 0) rc = zero_blocks(meta_first + 2, sb.inode_table_blocks, table);
+        }
+        if (rc == 0 && journal_blocks) rc = zero_blocks(sb.journal_start, journal_blocks, CSUM_NONE);
+    }
+    if (rc == -1) return -1;
 
+    fs.sb = sb;
+    fs.mounted = 0; // nothing is verified against a half written image
+    snap_unload();
+    bitmap_destroy(&block_bitmap);
+    bitmap_destroy(&inode_bitmap);
+    if (bitmap_init(&block_bitmap, fs.sb.total_blocks) == -1 || bitmap_init(&inode_bitmap, fs.sb.total_inodes) == -1) {
+        return -1;
+    }
+
+    // Step 3: group descriptors and bitmaps
+    if (init_groups() == -1) return -1;
     initialize_bitmap();
+    if (write_groups(1) == -1) return -1;
+
+    // Step 4: write superblock at block 0, from here on all metadata goes through the cache
+    cache_init(CACHE_DEFAULT_BUFFERS);
+    icache_init(ICACHE_DEFAULT_INODES);
+    dcache_init(DCACHE_DEFAULT_ENTRIES);
+    path_reset();
+    if (journal_blocks && (journal_format(fs.dev, fs.sb.journal_start, journal_blocks) == -1 ||
+                           journal_open(fs.sb.journal_start, journal_blocks, opts->commit_batch,
+                                        opts->commit_window_us) == -1)) {
+        return -1;
+    }
+    tx_begin();
+    sync_superblock();
 
     fs.sb.root_inode = initialize_root(); // initialize root inode
+    sync_superblock();
+    tx_commit();
+    fs.mounted = 1;
 
-    printf("Disk formatted: %s (%u blocks)\n", filename, num_blocks);
+    printf("Disk formatted: %s (%u blocks, %s)\n", filename, num_blocks, bdev_type_name(opts->backend));
+    return 0;
 }
 
+// marks what sits outside any group's data in memory, write_groups puts it on disk
 void initialize_bitmap() {
-    update_block_bitmap(0, 1); // superblock
-    update_block_bitmap(1, 1); // block bitmap space
-    update_block_bitmap(2, 1); // inode bitmap space
-    update_block_bitmap(3, 1); // inode table space 1/4
-    update_block_bitmap(4, 1);
-    update_block_bitmap(5, 1);
-    update_block_bitmap(6, 1); // inode table space 4/4
+    // superblock and descriptor table, every group's bitmaps and inode table are marked by init_groups
+    bitmap_set_run(&block_bitmap, 0, 1 + fs.sb.group_desc_blocks);
+    if (fs.sb.journal_blocks) {
+        bitmap_set_run(&block_bitmap, fs.sb.journal_start, fs.sb.journal_blocks);
+        fs.groups[group_of_block(fs.sb.journal_start)].free_blocks -= fs.sb.journal_blocks;
+    }
 }
 
-int update_inode_bitmap(uint32_t inode_num, uint8_t used) {
-    inode_bitmap[inode_num] = used;   // mark inode in bitmap
+// puts the reads of both bitmaps of the groups from first on in flight together, they sit next
+// to each other at the start of every group
+static void readahead_bitmaps(uint32_t first) {
+    uint32_t blocks[CACHE_READAHEAD_MAX];
+    uint32_t n = 0;
+    for (uint32_t g = first; g < fs.sb.groups_count && n < CACHE_READAHEAD_MAX; g++) {
+        blocks[n++] = fs.groups[g].block_bitmap;
+        blocks[n++] = fs.groups[g].inode_bitmap;
+    }
+    cache_readahead(blocks, n);
+}
+
+// opens an existing image and loads superblock and bitmaps into memory
+int mount_disk(const char *filename) {
+    return mount_disk_opts(filename, NULL);
+}
+
+static int mount_image(const char *filename, const FsOptions *opts) {
+    FsOptions defaults;
+    if (!opts) {
+        fs_default_options(&defaults);
+        opts = &defaults;
+    }
+
+    fs.dev = bdev_open(filename, opts->backend, open_flags(opts), 0);
+    if (!fs.dev) return -1;
+
+    // replay straight on the device, before anything of the image is cached
+    uint8_t *block;
+    if (posix_memalign((void **)&block, BDEV_ALIGN, BLOCK_SIZE) != 0 || bdev_read(fs.dev, 0, 1, block) == -1) {
+        bdev_close(fs.dev);
+        fs.dev = NULL;
+        return -1;
+    }
+    Superblock on_disk = *(const Superblock *)block;
+    // the journal guards what it replays with its own checksum
+    int intact = !(on_disk.features & FEATURE_METADATA_CSUM) || csum_verify(0, block, CSUM_SUPER);
+    free(block);
+    if (!intact) {
+        fprintf(stderr, "mount: superblock fails its checksum\n");
+        bdev_close(fs.dev);
+        fs.dev = NULL;
+        return -1;
+    }
+    if (on_disk.journal_blocks && journal_replay(fs.dev, on_disk.journal_start, on_disk.journal_blocks) == -1) {
+        bdev_close(fs.dev);
+        fs.dev = NULL;
+        return -1;
+    }
+
+    fs.aio = open_queue(opts);
+    cache_init(CACHE_DEFAULT_BUFFERS);
+    icache_init(ICACHE_DEFAULT_INODES);
+    dcache_init(DCACHE_DEFAULT_ENTRIES);
+    path_reset();
+    cache_read(0, &fs.sb, sizeof(Superblock));
 
-    // calc correct block + inode_num
-    uint32_t offset = fs.sb.inode_bitmap_start * BLOCK_SIZE + inode_num;
+    // descriptor table, then every group's bitmap slice into the global bitmaps
+    bitmap_destroy(&block_bitmap);
+    bitmap_destroy(&inode_bitmap);
+    free(fs.groups);
+    uint32_t bitmap_bytes = fs.sb.blocks_per_group / 8;
+    uint32_t inode_bytes = fs.sb.inodes_per_group / 8;
+    fs.groups = malloc(fs.sb.groups_count * sizeof(GroupDesc));
+    uint8_t *bits = malloc((size_t)fs.sb.groups_count * bitmap_bytes);
+    if (!fs.groups || !bits || init_group_locks() == -1 || bitmap_init(&block_bitmap, fs.sb.total_blocks) == -1 ||
+        bitmap_init(&inode_bitmap, fs.sb.total_inodes) == -1) {
+        free(bits);
+        unmount_disk();
+        return -1;
+    }
+    cache_read(BLOCK_SIZE, fs.groups, fs.sb.groups_count * sizeof(GroupDesc));
+    if (!(fs.sb.features & FEATURE_LAZY_ITABLE)) {
+        // images formatted in full have every table zeroed, the field was padding before
+        for (uint32_t g = 0; g < fs.sb.groups_count; g++) fs.groups[g].itable_zeroed = fs.sb.inode_table_blocks;
+    }
+
+    // bit-packed on disk, same bit order as in memory
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        if (g % (CACHE_READAHEAD_MAX / 2) == 0) readahead_bitmaps(g);
+        cache_read((uint64_t)fs.groups[g].block_bitmap * BLOCK_SIZE, bits + (size_t)g * bitmap_bytes, bitmap_bytes);
+    }
+    bitmap_load(&block_bitmap, bits);
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        cache_read((uint64_t)fs.groups[g].inode_bitmap * BLOCK_SIZE, bits + (size_t)g * inode_bytes, inode_bytes);
+    }
+    bitmap_load(&inode_bitmap, bits);
+    free(bits);
 
-    // set file pointer and write update
-    fseek(fs.disk, offset, SEEK_SET);
-    fwrite(&used, 1, 1,fs.disk);
+    for (uint32_t g = 0; g < fs.sb.groups_count && (fs.sb.features & FEATURE_METADATA_CSUM) && !opts->repair; g++) {
+        if (fs.groups[g].block_bitmap_csum != bitmap_slice_csum(&block_bitmap, g, bitmap_bytes) ||
+            fs.groups[g].inode_bitmap_csum != bitmap_slice_csum(&inode_bitmap, g, inode_bytes)) {
+            fprintf(stderr, "mount: bitmaps of group %u fail their checksum\n", g);
+            unmount_disk();
+            return -1;
+        }
+    }
 
+    if (fs.sb.journal_blocks && journal_open(fs.sb.journal_start, fs.sb.journal_blocks, opts->commit_batch,
+                                             opts->commit_window_us) == -1) {
+        unmount_disk();
+        return -1;
+    }
+    if (snap_load() == -1) {
+        unmount_disk();
+        return -1;
+    }
+
+    fs.mounted = 1;
     return 0;
 }
 
-int update_block_bitmap(uint32_t block_num, uint8_t used) {
-    block_bitmap[block_num] = used;  // mark block in bitmap
+// formats filename with num_blocks blocks, opts NULL means defaults, returns 0 or -1
+int format_disk_opts(const char *filename, uint32_t num_blocks, const FsOptions *opts) {
+    StatsSpan span = stats_begin(OP_FORMAT);
+    int rc = format_image(filename, num_blocks, opts);
+    stats_end(span);
+    return rc;
+}
+
+int mount_disk_opts(const char *filename, const FsOptions *opts) {
+    StatsSpan span = stats_begin(OP_MOUNT);
+    int rc = mount_image(filename, opts);
+    stats_end(span);
+    return rc;
+}
 
-    // calc correct block + block_num
-    uint32_t offset =fs.sb.block_bitmap_start * BLOCK_SIZE + block_num;
+// commits dirty in-core inodes and the superblock, then writes everything home,
+// returns num of blocks written back
+int fs_sync() {
+    StatsSpan span = stats_begin(OP_SYNC);
+    tx_begin();
+    icache_flush();
+    sync_superblock();
+    tx_commit();
+
+    // home writes see no transaction halfway through its buffers
+    tx_freeze();
+    int written = journal_checkpoint();
+    tx_thaw();
+    stats_end(span);
+    return written;
+}
+
+// writes back everything cached and closes the image
+void unmount_disk() {
+    if (!fs.dev) return;
+    StatsSpan span = stats_begin(OP_UNMOUNT);
+
+    tx_begin();
+    icache_destroy();
+    sync_superblock();
+    tx_commit();
+    tx_freeze();
+    journal_close();
+    dcache_destroy();
+    cache_destroy();
+    snap_unload();
+    aio_close(fs.aio);
+    bdev_close(fs.dev);
+    bitmap_destroy(&block_bitmap);
+    bitmap_destroy(&inode_bitmap);
+    free(fs.groups);
+    destroy_group_locks();
+    tx_thaw();
+
+    fs.dev = NULL;
+    fs.aio = NULL;
+    fs.groups = NULL;
+    fs.mounted = 0;
+    stats_end(span);
+}
 
-    // set file pointer to offset adn write update
-    fseek(fs.disk, offset, SEEK_SET);
-    fwrite(&used, 1, 1,fs.disk);
+// bitmap bytes of one group changed inside the open transaction, [lo, hi] with lo > hi meaning none
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+} DirtyRange;
 
+typedef struct {
+    DirtyRange blocks;
+    DirtyRange inodes;
+    uint8_t desc;       // descriptor counters changed
+    uint8_t listed;     // already in dirty_groups
+} GroupDirty;
+
+static GroupDirty *group_dirty = NULL;  // per group, sized on first use
+static uint32_t group_dirty_count = 0;
+static uint32_t *dirty_groups = NULL;   // groups with anything in group_dirty
+static uint32_t num_dirty_groups = 0;
+
+static const DirtyRange CLEAN = { UINT32_MAX, 0 };
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER; // the list is shared by all groups
+
+// dirty state of group, NULL if it can't be tracked (written through instead),
+// the group's own ranges are guarded by its group lock
+static GroupDirty *dirty_state(uint32_t group) {
+    pthread_mutex_lock(&dirty_lock);
+    if (group_dirty_count != fs.sb.groups_count) {
+        free(group_dirty);
+        free(dirty_groups);
+        group_dirty = malloc(fs.sb.groups_count * sizeof(GroupDirty));
+        dirty_groups = malloc(fs.sb.groups_count * sizeof(uint32_t));
+        if (!group_dirty || !dirty_groups) {
+            free(group_dirty);
+            free(dirty_groups);
+            group_dirty = NULL;
+            dirty_groups = NULL;
+            group_dirty_count = 0;
+            pthread_mutex_unlock(&dirty_lock);
+            return NULL;
+        }
+        for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+            group_dirty[g] = (GroupDirty){ CLEAN, CLEAN, 0, 0 };
+        }
+        group_dirty_count = fs.sb.groups_count;
+        num_dirty_groups = 0;
+    }
+    GroupDirty *d = &group_dirty[group];
+    if (!d->listed) {
+        d->listed = 1;
+        dirty_groups[num_dirty_groups++] = group;
+    }
+    pthread_mutex_unlock(&dirty_lock);
+    return d;
+}
+
+// copies group bytes [lo, hi] of bm to the group's cached bitmap block, written back on flush
+static void write_bitmap_bytes(const Bitmap *bm, uint32_t group, uint32_t bytes_per_group,
+                               uint32_t bitmap_block, uint32_t lo, uint32_t hi) {
+    const uint8_t *src = (const uint8_t *)bm->words + (uint64_t)group * bytes_per_group;
+    cache_write((uint64_t)bitmap_block * BLOCK_SIZE + lo, src + lo, hi - lo + 1);
+}
+
+static void write_desc(uint32_t group) {
+    cache_write(BLOCK_SIZE + (uint64_t)group * sizeof(GroupDesc), &fs.groups[group], sizeof(GroupDesc));
+}
+
+// copies the in-memory bytes holding bits [first, first + count) to the cached bitmap blocks of
+// their groups, inside a transaction only the byte ranges are remembered for flush_bitmaps
+static void write_bitmap_bits(const Bitmap *bm, int inodes, uint32_t first, uint32_t count) {
+    uint32_t per_group = inodes ? fs.sb.inodes_per_group : fs.sb.blocks_per_group;
+    uint32_t end = first + count;
+
+    while (first < end) {
+        uint32_t group = first / per_group;
+        uint32_t group_first = group * per_group;
+        uint32_t last = end < group_first + per_group ? end : group_first + per_group;
+        uint32_t lo = (first - group_first) / 8;
+        uint32_t hi = (last - 1 - group_first) / 8;
+        uint32_t bitmap_block = inodes ? fs.groups[group].inode_bitmap : fs.groups[group].block_bitmap;
+
+        GroupDirty *d = tx_active() ? dirty_state(group) : NULL;
+        if (d) {
+            DirtyRange *r = inodes ? &d->inodes : &d->blocks;
+            if (lo < r->lo) r->lo = lo;
+            if (hi > r->hi) r->hi = hi;
+        } else {
+            write_bitmap_bytes(bm, group, per_group / 8, bitmap_block, lo, hi);
+            if (fs.sb.features & FEATURE_METADATA_CSUM) {
+                group_csum(group);
+                write_desc(group);
+            }
+        }
+        first = last;
+    }
+}
+
+// the descriptor is written on commit, or right away outside a transaction
+static void desc_changed(uint32_t group) {
+    GroupDirty *d = tx_active() ? dirty_state(group) : NULL;
+    if (d) d->desc = 1;
+    else write_desc(group);
+}
+
+// changes a group's free counters, the descriptor is written on commit (or right away),
+// called with the group locked. the stores are atomic for allocators peeking at the counters unlocked
+void group_adjust(uint32_t group, int blocks, int inodes, int dirs) {
+    GroupDesc *gd = &fs.groups[group];
+    __atomic_store_n(&gd->free_blocks, gd->free_blocks + blocks, __ATOMIC_RELAXED);
+    __atomic_store_n(&gd->free_inodes, gd->free_inodes + inodes, __ATOMIC_RELAXED);
+    __atomic_store_n(&gd->used_dirs, gd->used_dirs + dirs, __ATOMIC_RELAXED);
+    desc_changed(group);
+}
+
+// zeroes the group's inode table up to the block holding its index-th inode, blocks past
+// itable_zeroed may hold anything on a lazily formatted image. inodes go out lowest first, so
+// it's one block now and then. called with the group locked, returns 0 or -1
+int group_init_itable(uint32_t group, uint32_t index) {
+    GroupDesc *gd = &fs.groups[group];
+    uint32_t need = index / INODES_PER_BLOCK + 1;
+    if (gd->itable_zeroed >= need) return 0;
+
+    for (uint32_t b = gd->itable_zeroed; b < need; b++) {
+        Buffer *buf = bget(gd->inode_table + b);
+        if (!buf) return -1;
+        memset(buf->data, 0, BLOCK_SIZE); // a cached copy of the stale block is no better
+        bdirty(buf);
+        brelse(buf);
+        gd->itable_zeroed = b + 1;
+    }
+    desc_changed(group);
+    return 0;
+}
+
+// writes the bitmap bytes and descriptors deferred by the transaction, one cache write each,
+// called by the commit with no other thread inside a transaction
+void flush_bitmaps() {
+    for (uint32_t i = 0; i < num_dirty_groups; i++) {
+        uint32_t g = dirty_groups[i];
+        GroupDirty *d = &group_dirty[g];
+        if (d->blocks.lo <= d->blocks.hi) {
+            write_bitmap_bytes(&block_bitmap, g, fs.sb.blocks_per_group / 8, fs.groups[g].block_bitmap,
+                               d->blocks.lo, d->blocks.hi);
+        }
+        if (d->inodes.lo <= d->inodes.hi) {
+            write_bitmap_bytes(&inode_bitmap, g, fs.sb.inodes_per_group / 8, fs.groups[g].inode_bitmap,
+                               d->inodes.lo, d->inodes.hi);
+        }
+        int bits = d->blocks.lo <= d->blocks.hi || d->inodes.lo <= d->inodes.hi;
+        if (bits && (fs.sb.features & FEATURE_METADATA_CSUM)) {
+            group_csum(g);
+            d->desc = 1;
+        }
+        if (d->desc) write_desc(g);
+        *d = (GroupDirty){ CLEAN, CLEAN, 0, 0 };
+    }
+    num_dirty_groups = 0;
+}
+
+// called with the inode's group locked
+int update_inode_bitmap(uint32_t inode_num, uint8_t used) {
+    // mark inode in bitmap
+    if (used) bitmap_set(&inode_bitmap, inode_num);
+    else bitmap_clear(&inode_bitmap, inode_num);
+
+    write_bitmap_bits(&inode_bitmap, 1, inode_num, 1);
     return 0;
 }
 
+int update_block_bitmap(uint32_t block_num, uint8_t used) {
+    return update_block_bitmap_run(block_num, 1, used);
+}
+
+// marks count blocks from first, one cache write per group the run touches,
+// the caller holds the lock of every group the run touches
+int update_block_bitmap_run(uint32_t first, uint32_t count, uint8_t used) {
+    if (count == 0) return 0;
 
+    if (used) {
+        bitmap_set_run(&block_bitmap, first, count);
+    } else {
+        for (uint32_t b = first; b < first + count; b++) bitmap_clear(&block_bitmap, b);
+    }
+
+    write_bitmap_bits(&block_bitmap, 0, first, count);
+    return 0;
+}
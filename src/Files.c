@@ -6,20 +6,626 @@
 
 #include <Directories.h>
 #include <FileManagement.h>
+#include <Transaction.h>
+#include <Cache.h>
+#include <Extents.h>
+#include <Stats.h>
+#include <Snapshot.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#define CLASSIC_MAX_BLOCKS ((uint64_t)DIRECT_PTRS + PTRS_PER_BLOCK + (uint64_t)PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+#define EXTENT_MAX_BLOCKS ((uint64_t)UINT32_MAX)
+#define FILE_IO_BATCH 16 // whole-block runs of one read or write in flight together
 
 int creat(uint32_t parent, char *name, uint16_t mode) {
-    // check if entry with this name already exists
-    if (dir_lookup(parent, name) != -1) return -1;
-    // check if type regular file
-    if (mode & 0xF000 != IREG) return -1;
+    StatsSpan span = stats_begin(OP_CREAT);
+    int file = -1;
 
-    int file = create_inode(mode);
-    if (file == -1) return -1;
+    // only a regular file whose name isn't taken yet
+    if ((mode & 0xF000) == IREG && dir_lookup(parent, name) == -1) {
+        // inode, bitmap, dir block and superblock updates commit together
+        tx_begin();
+        file = create_inode_in(parent, mode);
+        // a racing creat may have taken the name since the lookup, the inode goes again
+        if (file != -1 && dir_add(parent, name, file, IREG) == -1) {
+            free_inode((uint32_t)file);
+            file = -1;
+        }
+        tx_commit();
+    }
+    stats_end(span);
+    return file;
+}
+
+static uint64_t max_blocks(const Inode *inode) {
+    // an inline file gets the mapping new files of the image get once it moves out
+    if (inode->flags & INODE_INLINE) return (fs.sb.features & FEATURE_EXTENTS) ? EXTENT_MAX_BLOCKS : CLASSIC_MAX_BLOCKS;
+    return (inode->flags & INODE_EXTENTS) ? EXTENT_MAX_BLOCKS : CLASSIC_MAX_BLOCKS;
+}
 
+// allocates a zeroed block for an indirect pointer at *slot, dirtying whatever holds the slot
+static long new_pointer_block(InodeHandle *h, uint32_t *slot, Buffer *owner, uint32_t goal) {
+    int b = alloc_block_near(goal);
+    if (b == -1) return -1;
+    Buffer *nb = bget(b);
+    if (!nb) {
+        free_block(b);
+        return -1;
+    }
+    memset(nb->data, 0, BLOCK_SIZE);
+    bdirty(nb);
+    brelse(nb);
 
-    dir_add(parent, name, file, mode);
+    *slot = (uint32_t)b;
+    if (owner) bdirty(owner);
+    else idirty(h);
+    return b;
+}
 
-    return file;
+// slot holding logical's block pointer, in the inode (owner NULL) or in an indirect block
+// returned pinned through owner, missing indirect blocks are allocated near goal on create,
+// *slot is NULL for a hole in the pointer tree, returns 0 or -1
+static int classic_slot(InodeHandle *h, uint32_t logical, int create, uint32_t goal, uint32_t **slot,
+                        Buffer **owner) {
+    Inode *inode = &h->inode;
+    *slot = NULL;
+    *owner = NULL;
+    if (logical < DIRECT_PTRS) {
+        *slot = &inode->direct[logical];
+        return 0;
+    }
+
+    logical -= DIRECT_PTRS;
+    uint32_t *top = &inode->indirect;
+    int levels = 1;
+    if (logical >= PTRS_PER_BLOCK) {
+        logical -= PTRS_PER_BLOCK;
+        if (logical >= PTRS_PER_BLOCK * PTRS_PER_BLOCK) return -1;
+        top = &inode->double_indirect;
+        levels = 2;
+    }
+
+    uint32_t *ptr = top;
+    Buffer *holder = NULL;
+    for (int level = levels; level > 0; level--) {
+        if (*ptr == 0) {
+            if (!create || new_pointer_block(h, ptr, holder, goal) == -1) {
+                brelse(holder);
+                return create ? -1 : 0;
+            }
+        }
+        Buffer *b = bread(*ptr);
+        brelse(holder);
+        if (!b) return -1;
+        holder = b;
+        uint32_t index = level == 2 ? logical / PTRS_PER_BLOCK : logical % PTRS_PER_BLOCK;
+        ptr = (uint32_t *)b->data + index;
+    }
+
+    *slot = ptr;
+    *owner = holder;
+    return 0;
+}
+
+// block mapped at logical, 0 for a hole, -1 on error
+static long classic_get(InodeHandle *h, uint32_t logical) {
+    uint32_t *slot;
+    Buffer *owner;
+    if (classic_slot(h, logical, 0, 0, &slot, &owner) == -1) return -1;
+    long block = slot ? *slot : 0;
+    brelse(owner);
+    return block;
+}
+
+// maps logical to block, indirect blocks it needs go near goal, returns 0 or -1
+static int classic_set(InodeHandle *h, uint32_t logical, uint32_t block, uint32_t goal) {
+    uint32_t *slot;
+    Buffer *owner;
+    if (classic_slot(h, logical, 1, goal, &slot, &owner) == -1) return -1;
+    *slot = block;
+    if (owner) bdirty(owner);
+    else idirty(h);
+    brelse(owner);
+    return 0;
+}
+
+// physical block of logical plus how many blocks from it (at most max) continue contiguously
+// on disk in run, a hole is filled with one allocated run on create (fresh tells), returns the
+// block, 0 for a hole (run = its length) or -1
+static long map_run(InodeHandle *h, uint32_t logical, uint32_t max, int create, uint32_t *run, int *fresh) {
+    *fresh = 0;
+    if (h->inode.flags & INODE_EXTENTS) {
+        uint32_t len = 0;
+        long p = ext_map(&h->inode, logical, &len);
+        if (p == 0 && create) {
+            p = ext_alloc(h, logical, max, &len);
+            *fresh = 1;
+        }
+        if (p == -1) return -1;
+        *run = len < max ? len : max;
+        return p;
+    }
+
+    long first = classic_get(h, logical);
+    if (first == -1) return -1;
+    if (first > 0) {
+        uint32_t n = 1;
+        while (n < max && logical + n < CLASSIC_MAX_BLOCKS && classic_get(h, logical + n) == first + n) n++;
+        *run = n;
+        return first;
+    }
+
+    // how far the hole goes
+    uint32_t n = 1;
+    while (n < max && logical + n < CLASSIC_MAX_BLOCKS && classic_get(h, logical + n) == 0) n++;
+    *run = n;
+    if (!create) return 0;
+
+    // data right after the file's previous block, or at the start of its inode's group
+    uint32_t goal = group_data_start(group_of_inode(h->inum));
+    long prev = logical > 0 ? classic_get(h, logical - 1) : 0;
+    if (prev > 0) goal = (uint32_t)prev + 1;
+
+    uint32_t got;
+    long b = alloc_block_extent(goal, n, &got);
+    if (b == -1) return -1;
+    for (uint32_t i = 0; i < got; i++) {
+        // indirect blocks go after the run so they don't split it
+        if (classic_set(h, logical + i, (uint32_t)b + i, (uint32_t)b + got) == -1) {
+            free_block_run((uint32_t)b + i, got - i);
+            if (i == 0) return -1;
+            got = i;
+            break;
+        }
+    }
+    *fresh = 1;
+    *run = got;
+    return b;
+}
+
+// maps count blocks from first, allocated and written by the caller, at logical of a hole in a
+// block mapped file, for bulk loaders that place many files' data in one run. h is locked inside
+// a transaction, returns 0 or -1
+int file_map_run(InodeHandle *h, uint32_t logical, uint32_t first, uint32_t count) {
+    if (h->inode.flags & INODE_INLINE) return -1;
+    if (h->inode.flags & INODE_EXTENTS) return ext_insert(h, logical, first, count);
+    for (uint32_t i = 0; i < count; i++) {
+        // indirect blocks go after the run, like map_run places them
+        if (classic_set(h, logical + i, first + i, first + count) == -1) return -1;
+    }
+    return 0;
+}
+
+// whole-block runs of one call, kept in flight on the async queue until the call returns
+typedef struct {
+    AioRequest reqs[FILE_IO_BATCH];
+    uint32_t n;
+    int failed;
+} IoBatch;
+
+// waits for everything queued, a lone run just goes synchronously, returns 0 or -1
+static int batch_flush(IoBatch *b) {
+    if (b->n == 1) {
+        AioRequest *r = &b->reqs[0];
+        int rc = r->op == AIO_READ ? bdev_read(fs.dev, r->block, r->count, r->buf)
+                                   : bdev_write(fs.dev, r->block, r->count, r->buf);
+        if (rc == -1) b->failed = 1;
+    } else if (b->n > 1) {
+        if (aio_submit(fs.aio, b->reqs, b->n) == -1) {
+            b->failed = 1;
+        } else {
+            aio_wait(fs.aio, b->reqs, b->n);
+            for (uint32_t i = 0; i < b->n; i++) {
+                if (b->reqs[i].result == -1) b->failed = 1;
+            }
+        }
+    }
+    b->n = 0;
+    return b->failed ? -1 : 0;
+}
+
+// queues a run of count blocks, without a queue (or for a run too long for one transfer) it
+// goes to the device right away, returns 0 or -1
+static int batch_add(IoBatch *b, AioOp op, uint64_t block, uint32_t count, void *buf) {
+    if (!fs.aio || (uint64_t)count * BLOCK_SIZE > AIO_MAX_TRANSFER) {
+        int rc = op == AIO_READ ? bdev_read(fs.dev, block, count, buf) : bdev_write(fs.dev, block, count, buf);
+        return rc == -1 ? -1 : 0;
+    }
+    b->reqs[b->n++] = (AioRequest){ .op = op, .block = block, .count = count, .buf = buf };
+    return b->n == FILE_IO_BATCH ? batch_flush(b) : 0;
+}
+
+// writes len bytes at pos, whole blocks go to the device straight from src, as one write per
+// physically contiguous run, returns 0 or -1
+static int write_range(InodeHandle *h, uint64_t pos, const uint8_t *src, size_t len) {
+    if (h->inode.flags & INODE_INLINE) {
+        memcpy((uint8_t *)h->inode.direct + pos, src, len); // make_room checked it fits
+        idirty(h);
+        return 0;
+    }
+
+    IoBatch batch = { .n = 0, .failed = 0 };
+    while (len > 0) {
+        uint32_t logical = (uint32_t)(pos / BLOCK_SIZE);
+        uint32_t in_block = pos % BLOCK_SIZE;
+        size_t chunk;
+        uint32_t run;
+        int fresh;
+
+        if (in_block || len < BLOCK_SIZE) {
+            // partial block: read, patch, write back through an aligned block of this thread
+            chunk = BLOCK_SIZE - in_block < len ? BLOCK_SIZE - in_block : len;
+            _Alignas(BDEV_ALIGN) uint8_t block[BLOCK_SIZE];
+            long p = map_run(h, logical, 1, 1, &run, &fresh);
+            if (p <= 0) break;
+
+            if (fresh) memset(block, 0, BLOCK_SIZE);
+            else if (bdev_read(fs.dev, (uint64_t)p, 1, block) == -1) break;
+            memcpy(block + in_block, src, chunk);
+            if (snap_live) snap_cow_run((uint32_t)p, 1);
+            if (bdev_write(fs.dev, (uint64_t)p, 1, block) == -1) break;
+        } else {
+            uint64_t blocks = len / BLOCK_SIZE;
+            long p = map_run(h, logical, blocks < UINT32_MAX ? (uint32_t)blocks : UINT32_MAX, 1, &run, &fresh);
+            if (p <= 0) break;
+            if (snap_live && !fresh) snap_cow_run((uint32_t)p, run);
+            if (batch_add(&batch, AIO_WRITE, (uint64_t)p, run, (void *)src) == -1) break;
+            chunk = (size_t)run * BLOCK_SIZE;
+        }
+
+        pos += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+    // src may be reused once we return, so the queued runs finish first even on an error
+    if (batch_flush(&batch) == -1) return -1;
+    return len > 0 ? -1 : 0;
+}
+
+// reads len bytes at pos, holes read as zeros, returns 0 or -1
+static int read_range(InodeHandle *h, uint64_t pos, uint8_t *dst, size_t len) {
+    if (h->inode.flags & INODE_INLINE) {
+        memcpy(dst, (const uint8_t *)h->inode.direct + pos, len); // never past the size
+        return 0;
+    }
+
+    IoBatch batch = { .n = 0, .failed = 0 };
+    while (len > 0) {
+        uint32_t logical = (uint32_t)(pos / BLOCK_SIZE);
+        uint32_t in_block = pos % BLOCK_SIZE;
+        size_t chunk;
+        uint32_t run;
+        int fresh;
+
+        if (in_block || len < BLOCK_SIZE) {
+            chunk = BLOCK_SIZE - in_block < len ? BLOCK_SIZE - in_block : len;
+            _Alignas(BDEV_ALIGN) uint8_t block[BLOCK_SIZE];
+            long p = map_run(h, logical, 1, 0, &run, &fresh);
+            if (p == -1) break;
+
+            if (p == 0) memset(dst, 0, chunk);
+            else {
+                if (bdev_read(fs.dev, (uint64_t)p, 1, block) == -1) break;
+                memcpy(dst, block + in_block, chunk);
+            }
+        } else {
+            uint64_t blocks = len / BLOCK_SIZE;
+            long p = map_run(h, logical, blocks < UINT32_MAX ? (uint32_t)blocks : UINT32_MAX, 0, &run, &fresh);
+            if (p == -1) break;
+            chunk = (size_t)run * BLOCK_SIZE;
+
+            if (p == 0) memset(dst, 0, chunk);
+            else if (batch_add(&batch, AIO_READ, (uint64_t)p, run, dst) == -1) break;
+        }
+
+        pos += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+    if (batch_flush(&batch) == -1) return -1;
+    return len > 0 ? -1 : 0;
+}
+
+// true if no block is mapped, whatever the size says
+static int unmapped(const Inode *inode) {
+    if (inode->flags & INODE_EXTENTS) return ext_end(inode) == 0;
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        if (inode->direct[i]) return 0;
+    }
+    return inode->indirect == 0 && inode->double_indirect == 0;
+}
+
+static int classic_truncate(InodeHandle *h, uint32_t keep);
+
+// moves an inline file's bytes to a block of the mapping new files of the image get,
+// h is locked inside a transaction, returns 0 or -1
+static int promote_file(InodeHandle *h) {
+    uint8_t data[INLINE_DATA_MAX];
+    size_t size = (size_t)h->inode.size;
+    memcpy(data, h->inode.direct, INLINE_DATA_MAX);
+
+    h->inode.flags &= ~INODE_INLINE;
+    memset(h->inode.direct, 0, INLINE_DATA_MAX);
+    if (fs.sb.features & FEATURE_EXTENTS) ext_init(&h->inode);
+    idirty(h);
+    if (size == 0 || write_range(h, 0, data, size) == 0) return 0;
+
+    // blocks mapped before the write failed go back, the bytes stay inline
+    if (h->inode.flags & INODE_EXTENTS) ext_truncate(h, 0);
+    else classic_truncate(h, 0);
+    h->inode.flags = (h->inode.flags & ~INODE_EXTENTS) | INODE_INLINE;
+    memcpy(h->inode.direct, data, INLINE_DATA_MAX);
+    return -1;
+}
+
+// gets the file ready for bytes up to end: an empty file whose first write fits goes inline,
+// an inline one that outgrows the inode moves to blocks, returns 0 or -1
+static int make_room(InodeHandle *h, uint64_t end) {
+    Inode *inode = &h->inode;
+    if (!(inode->flags & INODE_INLINE) && (fs.sb.features & FEATURE_INLINE_DATA) && inode->size == 0 &&
+        end <= INLINE_DATA_MAX && unmapped(inode)) {
+        memset(inode->direct, 0, INLINE_DATA_MAX);
+        inode->flags = (inode->flags & ~INODE_EXTENTS) | INODE_INLINE;
+        idirty(h);
+    }
+    if ((inode->flags & INODE_INLINE) && end > INLINE_DATA_MAX) return promote_file(h);
+    return 0;
+}
+
+// largest size the inode's block mapping can address
+uint64_t fs_max_file_size(uint32_t inum) {
+    InodeHandle *h = iget(inum);
+    if (!h) return 0;
+    uint64_t max = max_blocks(&h->inode) * BLOCK_SIZE;
+    iput(h);
+    return max;
+}
+
+// reads up to len bytes at offset, returns num of bytes read (0 at or past the end) or -1
+static long read_file(uint32_t inum, uint64_t offset, void *buf, size_t len) {
+    InodeHandle *h = iget(inum);
+    if (!h) return -1;
+    if ((h->inode.mode & 0xF000) != IREG) {
+        iput(h);
+        return -1;
+    }
+
+    // readers share the inode, a writer or truncate waits for them
+    ilock_shared(h);
+    if (offset >= h->inode.size) len = 0;
+    else if (len > h->inode.size - offset) len = (size_t)(h->inode.size - offset);
+
+    int rc = read_range(h, offset, buf, len);
+    iunlock(h);
+
+    // atime moves at most once a second, so readers rarely need the inode to themselves for it.
+    // the only exclusive hold outside a transaction, nothing else is held or waited for meanwhile
+    time_t now = time(NULL);
+    if (rc == 0 && len > 0 && __atomic_load_n(&h->inode.atime, __ATOMIC_RELAXED) != now) {
+        ilock(h);
+        __atomic_store_n(&h->inode.atime, now, __ATOMIC_RELAXED);
+        idirty(h);
+        iunlock(h);
+    }
+    iput(h);
+    return rc == -1 ? -1 : (long)len;
+}
+
+// writes len bytes at offset, growing the file as needed, returns num of bytes written or -1.
+// data is written before the transaction that maps it commits, so a crash never leaves metadata
+// pointing at blocks that were never written. like write(2) nothing is durable before fs_sync,
+// so the mapping updates ride in the journal batch instead of forcing a sync each
+static long write_file(uint32_t inum, uint64_t offset, const void *buf, size_t len) {
+    InodeHandle *h = iget(inum);
+    if (!h) return -1;
+    if ((h->inode.mode & 0xF000) != IREG || offset + len > max_blocks(&h->inode) * BLOCK_SIZE) {
+        iput(h);
+        return -1;
+    }
+
+    const uint8_t *src = buf;
+    size_t done = 0;
+    while (done < len) {
+        // each transaction maps a bounded number of blocks, so it keeps only a few metadata
+        // buffers pinned however large the write is
+        uint64_t pos = offset + done;
+        uint64_t stop = (pos / BLOCK_SIZE + FILE_TX_BLOCKS) * BLOCK_SIZE;
+        size_t chunk = stop - pos < len - done ? (size_t)(stop - pos) : len - done;
+
+        // locked per chunk inside its transaction, so chunks of concurrent writers may interleave
+        tx_begin();
+        tx_mark_lazy();
+        ilock(h);
+        int rc = make_room(h, pos + chunk);
+        if (rc == 0) rc = write_range(h, pos, src + done, chunk);
+        if (rc == 0) {
+            if (pos + chunk > h->inode.size) h->inode.size = pos + chunk;
+            h->inode.mtime = time(NULL);
+            idirty(h);
+        }
+        iunlock(h);
+        tx_commit();
+        if (rc == -1) break;
+        done += chunk;
+    }
+
+    iput(h);
+    return done == 0 && len > 0 ? -1 : (long)done;
+}
+
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} FreeRun;
+
+// frees contiguous blocks with one bitmap update per run
+static void defer_free(FreeRun *r, uint32_t block) {
+    if (r->count && block == r->first + r->count) {
+        r->count++;
+        return;
+    }
+    if (r->count) free_block_run(r->first, r->count);
+    r->first = block;
+    r->count = 1;
+}
+
+// frees the blocks behind pointers [from, PTRS_PER_BLOCK) of an indirect block
+static int trim_indirect(uint32_t block, uint32_t from, FreeRun *r) {
+    Buffer *b = bread(block);
+    if (!b) return -1;
+    uint32_t *ptrs = (uint32_t *)b->data;
+    int changed = 0;
+    for (uint32_t i = from; i < PTRS_PER_BLOCK; i++) {
+        if (!ptrs[i]) continue;
+        defer_free(r, ptrs[i]);
+        ptrs[i] = 0;
+        changed = 1;
+    }
+    if (changed && from > 0) bdirty(b); // a block freed whole is never written again
+    brelse(b);
+    return 0;
+}
+
+// frees every block from logical block keep on in a classic inode
+static int classic_truncate(InodeHandle *h, uint32_t keep) {
+    Inode *inode = &h->inode;
+    FreeRun r = {0, 0};
+    int rc = 0;
+
+    for (uint32_t i = keep; i < DIRECT_PTRS; i++) {
+        if (!inode->direct[i]) continue;
+        defer_free(&r, inode->direct[i]);
+        inode->direct[i] = 0;
+    }
+
+    if (inode->indirect) {
+        uint32_t from = keep > DIRECT_PTRS ? keep - DIRECT_PTRS : 0;
+        if (from < PTRS_PER_BLOCK) rc = trim_indirect(inode->indirect, from, &r);
+        if (rc == 0 && from == 0) {
+            defer_free(&r, inode->indirect);
+            inode->indirect = 0;
+        }
+    }
+
+    if (inode->double_indirect && rc == 0) {
+        uint32_t base = DIRECT_PTRS + PTRS_PER_BLOCK;
+        uint32_t from = keep > base ? keep - base : 0;
+        Buffer *b = bread(inode->double_indirect);
+        if (!b) return -1;
+        uint32_t *ptrs = (uint32_t *)b->data;
+
+        int changed = 0;
+        for (uint32_t j = from / PTRS_PER_BLOCK; j < PTRS_PER_BLOCK && rc == 0; j++) {
+            if (!ptrs[j]) continue;
+            uint32_t sub = j == from / PTRS_PER_BLOCK ? from % PTRS_PER_BLOCK : 0;
+            rc = trim_indirect(ptrs[j], sub, &r);
+            if (rc == 0 && sub == 0) {
+                defer_free(&r, ptrs[j]);
+                ptrs[j] = 0;
+                changed = 1;
+            }
+        }
+        if (changed && from > 0) bdirty(b);
+        brelse(b);
+        if (rc == 0 && from == 0) {
+            defer_free(&r, inode->double_indirect);
+            inode->double_indirect = 0;
+        }
+    }
+
+    if (r.count) free_block_run(r.first, r.count);
+    idirty(h);
+    return rc;
+}
+
+// sets the file size, shrinking frees the blocks past the new end, growing leaves a hole,
+// returns 0 or -1
+static int truncate_file(uint32_t inum, uint64_t size) {
+    InodeHandle *h = iget(inum);
+    if (!h) return -1;
+    if ((h->inode.mode & 0xF000) != IREG || size > max_blocks(&h->inode) * BLOCK_SIZE) {
+        iput(h);
+        return -1;
+    }
+
+    tx_begin();
+    ilock(h);
+    int rc = 0;
+    if (h->inode.flags & INODE_INLINE) {
+        // bytes past the new end read as zeros if the file grows again
+        if (size < h->inode.size) memset((uint8_t *)h->inode.direct + size, 0, INLINE_DATA_MAX - size);
+        else rc = make_room(h, size);
+    } else if (size < h->inode.size) {
+        uint32_t keep = (uint32_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        rc = (h->inode.flags & INODE_EXTENTS) ? ext_truncate(h, keep) : classic_truncate(h, keep);
+
+        // bytes past the end of the last block read as zeros once the file grows again
+        uint32_t tail = size % BLOCK_SIZE;
+        uint32_t run;
+        int fresh;
+        long p = rc == 0 && tail ? map_run(h, keep - 1, 1, 0, &run, &fresh) : 0;
+        _Alignas(BDEV_ALIGN) uint8_t block[BLOCK_SIZE];
+        if (p > 0 && bdev_read(fs.dev, (uint64_t)p, 1, block) == 0) {
+            memset(block + tail, 0, BLOCK_SIZE - tail);
+            if (snap_live) snap_cow_run((uint32_t)p, 1);
+            if (bdev_write(fs.dev, (uint64_t)p, 1, block) == -1) rc = -1;
+        }
+    }
+    if (rc == 0) {
+        h->inode.size = size;
+        h->inode.mtime = time(NULL);
+        idirty(h);
+    }
+    iunlock(h);
+    tx_commit();
+
+    iput(h);
+    return rc;
+}
+
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len) {
+    StatsSpan span = stats_begin(OP_READ);
+    long rc = read_file(inum, offset, buf, len);
+    stats_end(span);
+    return rc;
+}
+
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len) {
+    StatsSpan span = stats_begin(OP_WRITE);
+    long rc = write_file(inum, offset, buf, len);
+    stats_end(span);
+    return rc;
+}
+
+int fs_truncate(uint32_t inum, uint64_t size) {
+    StatsSpan span = stats_begin(OP_TRUNCATE);
+    int rc = truncate_file(inum, size);
+    stats_end(span);
+    return rc;
+}
+
+// removes name from parent, the file itself goes with its last name, returns 0 or -1
+int fs_unlink(uint32_t parent, char *name) {
+    StatsSpan span = stats_begin(OP_UNLINK);
+    long file = dir_lookup(parent, name);
+    int rc = -1;
+
+    // dirs have their own way out (fs_rmdir), a name of one is never unlinked here
+    if (file != -1 && !is_dir((uint32_t)file)) {
+        tx_begin();
+        // only while the name still names file, a racing rename's new inode keeps its name
+        if (dir_remove_expect(parent, name, (uint32_t)file) == file) {
+            rc = 0;
+            InodeHandle *h = iget((uint32_t)file);
+            int last = h && h->inode.links_count == 0;
+            if (h) iput(h);
+            if (last && truncate_file((uint32_t)file, 0) == 0) free_inode((uint32_t)file);
+        }
+        tx_commit();
+    }
+    stats_end(span);
+    return rc;
 }
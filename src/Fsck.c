@@ -0,0 +1,711 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Fsck.h"
+#include "../include/FileManagement.h"
+#include "../include/Directories.h"
+#include "../include/DirIndex.h"
+#include "../include/Extents.h"
+#include "../include/Snapshot.h"
+#include "../include/Checksum.h"
+#include "../include/Transaction.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the check runs in passes over a mounted, synced image:
+//  1. threads claim chunks of the inode tables and note every inode in use
+//  2. the dir tree is walked from the root, dirs spread over the threads by work stealing,
+//     every entry counts one link of the inode it names; dirs the walk didn't reach go next
+//  3. the tables are read once more, the blocks of every inode kept go into a fresh bitmap
+// then bitmaps, free counts and link counts are compared with what was found (and replaced)
+
+// what the passes learn of an inode, flags[inum]
+#define F_USED 0x01     // mode set and linked or allocated
+#define F_DIR 0x02
+#define F_REACHED 0x04  // dir queued for the walk, or walked
+#define F_NAMED 0x08    // a walked dir has an entry other than "." and ".." for it
+#define F_KEEP 0x10     // stays allocated: named, the root, or an orphan with links left
+#define F_ORPHAN 0x20   // kept but named by no dir, goes into lost+found
+#define F_FIX 0x40      // its links_count gets rewritten by the repair
+
+#define MAP_SCRATCH (EXT_MAX_DEPTH + 1)     // blocks one thread reads pointer and tree blocks into
+
+// inode table blocks [first, first + count) of a group
+typedef struct {
+    uint32_t group;
+    uint32_t first;
+    uint32_t count;
+} Chunk;
+
+typedef struct {
+    uint32_t dir;
+    char name[NAME_MAX];
+} Dangling;
+
+// the owner pushes and pops dirs at the bottom, depth first, idle threads steal from the top
+typedef struct {
+    uint32_t *items;
+    uint32_t top;
+    uint32_t bottom;
+    uint32_t cap;
+    pthread_mutex_t lock;
+} Deque;
+
+typedef struct Check Check;
+
+typedef void (*inode_fn)(Check *c, uint32_t inum, const Inode *inode, uint8_t *scratch);
+
+struct Check {
+    uint8_t *flags;
+    uint16_t *links;            // links_count as the table has it
+    uint32_t *found;            // entries naming the inode, dots included, later the count it should have
+    uint64_t *blocks;           // block bitmap rebuilt from metadata and the inodes kept
+    uint64_t *inodes;           // inode bitmap of the inodes kept
+    uint32_t *dirs_in;          // kept dirs per group
+    GroupDesc *want;            // descriptors with the free counts found
+
+    Chunk *chunks;
+    uint32_t num_chunks;
+    uint32_t next_chunk;        // claimed with an atomic add
+    inode_fn per_inode;
+    int first_scan;             // table blocks failing their checksum are reported once
+
+    Deque deques[FSCK_THREADS];
+    uint32_t pending;           // dirs queued or being read, the walk is over at 0
+
+    Dangling *dangling;
+    uint32_t num_dangling;
+    uint32_t cap_dangling;
+    pthread_mutex_t lock;       // dangling list
+    int failed;                 // out of memory, the check can't be trusted
+
+    uint32_t *orphans;
+    uint32_t num_orphans;
+    FsckReport r;
+};
+
+typedef struct {
+    Check *c;
+    uint32_t id;
+} Worker;
+
+typedef struct {
+    Check *c;
+    uint32_t self;
+    uint32_t dir;
+} Visit;
+
+// counts one problem of a kind and prints the first FSCK_PRINT_MAX of them
+static void problem(uint64_t *counter, const char *fmt, ...) {
+    uint64_t n = __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+    if (n > FSCK_PRINT_MAX) return;
+
+    char line[NAME_MAX + 128];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "fsck: %s%s\n", line, n == FSCK_PRINT_MAX ? " (more like it are only counted)" : "");
+}
+
+static void run(Check *c, void *(*fn)(void *)) {
+    Worker workers[FSCK_THREADS];
+    pthread_t threads[FSCK_THREADS];
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < FSCK_THREADS; i++) workers[i] = (Worker){ c, i };
+    while (started < FSCK_THREADS && pthread_create(&threads[started], NULL, fn, &workers[started]) == 0) started++;
+    if (started == 0) fn(&workers[0]); // no threads to be had, one does it all
+    for (uint32_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+// ---------- inode tables ----------
+
+// cuts the zeroed part of every inode table into FSCK_CHUNK_BLOCKS chunks, blocks past
+// itable_zeroed hold stale bytes and no inode in use
+static int plan_chunks(Check *c) {
+    uint32_t n = 0;
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        uint32_t zeroed = fs.groups[g].itable_zeroed < fs.sb.inode_table_blocks ? fs.groups[g].itable_zeroed
+                                                                                : fs.sb.inode_table_blocks;
+        n += (zeroed + FSCK_CHUNK_BLOCKS - 1) / FSCK_CHUNK_BLOCKS;
+    }
+    c->chunks = malloc((n ? n : 1) * sizeof(Chunk));
+    if (!c->chunks) return -1;
+
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        uint32_t zeroed = fs.groups[g].itable_zeroed < fs.sb.inode_table_blocks ? fs.groups[g].itable_zeroed
+                                                                                : fs.sb.inode_table_blocks;
+        for (uint32_t first = 0; first < zeroed; first += FSCK_CHUNK_BLOCKS) {
+            uint32_t count = zeroed - first < FSCK_CHUNK_BLOCKS ? zeroed - first : FSCK_CHUNK_BLOCKS;
+            c->chunks[c->num_chunks++] = (Chunk){ g, first, count };
+        }
+    }
+    return 0;
+}
+
+static void *scan_worker(void *arg) {
+    Check *c = ((Worker *)arg)->c;
+    uint8_t *buf = NULL, *scratch = NULL;
+    if (posix_memalign((void **)&buf, BDEV_ALIGN, (size_t)FSCK_CHUNK_BLOCKS * BLOCK_SIZE) != 0 ||
+        posix_memalign((void **)&scratch, BDEV_ALIGN, (size_t)MAP_SCRATCH * BLOCK_SIZE) != 0) {
+        __atomic_store_n(&c->failed, 1, __ATOMIC_RELAXED);
+        free(buf);
+        return NULL;
+    }
+
+    uint32_t ipg = fs.sb.inodes_per_group;
+    for (;;) {
+        uint32_t k = __atomic_fetch_add(&c->next_chunk, 1, __ATOMIC_RELAXED);
+        if (k >= c->num_chunks) break;
+        const Chunk *ch = &c->chunks[k];
+        uint32_t table = fs.groups[ch->group].inode_table + ch->first;
+        if (bdev_read(fs.dev, table, ch->count, buf) == -1) {
+            if (c->first_scan) problem(&c->r.unreadable, "inode table blocks %u-%u can't be read", table, table + ch->count - 1);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < ch->count; i++) {
+            const uint8_t *block = buf + (size_t)i * BLOCK_SIZE;
+            if ((fs.sb.features & FEATURE_METADATA_CSUM) && !csum_verify(table + i, block, CSUM_ITABLE)) {
+                if (c->first_scan) problem(&c->r.unreadable, "inode table block %u fails its checksum", table + i);
+                continue;
+            }
+            uint32_t slot = (ch->first + i) * INODES_PER_BLOCK;
+            for (uint32_t s = 0; s < INODES_PER_BLOCK && slot + s < ipg; s++) {
+                c->per_inode(c, ch->group * ipg + slot + s, (const Inode *)block + s, scratch);
+            }
+        }
+    }
+    free(buf);
+    free(scratch);
+    return NULL;
+}
+
+static void scan(Check *c, inode_fn per_inode, int first_scan) {
+    c->per_inode = per_inode;
+    c->first_scan = first_scan;
+    c->next_chunk = 0;
+    run(c, scan_worker);
+}
+
+// pass 1: an inode is in use with its mode set and a link or its bitmap bit, a freed one keeps
+// its mode but has neither
+static void note_inode(Check *c, uint32_t inum, const Inode *inode, uint8_t *scratch) {
+    (void)scratch;
+    if (inode->mode == 0 || (inode->links_count == 0 && !bitmap_test(&inode_bitmap, inum))) return;
+    c->flags[inum] = F_USED | ((inode->mode & 0xF000) == IDIR ? F_DIR : 0);
+    c->links[inum] = inode->links_count;
+}
+
+// ---------- blocks ----------
+
+// sets b in the rebuilt bitmap for inum, returns -1 when b isn't a block of the image
+static int take_block(Check *c, uint32_t inum, uint32_t b) {
+    if (b >= fs.sb.total_blocks) {
+        problem(&c->r.bad_blocks, "inode %u maps block %u, past the end of the image", inum, b);
+        return -1;
+    }
+    uint64_t bit = 1ull << (b % 64);
+    if (__atomic_fetch_or(&c->blocks[b / 64], bit, __ATOMIC_RELAXED) & bit) {
+        problem(&c->r.cross_linked, "block %u of inode %u is in use already", b, inum);
+    }
+    return 0;
+}
+
+static int read_map(Check *c, uint32_t inum, uint32_t b, uint8_t *buf) {
+    if (bdev_read(fs.dev, b, 1, buf) == 0) return 0;
+    problem(&c->r.unreadable, "block %u of inode %u can't be read", b, inum);
+    return -1;
+}
+
+// a pointer block and what it points to, levels of pointer blocks below it (0 = data)
+static void map_pointers(Check *c, uint32_t inum, uint32_t b, int levels, uint8_t *scratch) {
+    if (take_block(c, inum, b) == -1 || levels == 0 || read_map(c, inum, b, scratch) == -1) return;
+    const uint32_t *ptrs = (const uint32_t *)scratch;
+    for (uint32_t i = 0; i < PTRS_PER_BLOCK; i++) {
+        if (ptrs[i]) map_pointers(c, inum, ptrs[i], levels - 1, scratch + BLOCK_SIZE);
+    }
+}
+
+// an extent tree node, in the inode (root) or in a block of its own
+static void map_extents(Check *c, uint32_t inum, const ExtentHeader *hdr, int root, int levels_left,
+                        uint8_t *scratch) {
+    uint32_t cap = hdr->depth ? (root ? EXT_ROOT_INDEXES : EXT_BLOCK_INDEXES) : (root ? EXT_ROOT_LEAVES : EXT_BLOCK_LEAVES);
+    if (hdr->magic != EXT_MAGIC || hdr->entries > cap || levels_left < 0) {
+        problem(&c->r.unreadable, "inode %u has a corrupt extent tree", inum);
+        return;
+    }
+
+    if (hdr->depth == 0) {
+        const Extent *e = (const Extent *)(hdr + 1);
+        for (uint32_t i = 0; i < hdr->entries; i++) {
+            uint64_t end = (uint64_t)e[i].start + e[i].len;
+            if (end > fs.sb.total_blocks) {
+                problem(&c->r.bad_blocks, "inode %u maps blocks %u-%llu, past the end of the image", inum,
+                        e[i].start, (unsigned long long)end - 1);
+                end = fs.sb.total_blocks;
+            }
+            for (uint64_t b = e[i].start; b < end; b++) take_block(c, inum, (uint32_t)b);
+        }
+        return;
+    }
+
+    const ExtentIdx *idx = (const ExtentIdx *)(hdr + 1);
+    for (uint32_t i = 0; i < hdr->entries; i++) {
+        if (take_block(c, inum, idx[i].block) == -1 || read_map(c, inum, idx[i].block, scratch) == -1) continue;
+        map_extents(c, inum, (const ExtentHeader *)scratch, 0, levels_left - 1, scratch + BLOCK_SIZE);
+    }
+}
+
+// index root and its leaves, the leaves are listed in the root only
+static void map_index(Check *c, uint32_t inum, uint32_t root_block, uint8_t *scratch) {
+    if (take_block(c, inum, root_block) == -1 || read_map(c, inum, root_block, scratch) == -1) return;
+    const DxRoot *root = (const DxRoot *)scratch;
+    if (root->magic != DX_MAGIC || root->count > DX_MAX_LEAVES) {
+        problem(&c->r.unreadable, "dir %u has a corrupt index root in block %u", inum, root_block);
+        return;
+    }
+    for (uint32_t l = 0; l < root->count; l++) take_block(c, inum, root->entries[l].block);
+}
+
+// pass 3: the blocks of every inode kept
+static void map_inode(Check *c, uint32_t inum, const Inode *inode, uint8_t *scratch) {
+    if (!(c->flags[inum] & F_KEEP) || (inode->flags & INODE_INLINE)) return;
+    if ((inode->flags & INODE_INDEX) && (c->flags[inum] & F_DIR)) {
+        map_index(c, inum, inode->direct[0], scratch);
+        return;
+    }
+    if (inode->flags & INODE_EXTENTS) {
+        map_extents(c, inum, (const ExtentHeader *)inode->direct, 1, EXT_MAX_DEPTH, scratch);
+        return;
+    }
+    for (int i = 0; i < DIRECT_PTRS; i++) {
+        if (inode->direct[i]) take_block(c, inum, inode->direct[i]);
+    }
+    if (inode->indirect) map_pointers(c, inum, inode->indirect, 1, scratch);
+    if (inode->double_indirect) map_pointers(c, inum, inode->double_indirect, 2, scratch);
+}
+
+static void set_run(uint64_t *words, uint32_t first, uint32_t count) {
+    for (uint32_t b = first; b < first + count; b++) words[b / 64] |= 1ull << (b % 64);
+}
+
+// bits past nbits in the last word are set, as Bitmap keeps them
+static void set_padding(uint64_t *words, uint32_t nbits) {
+    if (nbits % 64) words[nbits / 64] |= ~0ull << (nbits % 64);
+}
+
+// superblock, descriptors, every group's bitmaps and table, the journal and what snapshots hold
+static void mark_metadata(Check *c) {
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        uint32_t first = g * fs.sb.blocks_per_group;
+        set_run(c->blocks, first, group_data_start(g) - first);
+    }
+    if (fs.sb.journal_blocks) set_run(c->blocks, fs.sb.journal_start, fs.sb.journal_blocks);
+    snap_owned(c->blocks);
+    set_padding(c->blocks, fs.sb.total_blocks);
+}
+
+// ---------- dir walk ----------
+
+static int push(Deque *d, uint32_t dir) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom == d->cap) {
+        if (d->top >= d->cap / 2 && d->top > 0) {
+            // stolen from enough to reuse the front
+            memmove(d->items, d->items + d->top, (d->bottom - d->top) * sizeof(uint32_t));
+            d->bottom -= d->top;
+            d->top = 0;
+        } else {
+            uint32_t cap = d->cap ? d->cap * 2 : 256;
+            uint32_t *grown = realloc(d->items, cap * sizeof(uint32_t));
+            if (!grown) {
+                pthread_mutex_unlock(&d->lock);
+                return -1;
+            }
+            d->items = grown;
+            d->cap = cap;
+        }
+    }
+    d->items[d->bottom++] = dir;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// queues dir on the deque of worker self, the walk isn't over until it was read
+static void queue_dir(Check *c, uint32_t self, uint32_t dir) {
+    __atomic_fetch_add(&c->pending, 1, __ATOMIC_RELAXED);
+    if (push(&c->deques[self], dir) == -1) {
+        __atomic_store_n(&c->failed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&c->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// a dir off the own deque's bottom, else off another's top
+static int take_dir(Check *c, uint32_t self, uint32_t *dir) {
+    for (uint32_t k = 0; k < FSCK_THREADS; k++) {
+        Deque *d = &c->deques[(self + k) % FSCK_THREADS];
+        pthread_mutex_lock(&d->lock);
+        int got = d->bottom > d->top;
+        if (got) *dir = k == 0 ? d->items[--d->bottom] : d->items[d->top++];
+        pthread_mutex_unlock(&d->lock);
+        if (got) return 1;
+    }
+    return 0;
+}
+
+static void add_dangling(Check *c, uint32_t dir, const char *name) {
+    pthread_mutex_lock(&c->lock);
+    if (c->num_dangling == c->cap_dangling) {
+        uint32_t cap = c->cap_dangling ? c->cap_dangling * 2 : 16;
+        Dangling *grown = realloc(c->dangling, cap * sizeof(Dangling));
+        if (!grown) {
+            c->failed = 1;
+            pthread_mutex_unlock(&c->lock);
+            return;
+        }
+        c->dangling = grown;
+        c->cap_dangling = cap;
+    }
+    Dangling *d = &c->dangling[c->num_dangling++];
+    d->dir = dir;
+    strcpy(d->name, name);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static int visit_entry(const DirEntry *entry, void *arg) {
+    Visit *v = arg;
+    Check *c = v->c;
+    uint32_t child = entry->inode_num;
+    if (child >= fs.sb.total_inodes || !(__atomic_load_n(&c->flags[child], __ATOMIC_RELAXED) & F_USED)) {
+        problem(&c->r.dangling, "dir %u: \"%s\" names inode %u, which isn't in use", v->dir, entry->name, child);
+        add_dangling(c, v->dir, entry->name);
+        return 0;
+    }
+
+    __atomic_fetch_add(&c->found[child], 1, __ATOMIC_RELAXED);
+    if (strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0) return 0;
+
+    // a dir is walked once, through whichever of its names comes first
+    int is_dir = (__atomic_load_n(&c->flags[child], __ATOMIC_RELAXED) & F_DIR) != 0;
+    uint8_t was = __atomic_fetch_or(&c->flags[child], F_NAMED | (is_dir ? F_REACHED : 0), __ATOMIC_RELAXED);
+    if (is_dir && !(was & F_REACHED)) queue_dir(c, v->self, child);
+    return 0;
+}
+
+static void *walk_worker(void *arg) {
+    Worker *w = arg;
+    Check *c = w->c;
+    for (;;) {
+        uint32_t dir;
+        if (!take_dir(c, w->id, &dir)) {
+            if (__atomic_load_n(&c->pending, __ATOMIC_ACQUIRE) == 0) break;
+            sched_yield();
+            continue;
+        }
+        Visit v = { c, w->id, dir };
+        if (dir_iterate(dir, visit_entry, &v) == -1) problem(&c->r.unreadable, "dir %u can't be read", dir);
+        __atomic_fetch_sub(&c->pending, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// walks from the root, then from the dirs that still have links but weren't reached, their
+// entries count as well (an orphan dir is relinked with everything below it)
+static void walk(Check *c) {
+    uint32_t root = fs.sb.root_inode;
+    c->flags[root] |= F_REACHED;
+    queue_dir(c, 0, root);
+    run(c, walk_worker);
+
+    uint32_t seeded = 0;
+    for (uint32_t i = 0; i < fs.sb.total_inodes; i++) {
+        if ((c->flags[i] & (F_USED | F_DIR | F_REACHED)) != (F_USED | F_DIR) || c->links[i] == 0) continue;
+        c->flags[i] |= F_REACHED;
+        queue_dir(c, seeded++ % FSCK_THREADS, i);
+    }
+    if (seeded) run(c, walk_worker);
+}
+
+// ---------- verdict ----------
+
+// keeps what is named, the root and orphans with links left, the rest in use gets freed
+static int settle_inodes(Check *c) {
+    uint32_t root = fs.sb.root_inode;
+    uint32_t cap = 0;
+    for (uint32_t i = 0; i < fs.sb.total_inodes; i++) {
+        uint8_t f = c->flags[i];
+        if (!(f & F_USED)) continue;
+        if (i != root && !(f & F_NAMED)) {
+            if (c->links[i] == 0) {
+                problem(&c->r.unlinked, "inode %u has no links and no name but is allocated", i);
+                continue;
+            }
+            problem(&c->r.orphans, "%s %u has %u links but is in no dir", f & F_DIR ? "dir" : "inode", i, c->links[i]);
+            if (c->num_orphans == cap) {
+                cap = cap ? cap * 2 : 16;
+                uint32_t *grown = realloc(c->orphans, cap * sizeof(uint32_t));
+                if (!grown) return -1;
+                c->orphans = grown;
+            }
+            c->orphans[c->num_orphans++] = i;
+            f |= F_ORPHAN;
+        }
+        c->flags[i] = f | F_KEEP;
+        c->inodes[i / 64] |= 1ull << (i % 64);
+        c->r.inodes++;
+        if (f & F_DIR) {
+            c->r.dirs++;
+            c->dirs_in[group_of_inode(i)]++;
+        }
+    }
+    set_padding(c->inodes, fs.sb.total_inodes);
+    return 0;
+}
+
+// the links every kept inode should end up with, the orphans counted in lost+found already
+static void settle_links(Check *c, long lost) {
+    for (uint32_t k = 0; k < c->num_orphans; k++) {
+        uint32_t o = c->orphans[k];
+        c->found[o]++;
+        c->flags[o] |= F_FIX;
+        if (!(c->flags[o] & F_DIR)) continue;
+
+        // its ".." moves from wherever it pointed to lost+found
+        long parent = dir_lookup(o, "..");
+        if (parent >= 0 && parent < fs.sb.total_inodes && (c->flags[parent] & F_KEEP)) {
+            c->found[parent]--;
+            c->flags[parent] |= F_FIX;
+        }
+        if (lost >= 0) {
+            c->found[lost]++;
+            c->flags[lost] |= F_FIX;
+        }
+    }
+
+    for (uint32_t i = 0; i < fs.sb.total_inodes; i++) {
+        if (!(c->flags[i] & F_KEEP)) continue;
+        if (c->found[i] > UINT16_MAX) c->found[i] = UINT16_MAX;
+        if (c->links[i] != c->found[i]) {
+            problem(&c->r.link_fixes, "inode %u has %u links, %u entries name it", i, c->links[i], c->found[i]);
+            c->flags[i] |= F_FIX;
+        }
+    }
+}
+
+static uint32_t count_bits(const uint64_t *words, uint32_t from, uint32_t to) {
+    uint32_t n = 0;
+    for (; from < to && from % 64; from++) n += (words[from / 64] >> (from % 64)) & 1;
+    for (; from + 64 <= to; from += 64) n += (uint32_t)__builtin_popcountll(words[from / 64]);
+    for (; from < to; from++) n += (words[from / 64] >> (from % 64)) & 1;
+    return n;
+}
+
+static void diff_bits(const uint64_t *want, const Bitmap *have, uint64_t *counter, const char *what) {
+    for (uint32_t w = 0; w < have->nwords; w++) {
+        for (uint64_t x = want[w] ^ have->words[w]; x; x &= x - 1) {
+            uint32_t bit = w * 64 + (uint32_t)__builtin_ctzll(x);
+            int used = (want[w] >> (bit % 64)) & 1;
+            problem(counter, "%s %u is %s but marked %s", what, bit, used ? "in use" : "free", used ? "free" : "in use");
+        }
+    }
+}
+
+static void check_counter(Check *c, const char *what, uint32_t group, uint32_t have, uint32_t want) {
+    if (have == want) return;
+    if (group == UINT32_MAX) problem(&c->r.counter_fixes, "superblock counts %u %s, %u are", have, what, want);
+    else problem(&c->r.counter_fixes, "group %u counts %u %s, %u are", group, have, what, want);
+}
+
+// bitmaps and free counts against the rebuilt ones
+static void compare_groups(Check *c) {
+    diff_bits(c->blocks, &block_bitmap, &c->r.block_bits, "block");
+    diff_bits(c->inodes, &inode_bitmap, &c->r.inode_bits, "inode");
+
+    uint32_t free_blocks = 0, free_inodes = 0;
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        GroupDesc *want = &c->want[g];
+        uint32_t first = g * fs.sb.blocks_per_group, ifirst = g * fs.sb.inodes_per_group;
+        *want = fs.groups[g];
+        want->free_blocks = group_end(g) - first - count_bits(c->blocks, first, group_end(g));
+        want->free_inodes = fs.sb.inodes_per_group - count_bits(c->inodes, ifirst, ifirst + fs.sb.inodes_per_group);
+        want->used_dirs = c->dirs_in[g];
+        check_counter(c, "free blocks", g, fs.groups[g].free_blocks, want->free_blocks);
+        check_counter(c, "free inodes", g, fs.groups[g].free_inodes, want->free_inodes);
+        check_counter(c, "dirs", g, fs.groups[g].used_dirs, want->used_dirs);
+        free_blocks += want->free_blocks;
+        free_inodes += want->free_inodes;
+    }
+    check_counter(c, "free blocks", UINT32_MAX, fs.sb.free_blocks, free_blocks);
+    check_counter(c, "free inodes", UINT32_MAX, fs.sb.free_inodes, free_inodes);
+    c->r.blocks = fs.sb.total_blocks - free_blocks;
+}
+
+// ---------- repair ----------
+
+// bitmaps and counters as rebuilt, dangling entries out, orphans into lost+found, then the link
+// counts. returns the problems left unrepaired
+static uint64_t repair(Check *c, long lost) {
+    uint64_t left = c->r.cross_linked + c->r.bad_blocks;
+
+    bitmap_load(&block_bitmap, c->blocks);
+    bitmap_load(&inode_bitmap, c->inodes);
+    memcpy(fs.groups, c->want, fs.sb.groups_count * sizeof(GroupDesc));
+    fs.sb.free_blocks = (uint32_t)(fs.sb.total_blocks - c->r.blocks);
+    fs.sb.free_inodes = (uint32_t)(fs.sb.total_inodes - c->r.inodes);
+    if (rewrite_groups() == -1) {
+        fprintf(stderr, "fsck: the bitmaps can't be written\n");
+        return left + c->r.block_bits + c->r.inode_bits + c->r.counter_fixes + c->r.unlinked + c->r.dangling +
+               c->r.orphans + c->r.link_fixes;
+    }
+
+    if (c->num_orphans && lost == -1) {
+        char name[] = "lost+found";
+        if (dir_lookup(fs.sb.root_inode, name) == -1) {
+            lost = mkdir(fs.sb.root_inode, name);
+            if (lost != -1) c->found[fs.sb.root_inode]++; // its ".."
+        }
+        if (lost == -1) fprintf(stderr, "fsck: no lost+found dir for the orphans\n");
+    }
+    for (uint32_t k = 0; k < c->num_orphans; k++) {
+        uint32_t o = c->orphans[k];
+        char name[16];
+        snprintf(name, sizeof(name), "#%u", o);
+        int is_dir = (c->flags[o] & F_DIR) != 0;
+        if (lost == -1 || dir_add((uint32_t)lost, name, o, is_dir ? IDIR : IREG) == -1) {
+            left++;
+            continue;
+        }
+        if (is_dir && dir_set_parent(o, (uint32_t)lost) == -1) dir_add(o, "..", (uint32_t)lost, IDIR);
+    }
+
+    for (uint32_t k = 0; k < c->num_dangling; k++) {
+        const Dangling *d = &c->dangling[k];
+        if (strcmp(d->name, "..") == 0 && (c->flags[d->dir] & F_ORPHAN) && lost != -1) continue; // pointed anew
+        if (strcmp(d->name, ".") == 0 || strcmp(d->name, "..") == 0 || dir_drop_entry(d->dir, d->name) == -1) left++;
+    }
+
+    uint32_t in_tx = 0;
+    tx_begin();
+    for (uint32_t i = 0; i < fs.sb.total_inodes; i++) {
+        if (!(c->flags[i] & F_FIX)) continue;
+        InodeHandle *h = iget(i);
+        if (!h) {
+            left++;
+            continue;
+        }
+        ilock(h);
+        if (h->inode.links_count != c->found[i]) {
+            h->inode.links_count = (uint16_t)c->found[i];
+            idirty(h);
+        }
+        iunlock(h);
+        iput(h);
+        if (++in_tx == FSCK_TX_INODES) {
+            tx_commit();
+            tx_begin();
+            in_tx = 0;
+        }
+    }
+    tx_commit();
+    if (fs_sync() == -1) left++;
+    return left;
+}
+
+static int init_check(Check *c) {
+    uint32_t n = fs.sb.total_inodes;
+    c->flags = calloc(n, sizeof(uint8_t));
+    c->links = calloc(n, sizeof(uint16_t));
+    c->found = calloc(n, sizeof(uint32_t));
+    c->blocks = calloc(block_bitmap.nwords, sizeof(uint64_t));
+    c->inodes = calloc(inode_bitmap.nwords, sizeof(uint64_t));
+    c->dirs_in = calloc(fs.sb.groups_count, sizeof(uint32_t));
+    c->want = calloc(fs.sb.groups_count, sizeof(GroupDesc));
+    pthread_mutex_init(&c->lock, NULL);
+    for (uint32_t i = 0; i < FSCK_THREADS; i++) pthread_mutex_init(&c->deques[i].lock, NULL);
+    if (!c->flags || !c->links || !c->found || !c->blocks || !c->inodes || !c->dirs_in || !c->want) return -1;
+    return plan_chunks(c);
+}
+
+static void free_check(Check *c) {
+    free(c->flags);
+    free(c->links);
+    free(c->found);
+    free(c->blocks);
+    free(c->inodes);
+    free(c->dirs_in);
+    free(c->want);
+    free(c->chunks);
+    free(c->dangling);
+    free(c->orphans);
+    pthread_mutex_destroy(&c->lock);
+    for (uint32_t i = 0; i < FSCK_THREADS; i++) {
+        free(c->deques[i].items);
+        pthread_mutex_destroy(&c->deques[i].lock);
+    }
+}
+
+// checks the image, repair != 0 also fixes what can be fixed, out (if not NULL) gets the counts.
+// returns FSCK_CLEAN, FSCK_FIXED or FSCK_ERRORS, -1 when the check couldn't run
+int fs_fsck(const char *image, const FsOptions *opts, int repair_image, FsckReport *out) {
+    FsOptions o;
+    if (opts) o = *opts;
+    else fs_default_options(&o);
+    o.repair = 1; // bitmaps failing their checksum get rebuilt here like any others
+    if (mount_disk_opts(image, &o) == -1) {
+        fprintf(stderr, "fsck: %s can't be mounted\n", image);
+        return -1;
+    }
+    // the journal is applied and everything cached is home, the table reads see what iget would
+    fs_sync();
+
+    Check c;
+    memset(&c, 0, sizeof(Check));
+    int rc = init_check(&c) == -1 ? -1 : 0;
+    if (rc == 0) {
+        scan(&c, note_inode, 1);
+        uint32_t root = fs.sb.root_inode;
+        if (root >= fs.sb.total_inodes || (c.flags[root] & (F_USED | F_DIR)) != (F_USED | F_DIR)) {
+            fprintf(stderr, "fsck: root inode %u is not a dir in use, nothing to check from\n", root);
+            rc = -1;
+        }
+    }
+    if (rc == 0) {
+        walk(&c);
+        rc = c.failed || settle_inodes(&c) == -1 ? -1 : 0;
+    }
+    long lost = -1;
+    if (rc == 0) {
+        lost = dir_lookup(fs.sb.root_inode, "lost+found");
+        if (lost >= fs.sb.total_inodes || (lost >= 0 && (c.flags[lost] & (F_KEEP | F_DIR)) != (F_KEEP | F_DIR))) lost = -1;
+        settle_links(&c, lost);
+        mark_metadata(&c);
+        scan(&c, map_inode, 0);
+        compare_groups(&c);
+        if (c.failed) rc = -1;
+    }
+
+    if (rc == 0) {
+        FsckReport *r = &c.r;
+        uint64_t problems = r->orphans + r->unlinked + r->dangling + r->cross_linked + r->bad_blocks + r->unreadable +
+                            r->link_fixes + r->block_bits + r->inode_bits + r->counter_fixes;
+        uint64_t left = problems;
+        if (problems && repair_image && r->unreadable) {
+            fprintf(stderr, "fsck: metadata that can't be read is left for now, nothing repaired\n");
+        } else if (problems && repair_image) {
+            left = repair(&c, lost);
+            if (left > problems) left = problems;
+        }
+        r->repaired = problems - left;
+        rc = problems == 0 ? FSCK_CLEAN : left == 0 ? FSCK_FIXED : FSCK_ERRORS;
+        if (out) *out = *r;
+    }
+    free_check(&c);
+    unmount_disk();
+    return rc;
+}
@@ -0,0 +1,612 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+// libc's mkdir() and creat() would clash with the ones Directories.h and Files.h declare
+#define mkdir host_mkdir
+#define creat host_creat
+#include <fcntl.h>
+#include <sys/stat.h>
+#undef creat
+#undef mkdir
+
+#include "../include/Import.h"
+#include "../include/FileManagement.h"
+#include "../include/Directories.h"
+#include "../include/DirIndex.h"
+#include "../include/Files.h"
+#include "../include/Journal.h"
+#include "../include/Transaction.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// one host file or dir, the whole tree is kept in memory between the scan and the copy
+typedef struct {
+    char *path;         // host path, the entry name follows name_off
+    uint64_t size;      // file bytes
+    time_t mtime;
+    uint32_t name_off;
+    uint32_t parent;    // node of the dir holding it
+    uint32_t first;     // dirs: children are nodes[first, first + count), in name order
+    uint32_t count;
+    uint32_t inum;      // given while copying, parents before their children
+    uint16_t mode;      // IDIR or IREG with the owner permission bits
+} Node;
+
+// the parallel scan, workers take dirs off todo and append their children to nodes
+typedef struct {
+    Node *nodes;
+    uint32_t num_nodes;
+    uint32_t cap_nodes;
+    uint32_t *todo;
+    uint32_t num_todo;
+    uint32_t cap_todo;
+    uint32_t pending;       // dirs queued or being read, the scan is over at 0
+    int failed;
+    int inline_data;        // small files will take no blocks
+    ImportStats stats;
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+} Scan;
+
+// children of one dir as a worker reads it, before they join the tree
+typedef struct {
+    Node *kids;
+    uint32_t n;
+    uint32_t cap;
+    ImportStats counts;
+} Listing;
+
+static uint64_t blocks_for(uint64_t bytes) {
+    return (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// data blocks a file of size bytes gets, none when it goes inline
+static uint64_t data_blocks(const Scan *s, uint64_t size) {
+    if (s->inline_data && size <= INLINE_DATA_MAX) return 0;
+    return blocks_for(size);
+}
+
+// pointer blocks of a classic mapping of blocks, never fewer than an extent tree needs
+static uint64_t map_blocks(uint64_t blocks) {
+    if (blocks <= DIRECT_PTRS) return 0;
+    uint64_t rest = blocks - DIRECT_PTRS;
+    if (rest <= PTRS_PER_BLOCK) return 1;
+    return 2 + blocks_for((rest - PTRS_PER_BLOCK) * sizeof(uint32_t));
+}
+
+// blocks of a dir with records bytes of entries besides "." and ".." as dir_build lays it out,
+// at most one leaf per DX_BUILD_FILL bytes plus the root once it needs an index
+static uint64_t dir_blocks(uint64_t records) {
+    uint64_t total = records + DIRENT_LEN(1) + DIRENT_LEN(2);
+    if (total <= BLOCK_SIZE) return 1; // or none when it stays inline
+    return 1 + (total + DX_BUILD_FILL - 1) / DX_BUILD_FILL;
+}
+
+static int compare_name(const void *a, const void *b) {
+    const Node *x = a, *y = b;
+    return strcmp(x->path + x->name_off, y->path + y->name_off);
+}
+
+static void free_listing(Listing *l) {
+    for (uint32_t i = 0; i < l->n; i++) free(l->kids[i].path);
+    free(l->kids);
+}
+
+// reads one host dir into l, the children sorted by name, returns 0 or -1
+static int list_dir(const Scan *s, const char *path, Listing *l) {
+    memset(l, 0, sizeof(Listing));
+    DIR *dp = opendir(path);
+    if (!dp) {
+        fprintf(stderr, "import: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t path_len = strlen(path);
+    uint64_t records = 0;
+    int rc = 0;
+    struct dirent *de;
+    while ((de = readdir(dp))) {
+        const char *name = de->d_name;
+        size_t name_len = strlen(name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dp), name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            fprintf(stderr, "import: %s/%s: %s\n", path, name, strerror(errno));
+            rc = -1;
+            break;
+        }
+        // only what the image can hold: dirs and regular files with names a record takes
+        if ((!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) || name_len >= NAME_MAX) {
+            l->counts.skipped++;
+            continue;
+        }
+
+        if (l->n == l->cap) {
+            uint32_t cap = l->cap ? l->cap * 2 : 16;
+            Node *grown = realloc(l->kids, cap * sizeof(Node));
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            l->kids = grown;
+            l->cap = cap;
+        }
+        Node *kid = &l->kids[l->n];
+        memset(kid, 0, sizeof(Node));
+        kid->path = malloc(path_len + 1 + name_len + 1);
+        if (!kid->path) {
+            rc = -1;
+            break;
+        }
+        memcpy(kid->path, path, path_len);
+        kid->path[path_len] = '/';
+        memcpy(kid->path + path_len + 1, name, name_len + 1);
+        kid->name_off = (uint32_t)path_len + 1;
+        kid->mtime = st.st_mtime;
+        l->n++;
+        records += DIRENT_LEN(name_len);
+
+        if (S_ISDIR(st.st_mode)) {
+            kid->mode = (uint16_t)(IDIR | (st.st_mode & S_IRWXU));
+            l->counts.dirs++;
+        } else {
+            kid->mode = (uint16_t)(IREG | (st.st_mode & S_IRWXU));
+            kid->size = (uint64_t)st.st_size;
+            uint64_t blocks = data_blocks(s, kid->size);
+            l->counts.files++;
+            l->counts.bytes += kid->size;
+            l->counts.data_blocks += blocks;
+            l->counts.meta_blocks += map_blocks(blocks);
+        }
+    }
+    closedir(dp);
+
+    if (rc == -1) {
+        free_listing(l);
+        return -1;
+    }
+    l->counts.meta_blocks += dir_blocks(records);
+    if (l->n > 1) qsort(l->kids, l->n, sizeof(Node), compare_name); // same tree, same image
+    return 0;
+}
+
+// adds l's children to the tree as node d's and queues the dirs among them, s->lock is held,
+// returns 0 or -1 (l is used up either way)
+static int add_children(Scan *s, uint32_t d, Listing *l) {
+    uint32_t cap_nodes = s->cap_nodes, cap_todo = s->cap_todo;
+    while (cap_nodes < s->num_nodes + l->n) cap_nodes *= 2;
+    while (cap_todo < s->num_todo + l->counts.dirs) cap_todo *= 2;
+    Node *nodes = cap_nodes == s->cap_nodes ? s->nodes : realloc(s->nodes, cap_nodes * sizeof(Node));
+    if (nodes) {
+        s->nodes = nodes;
+        s->cap_nodes = cap_nodes;
+    }
+    uint32_t *todo = cap_todo == s->cap_todo ? s->todo : realloc(s->todo, cap_todo * sizeof(uint32_t));
+    if (todo) {
+        s->todo = todo;
+        s->cap_todo = cap_todo;
+    }
+    if (!nodes || !todo) {
+        free_listing(l);
+        return -1;
+    }
+
+    s->nodes[d].first = s->num_nodes;
+    s->nodes[d].count = l->n;
+    for (uint32_t i = 0; i < l->n; i++) {
+        uint32_t k = s->num_nodes++;
+        s->nodes[k] = l->kids[i];
+        s->nodes[k].parent = d;
+        if ((s->nodes[k].mode & 0xF000) == IDIR) {
+            s->todo[s->num_todo++] = k;
+            s->pending++;
+        }
+    }
+    free(l->kids);
+
+    s->stats.dirs += l->counts.dirs;
+    s->stats.files += l->counts.files;
+    s->stats.bytes += l->counts.bytes;
+    s->stats.skipped += l->counts.skipped;
+    s->stats.data_blocks += l->counts.data_blocks;
+    s->stats.meta_blocks += l->counts.meta_blocks;
+    return 0;
+}
+
+static void *scan_worker(void *arg) {
+    Scan *s = arg;
+    pthread_mutex_lock(&s->lock);
+    while (s->pending > 0) {
+        if (s->num_todo == 0 || s->failed) {
+            pthread_cond_wait(&s->more, &s->lock);
+            continue;
+        }
+        uint32_t d = s->todo[--s->num_todo];
+        const char *path = s->nodes[d].path; // the string stays put when nodes grows
+        pthread_mutex_unlock(&s->lock);
+
+        Listing l;
+        int rc = list_dir(s, path, &l);
+
+        pthread_mutex_lock(&s->lock);
+        if (rc == -1 || add_children(s, d, &l) == -1) {
+            // the dirs still queued are dropped, the workers drain and stop
+            s->failed = 1;
+            s->pending -= s->num_todo;
+            s->num_todo = 0;
+        }
+        s->pending--;
+        pthread_cond_broadcast(&s->more);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void free_scan(Scan *s) {
+    for (uint32_t i = 0; i < s->num_nodes; i++) free(s->nodes[i].path);
+    free(s->nodes);
+    free(s->todo);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->more);
+}
+
+// walks the host tree with IMPORT_SCAN_THREADS workers, node 0 is host_dir, returns 0 or -1
+static int scan_tree(Scan *s, const char *host_dir) {
+    struct stat st;
+    if (stat(host_dir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "import: %s is not a dir\n", host_dir);
+        return -1;
+    }
+
+    s->cap_nodes = 1024;
+    s->cap_todo = 64;
+    s->nodes = malloc(s->cap_nodes * sizeof(Node));
+    s->todo = malloc(s->cap_todo * sizeof(uint32_t));
+    char *path = strdup(host_dir);
+    if (!s->nodes || !s->todo || !path) {
+        free(path);
+        return -1;
+    }
+    memset(&s->nodes[0], 0, sizeof(Node));
+    s->nodes[0].path = path;
+    s->nodes[0].mode = (uint16_t)(IDIR | (st.st_mode & S_IRWXU));
+    s->nodes[0].mtime = st.st_mtime;
+    s->num_nodes = 1;
+    s->todo[s->num_todo++] = 0;
+    s->pending = 1;
+    s->stats.dirs = 1;
+
+    pthread_t workers[IMPORT_SCAN_THREADS];
+    uint32_t started = 0;
+    while (started < IMPORT_SCAN_THREADS && pthread_create(&workers[started], NULL, scan_worker, s) == 0) started++;
+    if (started == 0) scan_worker(s); // no threads to be had, scan alone
+    for (uint32_t i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    return s->failed ? -1 : 0;
+}
+
+// puts the nodes in breadth first order, children still in name order, so the copy hands out
+// inodes and blocks the same way whichever scan worker finished first. returns 0 or -1
+static int order_tree(Scan *s) {
+    Node *sorted = malloc(s->num_nodes * sizeof(Node));
+    if (!sorted) return -1;
+    sorted[0] = s->nodes[0];
+    uint32_t n = 1;
+    for (uint32_t d = 0; d < n; d++) {
+        // a node's first still points into the scan's order until it is reached here
+        uint32_t first = sorted[d].first, count = sorted[d].count;
+        sorted[d].first = n;
+        for (uint32_t i = 0; i < count; i++, n++) {
+            sorted[n] = s->nodes[first + i];
+            sorted[n].parent = d;
+        }
+    }
+    free(s->nodes);
+    s->nodes = sorted;
+    s->cap_nodes = s->num_nodes;
+    return 0;
+}
+
+// image blocks for what the scan found plus room to grow, and the inode ratio that gives every
+// file and dir an inode, returns 0 or -1 when no image is that large
+static int size_image(const ImportStats *found, FsOptions *fmt, uint32_t *num_blocks) {
+    uint64_t inodes = found->dirs + found->files;
+    inodes += inodes / 8 + 64;
+    uint64_t payload = found->data_blocks + found->meta_blocks;
+    payload += payload / 8 + 64;
+
+    uint64_t blocks = payload > IMPORT_MIN_BLOCKS ? payload : IMPORT_MIN_BLOCKS;
+    for (int pass = 0; pass < 32 && blocks <= MAX_BLOCKS; pass++) {
+        // a group's inode bitmap is one block
+        uint64_t groups = (blocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+        if (groups * BITS_PER_BLOCK < inodes) {
+            blocks = (inodes + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK * BITS_PER_BLOCK;
+            continue;
+        }
+        uint64_t table = ((inodes + groups - 1) / groups + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK;
+        uint64_t desc = (groups + GROUP_DESC_PER_BLOCK - 1) / GROUP_DESC_PER_BLOCK;
+        uint64_t journal = !fmt->journal ? 0 : fmt->journal_blocks ? fmt->journal_blocks
+                                                                   : journal_default_blocks((uint32_t)blocks);
+        uint64_t need = 1 + desc + groups * (2 + table) + journal + payload;
+
+        // format leaves out a last group too small for its metadata and the journal
+        uint64_t last = blocks - (groups - 1) * BITS_PER_BLOCK;
+        uint64_t last_need = 2 + table + journal + 64 + (groups == 1 ? 1 + desc : 0);
+        if (need > blocks) blocks = need;
+        else if (last < last_need) blocks += last_need - last;
+        else {
+            *num_blocks = (uint32_t)blocks;
+            fmt->inode_ratio = (uint32_t)(blocks * BLOCK_SIZE / inodes);
+            return 0;
+        }
+    }
+    fprintf(stderr, "import: the tree needs a larger image than %u blocks\n", MAX_BLOCKS);
+    return -1;
+}
+
+// reads size bytes of the host file at path into buf, a file that shrank since the scan reads
+// as zeros past its end, returns 0 or -1
+static int read_host(const char *path, uint8_t *buf, uint64_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "import: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            fprintf(stderr, "import: %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (n == 0) break;
+        done += (uint64_t)n;
+    }
+    close(fd);
+    memset(buf + done, 0, size - done);
+    return 0;
+}
+
+// gives a copied file its host attributes and one link, maps blocks already written from first
+// when there are any, runs inside a transaction, returns 0 or -1
+static int finish_file(const Node *f, uint32_t first, uint32_t blocks) {
+    InodeHandle *h = iget(f->inum);
+    if (!h) return -1;
+    ilock(h);
+    int rc = blocks ? file_map_run(h, 0, first, blocks) : 0;
+    if (rc == 0 && blocks) h->inode.size = f->size;
+    h->inode.mode = f->mode;
+    h->inode.links_count = 1;
+    h->inode.mtime = f->mtime;
+    idirty(h);
+    iunlock(h);
+    iput(h);
+    return rc;
+}
+
+// copies a file that doesn't share a run (inline sized, or a run of its own) through fs_write,
+// staging at a time, returns 0 or -1
+static int copy_alone(const Node *f, uint8_t *staging) {
+    int fd = f->size ? open(f->path, O_RDONLY) : -1;
+    if (f->size && fd == -1) {
+        fprintf(stderr, "import: %s: %s\n", f->path, strerror(errno));
+        return -1;
+    }
+
+    int rc = 0;
+    for (uint64_t off = 0; rc == 0 && off < f->size;) {
+        size_t want = f->size - off < (uint64_t)IMPORT_RUN_BLOCKS * BLOCK_SIZE ? (size_t)(f->size - off)
+                                                                              : (size_t)IMPORT_RUN_BLOCKS * BLOCK_SIZE;
+        ssize_t n = pread(fd, staging, want, (off_t)off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break; // shrank since the scan, the rest stays a hole
+        if (fs_write(f->inum, off, staging, (size_t)n) != n) rc = -1;
+        off += (uint64_t)n;
+    }
+    if (fd != -1) close(fd);
+
+    tx_begin();
+    tx_mark_lazy();
+    if (rc == 0) rc = finish_file(f, 0, 0);
+    tx_commit();
+    if (rc == -1) fprintf(stderr, "import: %s: can't copy\n", f->path);
+    return rc;
+}
+
+// writes the files among kids: back to back runs of up to IMPORT_RUN_BLOCKS, each allocated at
+// once, read into staging and written with one device write, then mapped. returns 0 or -1
+static int copy_files(const Scan *s, const Node *kids, uint32_t n, uint32_t goal, uint8_t *staging) {
+    uint32_t i = 0;
+    while (i < n) {
+        const Node *f = &kids[i];
+        uint64_t blocks = data_blocks(s, f->size);
+        if ((f->mode & 0xF000) == IDIR) {
+            i++;
+            continue;
+        }
+        if (blocks == 0 || blocks >= IMPORT_RUN_BLOCKS) {
+            if (copy_alone(f, staging) == -1) return -1;
+            i++;
+            continue;
+        }
+
+        // the files after it that still fit the run
+        uint32_t want = 0, j = i;
+        for (; j < n; j++) {
+            if ((kids[j].mode & 0xF000) == IDIR) continue;
+            uint64_t b = data_blocks(s, kids[j].size);
+            if (b == 0 || b >= IMPORT_RUN_BLOCKS || want + b > IMPORT_RUN_BLOCKS) break;
+            want += (uint32_t)b;
+        }
+
+        tx_begin();
+        tx_mark_lazy();
+        uint32_t got;
+        long first = alloc_block_extent(goal, want, &got);
+        if (first == -1) {
+            tx_commit();
+            fprintf(stderr, "import: out of blocks\n");
+            return -1;
+        }
+
+        // free space may be cut up, the run takes the files that fit what was found
+        int rc = 0;
+        uint32_t used = 0, k = i;
+        for (; k < j; k++) {
+            if ((kids[k].mode & 0xF000) == IDIR) continue;
+            uint32_t b = (uint32_t)data_blocks(s, kids[k].size);
+            if (used + b > got) break;
+            if (read_host(kids[k].path, staging + (size_t)used * BLOCK_SIZE, kids[k].size) == -1) {
+                rc = -1;
+                break;
+            }
+            // the tail of the last block is zeros like a fresh block
+            memset(staging + (size_t)used * BLOCK_SIZE + kids[k].size, 0, (size_t)b * BLOCK_SIZE - kids[k].size);
+            used += b;
+        }
+        if (used < got) free_block_run((uint32_t)first + used, got - used);
+
+        // data reaches the device before the transaction that maps it commits
+        if (rc == 0 && used) rc = bdev_write(fs.dev, (uint64_t)first, used, staging);
+        uint32_t at = (uint32_t)first;
+        for (uint32_t m = i; rc == 0 && m < k; m++) {
+            if ((kids[m].mode & 0xF000) == IDIR) continue;
+            uint32_t b = (uint32_t)data_blocks(s, kids[m].size);
+            rc = finish_file(&kids[m], at, b);
+            at += b;
+        }
+        tx_commit();
+        if (rc == -1) return -1;
+
+        if (k == i) {
+            // not even the first file fit the free run found, it finds room of its own
+            if (copy_alone(f, staging) == -1) return -1;
+            k++;
+        }
+        goal = (uint32_t)first + used;
+        i = k;
+    }
+    return 0;
+}
+
+// gives node d's children their inodes, copies its files and builds its entries, the dir
+// itself got its inode from its own parent already, returns 0 or -1
+static int copy_dir(Scan *s, uint32_t d, uint8_t *staging) {
+    const Node *dir = &s->nodes[d];
+    Node *kids = s->nodes + dir->first;
+    uint32_t n = dir->count;
+    uint32_t *inums = malloc(IMPORT_TX_INODES * sizeof(uint32_t));
+    DirEntry *entries = malloc((n ? n : 1) * sizeof(DirEntry));
+    int rc = inums && entries ? 0 : -1;
+
+    // subdirs one by one so each gets an Orlov placement, files in bulk next to the dir
+    for (uint32_t i = 0; rc == 0 && i < n; i += IMPORT_TX_INODES) {
+        uint32_t end = n - i < IMPORT_TX_INODES ? n : i + IMPORT_TX_INODES;
+        uint32_t files = 0;
+        tx_begin();
+        tx_mark_lazy();
+        for (uint32_t k = i; rc == 0 && k < end; k++) {
+            if ((kids[k].mode & 0xF000) != IDIR) {
+                files++;
+                continue;
+            }
+            int inum = create_dir_in(dir->inum, kids[k].mode);
+            if (inum == -1) rc = -1;
+            else kids[k].inum = (uint32_t)inum;
+        }
+        if (rc == 0 && files && create_inodes_in(dir->inum, IREG | IRUSR | IWUSR, files, inums) < files) rc = -1;
+        for (uint32_t k = i, f = 0; rc == 0 && k < end; k++) {
+            if ((kids[k].mode & 0xF000) != IDIR) kids[k].inum = inums[f++];
+        }
+        tx_commit();
+        if (rc == -1) fprintf(stderr, "import: out of inodes\n");
+    }
+
+    uint32_t goal = group_data_start(group_of_inode(dir->inum));
+    if (rc == 0) rc = copy_files(s, kids, n, goal, staging);
+
+    uint32_t subdirs = 0;
+    for (uint32_t k = 0; rc == 0 && k < n; k++) {
+        DirEntry *e = &entries[k];
+        const char *name = kids[k].path + kids[k].name_off;
+        e->inode_num = kids[k].inum;
+        e->type = kids[k].mode & 0xF000;
+        e->name_len = (uint8_t)strlen(name);
+        e->_pad = 0;
+        memcpy(e->name, name, e->name_len + 1);
+        if (e->type == IDIR) subdirs++;
+    }
+
+    if (rc == 0) {
+        // every entry at once, "." and ".." of each subdir count towards the links
+        tx_begin();
+        tx_mark_lazy();
+        InodeHandle *h = iget(dir->inum);
+        if (!h) rc = -1;
+        else {
+            ilock(h);
+            rc = dir_build(h, s->nodes[dir->parent].inum, entries, n);
+            h->inode.mode = dir->mode;
+            h->inode.links_count = (uint16_t)(2 + subdirs);
+            h->inode.mtime = dir->mtime;
+            idirty(h);
+            iunlock(h);
+            iput(h);
+        }
+        tx_commit();
+        if (rc == -1) fprintf(stderr, "import: %s: too many entries for a dir\n", dir->path);
+    }
+
+    free(entries);
+    free(inums);
+    return rc;
+}
+
+// formats image just big enough for the host tree under host_dir (plus room to grow) and copies
+// the tree in, like mkfs -d: the tree is scanned in parallel and counted first, inodes and data
+// runs are allocated in bulk and dirs are built in memory, written with few large device writes.
+// opts picks the format options, the inode ratio follows from the tree. the image stays mounted,
+// out gets what was found. returns 0 or -1
+int fs_import(const char *host_dir, const char *image, const FsOptions *opts, ImportStats *out) {
+    Scan s;
+    memset(&s, 0, sizeof(Scan));
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.more, NULL);
+
+    FsOptions fmt;
+    if (opts) fmt = *opts;
+    else fs_default_options(&fmt);
+    s.inline_data = fmt.inline_data;
+
+    uint32_t num_blocks = 0;
+    uint8_t *staging = NULL;
+    int rc = scan_tree(&s, host_dir);
+    if (rc == 0) rc = order_tree(&s);
+    if (rc == 0) rc = size_image(&s.stats, &fmt, &num_blocks);
+    if (rc == 0) rc = format_disk_opts(image, num_blocks, &fmt);
+    if (rc == 0 && posix_memalign((void **)&staging, BDEV_ALIGN, (size_t)IMPORT_RUN_BLOCKS * BLOCK_SIZE) != 0) {
+        staging = NULL;
+        rc = -1;
+    }
+
+    // parents come before their children in nodes, so every dir has its inode when reached
+    if (rc == 0) s.nodes[0].inum = fs.sb.root_inode;
+    for (uint32_t d = 0; rc == 0 && d < s.num_nodes; d++) {
+        if ((s.nodes[d].mode & 0xF000) == IDIR) rc = copy_dir(&s, d, staging);
+    }
+    if (rc == 0 && fs_sync() == -1) rc = -1;
+
+    s.stats.image_blocks = num_blocks;
+    if (out) *out = s.stats;
+    free(staging);
+    free_scan(&s);
+    return rc;
+}
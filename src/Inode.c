@@ -22,7 +22,7 @@ void inode_to_string(const Inode *inode) {
     printf("Inode {\n");
     printf("  mode        : 0x%04x (%s)\n", inode->mode, perm);
     printf("  links       : %u\n", inode->links_count);
-    printf("  size        : %u bytes\n", inode->size);
+    printf("  size        : %llu bytes\n", (unsigned long long)inode->size);
 
     printf("  atime       : %s", ctime(&inode->atime));
     printf("  mtime       : %s", ctime(&inode->mtime));
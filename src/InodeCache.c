@@ -0,0 +1,236 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/InodeCache.h"
+#include "../include/Cache.h"
+#include "../include/Stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static InodeHandle *slots = NULL;       // fixed pool of in-core inodes
+static uint32_t num_slots = 0;
+static InodeHandle **hash_table = NULL; // inode number -> slot chains
+static uint32_t hash_mask = 0;
+static uint32_t clock_hand = 0;         // next eviction candidate
+static ICacheStats stats;
+
+// same scheme as the buffer cache: hits share the table, misses and evictions own it
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint32_t hash_inode(uint32_t inum) {
+    return (inum * 2654435761u) & hash_mask;
+}
+
+// copies the in-core inode into its inode table block, the block stays dirty in the buffer cache.
+// the flag is cleared first so an idirty racing with the copy is not lost, the shared hold keeps
+// out an atime stamp of a reader outside any transaction (Files.c)
+static void writeback(InodeHandle *h) {
+    __atomic_store_n(&h->dirty, 0, __ATOMIC_RELAXED);
+    pthread_rwlock_rdlock(&h->lock);
+    cache_write(inode_disk_offset(h->inum), &h->inode, sizeof(Inode));
+    pthread_rwlock_unlock(&h->lock);
+    __atomic_fetch_add(&stats.writebacks, 1, __ATOMIC_RELAXED);
+}
+
+static void hash_remove(InodeHandle *h) {
+    InodeHandle **link = &hash_table[hash_inode(h->inum)];
+    while (*link) {
+        if (*link == h) {
+            *link = h->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    h->hash_next = NULL;
+}
+
+static InodeHandle *hash_find(uint32_t inum) {
+    for (InodeHandle *h = hash_table[hash_inode(inum)]; h; h = h->hash_next) {
+        if (h->inum == inum) return h;
+    }
+    return NULL;
+}
+
+// CLOCK over the slot pool, same policy as the buffer cache
+static InodeHandle *pick_victim() {
+    for (uint32_t scanned = 0; scanned < 2 * num_slots; scanned++) {
+        InodeHandle *h = &slots[clock_hand];
+        clock_hand = (clock_hand + 1) % num_slots;
+
+        if (__atomic_load_n(&h->refs, __ATOMIC_ACQUIRE) > 0) continue; // handed out, never evicted
+        if (!h->valid) return h;            // never used slot
+        if (h->referenced) {
+            h->referenced = 0;
+            continue;
+        }
+
+        if (__atomic_load_n(&h->dirty, __ATOMIC_RELAXED)) writeback(h);
+        hash_remove(h);
+        h->valid = 0;
+        __atomic_fetch_add(&stats.evictions, 1, __ATOMIC_RELAXED);
+        return h;
+    }
+    return NULL; // every slot is referenced
+}
+
+// references the hashed slot of inum, NULL if it isn't cached, table held at least shared
+static InodeHandle *ref_cached(uint32_t inum) {
+    InodeHandle *h = hash_find(inum);
+    if (!h) return NULL;
+    __atomic_fetch_add(&h->refs, 1, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&h->referenced, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.hits, 1, __ATOMIC_RELAXED);
+    STATS_COUNT(icache_hits, 1);
+    return h;
+}
+
+// returns referenced slot for inum with the inode loaded, a miss reads the inode table under
+// the exclusive table lock, fresh skips the read and hands out a zeroed dirty inode
+static InodeHandle *claim(uint32_t inum, int fresh) {
+    if (!slots && icache_init(ICACHE_DEFAULT_INODES) == -1) return NULL;
+    if (inum >= fs.sb.total_inodes) return NULL; // e.g. a corrupt dir entry
+
+    InodeHandle *h = NULL;
+    if (!fresh) {
+        pthread_rwlock_rdlock(&table_lock);
+        h = ref_cached(inum);
+        pthread_rwlock_unlock(&table_lock);
+        if (h) return h;
+    }
+
+    pthread_rwlock_wrlock(&table_lock);
+    h = ref_cached(inum); // another thread may have loaded it in between
+    if (!h) {
+        __atomic_fetch_add(&stats.misses, 1, __ATOMIC_RELAXED);
+        STATS_COUNT(icache_misses, 1);
+        h = pick_victim();
+        if (!h) {
+            pthread_rwlock_unlock(&table_lock);
+            return NULL;
+        }
+
+        h->inum = inum;
+        h->refs = 1;
+        h->dirty = 0;
+        h->referenced = 1;
+        h->dir_room_known = 0;
+        uint32_t b = hash_inode(inum);
+        h->hash_next = hash_table[b];
+        hash_table[b] = h;
+        if (!fresh && cache_read(inode_disk_offset(inum), &h->inode, sizeof(Inode)) == -1) {
+            hash_remove(h); // table block unreadable (fails its checksum), the slot stays free
+            h->valid = 0;
+            h->refs = 0;
+            pthread_rwlock_unlock(&table_lock);
+            return NULL;
+        }
+        h->valid = 1;
+    }
+    if (fresh) {
+        memset(&h->inode, 0, sizeof(Inode));
+        h->dirty = 1;
+        h->dir_room_known = 0;
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return h;
+}
+
+static void release_slots() {
+    for (uint32_t i = 0; i < num_slots; i++) pthread_rwlock_destroy(&slots[i].lock);
+    free(slots);
+    free(hash_table);
+    slots = NULL;
+    hash_table = NULL;
+    num_slots = 0;
+}
+
+// sets up num_inodes in-core slots, drops whatever was cached before without writing it back
+int icache_init(uint32_t n) {
+    release_slots();
+
+    if (n == 0) n = ICACHE_DEFAULT_INODES;
+
+    uint32_t buckets = 1;
+    while (buckets < 2 * n) buckets <<= 1;
+
+    slots = calloc(n, sizeof(InodeHandle));
+    hash_table = calloc(buckets, sizeof(InodeHandle *));
+    if (!slots || !hash_table) {
+        free(slots);
+        free(hash_table);
+        slots = NULL;
+        hash_table = NULL;
+        num_slots = 0;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < n; i++) pthread_rwlock_init(&slots[i].lock, NULL);
+    num_slots = n;
+    hash_mask = buckets - 1;
+    clock_hand = 0;
+    memset(&stats, 0, sizeof(stats));
+    return 0;
+}
+
+// writes back dirty inodes into the buffer cache and releases the pool
+void icache_destroy() {
+    if (!slots) return;
+    icache_flush();
+    release_slots();
+}
+
+// returns referenced handle with the inode loaded, release with iput
+InodeHandle *iget(uint32_t inum) {
+    return claim(inum, 0);
+}
+
+// like iget but skips the inode table read, for freshly allocated inodes
+InodeHandle *iget_new(uint32_t inum) {
+    return claim(inum, 1);
+}
+
+void iput(InodeHandle *h) {
+    if (h) __atomic_fetch_sub(&h->refs, 1, __ATOMIC_RELEASE);
+}
+
+// marks inode to be written back on flush or eviction
+void idirty(InodeHandle *h) {
+    __atomic_store_n(&h->dirty, 1, __ATOMIC_RELAXED);
+}
+
+// exclusive hold of the inode and the blocks it maps, for changing either. take it after
+// tx_begin and drop it before the outermost tx_commit (Transaction.h)
+void ilock(InodeHandle *h) {
+    pthread_rwlock_wrlock(&h->lock);
+}
+
+// shared hold for reading the inode or walking its blocks
+void ilock_shared(InodeHandle *h) {
+    pthread_rwlock_rdlock(&h->lock);
+}
+
+void iunlock(InodeHandle *h) {
+    pthread_rwlock_unlock(&h->lock);
+}
+
+// writes every dirty inode into the buffer cache, returns num written
+int icache_flush() {
+    if (!slots) return 0;
+
+    int count = 0;
+    pthread_rwlock_wrlock(&table_lock);
+    for (uint32_t i = 0; i < num_slots; i++) {
+        if (slots[i].valid && __atomic_load_n(&slots[i].dirty, __ATOMIC_RELAXED)) {
+            writeback(&slots[i]);
+            count++;
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return count;
+}
+
+void icache_stats(ICacheStats *out) {
+    *out = stats;
+}
@@ -0,0 +1,334 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Journal.h"
+#include "../include/FileSystemStructure.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int is_open = 0;
+static uint32_t journal_start = 0;  // first block of the region, holds the JournalSuper
+static uint32_t journal_blocks = 0;
+static uint32_t head = 1;           // next free block, relative to journal_start
+static uint32_t sequence = 0;       // sequence of the next record
+static int clean = 1;               // on-disk super says there is nothing to replay
+
+static uint32_t commit_batch = 1;   // transactions per record
+static uint64_t window_ns = 0;      // oldest batched transaction waits at most this long, 0 = no limit
+
+static Buffer **batch = NULL;       // buffers of committed transactions waiting for their record
+static uint32_t num_batch = 0;
+static uint32_t batch_cap = 0;
+static uint32_t batch_tx = 0;
+static uint64_t batch_started = 0;
+
+static uint8_t *staging = NULL;     // descriptor + images + commit, written with one call
+static JournalStats stats;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// FNV-1a over the tags and the images, catches torn records written with a single sync
+static uint32_t record_checksum(const uint32_t *tags, const uint8_t *images, uint32_t count) {
+    uint32_t h = 2166136261u;
+    const uint8_t *p = (const uint8_t *)tags;
+    for (size_t i = 0; i < count * sizeof(uint32_t); i++) h = (h ^ p[i]) * 16777619u;
+    for (size_t i = 0; i < (size_t)count * BLOCK_SIZE; i++) h = (h ^ images[i]) * 16777619u;
+    return h;
+}
+
+// most images one record can carry in this journal
+static uint32_t record_limit() {
+    uint32_t fit = journal_blocks > 3 ? journal_blocks - 3 : 0; // super, descriptor, commit
+    return fit < JOURNAL_MAX_TAGS ? fit : (uint32_t)JOURNAL_MAX_TAGS;
+}
+
+static int write_super(BlockDevice *dev, uint32_t start, const JournalSuper *js) {
+    uint8_t *block;
+    if (posix_memalign((void **)&block, BDEV_ALIGN, BLOCK_SIZE) != 0) return -1;
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, js, sizeof(JournalSuper));
+    int rc = bdev_write(dev, start, 1, block);
+    free(block);
+    return rc;
+}
+
+static int read_block_aligned(BlockDevice *dev, uint64_t block, uint8_t **out) {
+    if (posix_memalign((void **)out, BDEV_ALIGN, BLOCK_SIZE) != 0) return -1;
+    if (bdev_read(dev, block, 1, *out) == -1) {
+        free(*out);
+        return -1;
+    }
+    return 0;
+}
+
+// journal size format_disk picks for an image of total_blocks
+uint32_t journal_default_blocks(uint32_t total_blocks) {
+    uint32_t blocks = total_blocks / JOURNAL_DEFAULT_RATIO;
+    if (blocks < JOURNAL_MIN_BLOCKS) blocks = JOURNAL_MIN_BLOCKS;
+    if (blocks > JOURNAL_MAX_BLOCKS) blocks = JOURNAL_MAX_BLOCKS;
+    return blocks;
+}
+
+// writes an empty journal super at start, returns 0 or -1
+int journal_format(BlockDevice *dev, uint32_t start, uint32_t blocks) {
+    if (blocks < JOURNAL_MIN_BLOCKS) return -1;
+    memset(&stats, 0, sizeof(stats));
+    JournalSuper js = { JOURNAL_MAGIC, blocks, 0, 1 };
+    return write_super(dev, start, &js);
+}
+
+// applies every fully committed record to its home blocks, returns num of records or -1
+int journal_replay(BlockDevice *dev, uint32_t start, uint32_t blocks) {
+    memset(&stats, 0, sizeof(stats));
+
+    uint8_t *block;
+    if (read_block_aligned(dev, start, &block) == -1) return -1;
+    JournalSuper js = *(const JournalSuper *)block;
+    free(block);
+
+    if (js.magic != JOURNAL_MAGIC || js.blocks != blocks) {
+        fprintf(stderr, "journal: bad journal superblock at block %u\n", start);
+        return -1;
+    }
+    if (js.start == 0) return 0; // clean unmount or checkpointed
+
+    uint32_t pos = js.start;
+    uint32_t seq = js.sequence;
+    int replayed = 0;
+    while (pos + 2 <= blocks) {
+        uint8_t *desc_block;
+        if (read_block_aligned(dev, (uint64_t)start + pos, &desc_block) == -1) break;
+        const JournalHeader *desc = (const JournalHeader *)desc_block;
+        uint32_t count = desc->count;
+        if (desc->magic != JOURNAL_MAGIC || desc->type != JOURNAL_DESCRIPTOR || desc->sequence != seq
+            || count > JOURNAL_MAX_TAGS || pos + count + 2 > blocks) {
+            free(desc_block);
+            break; // end of the log
+        }
+
+        uint8_t *images = NULL;
+        uint8_t *commit_block = NULL;
+        int ok = posix_memalign((void **)&images, BDEV_ALIGN, (size_t)(count ? count : 1) * BLOCK_SIZE) == 0
+                 && (count == 0 || bdev_read(dev, (uint64_t)start + pos + 1, count, images) == 0)
+                 && read_block_aligned(dev, (uint64_t)start + pos + 1 + count, &commit_block) == 0;
+        if (ok) {
+            const JournalHeader *commit = (const JournalHeader *)commit_block;
+            ok = commit->magic == JOURNAL_MAGIC && commit->type == JOURNAL_COMMIT && commit->sequence == seq
+                 && commit->count == count && commit->checksum == record_checksum(desc->tags, images, count);
+        }
+        if (ok) {
+            for (uint32_t i = 0; i < count; i++) {
+                bdev_write(dev, desc->tags[i], 1, images + (size_t)i * BLOCK_SIZE);
+            }
+            stats.replayed_blocks += count;
+            replayed++;
+            pos += count + 2;
+            seq++;
+        }
+        free(commit_block);
+        free(images);
+        free(desc_block);
+        if (!ok) break; // torn record, never committed
+    }
+    stats.replayed_records = replayed;
+
+    // home blocks are durable before the journal forgets them
+    if (bdev_sync(dev) == -1) return -1;
+    js.start = 0;
+    js.sequence = seq;
+    if (write_super(dev, start, &js) == -1 || bdev_sync(dev) == -1) return -1;
+    return replayed;
+}
+
+// forgets the state of an earlier image without touching any device
+static void discard() {
+    free(batch);
+    free(staging);
+    batch = NULL;
+    staging = NULL;
+    num_batch = 0;
+    batch_cap = 0;
+    batch_tx = 0;
+    is_open = 0;
+}
+
+// starts logging commits into the (already replayed) journal on fs.dev, returns 0 or -1
+int journal_open(uint32_t start, uint32_t blocks, uint32_t batch_size, uint32_t commit_window_us) {
+    discard();
+
+    uint8_t *block;
+    if (read_block_aligned(fs.dev, start, &block) == -1) return -1;
+    JournalSuper js = *(const JournalSuper *)block;
+    free(block);
+    if (js.magic != JOURNAL_MAGIC || js.blocks != blocks || js.start != 0) return -1;
+
+    journal_start = start;
+    journal_blocks = blocks;
+    head = 1;
+    sequence = js.sequence;
+    clean = 1;
+    commit_batch = batch_size ? batch_size : 1;
+    window_ns = (uint64_t)commit_window_us * 1000;
+
+    if (posix_memalign((void **)&staging, BDEV_ALIGN, (size_t)(record_limit() + 2) * BLOCK_SIZE) != 0) {
+        staging = NULL;
+        return -1;
+    }
+    is_open = 1;
+    return 0;
+}
+
+// logs what is still batched, checkpoints and stops journaling
+void journal_close() {
+    if (!is_open) return;
+    journal_checkpoint();
+    discard();
+}
+
+int journal_enabled() {
+    return is_open;
+}
+
+static void release_batch() {
+    for (uint32_t i = 0; i < num_batch; i++) cache_untrack(batch[i]);
+    num_batch = 0;
+    batch_tx = 0;
+}
+
+static int mark_clean() {
+    JournalSuper js = { JOURNAL_MAGIC, journal_blocks, 0, sequence };
+    if (write_super(fs.dev, journal_start, &js) == -1 || bdev_sync(fs.dev) == -1) return -1;
+    head = 1;
+    clean = 1;
+    return 0;
+}
+
+// writes every logged block home, after which the journal space can be reused
+static int checkpoint_home() {
+    int written = cache_flush(); // batched buffers are still tracked and stay put
+    if (written == -1 || bdev_sync(fs.dev) == -1) return -1;
+    if (!clean && mark_clean() == -1) return -1;
+    stats.checkpoints++;
+    return written;
+}
+
+static int compare_block_num(const void *a, const void *b) {
+    uint32_t x = (*(Buffer * const *)a)->block_num;
+    uint32_t y = (*(Buffer * const *)b)->block_num;
+    return (x > y) - (x < y);
+}
+
+// writes the batch as one record with a single device sync, returns num of images logged or -1
+int journal_flush() {
+    if (!is_open || num_batch == 0) return 0;
+
+    uint64_t started = now_ns();
+    uint32_t count = num_batch;
+    qsort(batch, count, sizeof(Buffer *), compare_block_num);
+
+    if (count > record_limit()) {
+        // too big for the journal at all, written in place after a checkpoint
+        release_batch();
+        return checkpoint_home() == -1 ? -1 : 0;
+    }
+    if (head + count + 2 > journal_blocks && checkpoint_home() == -1) return -1;
+
+    JournalHeader *desc = (JournalHeader *)staging;
+    memset(desc, 0, BLOCK_SIZE);
+    desc->magic = JOURNAL_MAGIC;
+    desc->type = JOURNAL_DESCRIPTOR;
+    desc->sequence = sequence;
+    desc->count = count;
+
+    uint8_t *images = staging + BLOCK_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        desc->tags[i] = batch[i]->block_num;
+        bseal(batch[i]); // replay puts the image home as logged
+        memcpy(images + (size_t)i * BLOCK_SIZE, batch[i]->data, BLOCK_SIZE);
+    }
+
+    JournalHeader *commit = (JournalHeader *)(images + (size_t)count * BLOCK_SIZE);
+    memset(commit, 0, BLOCK_SIZE);
+    commit->magic = JOURNAL_MAGIC;
+    commit->type = JOURNAL_COMMIT;
+    commit->sequence = sequence;
+    commit->count = count;
+    commit->checksum = record_checksum(desc->tags, images, count);
+
+    uint64_t bytes = (uint64_t)(count + 2) * BLOCK_SIZE;
+    if (clean) {
+        // first record since the last checkpoint, replay has to start here
+        JournalSuper js = { JOURNAL_MAGIC, journal_blocks, head, sequence };
+        if (write_super(fs.dev, journal_start, &js) == -1) return -1;
+        bytes += BLOCK_SIZE;
+        clean = 0;
+    }
+    if (bdev_write(fs.dev, (uint64_t)journal_start + head, count + 2, staging) == -1) return -1;
+    if (bdev_sync(fs.dev) == -1) return -1;
+
+    head += count + 2;
+    sequence++;
+
+    stats.records++;
+    stats.transactions += batch_tx;
+    stats.blocks_logged += count;
+    stats.bytes_written += bytes;
+
+    // logged, the buffers may now reach their home blocks whenever the cache likes
+    release_batch();
+
+    uint64_t took = now_ns() - started;
+    stats.commit_ns += took;
+    if (took > stats.max_commit_ns) stats.max_commit_ns = took;
+    return (int)count;
+}
+
+// takes over the pinned buffers of one committed transaction, they are logged together with the
+// rest of the batch, a lazy transaction doesn't count towards commit_batch and waits for the
+// next regular commit, a full batch, the window or journal_flush,
+// returns num of images logged now (0 while batching) or -1
+int journal_commit(Buffer **bufs, uint32_t count, int lazy) {
+    if (!is_open) return -1;
+    if (count == 0 && num_batch == 0) return 0;
+
+    if (num_batch + count > batch_cap) {
+        uint32_t cap = batch_cap ? batch_cap : 64;
+        while (cap < num_batch + count) cap *= 2;
+        Buffer **grown = realloc(batch, cap * sizeof(Buffer *));
+        if (!grown) {
+            for (uint32_t i = 0; i < count; i++) cache_untrack(bufs[i]);
+            return -1;
+        }
+        batch = grown;
+        batch_cap = cap;
+    }
+    memcpy(batch + num_batch, bufs, count * sizeof(Buffer *));
+    num_batch += count;
+    if (batch_tx++ == 0) batch_started = now_ns();
+
+    // batched buffers stay pinned, so keep the batch well inside the cache and the journal
+    int due = (!lazy && batch_tx >= commit_batch)
+              || num_batch * 2 >= record_limit()
+              || num_batch * 4 >= cache_capacity()
+              || (window_ns && now_ns() - batch_started >= window_ns);
+    return due ? journal_flush() : 0;
+}
+
+// logs the batch, then writes everything home and marks the journal empty,
+// returns num of blocks written home or -1
+int journal_checkpoint() {
+    if (!is_open) return cache_flush();
+    if (journal_flush() == -1) return -1;
+    return checkpoint_home();
+}
+
+void journal_stats(JournalStats *out) {
+    *out = stats;
+}
@@ -3,3 +3,105 @@
 //
 
 #include "../include/Paths.h"
+#include "../include/DentryCache.h"
+#include "../include/FileSystemStructure.h"
+#include "../include/Stats.h"
+
+#include <string.h>
+
+static long cwd = -1; // working directory of every thread, -1 = the root
+
+// resolves the first len bytes of path from start one component at a time through the dentry
+// cache, type gets IDIR or IREG of the result, returns its inum or -1
+static long walk(uint32_t start, const char *path, size_t len, uint16_t *type) {
+    uint32_t cur = path[0] == '/' ? fs.sb.root_inode : start;
+    uint16_t cur_type = IDIR;
+
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && path[i] == '/') i++; // repeated and trailing slashes
+        if (i == len) break;
+
+        size_t end = i;
+        while (end < len && path[end] != '/') end++;
+        size_t n = end - i;
+        if (n >= NAME_MAX) return -1; // longer than any stored name
+
+        // only directories have components below them
+        if (cur_type != IDIR) return -1;
+
+        char name[NAME_MAX];
+        memcpy(name, path + i, n);
+        name[n] = '\0';
+        i = end;
+
+        if (strcmp(name, ".") == 0) continue;
+
+        // ".." is a real entry, the root's points back at the root
+        long next = dcache_lookup(cur, name, &cur_type);
+        if (next == -1) return -1;
+        cur = (uint32_t)next;
+    }
+
+    if (type) *type = cur_type;
+    return cur;
+}
+
+// inum path names, absolute or relative to cwd, or -1
+long path_resolve(uint32_t cwd_inum, const char *path) {
+    if (!path || !*path) return -1;
+    StatsSpan span = stats_begin(OP_RESOLVE);
+    long inum = walk(cwd_inum, path, strlen(path), NULL);
+    stats_end(span);
+    return inum;
+}
+
+// resolves everything but the last component, which is copied to name (NAME_MAX bytes),
+// returns the inum of the directory it would live in or -1
+long path_resolve_parent(uint32_t cwd_inum, const char *path, char *name) {
+    if (!path || !*path) return -1;
+
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+    size_t last = len;
+    while (last > 0 && path[last - 1] != '/') last--;
+
+    size_t n = len - last;
+    if (n == 0 || n >= NAME_MAX) return -1; // "/" or a name too long to store
+    memcpy(name, path + last, n);
+    name[n] = '\0';
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+
+    if (last == 0) return cwd_inum; // plain name
+    uint16_t type;
+    StatsSpan span = stats_begin(OP_RESOLVE);
+    long dir = walk(cwd_inum, path, last, &type);
+    stats_end(span);
+    return dir != -1 && type == IDIR ? dir : -1;
+}
+
+// path_resolve from the working directory
+long path_lookup(const char *path) {
+    return path_resolve(path_cwd(), path);
+}
+
+// makes path the working directory, returns 0 or -1
+int path_chdir(const char *path) {
+    uint16_t type;
+    if (!path || !*path) return -1;
+    long dir = walk(path_cwd(), path, strlen(path), &type);
+    if (dir == -1 || type != IDIR) return -1;
+
+    __atomic_store_n(&cwd, dir, __ATOMIC_RELAXED);
+    return 0;
+}
+
+uint32_t path_cwd() {
+    long dir = __atomic_load_n(&cwd, __ATOMIC_RELAXED);
+    return dir == -1 ? fs.sb.root_inode : (uint32_t)dir;
+}
+
+// back to the root, for a freshly formatted or mounted image
+void path_reset() {
+    __atomic_store_n(&cwd, -1, __ATOMIC_RELAXED);
+}
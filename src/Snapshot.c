@@ -0,0 +1,891 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Snapshot.h"
+#include "../include/FileManagement.h"
+#include "../include/Transaction.h"
+#include "../include/Journal.h"
+#include "../include/Checksum.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAP_COPY_BLOCKS 64         // blocks one copy moves at most, size of the bounce buffer
+
+// copy-out snapshots: the live image is written in place as before, the first write (or free)
+// of a block the newest snapshot still reads moves its old contents into a slot of one of its
+// chunks. snapshot k reads block b from the first map of k, k+1, ... newest holding b, else home
+
+// home -> copy, open addressing, keys stored + 1 so the superblock's block 0 fits
+typedef struct {
+    uint32_t *keys;
+    uint32_t *vals;
+    uint32_t cap;       // power of two
+    uint32_t count;
+} BlockMap;
+
+typedef struct {
+    uint32_t meta;      // map block, the slots follow it
+    uint32_t slots;
+    uint32_t born;
+} ChunkRef;
+
+typedef struct {
+    BlockMap map;
+    ChunkRef *chunks;   // in list order
+    uint32_t num_chunks;
+    uint32_t chunks_cap;
+    uint32_t kept;      // pairs whose block was kept instead of copied
+} Snap;
+
+typedef struct {
+    uint32_t meta;
+    SnapChunk *img;     // kept in memory while pairs go in, every change is written through
+} OpenChunk;
+
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} Run;
+
+int snap_live = 0;
+
+static SnapTable *table = NULL;     // image of the table block, aligned for the device
+static uint32_t table_block = 0;
+static Snap snaps[SNAP_MAX];        // same order as table->entries
+
+static uint64_t *cow = NULL;        // blocks the newest snapshot still reads from their home
+static uint64_t *owned = NULL;      // chunk runs, kept blocks and the table: never preserved
+static uint32_t nwords = 0;
+
+static OpenChunk open_chunks[2];    // newest snapshot's chunks taking pairs, its last one at the end
+static uint32_t num_open = 0;
+static uint32_t room = 0;           // copies the open chunks still take, peeked without the lock
+
+static uint8_t *bounce = NULL;      // SNAP_COPY_BLOCKS blocks, used under lock
+static int unsynced = 0;            // copies written since the last sync
+
+// lock is a leaf: only device I/O under it. admin keeps create, delete and export apart
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t admin = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t barrier_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int bit_test(const uint64_t *bits, uint32_t b) {
+    return (int)((__atomic_load_n(&bits[b / 64], __ATOMIC_RELAXED) >> (b % 64)) & 1);
+}
+
+static void bit_set(uint64_t *bits, uint32_t b) {
+    __atomic_fetch_or(&bits[b / 64], 1ull << (b % 64), __ATOMIC_RELAXED);
+}
+
+static void bit_clear(uint64_t *bits, uint32_t b) {
+    __atomic_fetch_and(&bits[b / 64], ~(1ull << (b % 64)), __ATOMIC_RELAXED);
+}
+
+static void bits_set_run(uint64_t *bits, uint32_t first, uint32_t count, int set) {
+    for (uint32_t b = first; b < first + count; b++) {
+        if (set) bit_set(bits, b);
+        else bit_clear(bits, b);
+    }
+}
+
+static uint32_t map_slot(const BlockMap *m, uint32_t home) {
+    return (home * 2654435761u) & (m->cap - 1);
+}
+
+static int map_get(const BlockMap *m, uint32_t home, uint32_t *copy) {
+    if (m->count == 0) return 0;
+    for (uint32_t i = map_slot(m, home);; i = (i + 1) & (m->cap - 1)) {
+        if (m->keys[i] == 0) return 0;
+        if (m->keys[i] == home + 1) {
+            if (copy) *copy = m->vals[i];
+            return 1;
+        }
+    }
+}
+
+static int map_put(BlockMap *m, uint32_t home, uint32_t copy) {
+    if (2 * (m->count + 1) > m->cap) {
+        BlockMap grown = { NULL, NULL, m->cap ? 2 * m->cap : 64, 0 };
+        grown.keys = calloc(grown.cap, sizeof(uint32_t));
+        grown.vals = malloc(grown.cap * sizeof(uint32_t));
+        if (!grown.keys || !grown.vals) {
+            free(grown.keys);
+            free(grown.vals);
+            return -1;
+        }
+        for (uint32_t i = 0; i < m->cap; i++) {
+            if (m->keys[i]) map_put(&grown, m->keys[i] - 1, m->vals[i]);
+        }
+        free(m->keys);
+        free(m->vals);
+        *m = grown;
+    }
+    uint32_t i = map_slot(m, home);
+    while (m->keys[i] && m->keys[i] != home + 1) i = (i + 1) & (m->cap - 1);
+    if (m->keys[i] == 0) m->count++;
+    m->keys[i] = home + 1;
+    m->vals[i] = copy;
+    return 0;
+}
+
+static void map_free(BlockMap *m) {
+    free(m->keys);
+    free(m->vals);
+    memset(m, 0, sizeof(BlockMap));
+}
+
+static int add_chunk_ref(Snap *s, ChunkRef ref) {
+    if (s->num_chunks == s->chunks_cap) {
+        uint32_t cap = s->chunks_cap ? 2 * s->chunks_cap : 8;
+        ChunkRef *grown = realloc(s->chunks, cap * sizeof(ChunkRef));
+        if (!grown) return -1;
+        s->chunks = grown;
+        s->chunks_cap = cap;
+    }
+    s->chunks[s->num_chunks++] = ref;
+    return 0;
+}
+
+static SnapChunk *alloc_chunk_image() {
+    SnapChunk *c;
+    if (posix_memalign((void **)&c, BDEV_ALIGN, BLOCK_SIZE) != 0) return NULL;
+    memset(c, 0, BLOCK_SIZE);
+    return c;
+}
+
+static int write_table() {
+    if (bdev_write(fs.dev, table_block, 1, table) == -1) return -1;
+    return bdev_sync(fs.dev);
+}
+
+static uint32_t newest_id() {
+    return table->count ? table->entries[table->count - 1].id : 0;
+}
+
+static int find(uint32_t id) {
+    for (uint32_t i = 0; table && i < table->count; i++) {
+        if (table->entries[i].id == id) return (int)i;
+    }
+    return -1;
+}
+
+static void update_room() {
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < num_open; i++) {
+        const SnapChunk *c = open_chunks[i].img;
+        uint32_t slots = c->slots - c->used, pairs = (uint32_t)SNAP_CHUNK_PAIRS - c->count;
+        r += slots < pairs ? slots : pairs;
+    }
+    __atomic_store_n(&room, r, __ATOMIC_RELAXED);
+}
+
+static void close_window() {
+    for (uint32_t i = 0; i < num_open; i++) free(open_chunks[i].img);
+    num_open = 0;
+    update_room();
+}
+
+// c becomes the newest snapshot's last chunk, the oldest open one drops out once two are open
+static void open_chunk(uint32_t meta, SnapChunk *c) {
+    if (num_open == 2) {
+        free(open_chunks[0].img);
+        open_chunks[0] = open_chunks[1];
+        num_open = 1;
+    }
+    open_chunks[num_open++] = (OpenChunk){ meta, c };
+    update_room();
+}
+
+static SnapChunk *open_image(uint32_t meta) {
+    for (uint32_t i = 0; i < num_open; i++) {
+        if (open_chunks[i].meta == meta) return open_chunks[i].img;
+    }
+    return NULL;
+}
+
+// open chunk with a free pair and, when slot is set, a free slot
+static OpenChunk *take(int slot) {
+    for (uint32_t i = 0; i < num_open; i++) {
+        SnapChunk *c = open_chunks[i].img;
+        if (c->count < SNAP_CHUNK_PAIRS && (!slot || c->used < c->slots)) return &open_chunks[i];
+    }
+    return NULL;
+}
+
+// a block couldn't be preserved: every snapshot may read it, none is trusted any more
+static void overflow() {
+    for (uint32_t i = 0; i < table->count; i++) table->entries[i].flags |= SNAP_BROKEN;
+    memset(cow, 0, nwords * sizeof(uint64_t));
+    write_table();
+}
+
+// points the chunk at meta to next, the open image if it is one
+static int set_next(uint32_t meta, uint32_t next) {
+    SnapChunk *c = open_image(meta);
+    SnapChunk *img = c ? c : alloc_chunk_image();
+    if (!img || (!c && bdev_read(fs.dev, meta, 1, img) == -1)) {
+        if (!c) free(img);
+        return -1;
+    }
+    img->next = next;
+    int rc = bdev_write(fs.dev, meta, 1, img);
+    if (!c) free(img);
+    return rc;
+}
+
+// allocates a chunk and its slots, written empty, returns its map block or -1
+static long new_chunk(uint32_t born, uint32_t owner, SnapChunk **out) {
+    // a full run where one is free, else whatever the first gap holds
+    uint32_t got = 1 + SNAP_CHUNK_SLOTS;
+    long meta = alloc_block_run(got);
+    if (meta == -1) meta = alloc_block_extent(0, got, &got);
+    if (meta == -1) return -1;
+    SnapChunk *c = got > 1 ? alloc_chunk_image() : NULL;
+    if (!c) {
+        free_block_run((uint32_t)meta, got);
+        return -1;
+    }
+    c->magic = SNAP_MAGIC;
+    c->born = born;
+    c->owner = owner;
+    c->slots = got - 1;
+    if (bdev_write(fs.dev, (uint64_t)meta, 1, c) == -1) {
+        free(c);
+        free_block_run((uint32_t)meta, got);
+        return -1;
+    }
+    *out = c;
+    return meta;
+}
+
+// appends a chunk to the newest snapshot, allocated without the lock held
+static int grow() {
+    pthread_mutex_lock(&lock);
+    uint32_t born = table ? table->next_id : 0, owner = table ? newest_id() : 0;
+    pthread_mutex_unlock(&lock);
+
+    SnapChunk *c;
+    long meta = new_chunk(born, owner, &c);
+    if (meta == -1) return -1;
+    uint32_t slots = c->slots;
+
+    pthread_mutex_lock(&lock);
+    if (!snap_live || newest_id() != owner) { // the snapshot went away meanwhile
+        pthread_mutex_unlock(&lock);
+        free(c);
+        free_block_run((uint32_t)meta, 1 + slots);
+        return -1;
+    }
+    Snap *s = &snaps[table->count - 1];
+    ChunkRef ref = { (uint32_t)meta, c->slots, born };
+    uint32_t tail = s->chunks[s->num_chunks - 1].meta;
+    if (add_chunk_ref(s, ref) == -1 || set_next(tail, (uint32_t)meta) == -1) {
+        if (s->num_chunks && s->chunks[s->num_chunks - 1].meta == (uint32_t)meta) s->num_chunks--;
+        pthread_mutex_unlock(&lock);
+        free(c);
+        free_block_run((uint32_t)meta, 1 + slots);
+        return -1;
+    }
+    bits_set_run(owned, (uint32_t)meta, 1 + slots, 1);
+    open_chunk((uint32_t)meta, c);
+    __atomic_store_n(&unsynced, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+// copies the leading blocks of [b, b + n) still marked into slots of one open chunk,
+// returns how many blocks it dealt with, 0 when no chunk has a free slot
+static uint32_t preserve(uint32_t b, uint32_t n) {
+    if (!snap_live) return n;
+    Snap *s = &snaps[table->count - 1];
+    if (!bit_test(cow, b) || map_get(&s->map, b, NULL)) {
+        bit_clear(cow, b);
+        return 1;
+    }
+    OpenChunk *oc = take(1);
+    if (!oc) return 0;
+    SnapChunk *c = oc->img;
+
+    uint32_t max = c->slots - c->used;
+    if ((uint32_t)SNAP_CHUNK_PAIRS - c->count < max) max = (uint32_t)SNAP_CHUNK_PAIRS - c->count;
+    if (SNAP_COPY_BLOCKS < max) max = SNAP_COPY_BLOCKS;
+    if (n < max) max = n;
+    uint32_t m = 1;
+    while (m < max && bit_test(cow, b + m) && !map_get(&s->map, b + m, NULL)) m++;
+
+    uint32_t slot = oc->meta + 1 + c->used;
+    if (bdev_read(fs.dev, b, m, bounce) == -1 || bdev_write(fs.dev, slot, m, bounce) == -1) {
+        overflow();
+        return n;
+    }
+    for (uint32_t i = 0; i < m; i++) {
+        bit_clear(cow, b + i);
+        c->pairs[c->count++] = (SnapPair){ b + i, slot + i };
+        if (map_put(&s->map, b + i, slot + i) == -1) {
+            overflow();
+            return n;
+        }
+    }
+    c->used += m;
+    if (bdev_write(fs.dev, oc->meta, 1, c) == -1) overflow();
+    __atomic_store_n(&unsynced, 1, __ATOMIC_RELEASE);
+    update_room();
+    return m;
+}
+
+// buffer of block is about to be dirtied, its old contents go to the newest snapshot first.
+// runs inside cache code, so it never allocates: snap_reserve keeps room for these
+void snap_cow(uint32_t block) {
+    if (!cow || !bit_test(cow, block)) return;
+    pthread_mutex_lock(&lock);
+    if (preserve(block, 1) == 0) overflow();
+    pthread_mutex_unlock(&lock);
+}
+
+// file data in [first, first + count) is about to be written on the device directly,
+// the copies are durable when this returns
+void snap_cow_run(uint32_t first, uint32_t count) {
+    if (!cow) return;
+    int copied = 0;
+    for (uint32_t b = first; b < first + count;) {
+        if (!bit_test(cow, b)) {
+            b++;
+            continue;
+        }
+        uint32_t n = 1;
+        while (b + n < first + count && bit_test(cow, b + n)) n++;
+
+        pthread_mutex_lock(&lock);
+        uint32_t done = preserve(b, n);
+        pthread_mutex_unlock(&lock);
+        if (done == 0) {
+            if (grow() == -1) {
+                pthread_mutex_lock(&lock);
+                if (snap_live) overflow();
+                pthread_mutex_unlock(&lock);
+                return;
+            }
+            continue;
+        }
+        b += done;
+        copied = 1;
+    }
+    if (copied) snap_barrier();
+}
+
+// block is being freed, returns 1 when a snapshot still reads it: it then stays allocated
+// and becomes the newest snapshot's (kept instead of copied)
+int snap_keep(uint32_t block) {
+    if (!cow || !bit_test(cow, block)) return 0;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        if (!snap_live || !bit_test(cow, block)) {
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+        Snap *s = &snaps[table->count - 1];
+        if (map_get(&s->map, block, NULL)) { // already preserved by an older snapshot's copy
+            bit_clear(cow, block);
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+        OpenChunk *oc = take(0);
+        if (oc) {
+            SnapChunk *c = oc->img;
+            c->pairs[c->count++] = (SnapPair){ block, block };
+            int rc = map_put(&s->map, block, block);
+            bit_clear(cow, block);
+            if (rc == -1 || bdev_write(fs.dev, oc->meta, 1, c) == -1) overflow();
+            bit_set(owned, block);
+            s->kept++;
+            __atomic_store_n(&unsynced, 1, __ATOMIC_RELEASE);
+            update_room();
+            pthread_mutex_unlock(&lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (grow() == -1) {
+            pthread_mutex_lock(&lock);
+            if (snap_live) overflow();
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+    }
+}
+
+// called as a thread's transaction starts: the copies its buffers may need fit without
+// allocating from inside the cache
+void snap_reserve() {
+    if (__atomic_load_n(&room, __ATOMIC_RELAXED) < SNAP_RESERVE) grow();
+}
+
+// home writes go to the device only after the copies of what they overwrite
+void snap_barrier() {
+    if (!__atomic_load_n(&unsynced, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&barrier_lock);
+    if (__atomic_exchange_n(&unsynced, 0, __ATOMIC_ACQ_REL)) bdev_sync(fs.dev);
+    pthread_mutex_unlock(&barrier_lock);
+}
+
+// reads block as snapshot idx sees it into buf (aligned), lock held
+static int view_read(uint32_t idx, uint32_t block, void *buf) {
+    for (uint32_t i = idx; i < table->count; i++) {
+        uint32_t copy;
+        if (map_get(&snaps[i].map, block, &copy)) return bdev_read(fs.dev, copy, 1, buf);
+    }
+    return bdev_read(fs.dev, block, 1, buf);
+}
+
+// snapshot idx's block bitmap into words (nwords of them), lock held
+static int view_bitmap(uint32_t idx, const GroupDesc *groups, uint64_t *words) {
+    uint32_t per_group = fs.sb.blocks_per_group / 64;
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) {
+        if (view_read(idx, groups[g].block_bitmap, bounce) == -1) return -1;
+        uint32_t first = g * per_group;
+        uint32_t n = nwords - first < per_group ? nwords - first : per_group;
+        memcpy(words + first, bounce, n * sizeof(uint64_t));
+    }
+    return 0;
+}
+
+static int alloc_state() {
+    if (cow) return 0;
+    nwords = block_bitmap.nwords;
+    cow = calloc(nwords, sizeof(uint64_t));
+    owned = calloc(nwords, sizeof(uint64_t));
+    if (posix_memalign((void **)&table, BDEV_ALIGN, BLOCK_SIZE) != 0) table = NULL;
+    if (posix_memalign((void **)&bounce, BDEV_ALIGN, (size_t)SNAP_COPY_BLOCKS * BLOCK_SIZE) != 0) bounce = NULL;
+    if (!cow || !owned || !table || !bounce) {
+        snap_unload();
+        return -1;
+    }
+    memset(table, 0, BLOCK_SIZE);
+    return 0;
+}
+
+void snap_unload() {
+    snap_live = 0;
+    for (uint32_t i = 0; table && i < table->count; i++) {
+        map_free(&snaps[i].map);
+        free(snaps[i].chunks);
+    }
+    memset(snaps, 0, sizeof(snaps));
+    close_window();
+    free(cow);
+    free(owned);
+    free(table);
+    free(bounce);
+    cow = owned = NULL;
+    table = NULL;
+    bounce = NULL;
+    table_block = 0;
+    nwords = 0;
+    unsynced = 0;
+}
+
+// reads the table and every chunk list, then works out which blocks still need preserving:
+// those some snapshot sees at home (no newer map has them) that aren't snapshot blocks
+int snap_load() {
+    snap_unload();
+    if (!fs.sb.snap_table) return 0;
+    if (alloc_state() == -1) return -1;
+    table_block = fs.sb.snap_table;
+    if (bdev_read(fs.dev, table_block, 1, table) == -1 || table->magic != SNAP_MAGIC || table->count > SNAP_MAX) {
+        snap_unload();
+        return -1;
+    }
+    bit_set(owned, table_block);
+
+    SnapChunk *c = alloc_chunk_image();
+    uint64_t *mapped = calloc(nwords, sizeof(uint64_t));
+    uint64_t *view = malloc(nwords * sizeof(uint64_t));
+    int rc = c && mapped && view ? 0 : -1;
+    for (uint32_t i = 0; i < table->count && rc == 0; i++) {
+        Snap *s = &snaps[i];
+        for (uint32_t meta = table->entries[i].first; meta && rc == 0; meta = c->next) {
+            if (meta >= fs.sb.total_blocks || bdev_read(fs.dev, meta, 1, c) == -1 || c->magic != SNAP_MAGIC ||
+                c->slots > SNAP_CHUNK_SLOTS || c->count > SNAP_CHUNK_PAIRS ||
+                add_chunk_ref(s, (ChunkRef){ meta, c->slots, c->born }) == -1) {
+                rc = -1;
+                break;
+            }
+            bits_set_run(owned, meta, 1 + c->slots, 1);
+            for (uint32_t p = 0; p < c->count && rc == 0; p++) {
+                SnapPair pair = c->pairs[p];
+                if (pair.home == SNAP_DEAD) continue;
+                if (pair.home >= fs.sb.total_blocks || map_put(&s->map, pair.home, pair.copy) == -1) rc = -1;
+                if (pair.copy == pair.home) {
+                    bit_set(owned, pair.home);
+                    s->kept++;
+                }
+            }
+        }
+    }
+
+    // the newest snapshot's last chunk takes the next pairs
+    if (rc == 0 && table->count) {
+        Snap *s = &snaps[table->count - 1];
+        SnapChunk *tail = s->num_chunks ? alloc_chunk_image() : NULL;
+        if (!tail || bdev_read(fs.dev, s->chunks[s->num_chunks - 1].meta, 1, tail) == -1) {
+            free(tail);
+            rc = -1;
+        } else {
+            open_chunk(s->chunks[s->num_chunks - 1].meta, tail);
+        }
+    }
+
+    for (uint32_t k = table->count; k-- > 0 && rc == 0;) {
+        const BlockMap *m = &snaps[k].map;
+        for (uint32_t i = 0; i < m->cap; i++) {
+            if (m->keys[i]) bit_set(mapped, m->keys[i] - 1);
+        }
+        if (view_bitmap(k, fs.groups, view) == -1) {
+            rc = -1;
+            break;
+        }
+        for (uint32_t w = 0; w < nwords; w++) cow[w] |= view[w] & ~mapped[w] & ~owned[w];
+    }
+    // a view sees allocated what was freed since, only blocks still allocated can be written
+    for (uint32_t w = 0; w < nwords && rc == 0; w++) cow[w] &= block_bitmap.words[w];
+    free(c);
+    free(mapped);
+    free(view);
+    if (rc == -1) {
+        snap_unload();
+        return -1;
+    }
+    snap_live = table->count > 0;
+    return 0;
+}
+
+// marks in bits the blocks only snapshots use (table, chunks, kept blocks), no live inode maps them
+void snap_owned(uint64_t *bits) {
+    pthread_mutex_lock(&lock);
+    for (uint32_t w = 0; owned && w < nwords; w++) bits[w] |= owned[w];
+    pthread_mutex_unlock(&lock);
+}
+
+// freezes the image for an instant: everything goes home, the table gets the new entry and
+// every allocated block starts out to be preserved. returns the new id or -1
+int fs_snapshot_create() {
+    if (!fs.dev) return -1;
+    pthread_mutex_lock(&admin);
+    if (alloc_state() == -1 || table->count == SNAP_MAX) {
+        pthread_mutex_unlock(&admin);
+        return -1;
+    }
+
+    tx_begin();
+    int rc = 0;
+    if (!table_block) {
+        int b = alloc_block();
+        memset(table, 0, BLOCK_SIZE);
+        table->magic = SNAP_MAGIC;
+        table->next_id = 1;
+        if (b == -1) {
+            rc = -1;
+        } else {
+            pthread_mutex_lock(&lock);
+            table_block = (uint32_t)b;
+            bit_set(owned, table_block);
+            rc = write_table();
+            pthread_mutex_unlock(&lock);
+            fs.sb.snap_table = table_block;
+            sync_superblock();
+        }
+    }
+    uint32_t id = table->next_id;
+    SnapChunk *c = NULL;
+    long meta = rc == 0 ? new_chunk(id, id, &c) : -1;
+    if (meta != -1) bits_set_run(owned, (uint32_t)meta, 1 + c->slots, 1);
+    tx_commit();
+    if (meta == -1) {
+        pthread_mutex_unlock(&admin);
+        return -1;
+    }
+
+    fs_sync();
+    tx_freeze();
+    journal_checkpoint();
+    bdev_sync(fs.dev);
+
+    pthread_mutex_lock(&lock);
+    Snap *s = &snaps[table->count];
+    memset(s, 0, sizeof(Snap));
+    rc = add_chunk_ref(s, (ChunkRef){ (uint32_t)meta, c->slots, id });
+    if (rc == 0) {
+        table->entries[table->count++] = (SnapEntry){ id, (uint32_t)meta, 0, 0, (int64_t)time(NULL) };
+        table->next_id = id + 1;
+        rc = write_table();
+        if (rc == -1) table->count--;
+    }
+    if (rc == 0) {
+        for (uint32_t w = 0; w < nwords; w++) cow[w] = block_bitmap.words[w] & ~owned[w];
+        close_window();
+        open_chunk((uint32_t)meta, c);
+        snap_live = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    tx_thaw();
+
+    if (rc == -1) {
+        free(s->chunks);
+        memset(s, 0, sizeof(Snap));
+        tx_begin();
+        bits_set_run(owned, (uint32_t)meta, 1 + c->slots, 0);
+        free_block_run((uint32_t)meta, 1 + c->slots);
+        tx_commit();
+        free(c);
+    }
+    pthread_mutex_unlock(&admin);
+    return rc == -1 ? -1 : (int)id;
+}
+
+static int add_run(Run **runs, uint32_t *n, uint32_t *cap, uint32_t first, uint32_t count) {
+    if (*n == *cap) {
+        uint32_t grown_cap = *cap ? 2 * *cap : 16;
+        Run *grown = realloc(*runs, grown_cap * sizeof(Run));
+        if (!grown) return -1;
+        *runs = grown;
+        *cap = grown_cap;
+    }
+    (*runs)[(*n)++] = (Run){ first, count };
+    return 0;
+}
+
+// pairs the next older snapshot has no copy of go down to it with their chunks, the rest is
+// freed. returns 0 or -1
+int fs_snapshot_delete(uint32_t id) {
+    if (!fs.dev || !table) return -1;
+    pthread_mutex_lock(&admin);
+    tx_begin();
+    pthread_mutex_lock(&lock);
+    int idx = find(id);
+    if (idx == -1) {
+        pthread_mutex_unlock(&lock);
+        tx_commit();
+        pthread_mutex_unlock(&admin);
+        return -1;
+    }
+
+    Snap victim = snaps[idx];
+    Snap *older = idx > 0 ? &snaps[idx - 1] : NULL;
+    int newest = (uint32_t)idx == table->count - 1;
+    if (table->count == 1) { // nothing reads old contents any more
+        snap_live = 0;
+        memset(cow, 0, nwords * sizeof(uint64_t));
+    }
+
+    Run *frees = NULL;
+    uint32_t num_frees = 0, frees_cap = 0;
+    SnapChunk *img = alloc_chunk_image();
+    int rc = img ? 0 : -1;
+    for (uint32_t i = 0; i < victim.num_chunks && rc == 0; i++) {
+        ChunkRef ref = victim.chunks[i];
+        SnapChunk *c = open_image(ref.meta);
+        // the newest one's open chunks stay open for the snapshot that becomes the newest
+        int stays = newest && older && c;
+        if (!c && bdev_read(fs.dev, ref.meta, 1, img) == -1) {
+            rc = -1;
+            break;
+        }
+        if (!c) c = img;
+
+        uint32_t live = 0;
+        for (uint32_t p = 0; p < c->count; p++) {
+            SnapPair *pair = &c->pairs[p];
+            if (pair->home == SNAP_DEAD) continue;
+            if (older && !map_get(&older->map, pair->home, NULL) && map_put(&older->map, pair->home, pair->copy) == 0) {
+                if (pair->copy == pair->home) older->kept++;
+                live++;
+                continue;
+            }
+            if (pair->copy == pair->home) {
+                bit_clear(owned, pair->home);
+                add_run(&frees, &num_frees, &frees_cap, pair->home, 1);
+            }
+            pair->home = SNAP_DEAD;
+        }
+        if (live == 0 && !stays) {
+            bits_set_run(owned, ref.meta, 1 + ref.slots, 0);
+            add_run(&frees, &num_frees, &frees_cap, ref.meta, 1 + ref.slots);
+            continue;
+        }
+
+        c->next = 0;
+        if (bdev_write(fs.dev, ref.meta, 1, c) == -1 ||
+            set_next(older->chunks[older->num_chunks - 1].meta, ref.meta) == -1 ||
+            add_chunk_ref(older, ref) == -1) {
+            rc = -1;
+        }
+    }
+    free(img);
+
+    if (rc == 0) {
+        memmove(&table->entries[idx], &table->entries[idx + 1], (table->count - idx - 1) * sizeof(SnapEntry));
+        memmove(&snaps[idx], &snaps[idx + 1], (table->count - idx - 1) * sizeof(Snap));
+        table->count--;
+        memset(&snaps[table->count], 0, sizeof(Snap));
+        map_free(&victim.map);
+        free(victim.chunks);
+        if (newest && !older) close_window();
+        if (table->count == 0) {
+            bit_clear(owned, table_block);
+            add_run(&frees, &num_frees, &frees_cap, table_block, 1);
+            table_block = 0;
+        } else {
+            rc = write_table();
+        }
+    } else {
+        overflow(); // lists half moved, nothing is trusted
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (rc == 0 && !table_block) {
+        fs.sb.snap_table = 0;
+        sync_superblock();
+    }
+    for (uint32_t i = 0; i < num_frees; i++) free_block_run(frees[i].first, frees[i].count);
+    free(frees);
+    tx_commit();
+    pthread_mutex_unlock(&admin);
+    return rc;
+}
+
+// fills out with up to max snapshots, oldest first, returns how many there are
+uint32_t fs_snapshot_list(SnapshotInfo *out, uint32_t max) {
+    pthread_mutex_lock(&lock);
+    uint32_t count = table ? table->count : 0;
+    for (uint32_t i = 0; i < count && i < max; i++) {
+        const Snap *s = &snaps[i];
+        uint32_t blocks = s->kept;
+        for (uint32_t c = 0; c < s->num_chunks; c++) blocks += 1 + s->chunks[c].slots;
+        out[i] = (SnapshotInfo){ table->entries[i].id, (time_t)table->entries[i].created, s->map.count, blocks,
+                                 (table->entries[i].flags & SNAP_BROKEN) != 0 };
+    }
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+// block as it was when snapshot id was taken, returns 0 or -1
+int fs_snapshot_read(uint32_t id, uint32_t block, void *buf) {
+    pthread_mutex_lock(&lock);
+    int idx = find(id);
+    int rc = idx == -1 || block >= fs.sb.total_blocks || (table->entries[idx].flags & SNAP_BROKEN) ? -1 :
+             view_read((uint32_t)idx, block, bounce);
+    if (rc == 0) memcpy(buf, bounce, BLOCK_SIZE);
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+// writes snapshot id out as a standalone image: the blocks its bitmaps mark used, minus the
+// snapshot machinery that was already allocated then, with a clean journal. returns 0 or -1
+int fs_snapshot_export(uint32_t id, const char *image) {
+    if (!fs.dev || !table) return -1;
+    pthread_mutex_lock(&admin);
+    uint32_t desc_bytes = fs.sb.group_desc_blocks * BLOCK_SIZE;
+    GroupDesc *groups = malloc(desc_bytes);
+    uint64_t *used = malloc(nwords * sizeof(uint64_t));
+    uint8_t *block;
+    if (posix_memalign((void **)&block, BDEV_ALIGN, BLOCK_SIZE) != 0) block = NULL;
+    SnapChunk *c = alloc_chunk_image();
+    Superblock sb;
+    int rc = groups && used && block && c ? 0 : -1;
+
+    pthread_mutex_lock(&lock);
+    int idx = find(id);
+    if (idx == -1 || (table->entries[idx].flags & SNAP_BROKEN)) rc = -1;
+    if (rc == 0 && view_read((uint32_t)idx, 0, block) == 0) sb = *(const Superblock *)block;
+    else rc = -1;
+    for (uint32_t d = 0; d < fs.sb.group_desc_blocks && rc == 0; d++) {
+        rc = view_read((uint32_t)idx, 1 + d, block);
+        if (rc == 0) memcpy((uint8_t *)groups + (size_t)d * BLOCK_SIZE, block, BLOCK_SIZE);
+    }
+    if (rc == 0) rc = view_bitmap((uint32_t)idx, groups, used);
+
+    // snapshot blocks it already saw allocated go back to free
+    uint32_t released = 0;
+    if (rc == 0) {
+        if (bit_test(used, table_block)) {
+            bit_clear(used, table_block);
+            groups[group_of_block(table_block)].free_blocks++;
+            released++;
+        }
+        for (uint32_t i = 0; i < table->count && rc == 0; i++) {
+            for (uint32_t k = 0; k < snaps[i].num_chunks && rc == 0; k++) {
+                ChunkRef ref = snaps[i].chunks[k];
+                SnapChunk *img = open_image(ref.meta);
+                if (!img && bdev_read(fs.dev, ref.meta, 1, c) == -1) rc = -1;
+                if (!img) img = c;
+                for (uint32_t b = ref.meta; b < ref.meta + 1 + ref.slots && ref.born <= id; b++) {
+                    if (!bit_test(used, b)) continue;
+                    bit_clear(used, b);
+                    groups[group_of_block(b)].free_blocks++;
+                    released++;
+                }
+                for (uint32_t p = 0; p < img->count && img->owner < id; p++) {
+                    uint32_t home = img->pairs[p].home;
+                    if (home == SNAP_DEAD || img->pairs[p].copy != home || !bit_test(used, home)) continue;
+                    bit_clear(used, home);
+                    groups[group_of_block(home)].free_blocks++;
+                    released++;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    BlockDevice *out = rc == 0 ? bdev_open(image, BDEV_STDIO, BDEV_CREATE, sb.total_blocks) : NULL;
+    if (!out) rc = -1;
+    uint32_t meta_end = 1 + sb.group_desc_blocks;
+    for (uint32_t b = meta_end; b < sb.total_blocks && rc == 0; b++) {
+        if (!bit_test(used, b)) continue;
+        if (sb.journal_blocks && b >= sb.journal_start && b < sb.journal_start + sb.journal_blocks) continue;
+        pthread_mutex_lock(&lock);
+        rc = view_read((uint32_t)idx, b, block);
+        pthread_mutex_unlock(&lock);
+        if (rc == 0) rc = bdev_write(out, b, 1, block);
+    }
+
+    // patched bitmaps, descriptors and superblock over what was copied
+    uint32_t per_group = sb.blocks_per_group / 64;
+    for (uint32_t g = 0; g < sb.groups_count && rc == 0; g++) {
+        uint32_t first = g * per_group;
+        uint32_t n = nwords - first < per_group ? nwords - first : per_group;
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, used + first, n * sizeof(uint64_t));
+        if (sb.features & FEATURE_METADATA_CSUM) groups[g].block_bitmap_csum = csum_bitmap(block, sb.blocks_per_group / 8, 0);
+        rc = bdev_write(out, groups[g].block_bitmap, 1, block);
+    }
+    for (uint32_t d = 0; d < sb.group_desc_blocks && rc == 0; d++) {
+        memcpy(block, (uint8_t *)groups + (size_t)d * BLOCK_SIZE, BLOCK_SIZE);
+        rc = bdev_write(out, 1 + d, 1, block);
+    }
+    if (rc == 0) {
+        sb.free_blocks += released;
+        sb.snap_table = 0;
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, &sb, sizeof(Superblock));
+        if (sb.features & FEATURE_METADATA_CSUM) csum_seal(0, block, CSUM_SUPER);
+        rc = bdev_write(out, 0, 1, block);
+    }
+    if (rc == 0 && sb.journal_blocks) {
+        JournalSuper js = { JOURNAL_MAGIC, sb.journal_blocks, 0, 1 };
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, &js, sizeof(JournalSuper));
+        rc = bdev_write(out, sb.journal_start, 1, block);
+    }
+    if (rc == 0) rc = bdev_sync(out);
+    if (out) bdev_close(out);
+
+    free(groups);
+    free(used);
+    free(block);
+    free(c);
+    pthread_mutex_unlock(&admin);
+    return rc;
+}
@@ -0,0 +1,136 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Stats.h"
+
+#include <time.h>
+
+int stats_on = 0;
+
+static FsStats totals;              // updated with relaxed atomics, threads count concurrently
+static __thread int current = -1;   // op the calling thread is inside of, -1 for none
+
+static const char *const op_names[OP_COUNT] = {
+    "format", "mount", "unmount", "sync", "mkdir", "creat", "dir_add", "dir_lookup",
+    "path_resolve", "fs_read", "fs_write", "fs_truncate", "dir_remove", "fs_unlink", "fs_rmdir",
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void add(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// counting starts and stops between calls, a span begun before stats_enable(0) still ends
+void stats_enable(int on) {
+    __atomic_store_n(&stats_on, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+// zeroes the counters, meant for moments no op is running
+void stats_reset() {
+    uint64_t *words = (uint64_t *)&totals;
+    for (size_t i = 0; i < sizeof(totals) / sizeof(uint64_t); i++) __atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+}
+
+// copies the counters, each one consistent by itself
+void stats_snapshot(FsStats *out) {
+    const uint64_t *from = (const uint64_t *)&totals;
+    uint64_t *to = (uint64_t *)out;
+    for (size_t i = 0; i < sizeof(totals) / sizeof(uint64_t); i++) to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+const char *stats_op_name(FsOp op) {
+    return op >= 0 && op < OP_COUNT ? op_names[op] : "?";
+}
+
+// upper bound of the bucket holding the p-th fraction of calls (0 < p <= 1), at most the
+// slowest call, 0 without calls
+uint64_t stats_percentile(const OpStats *op, double p) {
+    if (op->calls == 0) return 0;
+    uint64_t want = (uint64_t)(p * op->calls + 0.999999);
+    if (want == 0) want = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += op->latency[i];
+        if (seen < want) continue;
+        uint64_t upper = i + 1 < STATS_BUCKETS ? (1ull << (i + 1)) - 1 : op->max_ns;
+        return upper < op->max_ns ? upper : op->max_ns;
+    }
+    return op->max_ns;
+}
+
+static void print_io(FILE *out, const IoCounters *io) {
+    fprintf(out, "reads %llu (%llu B)  writes %llu (%llu B)  seeks %llu  cache %llu/%llu  icache %llu/%llu  "
+                 "allocs %llu (%llu words)  sb syncs %llu\n",
+            (unsigned long long)io->dev_reads, (unsigned long long)io->bytes_read,
+            (unsigned long long)io->dev_writes, (unsigned long long)io->bytes_written,
+            (unsigned long long)io->seeks, (unsigned long long)io->cache_hits,
+            (unsigned long long)io->cache_misses, (unsigned long long)io->icache_hits,
+            (unsigned long long)io->icache_misses, (unsigned long long)io->allocs,
+            (unsigned long long)io->alloc_words, (unsigned long long)io->sb_syncs);
+}
+
+// human readable dump, per op the I/O per call is what attributes the device traffic
+void stats_print(FILE *out) {
+    FsStats s;
+    stats_snapshot(&s);
+    fprintf(out, "stats %s\ntotal: ", stats_on ? "on" : "off");
+    print_io(out, &s.io);
+
+    for (int i = 0; i < OP_COUNT; i++) {
+        const OpStats *op = &s.ops[i];
+        if (op->calls == 0) continue;
+        fprintf(out, "%-12s calls %llu  avg %llu ns  p50 %llu ns  p99 %llu ns  max %llu ns\n             ",
+                op_names[i], (unsigned long long)op->calls, (unsigned long long)(op->total_ns / op->calls),
+                (unsigned long long)stats_percentile(op, 0.50), (unsigned long long)stats_percentile(op, 0.99),
+                (unsigned long long)op->max_ns);
+        print_io(out, &op->io);
+    }
+}
+
+// ---------- hooks ----------
+
+// adds n to the field-th counter, and to the running op's copy of it
+void stats_count(size_t field, uint64_t n) {
+    add((uint64_t *)&totals.io + field, n);
+    if (current >= 0) add((uint64_t *)&totals.ops[current].io + field, n);
+}
+
+StatsSpan stats_begin_slow(FsOp op) {
+    if (current >= 0) return (StatsSpan){ -1, 0 };
+    current = op;
+    return (StatsSpan){ op, now_ns() };
+}
+
+void stats_end_slow(StatsSpan span) {
+    uint64_t ns = now_ns() - span.start_ns;
+    current = -1;
+
+    OpStats *op = &totals.ops[span.op];
+    add(&op->calls, 1);
+    add(&op->total_ns, ns);
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    add(&op->latency[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1], 1);
+
+    uint64_t max = __atomic_load_n(&op->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&op->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// makes this thread count towards op (an async transfer's submitter), returns the previous one
+int stats_adopt(int op) {
+    int prev = current;
+    current = op;
+    return prev;
+}
+
+// op this thread counts towards, for handing on to another thread
+int stats_current() {
+    return current;
+}
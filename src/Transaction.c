@@ -0,0 +1,142 @@
+//
+// Created by David Neškrabal on 17.10.2026.
+//
+
+#include "../include/Transaction.h"
+#include "../include/FileManagement.h"
+#include "../include/Cache.h"
+#include "../include/InodeCache.h"
+#include "../include/Journal.h"
+#include "../include/Snapshot.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// every thread joins the one running transaction, the last thread to leave it commits for all,
+// so concurrent operations share one journal record and one sync, like jbd handles
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static uint32_t handles = 0;        // threads inside the running transaction
+static int closing = 0;             // running transaction takes no new threads, commits once they leave
+static int committing = 0;          // commit (or tx_freeze) in progress, nobody may join
+static uint64_t running = 1;        // sequence of the running (or next) transaction
+static uint64_t committed = 0;      // sequence of the last finished commit
+static int superblock_dirty = 0;
+static int lazy = 0;                // no thread of the transaction needs it durable on commit
+static TxStats stats;
+
+static _Thread_local uint32_t depth = 0;    // nested tx_begin calls of this thread
+static _Thread_local int thread_lazy = 0;   // this thread's part may wait for a later sync
+static _Thread_local uint64_t joined = 0;   // sequence of the transaction this thread is in
+
+// groups metadata changes until the matching tx_commit, calls may nest
+void tx_begin() {
+    if (depth++ > 0) return;
+
+    pthread_mutex_lock(&lock);
+    while (closing || committing) pthread_cond_wait(&changed, &lock);
+    if (handles++ == 0) {
+        superblock_dirty = 0;
+        lazy = 1;
+        cache_track_begin();
+    }
+    joined = running;
+    thread_lazy = 0;
+    pthread_mutex_unlock(&lock);
+    if (snap_live) snap_reserve();
+}
+
+// writes what the transaction touched, called by the last thread with nobody else inside
+static int commit() {
+    // in-core inodes and deferred bitmap bytes go into their (tracked) blocks first
+    icache_flush();
+    flush_bitmaps();
+    if (superblock_dirty) {
+        write_superblock();
+        superblock_dirty = 0;
+        stats.superblock_writes++;
+    }
+
+    int written;
+    if (journal_enabled()) {
+        Buffer **touched;
+        uint32_t n = cache_track_take(&touched);
+        written = journal_commit(touched, n, lazy) == -1 ? -1 : (int)n;
+    } else {
+        written = cache_track_commit();
+    }
+    if (written == -1) return -1;
+    stats.commits++;
+    stats.blocks_written += written;
+    return written;
+}
+
+// outermost commit writes every touched block once and the superblock at most once,
+// with a journal the blocks are logged instead and reach their home on checkpoint,
+// returns num of blocks written or logged. with other threads still inside, the last one to
+// leave commits and a non lazy caller waits for that
+int tx_commit() {
+    if (depth == 0) return -1;
+    if (--depth > 0) return 0;
+
+    pthread_mutex_lock(&lock);
+    if (!thread_lazy) lazy = 0;
+    // someone waits for durability, or the pinned buffers crowd the cache: stop taking threads
+    if (handles > 1 && (!thread_lazy || cache_tracked() * 2 >= cache_capacity())) closing = 1;
+
+    if (--handles > 0) {
+        while (!thread_lazy && committed < joined) pthread_cond_wait(&changed, &lock);
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    committing = 1;
+    pthread_mutex_unlock(&lock);
+    int written = commit();
+
+    pthread_mutex_lock(&lock);
+    committing = 0;
+    closing = 0;
+    committed = running++;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return written;
+}
+
+// waits for the running transaction to commit and keeps new ones out until tx_thaw,
+// for work that needs every buffer still (checkpoints, unmount)
+void tx_freeze() {
+    pthread_mutex_lock(&lock);
+    while (handles > 0 || committing) {
+        if (handles > 0) closing = 1;
+        pthread_cond_wait(&changed, &lock);
+    }
+    committing = 1;
+    pthread_mutex_unlock(&lock);
+}
+
+void tx_thaw() {
+    pthread_mutex_lock(&lock);
+    committing = 0;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+int tx_active() {
+    return depth > 0;
+}
+
+// superblock changed inside the transaction, written once on commit
+void tx_mark_superblock() {
+    __atomic_store_n(&superblock_dirty, 1, __ATOMIC_RELAXED);
+}
+
+// like write(2) without fsync: the journal may hold the transaction back for a later commit or
+// fs_sync, only the outermost tx_begin of a thread decides for its part
+void tx_mark_lazy() {
+    if (depth == 1) thread_lazy = 1;
+}
+
+void tx_stats(TxStats *out) {
+    *out = stats;
+}
@@ -1,10 +1,16 @@
 #include <FileManagement.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "../include/FileSystemStructure.h"
 #include "../include/Directories.h"
 #include "../include/Inode.h"
+#include "../include/Paths.h"
+#include "../include/Stats.h"
+#include "../include/Import.h"
+#include "../include/Snapshot.h"
+#include <stdlib.h>
 #include <Files.h>
 
 /* TO DO:
@@ -13,8 +19,126 @@
      - condence dir contents?
 */
 
-int main(void) {
-    format_disk("FS.bin", 20);
+#define CLI_IMAGE_BLOCKS 4096 // 16 MiB when the image has to be formatted first
 
-    fclose(fs.disk);
+static void help() {
+    printf("mkdir PATH | touch PATH | ls [PATH] | cd PATH | lookup PATH | sync\n"
+           "snapshot [create|delete ID|export ID IMAGE] | stats [on|off|reset] | help | quit\n");
+}
+
+// creates the last component of path in its parent, as a dir or a regular file
+static long make(const char *path, int dir) {
+    char name[NAME_MAX];
+    long parent = path_resolve_parent(path_cwd(), path, name);
+    if (parent == -1) return -1;
+    return dir ? mkdir((uint32_t)parent, name) : creat((uint32_t)parent, name, IREG | IRUSR | IWUSR);
+}
+
+static void stats_command(const char *arg) {
+    if (!arg) stats_print(stdout);
+    else if (strcmp(arg, "on") == 0) stats_enable(1);
+    else if (strcmp(arg, "off") == 0) stats_enable(0);
+    else if (strcmp(arg, "reset") == 0) stats_reset();
+    else printf("stats: on, off or reset\n");
+}
+
+// no arg lists the snapshots, returns -1 when the subcommand fails
+static long snapshot_command(const char *arg, const char *id, const char *image) {
+    if (!arg) {
+        SnapshotInfo list[SNAP_MAX];
+        uint32_t n = fs_snapshot_list(list, SNAP_MAX);
+        for (uint32_t i = 0; i < n; i++) {
+            char when[32];
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&list[i].created));
+            printf("%u  %s  %u copies  %u blocks%s\n", list[i].id, when, list[i].copies, list[i].blocks,
+                   list[i].broken ? "  broken" : "");
+        }
+        return 0;
+    }
+    if (strcmp(arg, "create") == 0) {
+        int rc = fs_snapshot_create();
+        if (rc != -1) printf("%d\n", rc);
+        return rc;
+    }
+    if (!id) {
+        printf("snapshot: %s needs an id\n", arg);
+        return 0;
+    }
+    if (strcmp(arg, "delete") == 0) return fs_snapshot_delete((uint32_t)strtoul(id, NULL, 10));
+    if (strcmp(arg, "export") == 0 && image) return fs_snapshot_export((uint32_t)strtoul(id, NULL, 10), image);
+    printf("snapshot: create, delete ID or export ID IMAGE\n");
+    return 0;
+}
+
+// imports the host tree under dir into a freshly formatted image, returns 0 or -1
+static int import_tree(const char *dir, const char *image) {
+    ImportStats st;
+    if (fs_import(dir, image, NULL, &st) == -1) return -1;
+    printf("imported %llu dirs and %llu files (%llu bytes) into %u blocks",
+           (unsigned long long)st.dirs, (unsigned long long)st.files, (unsigned long long)st.bytes, st.image_blocks);
+    if (st.skipped) printf(", skipped %llu", (unsigned long long)st.skipped);
+    printf("\n");
+    return 0;
+}
+
+// usage: fs_cli [-d dir] [image], commands are read from stdin, stats are counted from the start.
+// -d formats the image afresh with the host tree under dir copied in
+int main(int argc, char **argv) {
+    const char *import = NULL;
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-d") == 0) {
+        import = argv[2];
+        arg = 3;
+    }
+    const char *image = argc > arg ? argv[arg] : "FS.bin";
+    stats_enable(1);
+
+    if (import) {
+        if (import_tree(import, image) == -1) {
+            fprintf(stderr, "can't import %s into %s\n", import, image);
+            return 1;
+        }
+    } else {
+        FILE *f = fopen(image, "rb");
+        if (f) fclose(f);
+        if (f ? mount_disk(image) == -1 : format_disk_opts(image, CLI_IMAGE_BLOCKS, NULL) == -1) {
+            fprintf(stderr, "can't open %s\n", image);
+            return 1;
+        }
+    }
+
+    char line[512];
+    while (printf("> "), fflush(stdout), fgets(line, sizeof(line), stdin)) {
+        char *cmd = strtok(line, " \t\n");
+        char *arg = strtok(NULL, " \t\n");
+        if (!cmd) continue;
+
+        long rc = 0;
+        if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) break;
+        else if (strcmp(cmd, "help") == 0) help();
+        else if (strcmp(cmd, "stats") == 0) stats_command(arg);
+        else if (strcmp(cmd, "sync") == 0) rc = fs_sync();
+        else if (strcmp(cmd, "snapshot") == 0) {
+            char *id = arg ? strtok(NULL, " \t\n") : NULL;
+            rc = snapshot_command(arg, id, id ? strtok(NULL, " \t\n") : NULL);
+        }
+        else if (!arg && strcmp(cmd, "ls") == 0) rc = dir_list(path_cwd());
+        else if (!arg) printf("%s: missing path\n", cmd);
+        else if (strcmp(cmd, "mkdir") == 0) rc = make(arg, 1);
+        else if (strcmp(cmd, "touch") == 0) rc = make(arg, 0);
+        else if (strcmp(cmd, "cd") == 0) rc = path_chdir(arg);
+        else if (strcmp(cmd, "ls") == 0) {
+            rc = path_resolve(path_cwd(), arg);
+            if (rc != -1) rc = dir_list((uint32_t)rc);
+        } else if (strcmp(cmd, "lookup") == 0) {
+            rc = path_resolve(path_cwd(), arg);
+            if (rc != -1) printf("%ld\n", rc);
+        } else {
+            printf("unknown command %s, try help\n", cmd);
+        }
+        if (rc == -1) printf("%s: failed\n", cmd);
+    }
+
+    unmount_disk();
+    return 0;
 }
@@ -0,0 +1,333 @@
+// async_io.cpp
+// GoogleTest tests for the asynchronous I/O queue in AsyncIo.c, both engines on every backend
+// they run on, plus file I/O and mounts going through the queue of a mounted image.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "AsyncIo.h"
+#include "BlockDevice.h"
+#include "Cache.h"
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+}
+
+static const char *IMAGE = "aio_test.bin";
+
+struct Engine {
+    BlockDeviceType type;
+    AioEngine engine;
+    int direct_io;
+};
+
+static void PrintTo(const Engine &e, std::ostream *os) {
+    *os << bdev_type_name(e.type) << (e.direct_io ? "+direct" : "") << "/" << aio_engine_name(e.engine);
+}
+
+// aligned so O_DIRECT takes the buffers as they are
+static uint8_t *blocks_of(uint32_t n, uint8_t seed) {
+    uint8_t *buf;
+    if (posix_memalign((void **)&buf, BDEV_ALIGN, (size_t)n * BLOCK_SIZE) != 0) return nullptr;
+    for (size_t i = 0; i < (size_t)n * BLOCK_SIZE; i++) buf[i] = (uint8_t)(seed + i * 13);
+    return buf;
+}
+
+class AsyncIoTest : public ::testing::TestWithParam<Engine> {
+protected:
+    BlockDevice *dev = nullptr;
+
+    void SetUp() override {
+        dev = bdev_open(IMAGE, GetParam().type, BDEV_CREATE | (GetParam().direct_io ? BDEV_DIRECT : 0), 256);
+        ASSERT_NE(dev, nullptr);
+    }
+
+    void TearDown() override {
+        if (dev) bdev_close(dev);
+        std::remove(IMAGE);
+    }
+
+    AioQueue *open(uint32_t depth = 0, uint32_t workers = 0) {
+        return aio_open(dev, GetParam().engine, depth, workers);
+    }
+};
+
+TEST_P(AsyncIoTest, EngineFallsBackOutsidePread) {
+    AioQueue *q = open();
+    ASSERT_NE(q, nullptr);
+    if (GetParam().engine == AIO_ENGINE_THREADS || GetParam().type != BDEV_PREAD) {
+        EXPECT_EQ(aio_engine(q), AIO_ENGINE_THREADS);
+    }
+    aio_close(q);
+}
+
+TEST_P(AsyncIoTest, ScatteredRequestsRoundTrip) {
+    AioQueue *q = open();
+    ASSERT_NE(q, nullptr);
+
+    // runs of different lengths with gaps between them
+    const uint64_t starts[] = {3, 4, 10, 40, 41, 42, 100, 7};
+    const uint32_t counts[] = {1, 2, 4, 1, 1, 3, 8, 2};
+    const int n = sizeof(starts) / sizeof(starts[0]);
+    std::vector<uint8_t *> out(n), in(n);
+    std::vector<AioRequest> reqs(n);
+
+    for (int i = 0; i < n; i++) {
+        out[i] = blocks_of(counts[i], (uint8_t)(i + 1));
+        in[i] = blocks_of(counts[i], 0);
+        ASSERT_NE(out[i], nullptr);
+        reqs[i] = AioRequest{};
+        reqs[i].op = AIO_WRITE;
+        reqs[i].block = starts[i];
+        reqs[i].count = counts[i];
+        reqs[i].buf = out[i];
+    }
+    ASSERT_EQ(aio_submit(q, reqs.data(), n), 0);
+    ASSERT_EQ(aio_wait(q, reqs.data(), n), 0);
+
+    for (int i = 0; i < n; i++) {
+        reqs[i].op = AIO_READ;
+        reqs[i].buf = in[i];
+    }
+    ASSERT_EQ(aio_submit(q, reqs.data(), n), 0);
+    ASSERT_EQ(aio_wait(q, reqs.data(), n), 0);
+
+    for (int i = 0; i < n; i++) {
+        EXPECT_TRUE(reqs[i].complete);
+        EXPECT_EQ(std::memcmp(in[i], out[i], (size_t)counts[i] * BLOCK_SIZE), 0) << "run " << i;
+        free(out[i]);
+        free(in[i]);
+    }
+
+    AioStats stats;
+    aio_stats(q, &stats);
+    EXPECT_EQ(stats.submitted, 2u * n);
+    EXPECT_EQ(stats.completed, 2u * n);
+    EXPECT_EQ(stats.failed, 0u);
+    aio_close(q);
+
+    // and the plain path agrees with what went through the queue
+    uint8_t *check = blocks_of(8, 0);
+    ASSERT_EQ(bdev_read(dev, 100, 8, check), 0);
+    uint8_t *expect = blocks_of(8, 7);
+    EXPECT_EQ(std::memcmp(check, expect, 8 * BLOCK_SIZE), 0);
+    free(check);
+    free(expect);
+}
+
+TEST_P(AsyncIoTest, AdjacentRequestsMergeIntoOneTransfer) {
+    AioQueue *q = open();
+    ASSERT_NE(q, nullptr);
+
+    const int n = 16;
+    uint8_t *data = blocks_of(n, 9);
+    std::vector<AioRequest> reqs(n);
+    for (int i = 0; i < n; i++) {
+        reqs[i] = AioRequest{};
+        reqs[i].op = AIO_WRITE;
+        reqs[i].block = 20 + i;
+        reqs[i].count = 1;
+        reqs[i].buf = data + (size_t)(n - 1 - i) * BLOCK_SIZE; // memory order doesn't matter
+    }
+    ASSERT_EQ(aio_submit(q, reqs.data(), n), 0);
+    ASSERT_EQ(aio_wait(q, reqs.data(), n), 0);
+
+    AioStats stats;
+    aio_stats(q, &stats);
+    EXPECT_EQ(stats.submitted, (uint64_t)n);
+    EXPECT_EQ(stats.transfers, 1u);
+    aio_close(q);
+
+    uint8_t *back = blocks_of(1, 0);
+    ASSERT_EQ(bdev_read(dev, 20, 1, back), 0);
+    EXPECT_EQ(std::memcmp(back, data + (size_t)(n - 1) * BLOCK_SIZE, BLOCK_SIZE), 0);
+    free(back);
+    free(data);
+}
+
+static void count_done(AioRequest *r) {
+    // the flag is only set once the callback returned
+    if (!r->complete) static_cast<std::atomic<int> *>(r->arg)->fetch_add(1);
+}
+
+TEST_P(AsyncIoTest, CallbacksRunAndPollReapsThem) {
+    AioQueue *q = open();
+    ASSERT_NE(q, nullptr);
+
+    const int n = 12;
+    uint8_t *data = blocks_of(n, 4);
+    std::atomic<int> called{0};
+    std::vector<AioRequest> reqs(n);
+    for (int i = 0; i < n; i++) {
+        reqs[i] = AioRequest{};
+        reqs[i].op = AIO_WRITE;
+        reqs[i].block = 2 * i; // nothing merges
+        reqs[i].count = 1;
+        reqs[i].buf = data + (size_t)i * BLOCK_SIZE;
+        reqs[i].done = count_done;
+        reqs[i].arg = &called;
+    }
+    ASSERT_EQ(aio_submit(q, reqs.data(), n), 0);
+
+    int reaped = 0;
+    while (reaped < n) reaped += aio_poll(q, 1);
+    EXPECT_EQ(reaped, n);
+    EXPECT_EQ(called.load(), n);
+    EXPECT_EQ(aio_poll(q, 1), 0); // nothing left in flight
+
+    AioStats stats;
+    aio_stats(q, &stats);
+    EXPECT_EQ(stats.transfers, (uint64_t)n);
+    aio_close(q);
+    free(data);
+}
+
+TEST_P(AsyncIoTest, SmallDepthBoundsWhatIsInFlight) {
+    AioQueue *q = open(2, 2);
+    ASSERT_NE(q, nullptr);
+
+    const int n = 40;
+    uint8_t *data = blocks_of(n, 2);
+    std::vector<AioRequest> reqs(n);
+    for (int i = 0; i < n; i++) {
+        reqs[i] = AioRequest{};
+        reqs[i].op = AIO_WRITE;
+        reqs[i].block = 3 * i;
+        reqs[i].count = 1;
+        reqs[i].buf = data + (size_t)i * BLOCK_SIZE;
+    }
+    ASSERT_EQ(aio_submit(q, reqs.data(), n), 0);
+    ASSERT_EQ(aio_wait(q, reqs.data(), n), 0);
+
+    AioStats stats;
+    aio_stats(q, &stats);
+    EXPECT_LE(stats.max_in_flight, 2u);
+    EXPECT_EQ(stats.completed, (uint64_t)n);
+    aio_close(q);
+    free(data);
+}
+
+TEST_P(AsyncIoTest, ThreadsShareOneQueue) {
+    AioQueue *q = open(8, 0);
+    ASSERT_NE(q, nullptr);
+
+    const int threads = 4, per = 24;
+    std::vector<std::thread> pool;
+    std::atomic<int> failures{0};
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            uint8_t *out = blocks_of(per, (uint8_t)(t * 31));
+            uint8_t *in = blocks_of(per, 0);
+            std::vector<AioRequest> reqs(per);
+            for (int round = 0; round < 5; round++) {
+                for (int i = 0; i < per; i++) {
+                    reqs[i] = AioRequest{};
+                    reqs[i].op = AIO_WRITE;
+                    reqs[i].block = (uint64_t)t * per + i;
+                    reqs[i].count = 1;
+                    reqs[i].buf = out + (size_t)i * BLOCK_SIZE;
+                }
+                if (aio_submit(q, reqs.data(), per) == -1 || aio_wait(q, reqs.data(), per) == -1) failures++;
+                for (int i = 0; i < per; i++) {
+                    reqs[i].op = AIO_READ;
+                    reqs[i].buf = in + (size_t)i * BLOCK_SIZE;
+                }
+                if (aio_submit(q, reqs.data(), per) == -1 || aio_wait(q, reqs.data(), per) == -1) failures++;
+                if (std::memcmp(in, out, (size_t)per * BLOCK_SIZE) != 0) failures++;
+            }
+            free(out);
+            free(in);
+        });
+    }
+    for (auto &th : pool) th.join();
+    EXPECT_EQ(failures.load(), 0);
+    aio_close(q);
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, AsyncIoTest, ::testing::Values(
+        Engine{BDEV_PREAD, AIO_ENGINE_URING, 0},
+        Engine{BDEV_PREAD, AIO_ENGINE_URING, 1},
+        Engine{BDEV_PREAD, AIO_ENGINE_THREADS, 0},
+        Engine{BDEV_STDIO, AIO_ENGINE_URING, 0},
+        Engine{BDEV_MMAP, AIO_ENGINE_THREADS, 0}));
+
+// ---------- through a mounted image ----------
+
+class AsyncFsTest : public ::testing::TestWithParam<uint32_t> {
+protected:
+    FsOptions opts;
+
+    void SetUp() override {
+        fs_default_options(&opts);
+        opts.backend = BDEV_PREAD;
+        opts.io_depth = GetParam();
+        ASSERT_EQ(format_disk_opts(IMAGE, 4096, &opts), 0);
+        EXPECT_EQ(fs.aio != nullptr, GetParam() != 0);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static int make_file(const char *name) {
+        std::string copy = name;
+        return fs_creat(fs.sb.root_inode, &copy[0], IREG | IRUSR | IWUSR);
+    }
+};
+
+TEST_P(AsyncFsTest, FragmentedFileReadsBackWhole) {
+    int a = make_file("a"), b = make_file("b");
+    ASSERT_GE(a, 0);
+    ASSERT_GE(b, 0);
+
+    // alternating single block appends leave both files in many short runs
+    const int blocks = 48;
+    std::vector<uint8_t> data(blocks * BLOCK_SIZE);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 11 + i / BLOCK_SIZE);
+    std::vector<uint8_t> filler(BLOCK_SIZE, 0xEE);
+    for (int i = 0; i < blocks; i++) {
+        ASSERT_EQ(fs_write(a, (uint64_t)i * BLOCK_SIZE, data.data() + (size_t)i * BLOCK_SIZE, BLOCK_SIZE), BLOCK_SIZE);
+        ASSERT_EQ(fs_write(b, (uint64_t)i * BLOCK_SIZE, filler.data(), BLOCK_SIZE), BLOCK_SIZE);
+    }
+
+    // rewrite in one call with the head and tail partial, then remount and read it in one call
+    ASSERT_EQ(fs_write(a, 100, data.data() + 100, data.size() - 200), (long)data.size() - 200);
+    unmount_disk();
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+
+    std::vector<uint8_t> back(data.size());
+    ASSERT_EQ(fs_read(a, 0, back.data(), back.size()), (long)back.size());
+    EXPECT_EQ(back, data);
+
+    if (fs.aio) {
+        AioStats stats;
+        aio_stats(fs.aio, &stats);
+        EXPECT_GT(stats.submitted, 1u);
+        EXPECT_EQ(stats.failed, 0u);
+    }
+}
+
+TEST_P(AsyncFsTest, MountReadsBitmapsAhead) {
+    unmount_disk();
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+
+    CacheStats stats;
+    cache_stats(&stats);
+    // both bitmaps of every group, in flight together
+    if (fs.aio) EXPECT_GE(stats.readahead, 2u);
+    else EXPECT_EQ(stats.readahead, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Depths, AsyncFsTest, ::testing::Values(0u, AIO_DEFAULT_DEPTH));
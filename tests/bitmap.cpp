@@ -0,0 +1,145 @@
+// bitmap.cpp
+// GoogleTest tests for the bit-packed allocator in Bitmap.c and the block/inode allocators built on it.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Bitmap.h"
+}
+
+class BitmapTest : public ::testing::Test {
+protected:
+    Bitmap bm;
+
+    void SetUp() override {
+        ASSERT_EQ(bitmap_init(&bm, 100000), 0);
+    }
+
+    void TearDown() override {
+        bitmap_destroy(&bm);
+    }
+};
+
+TEST_F(BitmapTest, SetClearKeepCounts) {
+    EXPECT_EQ(bm.free_bits, 100000u);
+    bitmap_set(&bm, 70);
+    bitmap_set(&bm, 70);
+    EXPECT_EQ(bitmap_test(&bm, 70), 1);
+    EXPECT_EQ(bm.free_bits, 99999u);
+    EXPECT_EQ(bm.chunk_free[0], (uint32_t)BITMAP_CHUNK_BITS - 1);
+
+    bitmap_clear(&bm, 70);
+    EXPECT_EQ(bitmap_test(&bm, 70), 0);
+    EXPECT_EQ(bm.free_bits, 100000u);
+}
+
+TEST_F(BitmapTest, BitsArePackedLikeTheDiskFormat) {
+    bitmap_set(&bm, 9);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(bm.words);
+    EXPECT_EQ(bytes[0], 0u);
+    EXPECT_EQ(bytes[1], 0x02u);
+
+    uint8_t disk[16] = {0};
+    disk[3] = 0x80; // bit 31
+    Bitmap other;
+    ASSERT_EQ(bitmap_init(&other, 128), 0);
+    bitmap_load(&other, disk);
+    EXPECT_EQ(bitmap_test(&other, 31), 1);
+    EXPECT_EQ(other.free_bits, 127u);
+    bitmap_destroy(&other);
+}
+
+TEST_F(BitmapTest, AllocIsNextFitAboveMinimum) {
+    EXPECT_EQ(bitmap_alloc(&bm, 10), 10);
+    EXPECT_EQ(bitmap_alloc(&bm, 10), 11);
+    bitmap_clear(&bm, 10);
+    EXPECT_EQ(bitmap_alloc(&bm, 10), 12);   // hint moves on, the hole is reused after wrapping
+}
+
+TEST_F(BitmapTest, AllocWrapsToFreedBits) {
+    bitmap_set_run(&bm, 0, 100000);
+    EXPECT_EQ(bm.free_bits, 0u);
+    EXPECT_EQ(bitmap_alloc(&bm, 0), -1);
+
+    bitmap_clear(&bm, 5);
+    bm.hint = 90000;
+    EXPECT_EQ(bitmap_alloc(&bm, 0), 5);
+}
+
+TEST_F(BitmapTest, PaddingBitsNeverAllocated) {
+    Bitmap small;
+    ASSERT_EQ(bitmap_init(&small, 70), 0);
+    for (int i = 0; i < 70; i++) EXPECT_EQ(bitmap_alloc(&small, 0), i);
+    EXPECT_EQ(bitmap_alloc(&small, 0), -1);
+    bitmap_destroy(&small);
+}
+
+TEST_F(BitmapTest, RunSkipsFragmentedRegion) {
+    // every 8th bit used in the first 1000 bits
+    for (uint32_t b = 0; b < 1000; b += 8) bitmap_set(&bm, b);
+
+    long first = bitmap_alloc_run(&bm, 0, 20);
+    ASSERT_GT(first, 992);
+    for (long b = first; b < first + 20; b++) EXPECT_EQ(bitmap_test(&bm, (uint32_t)b), 1);
+
+    // short run still fits between the used bits
+    bm.hint = 0;
+    EXPECT_EQ(bitmap_alloc_run(&bm, 0, 7), 1);
+}
+
+TEST_F(BitmapTest, ScanCostStaysFlatWhenFull) {
+    // first 90% used, the allocator should jump over full chunks instead of reading every word
+    bitmap_set_run(&bm, 0, 90000);
+    bm.hint = 0;
+    bm.words_scanned = 0;
+
+    EXPECT_EQ(bitmap_alloc(&bm, 0), 90000);
+    EXPECT_LT(bm.words_scanned, 80u);   // 1407 words would be a linear scan
+}
+
+static const char *IMAGE = "bitmap_test.bin";
+
+class AllocatorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        format_disk(IMAGE, 4096);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+};
+
+TEST_F(AllocatorTest, BlockRunIsContiguousAndPersisted) {
+    uint32_t free_before = fs.sb.free_blocks;
+    long first = alloc_block_run(300);
+    ASSERT_GE(first, (long)fs.sb.data_block_start);
+    EXPECT_EQ(fs.sb.free_blocks, free_before - 300);
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    for (long b = first; b < first + 300; b++) EXPECT_EQ(bitmap_test(&block_bitmap, (uint32_t)b), 1);
+    EXPECT_EQ(bitmap_test(&block_bitmap, (uint32_t)(first + 300)), 0);
+}
+
+TEST_F(AllocatorTest, FreedBlocksComeBack) {
+    int a = alloc_block();
+    ASSERT_GE(a, 0);
+    free_block(a);
+    EXPECT_EQ(bitmap_test(&block_bitmap, a), 0);
+
+    // run larger than the image fails cleanly
+    EXPECT_EQ(alloc_block_run(5000), -1);
+}
+
+TEST_F(AllocatorTest, RejectsImagesBeyondMaxBlocks) {
+    unmount_disk();
+    EXPECT_EQ(format_disk_opts(IMAGE, MAX_BLOCKS + 1, nullptr), -1);
+}
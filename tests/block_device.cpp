@@ -0,0 +1,130 @@
+// block_device.cpp
+// GoogleTest tests for the storage backends in BlockDevice.c, run against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+#include "BlockDevice.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+long dir_add(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type);
+int create_dir(uint16_t mode);
+}
+
+static const char *IMAGE = "bdev_test.bin";
+
+struct Backend {
+    BlockDeviceType type;
+    int direct_io;
+};
+
+class BlockDeviceTest : public ::testing::TestWithParam<Backend> {
+protected:
+    FsOptions opts;
+
+    void SetUp() override {
+        fs_default_options(&opts);
+        opts.backend = GetParam().type;
+        opts.direct_io = GetParam().direct_io;
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+};
+
+TEST_P(BlockDeviceTest, RawBlocksRoundTrip) {
+    BlockDevice *dev = bdev_open(IMAGE, opts.backend, BDEV_CREATE | (opts.direct_io ? BDEV_DIRECT : 0), 16);
+    ASSERT_NE(dev, nullptr);
+    EXPECT_EQ(dev->num_blocks, 16u);
+
+    uint8_t *out, *in;
+    ASSERT_EQ(posix_memalign((void **)&out, BDEV_ALIGN, 3 * BLOCK_SIZE), 0);
+    ASSERT_EQ(posix_memalign((void **)&in, BDEV_ALIGN, 3 * BLOCK_SIZE), 0);
+    for (int i = 0; i < 3 * BLOCK_SIZE; i++) out[i] = (uint8_t)(i * 7);
+
+    ASSERT_EQ(bdev_write(dev, 5, 3, out), 0);
+    ASSERT_EQ(bdev_flush(dev), 0);
+    ASSERT_EQ(bdev_read(dev, 5, 3, in), 0);
+    EXPECT_EQ(std::memcmp(in, out, 3 * BLOCK_SIZE), 0);
+
+    // unaligned caller buffer still works with O_DIRECT
+    std::vector<uint8_t> odd(BLOCK_SIZE + 1);
+    ASSERT_EQ(bdev_read(dev, 6, 1, odd.data() + 1), 0);
+    EXPECT_EQ(std::memcmp(odd.data() + 1, out + BLOCK_SIZE, BLOCK_SIZE), 0);
+
+    ASSERT_EQ(bdev_sync(dev), 0);
+    bdev_close(dev);
+    free(out);
+    free(in);
+}
+
+TEST_P(BlockDeviceTest, FormatMountAndLookup) {
+    ASSERT_EQ(format_disk_opts(IMAGE, 64, &opts), 0);
+    int child = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    ASSERT_GE(child, 0);
+    ASSERT_NE(dir_add(fs.sb.root_inode, "etc", child, IDIR), -1);
+    unmount_disk();
+
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+    EXPECT_EQ(fs.dev->type, opts.backend);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "etc"), child);
+}
+
+TEST_P(BlockDeviceTest, ImagesAreInterchangeable) {
+    ASSERT_EQ(format_disk_opts(IMAGE, 64, &opts), 0);
+    int child = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    ASSERT_NE(dir_add(fs.sb.root_inode, "srv", child, IDIR), -1);
+    unmount_disk();
+
+    // same image through every other backend
+    for (int t = BDEV_STDIO; t <= BDEV_MMAP; t++) {
+        FsOptions other;
+        fs_default_options(&other);
+        other.backend = (BlockDeviceType)t;
+        ASSERT_EQ(mount_disk_opts(IMAGE, &other), 0);
+        EXPECT_EQ(dir_lookup(fs.sb.root_inode, "srv"), child) << bdev_type_name(other.backend);
+        unmount_disk();
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, BlockDeviceTest, ::testing::Values(
+        Backend{BDEV_STDIO, 0},
+        Backend{BDEV_PREAD, 0},
+        Backend{BDEV_PREAD, 1},
+        Backend{BDEV_MMAP, 0}));
+
+TEST(BlockDeviceMapTest, OnlyMmapMapsBlocks) {
+    BlockDevice *dev = bdev_open(IMAGE, BDEV_MMAP, BDEV_CREATE, 8);
+    ASSERT_NE(dev, nullptr);
+
+    std::vector<uint8_t> block(BLOCK_SIZE, 0x3C);
+    ASSERT_EQ(bdev_write(dev, 2, 1, block.data()), 0);
+    const uint8_t *view = static_cast<const uint8_t *>(bdev_map(dev, 2));
+    ASSERT_NE(view, nullptr);
+    EXPECT_EQ(view[0], 0x3C);
+    EXPECT_EQ(bdev_map(dev, 8), nullptr);
+    bdev_close(dev);
+
+    dev = bdev_open(IMAGE, BDEV_STDIO, 0, 0);
+    ASSERT_NE(dev, nullptr);
+    EXPECT_EQ(bdev_map(dev, 2), nullptr);
+    bdev_close(dev);
+    std::remove(IMAGE);
+}
+
+TEST(BlockDeviceMapTest, ParsesBackendNames) {
+    BlockDeviceType t;
+    ASSERT_EQ(bdev_parse_type("pread", &t), 0);
+    EXPECT_EQ(t, BDEV_PREAD);
+    EXPECT_EQ(bdev_parse_type("floppy", &t), -1);
+}
@@ -0,0 +1,161 @@
+// cache.cpp
+// GoogleTest tests for the block buffer cache in Cache.c, run against the real fs_core.
+//
+// Directories.h / Files.h declare mkdir()/creat() which clash with the libc prototypes
+// pulled in by gtest, so the directory functions used here are declared by hand.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+long dir_add(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type);
+int create_dir(uint16_t mode);
+}
+
+static const char *IMAGE = "cache_test.bin";
+
+class CacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        format_disk(IMAGE, 64);
+        ASSERT_NE(fs.dev, nullptr);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    // reads a block straight from the image file, bypassing the cache
+    std::vector<uint8_t> raw_block(uint32_t bnum) {
+        std::vector<uint8_t> out(BLOCK_SIZE, 0);
+        FILE *f = std::fopen(IMAGE, "rb");
+        std::fseek(f, (long)bnum * BLOCK_SIZE, SEEK_SET);
+        std::fread(out.data(), 1, BLOCK_SIZE, f);
+        std::fclose(f);
+        return out;
+    }
+};
+
+TEST_F(CacheTest, SecondReadIsHit) {
+    CacheStats before, after;
+    cache_stats(&before);
+
+    Buffer *b = bread(40);
+    ASSERT_NE(b, nullptr);
+    brelse(b);
+    b = bread(40);
+    brelse(b);
+
+    cache_stats(&after);
+    EXPECT_EQ(after.misses - before.misses, 1u);
+    EXPECT_EQ(after.hits - before.hits, 1u);
+}
+
+TEST_F(CacheTest, DirtyBlockReachesDiskOnlyOnFlush) {
+    std::vector<uint8_t> pattern(BLOCK_SIZE, 0xAB);
+    write_block(30, pattern.data());
+
+    EXPECT_EQ(raw_block(30)[0], 0);
+
+    ASSERT_GE(cache_flush(), 1);
+    EXPECT_EQ(raw_block(30), pattern);
+}
+
+TEST_F(CacheTest, EvictionWritesBackDirtyBuffers) {
+    cache_flush();
+    ASSERT_EQ(cache_init(4), 0);
+
+    for (uint32_t b = 20; b < 32; b++) {
+        std::vector<uint8_t> data(BLOCK_SIZE, (uint8_t)b);
+        write_block(b, data.data());
+    }
+
+    CacheStats st;
+    cache_stats(&st);
+    EXPECT_GT(st.evictions, 0u);
+
+    for (uint32_t b = 20; b < 32; b++) {
+        std::vector<uint8_t> data(BLOCK_SIZE);
+        read_block(b, data.data());
+        EXPECT_EQ(data[0], (uint8_t)b);
+        EXPECT_EQ(data[BLOCK_SIZE - 1], (uint8_t)b);
+    }
+}
+
+TEST_F(CacheTest, PinnedBufferSurvivesPressure) {
+    cache_flush();
+    ASSERT_EQ(cache_init(2), 0);
+
+    Buffer *pinned = bread(50);
+    ASSERT_NE(pinned, nullptr);
+    pinned->data[0] = 0x5A;
+    bdirty(pinned);
+
+    for (uint32_t b = 20; b < 30; b++) {
+        Buffer *other = bread(b);
+        ASSERT_NE(other, nullptr);
+        brelse(other);
+    }
+
+    EXPECT_EQ(pinned->block_num, 50u);
+    EXPECT_EQ(pinned->data[0], 0x5A);
+    brelse(pinned);
+}
+
+TEST_F(CacheTest, AllPinnedReturnsNull) {
+    cache_flush();
+    ASSERT_EQ(cache_init(2), 0);
+
+    Buffer *a = bread(20);
+    Buffer *b = bread(21);
+    EXPECT_EQ(bread(22), nullptr);
+    brelse(a);
+    brelse(b);
+    Buffer *c = bread(22);
+    EXPECT_NE(c, nullptr);
+    brelse(c);
+}
+
+TEST_F(CacheTest, WarmLookupDoesNotTouchDisk) {
+    // a few entries move the root out of its inode into a dir block
+    int child = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    ASSERT_GE(child, 0);
+    ASSERT_NE(dir_add(fs.sb.root_inode, "home", child, IDIR), -1);
+    for (const char *name : {"etc", "usr", "var", "tmp", "opt"}) {
+        int other = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+        ASSERT_GE(other, 0);
+        ASSERT_NE(dir_add(fs.sb.root_inode, name, other, IDIR), -1);
+    }
+
+    CacheStats before, after;
+    cache_stats(&before);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "home"), child);
+    cache_stats(&after);
+
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_GT(after.hits, before.hits);
+}
+
+TEST_F(CacheTest, MetadataPersistsAcrossRemount) {
+    int child = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    ASSERT_GE(child, 0);
+    ASSERT_NE(dir_add(fs.sb.root_inode, "var", child, IDIR), -1);
+    uint32_t free_blocks = fs.sb.free_blocks;
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "var"), child);
+    EXPECT_EQ(bitmap_test(&inode_bitmap, child), USED);
+}
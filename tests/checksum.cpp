@@ -0,0 +1,252 @@
+// checksum.cpp
+// GoogleTest tests for the metadata checksums of Checksum.c: the CRC32C itself, and blocks of a
+// real image corrupted behind its back being refused on the way in.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+#include "Checksum.h"
+#include "Paths.h"
+#define mkdir dir_mkdir
+#include "DirIndex.h"
+#undef mkdir
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+int fs_mkdir(uint32_t parent, char *name) __asm__("mkdir");
+int fs_unlink(uint32_t parent, char *name);
+}
+
+static const char *IMAGE = "checksum_test.bin";
+
+TEST(Crc32c, KnownVector) {
+    const char *check = "123456789";
+    EXPECT_EQ(crc32c(0, check, 9), 0xE3069283u);
+    EXPECT_EQ(crc32c_portable(0, check, 9), 0xE3069283u);
+    EXPECT_EQ(crc32c(0, "", 0), 0u);
+
+    // continuing from a crc is the same as one pass over both parts
+    EXPECT_EQ(crc32c(crc32c(0, check, 4), check + 4, 5), 0xE3069283u);
+}
+
+TEST(Crc32c, AcceleratedMatchesPortable) {
+    std::mt19937 rng(7);
+    std::vector<uint8_t> data(3 * BLOCK_SIZE + 64);
+    for (uint8_t &b : data) b = (uint8_t)rng();
+
+    // lengths around the three lane split and every start alignment
+    const size_t lens[] = {0, 1, 7, 8, 63, 255, 767, 768, 769, 1536, BLOCK_SIZE - 4, BLOCK_SIZE, 3 * BLOCK_SIZE};
+    for (size_t len : lens) {
+        for (size_t start = 0; start < 8; start++) {
+            uint32_t seed = (uint32_t)rng();
+            EXPECT_EQ(crc32c(seed, data.data() + start, len), crc32c_portable(seed, data.data() + start, len))
+                    << "len " << len << " start " << start;
+        }
+    }
+}
+
+TEST(Crc32c, SealedBlockVerifiesOnlyWhereItWasSealed) {
+    uint8_t block[BLOCK_SIZE];
+    for (size_t i = 0; i < BLOCK_SIZE; i++) block[i] = (uint8_t)(i * 13);
+    csum_seal(42, block, CSUM_DIR);
+    EXPECT_TRUE(csum_verify(42, block, CSUM_DIR));
+    EXPECT_FALSE(csum_verify(43, block, CSUM_DIR)); // same bytes written to the wrong block
+
+    block[100] ^= 1;
+    EXPECT_FALSE(csum_verify(42, block, CSUM_DIR));
+
+    // zeros are no seal, a wiped block doesn't pass
+    memset(block, 0, BLOCK_SIZE);
+    EXPECT_FALSE(csum_verify(42, block, CSUM_DIR));
+    EXPECT_FALSE(csum_verify(0, block, CSUM_SUPER));
+}
+
+class ChecksumTest : public ::testing::Test {
+protected:
+    FsOptions opts;
+
+    void SetUp() override {
+        fs_default_options(&opts);
+        opts.inline_data = 0; // every dir gets a block
+        ASSERT_EQ(format_disk_opts(IMAGE, 8192, &opts), 0);
+        path_reset();
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    int remount() {
+        unmount_disk();
+        int rc = mount_disk_opts(IMAGE, &opts);
+        path_reset();
+        return rc;
+    }
+
+    // flips a byte of the image behind the mounted fs's back, call unmounted
+    static void corrupt(uint32_t block, uint32_t offset) {
+        FILE *f = std::fopen(IMAGE, "r+b");
+        ASSERT_NE(f, nullptr);
+        long at = (long)block * BLOCK_SIZE + offset;
+        ASSERT_EQ(std::fseek(f, at, SEEK_SET), 0);
+        int c = std::fgetc(f);
+        ASSERT_NE(c, EOF);
+        ASSERT_EQ(std::fseek(f, at, SEEK_SET), 0);
+        std::fputc(c ^ 0xFF, f);
+        std::fclose(f);
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+    }
+
+    static uint64_t csum_errors() {
+        CacheStats st;
+        cache_stats(&st);
+        return st.csum_errors;
+    }
+};
+
+TEST_F(ChecksumTest, FeatureFollowsTheOption) {
+    EXPECT_TRUE(fs.sb.features & FEATURE_METADATA_CSUM);
+    unmount_disk();
+
+    opts.checksums = 0;
+    ASSERT_EQ(format_disk_opts(IMAGE, 8192, &opts), 0);
+    EXPECT_FALSE(fs.sb.features & FEATURE_METADATA_CSUM);
+    int dir = make_dir(fs.sb.root_inode, "d");
+    ASSERT_GT(dir, 0);
+    ASSERT_GT(make_file((uint32_t)dir, "f"), 0);
+    Inode inode;
+    ASSERT_EQ(read_inode((uint32_t)dir, &inode), 0);
+
+    // without checksums the tail of a dir block is just slack
+    ASSERT_EQ(remount(), 0);
+    unmount_disk();
+    corrupt(inode.direct[0], BLOCK_SIZE - 1);
+    ASSERT_EQ(remount(), 0);
+    EXPECT_GT(dir_lookup((uint32_t)dir, "f"), 0);
+}
+
+TEST_F(ChecksumTest, HoldAcrossChurnAndRemounts) {
+    int dir = make_dir(fs.sb.root_inode, "d");
+    ASSERT_GT(dir, 0);
+    // enough entries for an indexed dir, then some of them gone again
+    const int n = (int)DIR_BLOCK_ENTRIES + 200;
+    for (int i = 0; i < n; i++) ASSERT_GT(make_file((uint32_t)dir, "f" + std::to_string(i)), 0) << i;
+    for (int i = 0; i < n; i += 3) {
+        std::string name = "f" + std::to_string(i);
+        ASSERT_EQ(fs_unlink((uint32_t)dir, &name[0]), 0) << i;
+    }
+
+    for (int round = 0; round < 2; round++) {
+        ASSERT_EQ(remount(), 0);
+        for (int i = 0; i < n; i++) {
+            long found = dir_lookup((uint32_t)dir, ("f" + std::to_string(i)).c_str());
+            if (i % 3 == 0) EXPECT_LT(found, 0) << i;
+            else EXPECT_GT(found, 0) << i;
+        }
+        EXPECT_EQ(csum_errors(), 0u);
+    }
+}
+
+TEST_F(ChecksumTest, CorruptDirBlockIsRefused) {
+    int dir = make_dir(fs.sb.root_inode, "d");
+    ASSERT_GT(dir, 0);
+    ASSERT_GT(make_file((uint32_t)dir, "f"), 0);
+    Inode inode;
+    ASSERT_EQ(read_inode((uint32_t)dir, &inode), 0);
+    ASSERT_EQ(remount(), 0);
+    unmount_disk();
+
+    corrupt(inode.direct[0], DIRENT_HEADER + 1); // inside the name of "."
+    ASSERT_EQ(remount(), 0);
+    EXPECT_LT(dir_lookup((uint32_t)dir, "f"), 0);
+    EXPECT_GT(csum_errors(), 0u);
+}
+
+TEST_F(ChecksumTest, ZeroedDirBlockIsRefused) {
+    int dir = make_dir(fs.sb.root_inode, "d");
+    ASSERT_GT(dir, 0);
+    ASSERT_GT(make_file((uint32_t)dir, "f"), 0);
+    Inode inode;
+    ASSERT_EQ(read_inode((uint32_t)dir, &inode), 0);
+    ASSERT_EQ(remount(), 0);
+    unmount_disk();
+
+    // a lost write leaves the block as it was before the dir got it
+    FILE *f = std::fopen(IMAGE, "r+b");
+    ASSERT_NE(f, nullptr);
+    std::vector<uint8_t> zero(BLOCK_SIZE, 0);
+    ASSERT_EQ(std::fseek(f, (long)inode.direct[0] * BLOCK_SIZE, SEEK_SET), 0);
+    ASSERT_EQ(std::fwrite(zero.data(), 1, zero.size(), f), zero.size());
+    std::fclose(f);
+
+    ASSERT_EQ(remount(), 0);
+    EXPECT_LT(dir_lookup((uint32_t)dir, "f"), 0);
+    EXPECT_GT(csum_errors(), 0u);
+}
+
+TEST_F(ChecksumTest, UnwrittenInodeTableIsAccepted) {
+    // a lazy format leaves the tables past itable_zeroed as the sparse image has them, zero
+    unmount_disk();
+    opts.lazy_init = 1;
+    ASSERT_EQ(format_disk_opts(IMAGE, 8192, &opts), 0);
+    uint32_t group = fs.sb.groups_count - 1;
+    ASSERT_LT(fs.groups[group].itable_zeroed, fs.sb.inode_table_blocks);
+    uint32_t block = fs.groups[group].inode_table + fs.sb.inode_table_blocks - 1;
+    ASSERT_EQ(remount(), 0);
+
+    Inode inode;
+    EXPECT_EQ(read_inode(group * fs.sb.inodes_per_group + fs.sb.inodes_per_group - 1, &inode), 0);
+    EXPECT_EQ(csum_errors(), 0u);
+    std::vector<uint8_t> zero(BLOCK_SIZE, 0);
+    EXPECT_TRUE(csum_verify(block, zero.data(), CSUM_ITABLE));
+    EXPECT_FALSE(csum_verify(block + 1, zero.data(), CSUM_ITABLE)); // first data block
+}
+
+TEST_F(ChecksumTest, CorruptInodeTableIsRefused) {
+    int file = make_file(fs.sb.root_inode, "f");
+    ASSERT_GT(file, 0);
+    uint64_t offset = inode_disk_offset((uint32_t)file);
+    ASSERT_EQ(remount(), 0);
+    unmount_disk();
+
+    corrupt((uint32_t)(offset / BLOCK_SIZE), (uint32_t)(offset % BLOCK_SIZE) + 8); // its size
+    ASSERT_EQ(remount(), 0);
+    Inode inode;
+    EXPECT_EQ(read_inode((uint32_t)file, &inode), -1);
+    EXPECT_GT(csum_errors(), 0u);
+}
+
+TEST_F(ChecksumTest, CorruptSuperblockFailsMount) {
+    unmount_disk();
+    corrupt(0, offsetof(Superblock, free_blocks));
+    EXPECT_EQ(remount(), -1);
+}
+
+TEST_F(ChecksumTest, CorruptBitmapFailsMount) {
+    uint32_t bitmap = fs.groups[0].block_bitmap;
+    unmount_disk();
+    corrupt(bitmap, 100);
+    EXPECT_EQ(remount(), -1);
+}
@@ -0,0 +1,271 @@
+// concurrency.cpp
+// GoogleTest stress tests for many threads sharing one mounted image: disjoint directory trees,
+// one shared directory, concurrent file I/O and racing creates of the same name,
+// run against the real fs_core on every backend.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "InodeCache.h"
+#include "Paths.h"
+
+// Directories.h declares mkdir, which clashes with the libc prototype
+#define mkdir fs_mkdir
+#include "Directories.h"
+#undef mkdir
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+}
+
+static const char *IMAGE = "concurrency_test.bin";
+static const int THREADS = 8;
+
+class ConcurrencyTest : public ::testing::TestWithParam<BlockDeviceType> {
+protected:
+    void SetUp() override {
+        FsOptions opts;
+        fs_default_options(&opts);
+        opts.backend = GetParam();
+        ASSERT_EQ(format_disk_opts(IMAGE, 4 * BITS_PER_BLOCK, &opts), 0);
+        root = fs.sb.root_inode;
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+    }
+
+    static int count_entries(uint32_t dir) {
+        int n = 0;
+        dir_iterate(dir, [](const DirEntry *, void *arg) {
+            ++*static_cast<int *>(arg);
+            return 0;
+        }, &n);
+        return n;
+    }
+
+    // every thread runs body(t) at once
+    template <typename F>
+    static void run_threads(F body) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; t++) threads.emplace_back(body, t);
+        for (std::thread &th : threads) th.join();
+    }
+
+    uint32_t root = 0;
+};
+
+TEST_P(ConcurrencyTest, DisjointTreesCreateAndResolve) {
+    const int files = 150, dirs = 20;
+    uint32_t inodes_before = fs.sb.free_inodes;
+    std::atomic<int> failures{0};
+
+    run_threads([&](int t) {
+        std::string top = "/t" + std::to_string(t);
+        int dir = make_dir(root, top.substr(1));
+        if (dir < 0) {
+            failures++;
+            return;
+        }
+        for (int i = 0; i < files; i++) {
+            int f = make_file(dir, "f" + std::to_string(i));
+            if (f < 0 || path_resolve(root, (top + "/f" + std::to_string(i)).c_str()) != f) failures++;
+        }
+        for (int i = 0; i < dirs; i++) {
+            int d = make_dir(dir, "d" + std::to_string(i));
+            if (d < 0 || path_resolve(root, (top + "/d" + std::to_string(i) + "/..").c_str()) != dir) failures++;
+        }
+        // absent names are answered (and cached) without disturbing the neighbours
+        if (path_resolve(root, (top + "/missing").c_str()) != -1) failures++;
+    });
+    ASSERT_EQ(failures.load(), 0);
+
+    // every created inode is accounted for once, in the superblock and in the bitmap
+    uint32_t created = THREADS * (1 + files + dirs);
+    EXPECT_EQ(inodes_before - fs.sb.free_inodes, created);
+    EXPECT_EQ(inode_bitmap.free_bits, fs.sb.free_inodes);
+    EXPECT_EQ(block_bitmap.free_bits, fs.sb.free_blocks);
+    uint32_t group_free = 0;
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) group_free += fs.groups[g].free_inodes;
+    EXPECT_EQ(group_free, fs.sb.free_inodes);
+
+    // and it all survives a remount
+    unmount_disk();
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.backend = GetParam();
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+    EXPECT_EQ(count_entries(root), 2 + THREADS);
+    for (int t = 0; t < THREADS; t++) {
+        long dir = path_resolve(root, ("/t" + std::to_string(t)).c_str());
+        ASSERT_GE(dir, 0);
+        EXPECT_EQ(count_entries((uint32_t)dir), 2 + files + dirs);
+    }
+}
+
+TEST_P(ConcurrencyTest, SharedDirectoryKeepsEveryEntry) {
+    // enough names that the directory switches to the hashed index halfway through
+    const int per_thread = 120;
+    int dir = make_dir(root, "shared");
+    ASSERT_GE(dir, 0);
+    std::vector<std::vector<int>> made(THREADS);
+
+    run_threads([&](int t) {
+        for (int i = 0; i < per_thread; i++) {
+            made[t].push_back(make_file(dir, "t" + std::to_string(t) + "_" + std::to_string(i)));
+        }
+    });
+
+    std::set<int> unique;
+    for (int t = 0; t < THREADS; t++) {
+        for (int i = 0; i < per_thread; i++) {
+            int inum = made[t][i];
+            ASSERT_GE(inum, 0);
+            unique.insert(inum);
+            EXPECT_EQ(dir_lookup(dir, ("t" + std::to_string(t) + "_" + std::to_string(i)).c_str()), inum);
+        }
+    }
+    EXPECT_EQ(unique.size(), (size_t)THREADS * per_thread);
+    EXPECT_EQ(count_entries(dir), 2 + THREADS * per_thread);
+}
+
+TEST_P(ConcurrencyTest, SameNameRaceHasOneWinner) {
+    for (int round = 0; round < 5; round++) {
+        std::string name = "race" + std::to_string(round);
+        std::atomic<int> winners{0};
+        std::atomic<long> winner{-1};
+        uint32_t free_inodes = fs.sb.free_inodes;
+        std::atomic<int> ready{0};
+
+        // a loser may have seen the name missing before the winner added it, all start at once
+        run_threads([&](int) {
+            ready++;
+            while (ready.load() < THREADS) std::this_thread::yield();
+            int f = make_file(root, name);
+            if (f >= 0) {
+                winners++;
+                winner = f;
+            }
+        });
+        EXPECT_EQ(winners.load(), 1);
+        EXPECT_EQ(path_resolve(root, ("/" + name).c_str()), winner.load());
+        EXPECT_EQ(fs.sb.free_inodes, free_inodes - 1); // the losers' inodes went back
+    }
+}
+
+TEST_P(ConcurrencyTest, SameNameMkdirRaceLeavesNothingBehind) {
+    Inode before;
+    ASSERT_EQ(read_inode(root, &before), 0);
+    uint32_t free_inodes = fs.sb.free_inodes;
+    ASSERT_GT(make_dir(root, "taken"), 0);
+    ASSERT_EQ(make_dir(root, "taken"), -1);
+
+    for (int round = 0; round < 5; round++) {
+        std::string name = "race" + std::to_string(round);
+        std::atomic<int> winners{0};
+        std::atomic<long> winner{-1};
+
+        // the losers' dirs and the parent links their ".." took go again
+        run_threads([&](int) {
+            int d = make_dir(root, name);
+            if (d >= 0) {
+                winners++;
+                winner = d;
+            }
+        });
+        EXPECT_EQ(winners.load(), 1);
+        EXPECT_EQ(path_resolve(root, ("/" + name).c_str()), winner.load());
+        EXPECT_EQ(path_resolve(root, ("/" + name + "/..").c_str()), (long)root);
+    }
+
+    Inode after;
+    ASSERT_EQ(read_inode(root, &after), 0);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes - 6);
+    EXPECT_EQ(after.links_count, before.links_count + 6);
+}
+
+TEST_P(ConcurrencyTest, ConcurrentFileIo) {
+    const size_t size = 256 * 1024 + 777;
+    std::vector<int> files(THREADS);
+    for (int t = 0; t < THREADS; t++) {
+        files[t] = make_file(root, "io" + std::to_string(t));
+        ASSERT_GE(files[t], 0);
+    }
+    std::atomic<int> failures{0};
+
+    run_threads([&](int t) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; i++) data[i] = (uint8_t)(i * 31 + t * 7);
+
+        // unaligned pieces, so partial blocks go through each thread's own bounce block
+        for (size_t pos = 0; pos < size;) {
+            size_t n = std::min<size_t>(size - pos, 10000 + 333 * t);
+            if (fs_write(files[t], pos, data.data() + pos, n) != (long)n) failures++;
+            pos += n;
+        }
+        std::vector<uint8_t> back(size);
+        if (fs_read(files[t], 0, back.data(), size) != (long)size || back != data) failures++;
+    });
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(block_bitmap.free_bits, fs.sb.free_blocks);
+}
+
+TEST_P(ConcurrencyTest, ReadersShareAFileWithOneWriter) {
+    int file = make_file(root, "shared");
+    ASSERT_GE(file, 0);
+    std::vector<uint8_t> block(BLOCK_SIZE);
+    std::atomic<int> torn{0};
+
+    // the writer rewrites whole blocks with one byte value, a reader never sees two values mixed
+    run_threads([&](int t) {
+        if (t == 0) {
+            std::vector<uint8_t> fill(BLOCK_SIZE);
+            for (int round = 0; round < 200; round++) {
+                std::memset(fill.data(), round & 0xFF, fill.size());
+                fs_write(file, 0, fill.data(), fill.size());
+            }
+            return;
+        }
+        std::vector<uint8_t> seen(BLOCK_SIZE);
+        for (int round = 0; round < 200; round++) {
+            long got = fs_read(file, 0, seen.data(), seen.size());
+            if (got <= 0) continue;
+            for (long i = 1; i < got; i++) {
+                if (seen[i] != seen[0]) {
+                    torn++;
+                    break;
+                }
+            }
+        }
+    });
+    EXPECT_EQ(torn.load(), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, ConcurrencyTest,
+                         ::testing::Values(BDEV_STDIO, BDEV_PREAD, BDEV_MMAP),
+                         [](const ::testing::TestParamInfo<BlockDeviceType> &info) {
+                             return std::string(bdev_type_name(info.param));
+                         });
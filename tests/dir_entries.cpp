@@ -0,0 +1,206 @@
+// dir_entries.cpp
+// GoogleTest tests for the variable length directory records in Directories.c,
+// run against the real fs_core.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#define mkdir dir_mkdir
+#include "DirIndex.h"
+#undef mkdir
+}
+
+static const char *IMAGE = "dir_entries_test.bin";
+
+class DirEntriesTest : public ::testing::Test {
+protected:
+    int dir = -1;
+    int file = -1;
+
+    void SetUp() override {
+        format_disk(IMAGE, 4096);
+        ASSERT_NE(fs.dev, nullptr);
+        dir = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+        file = create_inode(IREG | IRUSR | IWUSR);
+        ASSERT_GE(dir, 0);
+        ASSERT_GE(file, 0);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    void remount() {
+        unmount_disk();
+        ASSERT_EQ(mount_disk(IMAGE), 0);
+    }
+
+    // name i padded with its own digits up to len bytes
+    static std::string long_name(int i, size_t len) {
+        std::string name = std::to_string(i) + "_";
+        while (name.size() < len) name += (char)('a' + (i + name.size()) % 26);
+        return name;
+    }
+
+    Inode dir_inode() {
+        Inode in;
+        read_inode(dir, &in);
+        return in;
+    }
+};
+
+static int collect(const DirEntry *entry, void *arg) {
+    static_cast<std::vector<std::string> *>(arg)->push_back(entry->name);
+    return 0;
+}
+
+TEST(DirentTest, RecordsPackAndFindByName) {
+    uint8_t block[BLOCK_SIZE];
+    dirent_init(block, BLOCK_SIZE);
+    EXPECT_EQ(dirent_first(block, BLOCK_SIZE), nullptr);
+
+    DirEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.type = IREG;
+    entry.name_len = 1;
+
+    // one byte names take the smallest record, the block holds DIR_BLOCK_ENTRIES of them
+    uint32_t stored = 0;
+    for (;; stored++) {
+        entry.inode_num = stored;
+        entry.name[0] = (char)('!' + stored % 90);
+        if (dirent_insert(block, BLOCK_SIZE, &entry) == -1) break;
+    }
+    EXPECT_EQ(stored, (uint32_t)DIR_BLOCK_ENTRIES);
+
+    DirEntry found;
+    EXPECT_EQ(dirent_find(block, BLOCK_SIZE, "!", &found), 0);
+    EXPECT_STREQ(found.name, "!");
+    EXPECT_EQ(found.type, IREG);
+    EXPECT_EQ(dirent_find(block, BLOCK_SIZE, "!!", nullptr), -1);
+}
+
+TEST(DirentTest, WalkKeepsInsertionOrder) {
+    uint8_t area[256];
+    dirent_init(area, sizeof(area));
+    std::vector<std::string> names = {"a", "longer_name", "mid", std::string(100, 'x')};
+
+    DirEntry entry;
+    for (size_t i = 0; i < names.size(); i++) {
+        std::memset(&entry, 0, sizeof(entry));
+        entry.inode_num = (uint32_t)i;
+        entry.type = IDIR;
+        entry.name_len = (uint8_t)names[i].size();
+        std::memcpy(entry.name, names[i].c_str(), names[i].size() + 1);
+        ASSERT_NE(dirent_insert(area, sizeof(area), &entry), -1) << i;
+    }
+
+    std::vector<std::string> walked;
+    EXPECT_EQ(dirent_walk(area, sizeof(area), collect, &walked), 0);
+    EXPECT_EQ(walked, names);
+
+    // no room left for another long name in 256 bytes
+    entry.name_len = 120;
+    EXPECT_EQ(dirent_reserve(area, sizeof(area), entry.name_len), -1);
+}
+
+TEST(DirentTest, FindTellsApartNamesThatDifferInOneByte) {
+    // stale bytes behind short names, left by longer ones that were removed
+    uint8_t block[BLOCK_SIZE];
+    dirent_init(block, BLOCK_SIZE);
+    DirEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.name_len = 200;
+    std::memset(entry.name, 'z', 200);
+    for (int i = 0; i < 15; i++) {
+        entry.name[0] = (char)('A' + i);
+        ASSERT_NE(dirent_insert(block, BLOCK_SIZE, &entry), -1);
+    }
+    for (int i = 0; i < 15; i++) {
+        std::string name(200, 'z');
+        name[0] = (char)('A' + i);
+        ASSERT_NE(dirent_remove(block, BLOCK_SIZE, name.c_str(), nullptr), -1);
+    }
+
+    for (size_t len = 1; len <= 20; len++) {
+        std::vector<std::string> names;
+        std::string base(len, 'a');
+        names.push_back(base);
+        for (size_t i = 0; i < len; i++) {
+            std::string name = base;
+            name[i] = 'b';
+            names.push_back(name);
+        }
+        for (size_t i = 0; i < names.size(); i++) {
+            std::memset(&entry, 0, sizeof(entry));
+            entry.inode_num = (uint32_t)i;
+            entry.name_len = (uint8_t)len;
+            std::memcpy(entry.name, names[i].c_str(), len + 1);
+            ASSERT_NE(dirent_insert(block, BLOCK_SIZE, &entry), -1);
+        }
+        for (size_t i = 0; i < names.size(); i++) {
+            EXPECT_EQ(dirent_find(block, BLOCK_SIZE, names[i].c_str(), nullptr), (long)i) << names[i];
+        }
+        EXPECT_EQ(dirent_find(block, BLOCK_SIZE, (base + "a").c_str(), nullptr), -1);
+        EXPECT_EQ(dirent_find(block, BLOCK_SIZE, std::string(len, 'c').c_str(), nullptr), -1);
+        for (const std::string &name : names) ASSERT_NE(dirent_remove(block, BLOCK_SIZE, name.c_str(), nullptr), -1);
+    }
+}
+
+TEST_F(DirEntriesTest, NamesUpTo255BytesRoundTrip) {
+    std::string longest(NAME_MAX - 1, 'n');
+    std::string too_long(NAME_MAX, 'n');
+    EXPECT_NE(dir_add(dir, longest.c_str(), file, IREG), -1);
+    EXPECT_EQ(dir_add(dir, too_long.c_str(), file, IREG), -1);
+    EXPECT_EQ(dir_add(dir, "", file, IREG), -1);
+    EXPECT_EQ(dir_lookup(dir, longest.c_str()), file);
+
+    remount();
+    EXPECT_EQ(dir_lookup(dir, longest.c_str()), file);
+    std::vector<std::string> names;
+    dir_iterate(dir, collect, &names);
+    EXPECT_EQ(names, (std::vector<std::string>{".", longest}));
+}
+
+TEST_F(DirEntriesTest, ShortNamesShareOneBlock) {
+    // 200 fixed size entries used to need two blocks, as records they fill about half of one
+    for (int i = 0; i < 200; i++) {
+        ASSERT_NE(dir_add(dir, ("f" + std::to_string(i)).c_str(), file, IREG), -1) << i;
+    }
+    Inode in = dir_inode();
+    EXPECT_EQ(in.flags & (INODE_INDEX | INODE_INLINE), 0u);
+    EXPECT_EQ(in.size, (uint64_t)BLOCK_SIZE);
+    EXPECT_EQ(dir_lookup(dir, "f199"), file);
+}
+
+TEST_F(DirEntriesTest, LongNamesSurviveIndexingAndRemount) {
+    const int n = 150;
+    for (int i = 0; i < n; i++) {
+        ASSERT_NE(dir_add(dir, long_name(i, 200).c_str(), file, IREG), -1) << i;
+    }
+    EXPECT_NE(dir_inode().flags & INODE_INDEX, 0u);
+
+    remount();
+    for (int i = 0; i < n; i++) {
+        EXPECT_EQ(dir_lookup(dir, long_name(i, 200).c_str()), file) << i;
+    }
+    std::vector<std::string> names;
+    dir_iterate(dir, collect, &names);
+    std::set<std::string> unique(names.begin(), names.end());
+    EXPECT_EQ(names.size(), (size_t)n + 1);
+    EXPECT_EQ(unique.size(), (size_t)n + 1);
+    EXPECT_TRUE(unique.count(long_name(n - 1, 200)));
+}
@@ -0,0 +1,122 @@
+// dir_index.cpp
+// GoogleTest tests for the hashed directory index in DirIndex.c, run against the real fs_core.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <set>
+#include <string>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+#include "InodeCache.h"
+#define mkdir fs_mkdir
+#include "DirIndex.h"
+#undef mkdir
+}
+
+static const char *IMAGE = "dir_index_test.bin";
+
+class DirIndexTest : public ::testing::Test {
+protected:
+    int dir = -1;
+    int file = -1;
+
+    void SetUp() override {
+        format_disk(IMAGE, 1024);
+        ASSERT_NE(fs.dev, nullptr);
+        dir = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+        file = create_inode(IREG | IRUSR | IWUSR);
+        ASSERT_GE(dir, 0);
+        ASSERT_GE(file, 0);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static std::string name(int i) {
+        return "entry_" + std::to_string(i);
+    }
+
+    // hard links to one file, so the test isn't bound by the inode count
+    void fill(int n) {
+        for (int i = 0; i < n; i++) {
+            ASSERT_NE(dir_add(dir, name(i).c_str(), file, IREG), -1) << i;
+        }
+    }
+
+    uint32_t flags() {
+        Inode in;
+        read_inode(dir, &in);
+        return in.flags;
+    }
+};
+
+static int collect(const DirEntry *entry, void *arg) {
+    static_cast<std::set<std::string> *>(arg)->insert(entry->name);
+    return 0;
+}
+
+TEST_F(DirIndexTest, SmallDirStaysLinear) {
+    fill(50);
+    EXPECT_EQ(flags() & INODE_INDEX, 0u);
+    EXPECT_EQ(dir_lookup(dir, "entry_49"), file);
+}
+
+TEST_F(DirIndexTest, ConvertsPastThreshold) {
+    fill((int)DIR_BLOCK_ENTRIES + 10);
+    EXPECT_NE(flags() & INODE_INDEX, 0u);
+
+    for (int i = 0; i < (int)DIR_BLOCK_ENTRIES + 10; i++) {
+        EXPECT_EQ(dir_lookup(dir, name(i).c_str()), file) << i;
+    }
+    EXPECT_EQ(dir_lookup(dir, "."), dir);
+    EXPECT_EQ(dir_lookup(dir, "missing"), -1);
+}
+
+TEST_F(DirIndexTest, DuplicateRejectedAfterConversion) {
+    fill(300);
+    EXPECT_EQ(dir_add(dir, "entry_123", file, IREG), -1);
+}
+
+TEST_F(DirIndexTest, LargeDirLookupReadsTwoBlocks) {
+    const int n = 10000;
+    fill(n);
+
+    for (int i = 0; i < n; i += 997) {
+        CacheStats before, after;
+        cache_stats(&before);
+        EXPECT_EQ(dir_lookup(dir, name(i).c_str()), file);
+        cache_stats(&after);
+        EXPECT_EQ((after.hits + after.misses) - (before.hits + before.misses), 2u);
+    }
+}
+
+TEST_F(DirIndexTest, IterateSeesEveryEntryOnce) {
+    const int n = 2000;
+    fill(n);
+
+    std::set<std::string> seen;
+    ASSERT_EQ(dir_iterate(dir, collect, &seen), 0);
+    EXPECT_EQ(seen.size(), (size_t)n + 1); // plus "."
+    EXPECT_TRUE(seen.count("entry_0"));
+    EXPECT_TRUE(seen.count("entry_1999"));
+}
+
+TEST_F(DirIndexTest, IndexSurvivesRemount) {
+    fill(1500);
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+
+    EXPECT_NE(flags() & INODE_INDEX, 0u);
+    EXPECT_EQ(dir_lookup(dir, "entry_0"), file);
+    EXPECT_EQ(dir_lookup(dir, "entry_1499"), file);
+}
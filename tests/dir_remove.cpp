@@ -0,0 +1,239 @@
+// dir_remove.cpp
+// GoogleTest tests for removing directory entries (dir_remove, fs_unlink, fs_rmdir),
+// run against the real fs_core.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Paths.h"
+#define mkdir dir_mkdir
+#include "DirIndex.h"
+#undef mkdir
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+int fs_unlink(uint32_t parent, char *name);
+}
+
+static const char *IMAGE = "dir_remove_test.bin";
+
+class DirRemoveTest : public ::testing::Test {
+protected:
+    int dir = -1;
+    int file = -1;
+
+    void SetUp() override {
+        format_disk(IMAGE, 4096);
+        ASSERT_NE(fs.dev, nullptr);
+        path_reset();
+        dir = make_dir(fs.sb.root_inode, "d");
+        file = create_inode(IREG | IRUSR | IWUSR);
+        ASSERT_GE(dir, 0);
+        ASSERT_GE(file, 0);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+    }
+
+    static int unlink(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_unlink(parent, &copy[0]);
+    }
+
+    static int rmdir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_rmdir(parent, &copy[0]);
+    }
+
+    // hard links to one file, so the test isn't bound by the inode count
+    void link(const std::string &name) {
+        ASSERT_NE(dir_add(dir, name.c_str(), file, IREG), -1) << name;
+    }
+
+    static Inode inode_of(uint32_t inum) {
+        Inode inode;
+        read_inode(inum, &inode);
+        return inode;
+    }
+};
+
+static int collect(const DirEntry *entry, void *arg) {
+    static_cast<std::vector<std::string> *>(arg)->push_back(entry->name);
+    return 0;
+}
+
+static DirEntry entry_of(const char *name, uint32_t inum) {
+    DirEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.inode_num = inum;
+    entry.type = IREG;
+    entry.name_len = (uint8_t)std::strlen(name);
+    std::strcpy(entry.name, name);
+    return entry;
+}
+
+TEST(DirentRemoveTest, HolesCoalesceAndGetReused) {
+    uint8_t block[BLOCK_SIZE];
+    dirent_init(block, BLOCK_SIZE);
+    const char *names[] = {"first", "second", "third", "fourth"};
+    for (uint32_t i = 0; i < 4; i++) {
+        DirEntry e = entry_of(names[i], i);
+        ASSERT_NE(dirent_insert(block, BLOCK_SIZE, &e), -1);
+    }
+    uint32_t room = dirent_room(block, BLOCK_SIZE);
+
+    // the first record stays as free space, later ones join the record before them
+    DirEntry out;
+    EXPECT_EQ(dirent_remove(block, BLOCK_SIZE, "first", &out), 0);
+    EXPECT_STREQ(out.name, "first");
+    EXPECT_NE(dirent_remove(block, BLOCK_SIZE, "second", nullptr), -1);
+    EXPECT_EQ(dirent_remove(block, BLOCK_SIZE, "second", nullptr), -1);
+    EXPECT_EQ(dirent_find(block, BLOCK_SIZE, "third", nullptr), 2);
+    EXPECT_EQ(dirent_room(block, BLOCK_SIZE), room);
+
+    // both holes are one now, a name longer than either alone fits at the front
+    DirEntry e = entry_of("first_and_second", 9);
+    EXPECT_EQ(dirent_insert(block, BLOCK_SIZE, &e), 0);
+    std::vector<std::string> names_left;
+    dirent_walk(block, BLOCK_SIZE, collect, &names_left);
+    EXPECT_EQ(names_left, (std::vector<std::string>{"first_and_second", "third", "fourth"}));
+}
+
+TEST_F(DirRemoveTest, RemovedNamesAreGoneAndLinksDrop) {
+    for (int i = 0; i < 20; i++) link("n" + std::to_string(i));
+    EXPECT_EQ(inode_of(file).links_count, 20u);
+
+    for (int i = 0; i < 20; i += 2) EXPECT_EQ(dir_remove(dir, ("n" + std::to_string(i)).c_str()), file);
+    EXPECT_EQ(dir_remove(dir, "n0"), -1);
+    EXPECT_EQ(dir_remove(dir, "."), -1);
+    EXPECT_EQ(dir_remove(dir, ".."), -1);
+    // a name that names another inode by now stays
+    EXPECT_EQ(dir_remove_expect(dir, "n1", (uint32_t)dir), -1);
+    EXPECT_EQ(inode_of(file).links_count, 10u);
+
+    for (int i = 0; i < 20; i++) {
+        EXPECT_EQ(dir_lookup(dir, ("n" + std::to_string(i)).c_str()), i % 2 ? file : -1) << i;
+    }
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    std::vector<std::string> names;
+    dir_iterate(dir, collect, &names);
+    EXPECT_EQ(names.size(), 12u);
+    EXPECT_EQ(dir_lookup(dir, "n1"), file);
+    EXPECT_EQ(dir_lookup(dir, "n2"), -1);
+}
+
+TEST_F(DirRemoveTest, ChurnKeepsTheDirFromGrowing) {
+    // a spool: names come and go, about 100 live at any time
+    for (int i = 0; i < 100; i++) link("msg" + std::to_string(i));
+    uint64_t size = inode_of(dir).size;
+    uint32_t free_blocks = fs.sb.free_blocks;
+
+    for (int i = 100; i < 3000; i++) {
+        link("msg" + std::to_string(i));
+        ASSERT_EQ(dir_remove(dir, ("msg" + std::to_string(i - 100)).c_str()), file) << i;
+    }
+    EXPECT_EQ(inode_of(dir).size, size);
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+    EXPECT_EQ(dir_lookup(dir, "msg2999"), file);
+    EXPECT_EQ(dir_lookup(dir, "msg2899"), -1);
+}
+
+TEST_F(DirRemoveTest, EmptiedIndexGivesItsLeavesBack) {
+    ASSERT_NE(inode_of(dir).flags & INODE_INLINE, 0u);
+    uint32_t free_blocks = fs.sb.free_blocks;
+
+    const int n = 1500;
+    for (int i = 0; i < n; i++) link("entry_" + std::to_string(i));
+    Inode full = inode_of(dir);
+    ASSERT_NE(full.flags & INODE_INDEX, 0u);
+    ASSERT_GT(full.size, 4ull * BLOCK_SIZE);
+
+    // leaves merge as they thin out, lookups of what's left keep working on the way down
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(dir_remove(dir, ("entry_" + std::to_string(i)).c_str()), file) << i;
+        if (i % 300 == 0) {
+            EXPECT_EQ(dir_lookup(dir, ("entry_" + std::to_string(n - 1)).c_str()), file);
+        }
+    }
+
+    // what remains is the root and one leaf with "." and ".."
+    Inode empty = inode_of(dir);
+    EXPECT_EQ(empty.size, 2ull * BLOCK_SIZE);
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks - 2);
+    std::vector<std::string> names;
+    dir_iterate(dir, collect, &names);
+    EXPECT_EQ(names.size(), 2u);
+}
+
+TEST_F(DirRemoveTest, UnlinkFreesTheFileWithItsLastName) {
+    int f = make_file(dir, "data");
+    ASSERT_GE(f, 0);
+    std::vector<uint8_t> bytes(3 * BLOCK_SIZE, 0x5A);
+    ASSERT_EQ(fs_write(f, 0, bytes.data(), bytes.size()), (long)bytes.size());
+    ASSERT_NE(dir_add(fs.sb.root_inode, "alias", f, IREG), -1);
+    uint32_t free_blocks = fs.sb.free_blocks;
+    uint32_t free_inodes = fs.sb.free_inodes;
+
+    EXPECT_EQ(unlink(dir, "data"), 0);
+    EXPECT_EQ(dir_lookup(dir, "data"), -1);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes); // still named "alias"
+    EXPECT_EQ(fs_read(f, 0, bytes.data(), 1), 1);
+
+    EXPECT_EQ(unlink(fs.sb.root_inode, "alias"), 0);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes + 1);
+    EXPECT_GE(fs.sb.free_blocks, free_blocks + 3);
+
+    EXPECT_EQ(unlink(dir, "data"), -1);
+    EXPECT_EQ(unlink(fs.sb.root_inode, "d"), -1); // a dir
+}
+
+TEST_F(DirRemoveTest, RmdirTakesOnlyEmptyDirs) {
+    int sub = make_dir(dir, "sub");
+    ASSERT_GE(sub, 0);
+    ASSERT_GE(make_file(sub, "f"), 0);
+    ASSERT_EQ(path_lookup("/d/sub"), sub);
+    uint16_t links = inode_of(dir).links_count;
+    uint32_t free_inodes = fs.sb.free_inodes;
+
+    EXPECT_EQ(rmdir(dir, "sub"), -1);
+    EXPECT_EQ(unlink(sub, "f"), 0);
+    EXPECT_EQ(rmdir(dir, "sub"), 0);
+
+    EXPECT_EQ(dir_lookup(dir, "sub"), -1);
+    EXPECT_EQ(path_lookup("/d/sub"), -1); // the cached name went too
+    EXPECT_EQ(inode_of(dir).links_count, links - 1);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes + 2);
+
+    EXPECT_EQ(rmdir(dir, "sub"), -1);
+    EXPECT_EQ(rmdir(fs.sb.root_inode, "."), -1);
+
+    // the name is free for a new dir
+    EXPECT_GE(make_dir(dir, "sub"), 0);
+}
@@ -0,0 +1,241 @@
+// extents.cpp
+// GoogleTest tests for extent-tree block mapping in Extents.c, run against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "InodeCache.h"
+#include "Extents.h"
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+}
+
+static const char *IMAGE = "extents_test.bin";
+
+struct Mapped {
+    uint32_t logical;
+    uint32_t start;
+    uint32_t len;
+};
+
+class ExtentsTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static int make_file(const std::string &name) {
+        std::string copy = name;
+        return fs_creat(fs.sb.root_inode, &copy[0], IREG | IRUSR | IWUSR);
+    }
+
+    static uint16_t depth_of(const Inode &inode) {
+        return reinterpret_cast<const ExtentHeader *>(inode.direct)->depth;
+    }
+
+    // every logical block of runs maps to its physical block
+    static void expect_mapped(const Inode &inode, const std::vector<Mapped> &runs) {
+        for (const Mapped &r : runs) {
+            uint32_t run = 0;
+            ASSERT_EQ(ext_map(&inode, r.logical, &run), (long)r.start);
+            EXPECT_GE(run, r.len);
+            ASSERT_EQ(ext_map(&inode, r.logical + r.len - 1, nullptr), (long)(r.start + r.len - 1));
+        }
+    }
+};
+
+TEST_F(ExtentsTest, NewFilesStartWithEmptyInlineRoot) {
+    format_disk(IMAGE, 1024);
+    int file = make_file("f");
+    ASSERT_GE(file, 0);
+
+    Inode inode;
+    ASSERT_EQ(read_inode(file, &inode), 0);
+    EXPECT_TRUE(inode.flags & INODE_EXTENTS);
+    EXPECT_EQ(depth_of(inode), 0);
+
+    uint32_t run = 0;
+    EXPECT_EQ(ext_map(&inode, 0, &run), 0); // all hole
+    EXPECT_EQ(run, UINT32_MAX);
+    EXPECT_EQ(ext_end(&inode), 0);
+
+    // directories keep classic block pointers
+    Inode root;
+    ASSERT_EQ(read_inode(fs.sb.root_inode, &root), 0);
+    EXPECT_FALSE(root.flags & INODE_EXTENTS);
+}
+
+TEST_F(ExtentsTest, ExtentsCanBeTurnedOff) {
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.extents = 0;
+    ASSERT_EQ(format_disk_opts(IMAGE, 1024, &opts), 0);
+
+    int file = make_file("f");
+    ASSERT_GE(file, 0);
+    ASSERT_GE(alloc_direct_inode_block(file), 0);
+
+    Inode inode;
+    ASSERT_EQ(read_inode(file, &inode), 0);
+    EXPECT_FALSE(inode.flags & INODE_EXTENTS);
+    EXPECT_NE(inode.direct[0], 0u);
+}
+
+TEST_F(ExtentsTest, LargeSequentialFileTakesAHandfulOfExtents) {
+    format_disk(IMAGE, 32 * BITS_PER_BLOCK); // 4 GiB, sparse
+    int file = make_file("big");
+    ASSERT_GE(file, 0);
+    uint32_t before = fs.sb.free_blocks;
+
+    // 2 GiB written front to back, as many blocks per call as the allocator hands out
+    const uint32_t blocks = 512 * 1024;
+    std::vector<Mapped> runs;
+    InodeHandle *h = iget(file);
+    ASSERT_NE(h, nullptr);
+    for (uint32_t logical = 0; logical < blocks;) {
+        uint32_t got = 0;
+        long first = ext_alloc(h, logical, blocks - logical, &got);
+        ASSERT_GT(first, 0);
+        runs.push_back({logical, (uint32_t)first, got});
+        logical += got;
+    }
+    EXPECT_EQ(ext_end(&h->inode), (long)blocks);
+
+    uint32_t extents = 0, tree_blocks = 0;
+    ASSERT_EQ(ext_count(&h->inode, &extents, &tree_blocks), 0);
+    EXPECT_LE(extents, 20u); // one per group the file crosses, give or take
+    EXPECT_GE(depth_of(h->inode), 1);
+    EXPECT_EQ(fs.sb.free_blocks, before - blocks - tree_blocks);
+    expect_mapped(h->inode, runs);
+    iput(h);
+
+    // the tree survives a remount
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    Inode inode;
+    ASSERT_EQ(read_inode(file, &inode), 0);
+    expect_mapped(inode, runs);
+    EXPECT_EQ(ext_map(&inode, blocks, nullptr), 0);
+}
+
+TEST_F(ExtentsTest, InterleavedFilesGrowMultiLevelTrees) {
+    format_disk(IMAGE, 4 * BITS_PER_BLOCK);
+    int a = make_file("a");
+    int b = make_file("b");
+    ASSERT_GE(a, 0);
+    ASSERT_GE(b, 0);
+    uint32_t before = fs.sb.free_blocks;
+
+    // alternating single block appends leave every extent one block long
+    const uint32_t blocks = 3000;
+    std::vector<Mapped> runs_a, runs_b;
+    for (uint32_t i = 0; i < blocks; i++) {
+        int ba = alloc_direct_inode_block(a);
+        int bb = alloc_direct_inode_block(b);
+        ASSERT_GT(ba, 0);
+        ASSERT_GT(bb, 0);
+        runs_a.push_back({i, (uint32_t)ba, 1});
+        runs_b.push_back({i, (uint32_t)bb, 1});
+    }
+
+    Inode inode;
+    ASSERT_EQ(read_inode(a, &inode), 0);
+    uint32_t extents = 0, tree_blocks = 0;
+    ASSERT_EQ(ext_count(&inode, &extents, &tree_blocks), 0);
+    EXPECT_EQ(extents, blocks);
+    EXPECT_EQ(depth_of(inode), 2); // more leaves than the inline root has room for
+    expect_mapped(inode, runs_a);
+
+    ASSERT_EQ(read_inode(b, &inode), 0);
+    expect_mapped(inode, runs_b);
+
+    // cutting both files back to nothing returns data and tree blocks
+    for (int file : {a, b}) {
+        InodeHandle *h = iget(file);
+        ASSERT_NE(h, nullptr);
+        ASSERT_EQ(ext_truncate(h, 0), 0);
+        EXPECT_EQ(ext_end(&h->inode), 0);
+        EXPECT_EQ(depth_of(h->inode), 0);
+        iput(h);
+    }
+    EXPECT_EQ(fs.sb.free_blocks, before);
+}
+
+TEST_F(ExtentsTest, TruncateKeepsTheHead) {
+    format_disk(IMAGE, 4 * BITS_PER_BLOCK);
+    int a = make_file("a");
+    int b = make_file("b");
+    ASSERT_GE(a, 0);
+    ASSERT_GE(b, 0);
+
+    std::vector<Mapped> head;
+    for (uint32_t i = 0; i < 1000; i++) {
+        int ba = alloc_direct_inode_block(a);
+        ASSERT_GT(ba, 0);
+        ASSERT_GT(alloc_direct_inode_block(b), 0);
+        if (i < 600) head.push_back({i, (uint32_t)ba, 1});
+    }
+    uint32_t before = fs.sb.free_blocks;
+
+    InodeHandle *h = iget(a);
+    ASSERT_NE(h, nullptr);
+    uint32_t old_tree = 0;
+    ASSERT_EQ(ext_count(&h->inode, nullptr, &old_tree), 0);
+    ASSERT_EQ(ext_truncate(h, 600), 0);
+
+    uint32_t extents = 0, tree_blocks = 0;
+    ASSERT_EQ(ext_count(&h->inode, &extents, &tree_blocks), 0);
+    EXPECT_EQ(extents, 600u);
+    EXPECT_EQ(ext_end(&h->inode), 600);
+    EXPECT_EQ(ext_map(&h->inode, 600, nullptr), 0);
+    expect_mapped(h->inode, head);
+    EXPECT_EQ(fs.sb.free_blocks, before + 400 + old_tree - tree_blocks);
+    iput(h);
+}
+
+TEST_F(ExtentsTest, OutOfOrderInsertsStaySorted) {
+    format_disk(IMAGE, 4 * BITS_PER_BLOCK);
+    int file = make_file("f");
+    ASSERT_GE(file, 0);
+
+    // only the mapping is under test, the physical numbers are never touched
+    const uint32_t count = 2500;
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+    InodeHandle *h = iget(file);
+    ASSERT_NE(h, nullptr);
+    for (uint32_t i : order) ASSERT_EQ(ext_insert(h, 2 * i, 1000000 + 2 * i, 1), 0);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t run = 0;
+        ASSERT_EQ(ext_map(&h->inode, 2 * i, &run), 1000000 + 2 * i);
+        EXPECT_EQ(run, 1u);
+        ASSERT_EQ(ext_map(&h->inode, 2 * i + 1, &run), 0); // hole up to the next extent
+        if (i + 1 < count) {
+            EXPECT_EQ(run, 1u);
+        }
+    }
+
+    // filling a hole glues its neighbours together
+    ASSERT_EQ(ext_insert(h, 1, 1000001, 1), 0);
+    uint32_t run = 0;
+    EXPECT_EQ(ext_map(&h->inode, 0, &run), 1000000);
+    EXPECT_EQ(run, 3u);
+
+    uint32_t extents = 0;
+    ASSERT_EQ(ext_count(&h->inode, &extents, nullptr), 0);
+    EXPECT_EQ(extents, count - 1);
+    iput(h);
+}
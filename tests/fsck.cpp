@@ -0,0 +1,369 @@
+// fsck.cpp
+// GoogleTest tests for fs_fsck in Fsck.c: images built through fs_core check clean, and images
+// damaged on purpose (through the API or behind its back) are reported, repaired and check
+// clean afterwards.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Extents.h"
+#include "Fsck.h"
+#include "Paths.h"
+#include "Snapshot.h"
+#define mkdir dir_mkdir
+#include "DirIndex.h"
+#undef mkdir
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+int fs_mkdir(uint32_t parent, char *name) __asm__("mkdir");
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+int fs_unlink(uint32_t parent, char *name);
+}
+
+static const char *IMAGE = "fsck_test.bin";
+
+// extents on or off, files are mapped by trees or by block pointers
+class FsckTest : public ::testing::TestWithParam<int> {
+protected:
+    FsOptions opts;
+
+    void SetUp() override {
+        fs_default_options(&opts);
+        opts.extents = GetParam();
+        ASSERT_EQ(format_disk_opts(IMAGE, 8192, &opts), 0);
+        path_reset();
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    void remount() {
+        unmount_disk();
+        ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+        path_reset();
+    }
+
+    // unmounts, checks (or repairs) and mounts again
+    int fsck(int repair, FsckReport *r) {
+        unmount_disk();
+        int rc = fs_fsck(IMAGE, &opts, repair, r);
+        EXPECT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+        path_reset();
+        return rc;
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name, size_t bytes = 0) {
+        std::string copy = name;
+        int inum = fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+        if (inum < 0 || bytes == 0) return inum;
+        std::vector<char> data(bytes, (char)('a' + inum % 26));
+        return fs_write((uint32_t)inum, 0, data.data(), bytes) == (long)bytes ? inum : -1;
+    }
+
+    static uint16_t links_of(uint32_t inum) {
+        Inode inode;
+        EXPECT_EQ(read_inode(inum, &inode), 0);
+        return inode.links_count;
+    }
+
+    static void set_links(uint32_t inum, uint16_t links) {
+        InodeHandle *h = iget(inum);
+        ASSERT_NE(h, nullptr);
+        ilock(h);
+        h->inode.links_count = links;
+        idirty(h);
+        iunlock(h);
+        iput(h);
+    }
+
+    static uint64_t problems(const FsckReport &r) {
+        return r.orphans + r.unlinked + r.dangling + r.cross_linked + r.bad_blocks + r.unreadable + r.link_fixes +
+               r.block_bits + r.inode_bits + r.counter_fixes;
+    }
+};
+
+TEST_P(FsckTest, BuiltImageIsClean) {
+    uint32_t root = fs.sb.root_inode;
+    uint64_t inodes = 1, dirs = 1;
+
+    // nested dirs of inline and block dirs, small and large files, one indexed dir
+    int top = make_dir(root, "top");
+    ASSERT_GT(top, 0);
+    inodes++, dirs++;
+    for (int d = 0; d < 8; d++) {
+        int sub = make_dir((uint32_t)top, "sub" + std::to_string(d));
+        ASSERT_GT(sub, 0);
+        inodes++, dirs++;
+        for (int f = 0; f < d * 3; f++, inodes++) {
+            ASSERT_GT(make_file((uint32_t)sub, "f" + std::to_string(f), (size_t)f * 1500), 0);
+        }
+    }
+    int big = make_dir(root, "big");
+    ASSERT_GT(big, 0);
+    inodes++, dirs++;
+    for (uint32_t i = 0; i < DIR_BLOCK_ENTRIES + 50; i++, inodes++) {
+        ASSERT_GT(make_file((uint32_t)big, "entry_" + std::to_string(i)), 0);
+    }
+    // past the direct pointers and the first indirect block
+    ASSERT_GT(make_file(root, "huge", (DIRECT_PTRS + PTRS_PER_BLOCK + 40) * (size_t)BLOCK_SIZE), 0);
+    inodes++;
+    std::string gone = "gone";
+    ASSERT_GT(make_file(root, gone, 3 * BLOCK_SIZE), 0);
+    ASSERT_EQ(fs_unlink(root, &gone[0]), 0);
+
+    FsckReport r;
+    uint32_t free_blocks = fs.sb.free_blocks;
+    ASSERT_EQ(fsck(0, &r), FSCK_CLEAN);
+    EXPECT_EQ(problems(r), 0u);
+    EXPECT_EQ(r.inodes, inodes);
+    EXPECT_EQ(r.dirs, dirs);
+    EXPECT_EQ(r.blocks, fs.sb.total_blocks - free_blocks);
+
+    // repairing a clean image changes nothing
+    ASSERT_EQ(fsck(1, &r), FSCK_CLEAN);
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+}
+
+TEST_P(FsckTest, BitmapsCountersAndLinksAreRebuilt) {
+    uint32_t root = fs.sb.root_inode;
+    int dir = make_dir(root, "d");
+    int file = make_file((uint32_t)dir, "f", 5 * BLOCK_SIZE);
+    int other = make_file(root, "g", 2 * BLOCK_SIZE);
+    ASSERT_GT(dir, 0);
+    ASSERT_GT(file, 0);
+    ASSERT_GT(other, 0);
+    uint32_t free_blocks = fs.sb.free_blocks, free_inodes = fs.sb.free_inodes;
+
+    // a leaked block, a block in use marked free, an inode in use marked free,
+    // link counts off both ways and a superblock count off
+    int leaked = alloc_block();
+    ASSERT_GT(leaked, 0);
+    Inode inode;
+    ASSERT_EQ(read_inode((uint32_t)other, &inode), 0);
+    uint32_t data = inode.flags & INODE_EXTENTS ? ((const Extent *)((const ExtentHeader *)inode.direct + 1))->start
+                                                : inode.direct[0];
+    free_block(data);
+    free_inode((uint32_t)file);
+    set_links((uint32_t)file, 7);
+    set_links((uint32_t)dir, 1);
+    fs.sb.free_blocks += 11;
+    sync_superblock();
+    fs_sync();
+
+    FsckReport r;
+    ASSERT_EQ(fsck(0, &r), FSCK_ERRORS);
+    EXPECT_EQ(r.block_bits, 2u);
+    EXPECT_EQ(r.inode_bits, 1u);
+    EXPECT_EQ(r.link_fixes, 2u);
+    EXPECT_GT(r.counter_fixes, 0u);
+    EXPECT_EQ(r.orphans + r.unlinked + r.dangling + r.cross_linked + r.bad_blocks + r.unreadable, 0u);
+    EXPECT_EQ(r.repaired, 0u);
+
+    ASSERT_EQ(fsck(1, &r), FSCK_FIXED);
+    EXPECT_EQ(r.repaired, problems(r));
+    ASSERT_EQ(fsck(0, &r), FSCK_CLEAN);
+
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes);
+    EXPECT_EQ(links_of((uint32_t)file), 1);
+    EXPECT_EQ(links_of((uint32_t)dir), 2);
+    char buf[BLOCK_SIZE];
+    EXPECT_EQ(fs_read((uint32_t)other, 0, buf, sizeof(buf)), (long)sizeof(buf));
+    EXPECT_EQ(buf[0], (char)('a' + other % 26));
+}
+
+TEST_P(FsckTest, OrphansGoToLostAndFound) {
+    uint32_t root = fs.sb.root_inode;
+    int dir = make_dir(root, "d");
+    ASSERT_GT(dir, 0);
+    int inner = make_file((uint32_t)dir, "inner", 100);
+    int kept = make_file(root, "kept", 2 * BLOCK_SIZE);
+    int unlinked = make_file(root, "unlinked", 2 * BLOCK_SIZE);
+    ASSERT_GT(inner, 0);
+    ASSERT_GT(kept, 0);
+    ASSERT_GT(unlinked, 0);
+    uint32_t free_blocks = fs.sb.free_blocks;
+
+    // names gone, the inodes stay allocated: a dir and a file with links left, one without
+    ASSERT_EQ(dir_remove(root, "d"), dir);
+    ASSERT_EQ(dir_remove(root, "kept"), kept);
+    set_links((uint32_t)kept, 1);
+    ASSERT_EQ(dir_remove(root, "unlinked"), unlinked);
+    fs_sync();
+
+    FsckReport r;
+    ASSERT_EQ(fsck(1, &r), FSCK_FIXED);
+    EXPECT_EQ(r.orphans, 2u);
+    EXPECT_EQ(r.unlinked, 1u);
+    ASSERT_EQ(fsck(0, &r), FSCK_CLEAN);
+
+    long lost = dir_lookup(root, "lost+found");
+    ASSERT_GT(lost, 0);
+    EXPECT_EQ(dir_lookup((uint32_t)lost, ("#" + std::to_string(dir)).c_str()), dir);
+    EXPECT_EQ(dir_lookup((uint32_t)lost, ("#" + std::to_string(kept)).c_str()), kept);
+    EXPECT_EQ(dir_lookup((uint32_t)lost, ("#" + std::to_string(unlinked)).c_str()), -1);
+    EXPECT_EQ(dir_lookup((uint32_t)dir, "inner"), inner);
+    EXPECT_EQ(dir_lookup((uint32_t)dir, ".."), lost);
+    EXPECT_EQ(links_of((uint32_t)lost), 3); // ".", its name and d's ".."
+    EXPECT_EQ(links_of((uint32_t)dir), 2);
+    EXPECT_EQ(links_of((uint32_t)kept), 1);
+
+    // the unlinked file's blocks came back, lost+found took at most one
+    EXPECT_GE(fs.sb.free_blocks + 1, free_blocks + 2);
+    EXPECT_EQ(path_lookup(("/lost+found/#" + std::to_string(dir) + "/inner").c_str()), inner);
+}
+
+TEST_P(FsckTest, DanglingEntriesAreRemoved) {
+    uint32_t root = fs.sb.root_inode;
+    ASSERT_GT(make_file(root, "real"), 0);
+    uint32_t ghost = fs.sb.total_inodes - 1; // never allocated
+    ASSERT_NE(dir_add(root, "ghost", ghost, IREG), -1);
+    // freed behind the dir's back, the inode keeps its mode with no links
+    int freed = make_file(root, "freed");
+    ASSERT_GT(freed, 0);
+    set_links((uint32_t)freed, 0);
+    free_inode((uint32_t)freed);
+    fs_sync();
+
+    FsckReport r;
+    ASSERT_EQ(fsck(0, &r), FSCK_ERRORS);
+    EXPECT_EQ(r.dangling, 2u);
+    ASSERT_EQ(fsck(1, &r), FSCK_FIXED);
+    ASSERT_EQ(fsck(0, &r), FSCK_CLEAN);
+    EXPECT_EQ(problems(r), 0u);
+    EXPECT_EQ(dir_lookup(root, "ghost"), -1);
+    EXPECT_EQ(dir_lookup(root, "freed"), -1);
+    EXPECT_EQ(links_of((uint32_t)freed), 0);
+    EXPECT_GT(dir_lookup(root, "real"), 0);
+}
+
+TEST_P(FsckTest, CrossLinkedBlockIsReported) {
+    uint32_t root = fs.sb.root_inode;
+    int a = make_file(root, "a", 2 * BLOCK_SIZE);
+    int b = make_file(root, "b", 2 * BLOCK_SIZE);
+    ASSERT_GT(a, 0);
+    ASSERT_GT(b, 0);
+
+    // b's first extent (or pointer) moved onto a's blocks
+    InodeHandle *ha = iget((uint32_t)a), *hb = iget((uint32_t)b);
+    ASSERT_NE(ha, nullptr);
+    ASSERT_NE(hb, nullptr);
+    ilock(hb);
+    if (hb->inode.flags & INODE_EXTENTS) {
+        Extent *eb = (Extent *)((ExtentHeader *)hb->inode.direct + 1);
+        eb->start = ((const Extent *)((const ExtentHeader *)ha->inode.direct + 1))->start;
+    } else {
+        hb->inode.direct[0] = ha->inode.direct[0];
+    }
+    idirty(hb);
+    iunlock(hb);
+    iput(hb);
+    iput(ha);
+    fs_sync();
+
+    FsckReport r;
+    EXPECT_EQ(fsck(0, &r), FSCK_ERRORS);
+    EXPECT_GT(r.cross_linked, 0u);
+    EXPECT_GT(r.block_bits, 0u); // b's own blocks are leaked now
+
+    // the leak is fixed, the cross link stays for somebody to look at
+    EXPECT_EQ(fsck(1, &r), FSCK_ERRORS);
+    EXPECT_LT(r.repaired, problems(r));
+    EXPECT_EQ(fsck(0, &r), FSCK_ERRORS);
+    EXPECT_EQ(r.block_bits, 0u);
+    EXPECT_GT(r.cross_linked, 0u);
+}
+
+TEST_P(FsckTest, SnapshotBlocksStayInUse) {
+    uint32_t root = fs.sb.root_inode;
+    int file = make_file(root, "f", 8 * BLOCK_SIZE);
+    ASSERT_GT(file, 0);
+    ASSERT_GE(fs_snapshot_create(), 0);
+
+    // copies of the overwritten blocks, the deleted file's blocks kept for the snapshot
+    std::vector<char> data(4 * BLOCK_SIZE, 'z');
+    ASSERT_EQ(fs_write((uint32_t)file, 0, data.data(), data.size()), (long)data.size());
+    int doomed = make_file(root, "doomed", 4 * BLOCK_SIZE);
+    ASSERT_GT(doomed, 0);
+    ASSERT_GE(fs_snapshot_create(), 0);
+    std::string name = "doomed";
+    ASSERT_EQ(fs_unlink(root, &name[0]), 0);
+    uint32_t free_blocks = fs.sb.free_blocks;
+
+    FsckReport r;
+    ASSERT_EQ(fsck(1, &r), FSCK_CLEAN);
+    EXPECT_EQ(problems(r), 0u);
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+}
+
+TEST_P(FsckTest, CorruptBitmapIsRebuilt) {
+    ASSERT_GT(make_file(fs.sb.root_inode, "f", 3 * BLOCK_SIZE), 0);
+    uint32_t bitmap = fs.groups[0].block_bitmap;
+    uint32_t free_blocks = fs.sb.free_blocks;
+    unmount_disk();
+
+    // zero a stretch of the bitmap on disk, the mount refuses the group
+    FILE *f = std::fopen(IMAGE, "r+b");
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(std::fseek(f, (long)bitmap * BLOCK_SIZE, SEEK_SET), 0);
+    std::vector<char> zero(64, 0);
+    ASSERT_EQ(std::fwrite(zero.data(), 1, zero.size(), f), zero.size());
+    std::fclose(f);
+    EXPECT_EQ(mount_disk_opts(IMAGE, &opts), -1);
+
+    FsckReport r;
+    EXPECT_EQ(fs_fsck(IMAGE, &opts, 1, &r), FSCK_FIXED);
+    EXPECT_GT(r.block_bits, 0u);
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+    path_reset();
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+    EXPECT_EQ(fsck(0, &r), FSCK_CLEAN);
+}
+
+TEST_P(FsckTest, WideTreeWalksInParallel) {
+    // more dirs than threads at every level so the walk has something to steal
+    uint32_t root = fs.sb.root_inode;
+    uint64_t inodes = 1;
+    std::vector<int> level = {(int)root};
+    for (int depth = 0; depth < 3; depth++) {
+        std::vector<int> next;
+        for (int parent : level) {
+            for (int i = 0; i < 6; i++, inodes++) {
+                int d = make_dir((uint32_t)parent, "d" + std::to_string(i));
+                ASSERT_GT(d, 0);
+                next.push_back(d);
+                ASSERT_GT(make_file((uint32_t)d, "f"), 0);
+                inodes++;
+            }
+        }
+        level = next;
+    }
+
+    FsckReport r;
+    ASSERT_EQ(fsck(0, &r), FSCK_CLEAN);
+    EXPECT_EQ(r.inodes, inodes);
+}
+
+INSTANTIATE_TEST_SUITE_P(Mapping, FsckTest, ::testing::Values(1, 0),
+                         [](const ::testing::TestParamInfo<int> &info) {
+                             return std::string(info.param ? "Extents" : "Pointers");
+                         });
@@ -0,0 +1,141 @@
+// groups.cpp
+// GoogleTest tests for block groups and locality-aware allocation, run against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <set>
+#include <string>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+}
+
+static const char *IMAGE = "groups_test.bin";
+static const uint32_t GROUPS = 4;
+
+class GroupsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        format_disk(IMAGE, GROUPS * BITS_PER_BLOCK); // 512 MiB, sparse
+        ASSERT_EQ(fs.sb.groups_count, GROUPS);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+    }
+};
+
+TEST_F(GroupsTest, EveryGroupHasItsOwnMetadata) {
+    for (uint32_t g = 0; g < GROUPS; g++) {
+        const GroupDesc &gd = fs.groups[g];
+        EXPECT_EQ(group_of_block(gd.block_bitmap), g);
+        EXPECT_EQ(group_of_block(gd.inode_table + fs.sb.inode_table_blocks - 1), g);
+        EXPECT_TRUE(bitmap_test(&block_bitmap, gd.inode_table));
+        EXPECT_FALSE(bitmap_test(&block_bitmap, group_data_start(g) + 1));
+    }
+    EXPECT_EQ(group_of_inode(fs.sb.root_inode), 0u);
+}
+
+TEST_F(GroupsTest, TopLevelDirsSpreadAcrossGroups) {
+    std::set<uint32_t> used;
+    for (uint32_t i = 0; i < GROUPS; i++) {
+        int d = make_dir(fs.sb.root_inode, "top" + std::to_string(i));
+        ASSERT_GE(d, 0);
+        used.insert(group_of_inode(d));
+    }
+    EXPECT_GE(used.size(), GROUPS - 1);
+}
+
+TEST_F(GroupsTest, ChildrenAndDataStayNearTheirParent) {
+    int top = -1;
+    for (uint32_t i = 0; i < GROUPS && top == -1; i++) {
+        int d = make_dir(fs.sb.root_inode, "top" + std::to_string(i));
+        ASSERT_GE(d, 0);
+        if (group_of_inode(d) != 0) top = d; // a dir away from the root's group
+    }
+    ASSERT_NE(top, -1);
+    uint32_t g = group_of_inode(top);
+
+    int sub = make_dir(top, "sub");
+    int file = make_file(top, "file");
+    ASSERT_GE(sub, 0);
+    ASSERT_GE(file, 0);
+    EXPECT_EQ(group_of_inode(sub), g);
+    EXPECT_EQ(group_of_inode(file), g);
+
+    // file data goes to the inode's group, one block after another
+    int prev = -1;
+    for (int i = 0; i < 4; i++) {
+        int b = alloc_direct_inode_block(file);
+        ASSERT_GE(b, 0);
+        EXPECT_EQ(group_of_block(b), g);
+        if (prev != -1) {
+            EXPECT_EQ(b, prev + 1);
+        }
+        prev = b;
+    }
+
+    // enough entries that sub needs a block of its own
+    for (int i = 0; i < 5; i++) ASSERT_GE(make_file(sub, "f" + std::to_string(i)), 0);
+    Inode dir;
+    read_inode(sub, &dir);
+    ASSERT_FALSE(dir.flags & INODE_INLINE);
+    EXPECT_EQ(group_of_block(dir.direct[0]), g);
+}
+
+TEST_F(GroupsTest, CountersMatchBitmapsAfterRemount) {
+    for (int i = 0; i < 6; i++) {
+        int d = make_dir(fs.sb.root_inode, "d" + std::to_string(i));
+        ASSERT_GE(d, 0);
+        ASSERT_GE(make_file(d, "f"), 0);
+    }
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+
+    uint64_t free_blocks = 0, free_inodes = 0, dirs = 0;
+    for (uint32_t g = 0; g < GROUPS; g++) {
+        const GroupDesc &gd = fs.groups[g];
+        uint32_t bits_free = 0;
+        for (uint32_t b = g * fs.sb.blocks_per_group; b < group_end(g); b++) bits_free += !bitmap_test(&block_bitmap, b);
+        EXPECT_EQ(gd.free_blocks, bits_free) << g;
+
+        uint32_t inodes_free = 0;
+        for (uint32_t i = g * fs.sb.inodes_per_group; i < (g + 1) * fs.sb.inodes_per_group; i++) {
+            inodes_free += !bitmap_test(&inode_bitmap, i);
+        }
+        EXPECT_EQ(gd.free_inodes, inodes_free) << g;
+
+        free_blocks += gd.free_blocks;
+        free_inodes += gd.free_inodes;
+        dirs += gd.used_dirs;
+    }
+    EXPECT_EQ(free_blocks, fs.sb.free_blocks);
+    EXPECT_EQ(free_inodes, fs.sb.free_inodes);
+    EXPECT_EQ(dirs, 7u); // root + 6
+}
+
+TEST_F(GroupsTest, TinyLastGroupIsLeftOut) {
+    unmount_disk();
+    format_disk(IMAGE, BITS_PER_BLOCK + 20);
+    EXPECT_EQ(fs.sb.groups_count, 1u);
+    EXPECT_EQ(fs.sb.total_blocks, (uint32_t)BITS_PER_BLOCK);
+    EXPECT_EQ(fs.sb.journal_start + fs.sb.journal_blocks, fs.sb.total_blocks);
+}
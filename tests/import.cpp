@@ -0,0 +1,281 @@
+// import.cpp
+// GoogleTest tests for fs_import, the bulk copy of a host tree into a fresh image,
+// run against the real fs_core with both block mappings, with and without inline data.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included. fs_core's mkdir and creat symbols also stand
+// in for libc's at link time, so host dirs are made with mkdirat.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Extents.h"
+#include "Import.h"
+#include "Paths.h"
+#define mkdir dir_mkdir
+#include "DirIndex.h"
+#undef mkdir
+
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+}
+
+namespace stdfs = std::filesystem;
+
+static const char *IMAGE = "import_test.bin";
+static const char *TREE = "import_test_tree";
+
+class ImportTest : public ::testing::TestWithParam<std::tuple<int, int>> {
+protected:
+    FsOptions opts;
+    ImportStats stats;
+
+    void SetUp() override {
+        stdfs::remove_all(TREE);
+        host_dir("");
+        fs_default_options(&opts);
+        opts.extents = std::get<0>(GetParam());
+        opts.inline_data = std::get<1>(GetParam());
+        std::memset(&stats, 0, sizeof(stats));
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+        stdfs::remove_all(TREE);
+    }
+
+    // bytes that differ per file and per offset
+    static std::string contents(const std::string &seed, size_t len) {
+        std::string data(len, '\0');
+        uint32_t h = 2166136261u;
+        for (char c : seed) h = (h ^ (unsigned char)c) * 16777619u;
+        for (size_t i = 0; i < len; i++) {
+            h = h * 1103515245u + 12345u;
+            data[i] = (char)(h >> 16);
+        }
+        return data;
+    }
+
+    // makes the host dir rel and the ones above it
+    static void host_dir(const std::string &rel) {
+        stdfs::path p = stdfs::path(TREE);
+        mkdirat(AT_FDCWD, p.c_str(), 0755);
+        for (const auto &part : stdfs::path(rel)) {
+            p /= part;
+            mkdirat(AT_FDCWD, p.c_str(), 0755);
+        }
+    }
+
+    static void host_file(const std::string &rel, size_t len) {
+        stdfs::path p = stdfs::path(TREE) / rel;
+        host_dir(stdfs::path(rel).parent_path().string());
+        std::ofstream(p, std::ios::binary) << contents(rel, len);
+    }
+
+    void import() {
+        ASSERT_EQ(fs_import(TREE, IMAGE, &opts, &stats), 0);
+        path_reset();
+    }
+
+    void remount() {
+        unmount_disk();
+        ASSERT_EQ(mount_disk(IMAGE), 0);
+        path_reset();
+    }
+
+    static Inode inode_of(uint32_t inum) {
+        Inode inode;
+        read_inode(inum, &inode);
+        return inode;
+    }
+
+    // the imported file at path holds what the host file of len bytes does
+    static void expect_file(const std::string &rel, size_t len) {
+        long inum = path_lookup(("/" + rel).c_str());
+        ASSERT_NE(inum, -1) << rel;
+        Inode in = inode_of((uint32_t)inum);
+        EXPECT_EQ(in.size, len) << rel;
+        EXPECT_EQ(in.links_count, 1u) << rel;
+        std::string data(len + 1, '\0');
+        EXPECT_EQ(fs_read((uint32_t)inum, 0, &data[0], len + 1), (long)len) << rel;
+        data.resize(len);
+        EXPECT_TRUE(data == contents(rel, len)) << rel;
+    }
+};
+
+static int collect(const DirEntry *entry, void *arg) {
+    static_cast<std::vector<std::string> *>(arg)->push_back(entry->name);
+    return 0;
+}
+
+TEST_P(ImportTest, TreeArrivesWithContentsAndLinks) {
+    std::vector<std::pair<std::string, size_t>> files = {
+        {"empty", 0},
+        {"tiny", 17},
+        {"docs/readme", 3000},
+        {"docs/spec", 3 * BLOCK_SIZE + 5},
+        {"src/a/b/deep", 100},
+        {"src/a/main.c", 12345},
+        {"big/blob", (size_t)IMPORT_RUN_BLOCKS * BLOCK_SIZE + 3 * BLOCK_SIZE + 1}, // a run of its own
+    };
+    for (auto &f : files) host_file(f.first, f.second);
+    host_dir("empty_dir");
+    stdfs::create_symlink("tiny", stdfs::path(TREE) / "link");
+    import();
+
+    EXPECT_EQ(stats.files, files.size());
+    EXPECT_EQ(stats.dirs, 7u); // the top dir, docs, src, src/a, src/a/b, big, empty_dir
+    EXPECT_EQ(stats.skipped, 1u);
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto &f : files) expect_file(f.first, f.second);
+        EXPECT_EQ(path_lookup("/link"), -1);
+
+        // "." of its own, a name in its parent and ".." of each subdir
+        EXPECT_EQ(inode_of(fs.sb.root_inode).links_count, 2u + 4u);
+        EXPECT_EQ(inode_of(path_lookup("/src")).links_count, 3u);
+        EXPECT_EQ(inode_of(path_lookup("/empty_dir")).links_count, 2u);
+        EXPECT_EQ(path_lookup("/src/a/b/.."), path_lookup("/src/a"));
+        EXPECT_EQ(path_lookup("/.."), (long)fs.sb.root_inode);
+
+        std::vector<std::string> names;
+        dir_iterate(fs.sb.root_inode, collect, &names);
+        EXPECT_EQ(names, (std::vector<std::string>{".", "..", "big", "docs", "empty", "empty_dir", "src", "tiny"}));
+        remount();
+    }
+}
+
+TEST_P(ImportTest, LargeDirGetsAnIndexThatKeepsWorking) {
+    const int n = 3000;
+    for (int i = 0; i < n; i++) host_file("many/file_" + std::to_string(i), i % 7 * 700);
+    import();
+
+    long dir = path_lookup("/many");
+    ASSERT_NE(dir, -1);
+    Inode in = inode_of((uint32_t)dir);
+    EXPECT_NE(in.flags & INODE_INDEX, 0u);
+    for (int i = 0; i < n; i += 97) expect_file("many/file_" + std::to_string(i), i % 7 * 700);
+
+    // the built index takes adds, splits and removes like one that grew entry by entry
+    int file = create_inode(IREG | IRUSR | IWUSR);
+    ASSERT_GE(file, 0);
+    for (int i = 0; i < 2000; i++) ASSERT_NE(dir_add((uint32_t)dir, ("added_" + std::to_string(i)).c_str(), file, IREG), -1) << i;
+    for (int i = 0; i < n; i += 2) ASSERT_NE(dir_remove((uint32_t)dir, ("file_" + std::to_string(i)).c_str()), -1) << i;
+
+    remount();
+    std::vector<std::string> names;
+    dir_iterate((uint32_t)dir, collect, &names);
+    std::set<std::string> unique(names.begin(), names.end());
+    EXPECT_EQ(names.size(), (size_t)(2 + n / 2 + 2000));
+    EXPECT_EQ(unique.size(), names.size());
+    EXPECT_EQ(dir_lookup((uint32_t)dir, "file_1"), path_lookup("/many/file_1"));
+    EXPECT_EQ(dir_lookup((uint32_t)dir, "file_2"), -1);
+    EXPECT_EQ(dir_lookup((uint32_t)dir, "added_1999"), file);
+}
+
+TEST_P(ImportTest, SmallFilesOfADirLieBackToBack) {
+    for (int i = 0; i < 50; i++) host_file("d/f" + std::to_string(100 + i), 2 * BLOCK_SIZE - 10);
+    import();
+
+    // one run for all of them, in name order
+    long prev = -1;
+    for (int i = 0; i < 50; i++) {
+        long inum = path_lookup(("/d/f" + std::to_string(100 + i)).c_str());
+        ASSERT_NE(inum, -1);
+        Inode in = inode_of((uint32_t)inum);
+        long block = (in.flags & INODE_EXTENTS) ? ext_map(&in, 0, nullptr) : (long)in.direct[0];
+        if (prev != -1) {
+            EXPECT_EQ(block, prev + 2) << i;
+        }
+        prev = block;
+    }
+}
+
+TEST_P(ImportTest, SameTreeGivesTheSameImage) {
+    // dirs of very different sizes, the scan workers finish them in no particular order
+    for (int d = 0; d < 12; d++) {
+        for (int s = 0; s < 3; s++) {
+            std::string dir = "d" + std::to_string(d) + "/s" + std::to_string(s);
+            for (int f = 0; f < (d % 4) * 40 + s; f++) host_file(dir + "/f" + std::to_string(f), (size_t)f * 700);
+            host_dir(dir + "/empty");
+        }
+    }
+
+    // inode and first block of every path, in the order the tree is walked
+    auto layout = [&]() {
+        std::vector<long> out;
+        for (int d = 0; d < 12; d++) {
+            for (int s = 0; s < 3; s++) {
+                std::string dir = "/d" + std::to_string(d) + "/s" + std::to_string(s);
+                out.push_back(path_lookup(dir.c_str()));
+                out.push_back(path_lookup((dir + "/empty").c_str()));
+                for (int f = 0; f < (d % 4) * 40 + s; f++) {
+                    long inum = path_lookup((dir + "/f" + std::to_string(f)).c_str());
+                    Inode in = inode_of((uint32_t)inum);
+                    out.push_back(inum);
+                    out.push_back((in.flags & INODE_EXTENTS) ? ext_map(&in, 0, nullptr) : (long)in.direct[0]);
+                }
+            }
+        }
+        return out;
+    };
+
+    import();
+    std::vector<long> first = layout();
+    for (int round = 0; round < 3; round++) {
+        unmount_disk();
+        import();
+        EXPECT_EQ(layout(), first) << round;
+    }
+}
+
+TEST_P(ImportTest, ImageIsSizedForTheTree) {
+    const int n = 2500;
+    for (int i = 0; i < n; i++) host_file("d" + std::to_string(i % 10) + "/" + std::to_string(i), 40);
+    import();
+
+    // every host file got an inode with some to spare, and the image can still grow
+    EXPECT_EQ(stats.files, (uint64_t)n);
+    EXPECT_GE(fs.sb.total_inodes, (uint32_t)n + 11);
+    EXPECT_GT(fs.sb.free_inodes, 0u);
+    EXPECT_GT(fs.sb.free_blocks, 0u);
+    EXPECT_EQ(fs.sb.total_blocks, stats.image_blocks);
+    EXPECT_EQ(fs.sb.total_inodes - fs.sb.free_inodes, (uint32_t)n + 11);
+    expect_file("d3/2493", 40);
+
+    // the image stays a normal one to write to
+    long dir = path_lookup("/d3");
+    ASSERT_NE(dir, -1);
+    int file = create_inode(IREG | IRUSR | IWUSR);
+    ASSERT_GE(file, 0);
+    EXPECT_NE(dir_add((uint32_t)dir, "more", file, IREG), -1);
+    EXPECT_EQ(fs_write(file, 0, "abc", 3), 3);
+}
+
+TEST_P(ImportTest, MissingTreeFails) {
+    EXPECT_EQ(fs_import("import_test_no_such_dir", IMAGE, &opts, &stats), -1);
+    host_file("plain", 10);
+    EXPECT_EQ(fs_import((stdfs::path(TREE) / "plain").c_str(), IMAGE, &opts, &stats), -1);
+}
+
+INSTANTIATE_TEST_SUITE_P(Mappings, ImportTest,
+                         ::testing::Combine(::testing::Values(1, 0), ::testing::Values(1, 0)),
+                         [](const ::testing::TestParamInfo<std::tuple<int, int>> &info) {
+                             return std::string(std::get<0>(info.param) ? "Extents" : "Classic") +
+                                    (std::get<1>(info.param) ? "Inline" : "Blocks");
+                         });
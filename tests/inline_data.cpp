@@ -0,0 +1,213 @@
+// inline_data.cpp
+// GoogleTest tests for directories and files kept in the inode's pointer area (INODE_INLINE),
+// run against the real fs_core with both block mappings.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#define mkdir dir_mkdir
+#include "Directories.h"
+#undef mkdir
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+int fs_truncate(uint32_t inum, uint64_t size);
+}
+
+static const char *IMAGE = "inline_test.bin";
+
+class InlineDataTest : public ::testing::TestWithParam<int> {
+protected:
+    void SetUp() override {
+        format(1);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    void format(int inline_data) {
+        unmount_disk();
+        FsOptions opts;
+        fs_default_options(&opts);
+        opts.extents = GetParam();
+        opts.inline_data = inline_data;
+        ASSERT_EQ(format_disk_opts(IMAGE, 4096, &opts), 0);
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+    }
+
+    static Inode inode_of(uint32_t inum) {
+        Inode inode;
+        read_inode(inum, &inode);
+        return inode;
+    }
+
+    static int collect(const DirEntry *entry, void *arg) {
+        static_cast<std::vector<std::string> *>(arg)->push_back(entry->name);
+        return 0;
+    }
+
+    static std::vector<std::string> names(uint32_t dir) {
+        std::vector<std::string> out;
+        dir_iterate(dir, collect, &out);
+        return out;
+    }
+
+    void remount() {
+        FsOptions opts;
+        fs_default_options(&opts);
+        unmount_disk();
+        ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+    }
+};
+
+TEST_P(InlineDataTest, EmptyDirTakesNoBlock) {
+    uint32_t before = fs.sb.free_blocks;
+    int dir = make_dir(fs.sb.root_inode, "empty");
+    ASSERT_GE(dir, 0);
+    EXPECT_EQ(fs.sb.free_blocks, before);
+    EXPECT_TRUE(inode_of(dir).flags & INODE_INLINE);
+
+    EXPECT_EQ(dir_lookup(dir, "."), dir);
+    EXPECT_EQ(dir_lookup(dir, ".."), (long)fs.sb.root_inode);
+    EXPECT_EQ(dir_lookup(dir, "missing"), -1);
+    EXPECT_EQ(names(dir), (std::vector<std::string>{".", ".."}));
+    EXPECT_EQ(inode_of(dir).links_count, 2u); // its "." and its name in the root
+
+    remount();
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "empty"), dir);
+    EXPECT_EQ(dir_lookup(dir, ".."), (long)fs.sb.root_inode);
+}
+
+TEST_P(InlineDataTest, DirMovesToABlockOnceItOutgrowsTheInode) {
+    int dir = make_dir(fs.sb.root_inode, "d");
+    ASSERT_GE(dir, 0);
+    uint32_t before = fs.sb.free_blocks;
+
+    std::vector<std::string> expected = {".", ".."};
+    for (int i = 0; i < 20; i++) {
+        expected.push_back("e" + std::to_string(i));
+        ASSERT_GE(make_file(dir, expected.back()), 0);
+    }
+    Inode inode = inode_of(dir);
+    EXPECT_FALSE(inode.flags & INODE_INLINE);
+    EXPECT_EQ(fs.sb.free_blocks, before - 1);
+    EXPECT_EQ(inode.size, (uint64_t)BLOCK_SIZE);
+    EXPECT_EQ(names(dir), expected);
+
+    remount();
+    EXPECT_EQ(names(dir), expected);
+    EXPECT_EQ(dir_lookup(dir, ".."), (long)fs.sb.root_inode);
+    EXPECT_EQ(dir_lookup(dir, "."), dir);
+}
+
+TEST_P(InlineDataTest, SmallFileStaysInTheInode) {
+    int file = make_file(fs.sb.root_inode, "f");
+    ASSERT_GE(file, 0);
+    uint32_t before = fs.sb.free_blocks;
+
+    const char text[] = "hello, inline world";
+    ASSERT_EQ(fs_write(file, 3, text, sizeof(text)), (long)sizeof(text));
+    EXPECT_EQ(fs.sb.free_blocks, before);
+    EXPECT_TRUE(inode_of(file).flags & INODE_INLINE);
+
+    remount();
+    std::vector<char> back(3 + sizeof(text), 'x');
+    ASSERT_EQ(fs_read(file, 0, back.data(), back.size()), (long)back.size());
+    EXPECT_EQ(std::string(back.data(), 3), std::string(3, '\0'));
+    EXPECT_STREQ(back.data() + 3, text);
+}
+
+TEST_P(InlineDataTest, FileMovesOutWhenItGrows) {
+    int file = make_file(fs.sb.root_inode, "f");
+    ASSERT_GE(file, 0);
+    std::vector<uint8_t> data(2 * BLOCK_SIZE + 10);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 7 + 1);
+
+    ASSERT_EQ(fs_write(file, 0, data.data(), 40), 40);
+    ASSERT_TRUE(inode_of(file).flags & INODE_INLINE);
+    ASSERT_EQ(fs_write(file, 40, data.data() + 40, data.size() - 40), (long)(data.size() - 40));
+
+    Inode inode = inode_of(file);
+    EXPECT_FALSE(inode.flags & INODE_INLINE);
+    EXPECT_EQ(!!(inode.flags & INODE_EXTENTS), GetParam());
+    EXPECT_EQ(inode.size, data.size());
+
+    remount();
+    std::vector<uint8_t> back(data.size());
+    ASSERT_EQ(fs_read(file, 0, back.data(), back.size()), (long)back.size());
+    EXPECT_EQ(back, data);
+}
+
+TEST_P(InlineDataTest, TruncateKeepsInlineBytesConsistent) {
+    int file = make_file(fs.sb.root_inode, "f");
+    ASSERT_GE(file, 0);
+    const char text[] = "0123456789";
+    ASSERT_EQ(fs_write(file, 0, text, 10), 10);
+
+    // shrinking and growing again inside the inode reads zeros past the cut
+    ASSERT_EQ(fs_truncate(file, 4), 0);
+    ASSERT_EQ(fs_truncate(file, 8), 0);
+    char back[8];
+    ASSERT_EQ(fs_read(file, 0, back, sizeof(back)), 8);
+    EXPECT_EQ(std::memcmp(back, "0123\0\0\0\0", 8), 0);
+
+    // growing past the inode moves the bytes to a block
+    ASSERT_EQ(fs_truncate(file, 3 * BLOCK_SIZE), 0);
+    EXPECT_FALSE(inode_of(file).flags & INODE_INLINE);
+    std::vector<uint8_t> all(3 * BLOCK_SIZE, 0xFF);
+    ASSERT_EQ(fs_read(file, 0, all.data(), all.size()), (long)all.size());
+    EXPECT_EQ(std::memcmp(all.data(), "0123", 4), 0);
+    for (size_t i = 4; i < all.size(); i++) ASSERT_EQ(all[i], 0) << i;
+}
+
+TEST_P(InlineDataTest, FilesWithBlocksNeverGoInline) {
+    int file = make_file(fs.sb.root_inode, "f");
+    ASSERT_GE(file, 0);
+    ASSERT_GE(alloc_direct_inode_block(file), 0); // mapped but still empty
+    ASSERT_EQ(fs_write(file, 0, "x", 1), 1);
+    EXPECT_FALSE(inode_of(file).flags & INODE_INLINE);
+}
+
+TEST_P(InlineDataTest, CanBeTurnedOff) {
+    format(0);
+    EXPECT_FALSE(fs.sb.features & FEATURE_INLINE_DATA);
+    uint32_t before = fs.sb.free_blocks;
+    int dir = make_dir(fs.sb.root_inode, "d");
+    int file = make_file(fs.sb.root_inode, "f");
+    ASSERT_GE(dir, 0);
+    ASSERT_GE(file, 0);
+    ASSERT_EQ(fs_write(file, 0, "x", 1), 1);
+
+    EXPECT_FALSE(inode_of(dir).flags & INODE_INLINE);
+    EXPECT_FALSE(inode_of(file).flags & INODE_INLINE);
+    EXPECT_LT(fs.sb.free_blocks, before - 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(Mappings, InlineDataTest, ::testing::Values(0, 1),
+                         [](const ::testing::TestParamInfo<int> &info) {
+                             return info.param ? "Extents" : "Classic";
+                         });
@@ -0,0 +1,187 @@
+// inode_cache.cpp
+// GoogleTest tests for the in-core inode table in InodeCache.c, run against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+#include "InodeCache.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+long dir_add(uint32_t dir_inum, const char *name, uint32_t child_inum, uint16_t type);
+int create_dir(uint16_t mode);
+}
+
+static const char *IMAGE = "icache_test.bin";
+
+class InodeCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        format_disk(IMAGE, 64);
+        ASSERT_NE(fs.dev, nullptr);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    // writes everything back and empties both caches
+    void go_cold() {
+        fs_sync();
+        ASSERT_EQ(icache_init(0), 0);
+        ASSERT_EQ(cache_init(0), 0);
+    }
+};
+
+TEST_F(InodeCacheTest, SecondIgetIsHit) {
+    go_cold();
+
+    InodeHandle *a = iget(fs.sb.root_inode);
+    ASSERT_NE(a, nullptr);
+    InodeHandle *b = iget(fs.sb.root_inode);
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a->refs, 2u);
+    iput(b);
+    iput(a);
+
+    ICacheStats st;
+    icache_stats(&st);
+    EXPECT_EQ(st.misses, 1u);
+    EXPECT_EQ(st.hits, 1u);
+}
+
+TEST_F(InodeCacheTest, ColdDirAddReadsEachInodeOnce) {
+    int child = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    ASSERT_GE(child, 0);
+    go_cold();
+
+    ASSERT_NE(dir_add(fs.sb.root_inode, "usr", child, IDIR), -1);
+
+    ICacheStats st;
+    icache_stats(&st);
+    EXPECT_EQ(st.misses, 2u);       // the directory and the child, nothing re-read
+    EXPECT_EQ(st.writebacks, 2u);   // each written once, by the commit
+}
+
+TEST_F(InodeCacheTest, WarmDirAddDoesNotReadInodes) {
+    int a = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    int b = create_dir(IDIR | IRUSR | IWUSR | IXUSR);
+    ASSERT_NE(dir_add(fs.sb.root_inode, "a", a, IDIR), -1);
+
+    ICacheStats before, after;
+    icache_stats(&before);
+    ASSERT_NE(dir_add(fs.sb.root_inode, "b", b, IDIR), -1);
+    icache_stats(&after);
+
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_EQ(after.writebacks - before.writebacks, 2u);
+}
+
+TEST_F(InodeCacheTest, RepeatedChangesWrittenBackOnce) {
+    int inum = create_inode(IREG | IRUSR);
+    ASSERT_GE(inum, 0);
+    fs_sync();
+
+    ICacheStats before, after;
+    icache_stats(&before);
+    for (uint32_t i = 1; i <= 10; i++) {
+        Inode in;
+        read_inode(inum, &in);
+        in.size = i * 100;
+        write_inode(inum, &in);
+    }
+    icache_stats(&after);
+    EXPECT_EQ(after.writebacks, before.writebacks);
+
+    EXPECT_EQ(icache_flush(), 1);
+
+    go_cold();
+    Inode out;
+    read_inode(inum, &out);
+    EXPECT_EQ(out.size, 1000u);
+}
+
+TEST_F(InodeCacheTest, EvictionWritesBackDirtyInodes) {
+    fs_sync();
+    ASSERT_EQ(icache_init(2), 0);
+
+    int inums[6];
+    for (int i = 0; i < 6; i++) {
+        inums[i] = create_inode(IREG | IRUSR);
+        ASSERT_GE(inums[i], 0);
+        Inode in;
+        read_inode(inums[i], &in);
+        in.size = 1000 + i;
+        write_inode(inums[i], &in);
+    }
+
+    ICacheStats st;
+    icache_stats(&st);
+    EXPECT_GT(st.evictions, 0u);
+
+    for (int i = 0; i < 6; i++) {
+        Inode out;
+        read_inode(inums[i], &out);
+        EXPECT_EQ(out.size, 1000u + i);
+    }
+}
+
+TEST_F(InodeCacheTest, ReferencedHandleSurvivesPressure) {
+    fs_sync();
+    ASSERT_EQ(icache_init(2), 0);
+
+    InodeHandle *held = iget(fs.sb.root_inode);
+    ASSERT_NE(held, nullptr);
+    held->inode.size = 4242;
+    idirty(held);
+
+    for (uint32_t i = 10; i < 20; i++) {
+        InodeHandle *other = iget(i);
+        ASSERT_NE(other, nullptr);
+        iput(other);
+    }
+
+    EXPECT_EQ(held->inum, fs.sb.root_inode);
+    EXPECT_EQ(held->inode.size, 4242u);
+    iput(held);
+}
+
+TEST_F(InodeCacheTest, AllReferencedReturnsNull) {
+    fs_sync();
+    ASSERT_EQ(icache_init(2), 0);
+
+    InodeHandle *a = iget(1);
+    InodeHandle *b = iget(2);
+    EXPECT_EQ(iget(3), nullptr);
+    iput(a);
+    iput(b);
+    InodeHandle *c = iget(3);
+    EXPECT_NE(c, nullptr);
+    iput(c);
+}
+
+TEST_F(InodeCacheTest, FullCacheGivesTheNewInodeBack) {
+    fs_sync();
+    ASSERT_EQ(icache_init(2), 0);
+    uint32_t free_inodes = fs.sb.free_inodes;
+    uint32_t group_free = fs.groups[0].free_inodes;
+
+    // no slot for the new inode, the one allocated for it is released again
+    InodeHandle *a = iget(fs.sb.root_inode);
+    InodeHandle *b = iget(fs.sb.total_inodes - 1);
+    EXPECT_EQ(create_inode(IREG | IRUSR | IWUSR), -1);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes);
+    EXPECT_EQ(fs.groups[0].free_inodes, group_free);
+    iput(a);
+    iput(b);
+
+    int inum = create_inode(IREG | IRUSR | IWUSR);
+    EXPECT_GE(inum, 0);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes - 1);
+}
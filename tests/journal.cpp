@@ -0,0 +1,206 @@
+// journal.cpp
+// GoogleTest tests for the metadata journal in Journal.c, run against the real fs_core.
+//
+// A crash is simulated by copying the image while blocks are logged but not yet checkpointed.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+#include "Journal.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+}
+
+static const char *IMAGE = "journal_test.bin";
+static const char *CRASHED = "journal_crashed.bin";
+
+class JournalTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        format_disk(IMAGE, 512);
+        ASSERT_NE(fs.dev, nullptr);
+        fs_sync();
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+        std::remove(CRASHED);
+    }
+
+    int mkdir_root(const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(fs.sb.root_inode, &copy[0]);
+    }
+
+    // image as it would be found after power loss right now
+    static void crash_copy() {
+        std::ifstream in(IMAGE, std::ios::binary);
+        std::ofstream out(CRASHED, std::ios::binary);
+        out << in.rdbuf();
+    }
+
+    static void patch(const char *image, uint64_t offset, uint8_t value) {
+        FILE *f = std::fopen(image, "rb+");
+        std::fseek(f, (long)offset, SEEK_SET);
+        std::fputc(value, f);
+        std::fclose(f);
+    }
+
+    static std::vector<uint8_t> raw_block(const char *image, uint32_t bnum) {
+        std::vector<uint8_t> out(BLOCK_SIZE, 0);
+        FILE *f = std::fopen(image, "rb");
+        std::fseek(f, (long)bnum * BLOCK_SIZE, SEEK_SET);
+        std::fread(out.data(), 1, BLOCK_SIZE, f);
+        std::fclose(f);
+        return out;
+    }
+};
+
+TEST_F(JournalTest, FormatReservesJournalAtEnd) {
+    uint32_t blocks = journal_default_blocks(512);
+    EXPECT_EQ(fs.sb.journal_blocks, blocks);
+    EXPECT_EQ(fs.sb.journal_start, 512 - blocks);
+    for (uint32_t b = fs.sb.journal_start; b < 512; b++) EXPECT_TRUE(bitmap_test(&block_bitmap, b)) << b;
+
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.journal_blocks = 600;
+    unmount_disk();
+    EXPECT_EQ(format_disk_opts(IMAGE, 512, &opts), -1);
+}
+
+TEST_F(JournalTest, CommitIsLoggedBeforeHomeBlocks) {
+    std::vector<uint8_t> sb_before = raw_block(IMAGE, 0);
+    JournalStats before, after;
+    journal_stats(&before);
+
+    ASSERT_GE(mkdir_root("home"), 0);
+
+    journal_stats(&after);
+    EXPECT_EQ(after.records - before.records, 1u);
+    EXPECT_GT(after.blocks_logged, before.blocks_logged);
+    EXPECT_GT(after.commit_ns, before.commit_ns);
+    EXPECT_EQ(raw_block(IMAGE, 0), sb_before); // home copy waits for the checkpoint
+
+    fs_sync();
+    EXPECT_NE(raw_block(IMAGE, 0), sb_before);
+}
+
+TEST_F(JournalTest, ReplayRecoversCommittedOperations) {
+    int home = mkdir_root("home");
+    int etc = mkdir_root("etc");
+    ASSERT_GE(home, 0);
+    ASSERT_GE(etc, 0);
+    uint32_t free_inodes = fs.sb.free_inodes;
+    crash_copy();
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(CRASHED), 0);
+
+    JournalStats st;
+    journal_stats(&st);
+    EXPECT_EQ(st.replayed_records, 2u);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "home"), home);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "etc"), etc);
+    EXPECT_TRUE(bitmap_test(&inode_bitmap, etc));
+
+    // replayed and checkpointed, a second mount has nothing left to do
+    unmount_disk();
+    ASSERT_EQ(mount_disk(CRASHED), 0);
+    journal_stats(&st);
+    EXPECT_EQ(st.replayed_records, 0u);
+}
+
+TEST_F(JournalTest, TornRecordIsNotReplayed) {
+    uint32_t free_inodes = fs.sb.free_inodes;
+    ASSERT_GE(mkdir_root("home"), 0);
+    crash_copy();
+
+    // first image of the only record, as if the write never finished
+    uint64_t image_offset = (uint64_t)(fs.sb.journal_start + 2) * BLOCK_SIZE;
+    patch(CRASHED, image_offset + 17, raw_block(CRASHED, fs.sb.journal_start + 2)[17] ^ 0xFF);
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(CRASHED), 0);
+
+    JournalStats st;
+    journal_stats(&st);
+    EXPECT_EQ(st.replayed_records, 0u);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "home"), -1);
+}
+
+TEST_F(JournalTest, GroupCommitSharesOneRecord) {
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.commit_batch = 16;
+    unmount_disk();
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+
+    JournalStats before, after;
+    journal_stats(&before);
+    for (int i = 0; i < 5; i++) ASSERT_GE(mkdir_root("d" + std::to_string(i)), 0);
+
+    journal_stats(&after);
+    EXPECT_EQ(after.records, before.records); // still batched
+
+    EXPECT_GT(journal_flush(), 0);
+    journal_stats(&after);
+    EXPECT_EQ(after.records - before.records, 1u);
+    EXPECT_EQ(after.transactions - before.transactions, 5u);
+    // root dir, inode table, bitmaps and superblock are logged once for the whole batch
+    EXPECT_LT(after.blocks_logged - before.blocks_logged, 5u * 4);
+
+    crash_copy();
+    unmount_disk();
+    ASSERT_EQ(mount_disk(CRASHED), 0);
+    for (int i = 0; i < 5; i++) EXPECT_GE(dir_lookup(fs.sb.root_inode, ("d" + std::to_string(i)).c_str()), 0);
+}
+
+TEST_F(JournalTest, CommitWindowFlushesBatch) {
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.commit_batch = 1000;
+    opts.commit_window_us = 1;
+    unmount_disk();
+    ASSERT_EQ(mount_disk_opts(IMAGE, &opts), 0);
+
+    JournalStats before, after;
+    journal_stats(&before);
+    ASSERT_GE(mkdir_root("a"), 0);
+    ASSERT_GE(mkdir_root("b"), 0);
+    journal_stats(&after);
+    EXPECT_GE(after.records - before.records, 1u);
+}
+
+TEST_F(JournalTest, FullJournalIsCheckpointedAndReused) {
+    unmount_disk();
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.journal_blocks = JOURNAL_MIN_BLOCKS;
+    ASSERT_EQ(format_disk_opts(IMAGE, 512, &opts), 0);
+
+    for (int i = 0; i < 30; i++) ASSERT_GE(mkdir_root("d" + std::to_string(i)), 0) << i;
+
+    JournalStats st;
+    journal_stats(&st);
+    EXPECT_GT(st.checkpoints, 0u);
+    EXPECT_GE(st.bytes_written, (st.blocks_logged + 2 * st.records) * BLOCK_SIZE);
+
+    crash_copy();
+    unmount_disk();
+    ASSERT_EQ(mount_disk(CRASHED), 0);
+    for (int i = 0; i < 30; i++) EXPECT_GE(dir_lookup(fs.sb.root_inode, ("d" + std::to_string(i)).c_str()), 0) << i;
+}
@@ -0,0 +1,200 @@
+// layout.cpp
+// GoogleTest tests for the on-disk geometry format_disk computes, run against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+}
+
+static const char *IMAGE = "layout_test.bin";
+
+class LayoutTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    void format(uint32_t num_blocks, uint32_t inode_ratio = DEFAULT_INODE_RATIO, int lazy_init = 1) {
+        FsOptions opts;
+        fs_default_options(&opts);
+        opts.inode_ratio = inode_ratio;
+        opts.lazy_init = lazy_init;
+        ASSERT_EQ(format_disk_opts(IMAGE, num_blocks, &opts), 0);
+    }
+};
+
+TEST_F(LayoutTest, RegionsFollowEachOtherWithoutOverlap) {
+    format(4096);
+    const Superblock &sb = fs.sb;
+
+    EXPECT_EQ(sb.groups_count, 1u);
+    EXPECT_EQ(sb.block_bitmap_start, 1 + sb.group_desc_blocks);
+    EXPECT_EQ(sb.inode_bitmap_start, sb.block_bitmap_start + 1);
+    EXPECT_EQ(sb.inode_start, sb.inode_bitmap_start + 1);
+    EXPECT_EQ(sb.data_block_start, sb.inode_start + sb.inode_table_blocks);
+    EXPECT_LE(sb.data_block_start, sb.journal_start);
+
+    EXPECT_EQ(sb.total_inodes, sb.inodes_per_group * sb.groups_count);
+    EXPECT_LE(sb.inodes_per_group, sb.inode_table_blocks * INODES_PER_BLOCK);
+    EXPECT_GE(sb.total_inodes, 4096u * BLOCK_SIZE / DEFAULT_INODE_RATIO);
+    EXPECT_EQ(sb.free_blocks, sb.total_blocks - sb.data_block_start - sb.journal_blocks); // root is inline
+    EXPECT_EQ(fs.groups[0].free_blocks, sb.free_blocks);
+
+    for (uint32_t b = 0; b < sb.data_block_start; b++) EXPECT_TRUE(bitmap_test(&block_bitmap, b)) << b;
+}
+
+TEST_F(LayoutTest, InodeRatioSizesTheTable) {
+    format(4096, 4096);
+    EXPECT_EQ(fs.sb.inodes_per_group % 8, 0u);
+    uint32_t dense = fs.sb.total_inodes;
+    uint32_t dense_table = fs.sb.inode_table_blocks;
+    unmount_disk();
+
+    format(4096, 65536);
+    EXPECT_GT(dense, fs.sb.total_inodes);
+    EXPECT_GT(dense_table, fs.sb.inode_table_blocks);
+    EXPECT_GE(dense, 4096u);
+}
+
+TEST_F(LayoutTest, LastInodeStaysInsideTheTable) {
+    format(1024);
+    std::vector<uint8_t> pattern(BLOCK_SIZE, 0x5A);
+    write_block(fs.sb.data_block_start + 1, pattern.data());
+
+    Inode last;
+    std::memset(&last, 0, sizeof(Inode));
+    last.mode = IREG | IRUSR;
+    last.size = 12345;
+    uint32_t inum = fs.sb.total_inodes - 1;
+    ASSERT_EQ(write_inode(inum, &last), 0);
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+
+    Inode back;
+    ASSERT_EQ(read_inode(inum, &back), 0);
+    EXPECT_EQ(back.size, 12345u);
+
+    std::vector<uint8_t> data(BLOCK_SIZE);
+    read_block(fs.sb.data_block_start + 1, data.data());
+    EXPECT_EQ(data, pattern);
+}
+
+TEST_F(LayoutTest, ImagesPastFourGiBSpanManyGroups) {
+    const uint32_t blocks = 2u * 1024 * 1024; // 8 GiB, sparse
+    format(blocks, 1024 * 1024);
+    EXPECT_EQ(fs.sb.groups_count, blocks / BITS_PER_BLOCK);
+
+    // a block past the 4 GiB mark and past the first bitmap block
+    uint32_t far = fs.sb.journal_start - 1;
+    ASSERT_GT((uint64_t)far * BLOCK_SIZE, 1ull << 32);
+    std::vector<uint8_t> pattern(BLOCK_SIZE, 0xC3);
+    write_block(far, pattern.data());
+    update_block_bitmap(far, USED);
+    group_adjust(group_of_block(far), -1, 0, 0);
+
+    char name[] = "deep";
+    int child = fs_mkdir(fs.sb.root_inode, name);
+    ASSERT_GE(child, 0);
+    uint32_t free_blocks = fs.sb.free_blocks;
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    EXPECT_EQ(fs.sb.free_blocks, free_blocks);
+    EXPECT_TRUE(bitmap_test(&block_bitmap, far));
+    EXPECT_FALSE(bitmap_test(&block_bitmap, far - 1));
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "deep"), child);
+
+    std::vector<uint8_t> data(BLOCK_SIZE);
+    read_block(far, data.data());
+    EXPECT_EQ(data, pattern);
+}
+
+TEST_F(LayoutTest, TooSmallImageIsRejected) {
+    FsOptions opts;
+    fs_default_options(&opts);
+    opts.journal = 0;
+    // superblock, descriptors, two bitmaps, one inode table block, root dir block
+    EXPECT_EQ(format_disk_opts(IMAGE, 5, &opts), -1);
+    EXPECT_EQ(format_disk_opts(IMAGE, 6, &opts), 0);
+}
+
+TEST_F(LayoutTest, LazyFormatOfAHugeImageStaysSparse) {
+    const uint32_t blocks = 25u * 1024 * 1024; // 100 GiB
+    auto start = std::chrono::steady_clock::now();
+    format(blocks);
+    auto took = std::chrono::steady_clock::now() - start;
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(took).count(), 2000);
+    EXPECT_TRUE(fs.sb.features & FEATURE_LAZY_ITABLE);
+
+    // bitmaps, descriptors and the root, nothing of the inode tables or the journal
+    struct stat st;
+    ASSERT_EQ(stat(IMAGE, &st), 0);
+    EXPECT_LT((uint64_t)st.st_blocks * 512, 16ull << 20);
+
+    char name[] = "big";
+    int child = fs_mkdir(fs.sb.root_inode, name);
+    ASSERT_GE(child, 0);
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "big"), child);
+}
+
+TEST_F(LayoutTest, LazyInodeTableIsZeroedOnFirstUse) {
+    format(4096);
+    const GroupDesc &gd = fs.groups[0];
+    ASSERT_EQ(gd.itable_zeroed, 1u); // just the root's block
+    ASSERT_GT(fs.sb.inode_table_blocks, 2u);
+
+    // stale bytes from whatever the image held before
+    std::vector<uint8_t> junk(BLOCK_SIZE, 0xEE);
+    write_block(gd.inode_table + 1, junk.data());
+
+    std::vector<int> files;
+    while (files.empty() || (uint32_t)files.back() < INODES_PER_BLOCK) {
+        std::string name = "f" + std::to_string(files.size());
+        files.push_back(fs_creat(fs.sb.root_inode, &name[0], IREG | IRUSR | IWUSR));
+        ASSERT_GE(files.back(), 0);
+    }
+    EXPECT_EQ(gd.itable_zeroed, 2u);
+
+    // the next inode of the freshly zeroed block is still free and reads back empty
+    Inode next, zero;
+    std::memset(&zero, 0, sizeof(Inode));
+    ASSERT_EQ(read_inode((uint32_t)files.back() + 1, &next), 0);
+    EXPECT_EQ(std::memcmp(&next, &zero, sizeof(Inode)), 0);
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    EXPECT_EQ(fs.groups[0].itable_zeroed, 2u);
+    for (size_t i = 0; i < files.size(); i++) {
+        EXPECT_EQ(dir_lookup(fs.sb.root_inode, ("f" + std::to_string(i)).c_str()), files[i]);
+    }
+}
+
+TEST_F(LayoutTest, FullFormatZeroesEveryTable) {
+    format(3 * BITS_PER_BLOCK, DEFAULT_INODE_RATIO, 0);
+    EXPECT_FALSE(fs.sb.features & FEATURE_LAZY_ITABLE);
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) EXPECT_EQ(fs.groups[g].itable_zeroed, fs.sb.inode_table_blocks);
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    for (uint32_t g = 0; g < fs.sb.groups_count; g++) EXPECT_EQ(fs.groups[g].itable_zeroed, fs.sb.inode_table_blocks);
+}
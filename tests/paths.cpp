@@ -0,0 +1,213 @@
+// paths.cpp
+// GoogleTest tests for path resolution in Paths.c and the dentry cache behind it,
+// run against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "Cache.h"
+#include "InodeCache.h"
+#include "Paths.h"
+
+// DentryCache.h pulls in Directories.h, whose mkdir clashes with the libc prototype
+#define mkdir fs_mkdir
+#include "DentryCache.h"
+#undef mkdir
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+}
+
+static const char *IMAGE = "paths_test.bin";
+
+class PathsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        format_disk(IMAGE, 4096);
+        root = fs.sb.root_inode;
+
+        // /usr/local/lib/deep and /usr/local/lib/file
+        usr = make_dir(root, "usr");
+        local = make_dir(usr, "local");
+        lib = make_dir(local, "lib");
+        deep = make_dir(lib, "deep");
+        file = make_file(lib, "file");
+        ASSERT_GE(deep, 0);
+        ASSERT_GE(file, 0);
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    static int make_dir(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static int make_file(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_creat(parent, &copy[0], IREG | IRUSR | IWUSR);
+    }
+
+    uint32_t root = 0;
+    int usr = -1, local = -1, lib = -1, deep = -1, file = -1;
+};
+
+TEST_F(PathsTest, AbsolutePaths) {
+    EXPECT_EQ(path_resolve(root, "/"), root);
+    EXPECT_EQ(path_resolve(root, "/usr"), usr);
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/deep"), deep);
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/file"), file);
+    EXPECT_EQ(path_resolve(lib, "/usr/local"), local); // cwd doesn't matter
+    EXPECT_EQ(path_resolve(root, "//usr///local/"), local);
+}
+
+TEST_F(PathsTest, RelativeAndDotComponents) {
+    EXPECT_EQ(path_resolve(local, "lib/deep"), deep);
+    EXPECT_EQ(path_resolve(local, "./lib/./deep/."), deep);
+    EXPECT_EQ(path_resolve(deep, ".."), lib);
+    EXPECT_EQ(path_resolve(deep, "../../.."), usr);
+    EXPECT_EQ(path_resolve(deep, "../file"), file);
+    EXPECT_EQ(path_resolve(root, "/.."), root); // the root is its own parent
+    EXPECT_EQ(path_resolve(root, "usr/local/lib/deep/../../lib/file"), file);
+}
+
+TEST_F(PathsTest, Failures) {
+    EXPECT_EQ(path_resolve(root, ""), -1);
+    EXPECT_EQ(path_resolve(root, "/nope"), -1);
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/file/x"), -1); // file is not a directory
+    std::string too_long = "/usr/" + std::string(NAME_MAX, 'a');
+    EXPECT_EQ(path_resolve(root, too_long.c_str()), -1);
+}
+
+TEST_F(PathsTest, WorkingDirectory) {
+    EXPECT_EQ(path_cwd(), root);
+    ASSERT_EQ(path_chdir("/usr/local"), 0);
+    EXPECT_EQ(path_cwd(), (uint32_t)local);
+    EXPECT_EQ(path_lookup("lib/file"), file);
+
+    ASSERT_EQ(path_chdir("lib/deep"), 0);
+    EXPECT_EQ(path_cwd(), (uint32_t)deep);
+    EXPECT_EQ(path_chdir("../file"), -1); // not a directory
+    EXPECT_EQ(path_chdir("missing"), -1);
+    EXPECT_EQ(path_cwd(), (uint32_t)deep);
+
+    ASSERT_EQ(path_chdir(".."), 0);
+    EXPECT_EQ(path_cwd(), (uint32_t)lib);
+
+    // a remount starts back at the root
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    EXPECT_EQ(path_cwd(), root);
+}
+
+TEST_F(PathsTest, ParentAndLastComponent) {
+    char name[NAME_MAX];
+    EXPECT_EQ(path_resolve_parent(root, "/usr/local/lib/newfile", name), lib);
+    EXPECT_STREQ(name, "newfile");
+    EXPECT_EQ(path_resolve_parent(local, "lib/deep/", name), lib);
+    EXPECT_STREQ(name, "deep");
+    EXPECT_EQ(path_resolve_parent(deep, "plain", name), deep);
+    EXPECT_STREQ(name, "plain");
+
+    EXPECT_EQ(path_resolve_parent(root, "/", name), -1);
+    EXPECT_EQ(path_resolve_parent(root, "/usr/..", name), -1);
+    EXPECT_EQ(path_resolve_parent(root, "/nope/x", name), -1);
+    EXPECT_EQ(path_resolve_parent(root, "/usr/local/lib/file/x", name), -1);
+}
+
+TEST_F(PathsTest, CachedDeepPathTouchesNoBlocksOrInodes) {
+    ASSERT_EQ(path_resolve(root, "/usr/local/lib/deep"), deep);
+
+    // everything after the first walk is answered by the dentry cache alone
+    CacheStats before;
+    ICacheStats ibefore;
+    DCacheStats dbefore;
+    cache_stats(&before);
+    icache_stats(&ibefore);
+    dcache_stats(&dbefore);
+
+    for (int i = 0; i < 100; i++) ASSERT_EQ(path_resolve(root, "/usr/local/lib/deep"), deep);
+
+    CacheStats after;
+    ICacheStats iafter;
+    DCacheStats dafter;
+    cache_stats(&after);
+    icache_stats(&iafter);
+    dcache_stats(&dafter);
+    EXPECT_EQ(after.hits + after.misses, before.hits + before.misses);
+    EXPECT_EQ(iafter.hits + iafter.misses, ibefore.hits + ibefore.misses);
+    EXPECT_EQ(dafter.misses, dbefore.misses);
+    EXPECT_EQ(dafter.hits - dbefore.hits, 400u);
+}
+
+TEST_F(PathsTest, NegativeEntriesAreCachedAndReplacedOnAdd) {
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/later"), -1);
+
+    DCacheStats before;
+    dcache_stats(&before);
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/later"), -1);
+    DCacheStats after;
+    dcache_stats(&after);
+    EXPECT_EQ(after.negative_hits - before.negative_hits, 1u);
+    EXPECT_EQ(after.misses, before.misses);
+
+    // dir_add replaces the negative entry, no stale "absent"
+    int later = make_file(lib, "later");
+    ASSERT_GE(later, 0);
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/later"), later);
+
+    int sub = make_dir(lib, "sub");
+    ASSERT_GE(sub, 0);
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/sub/.."), lib);
+}
+
+TEST_F(PathsTest, LateAddCachesNoRemovedName) {
+    int gone = make_file(lib, "gone");
+    ASSERT_GE(gone, 0);
+
+    // an unlink that finished between dir_add's change and its dcache_add
+    ASSERT_EQ(dir_remove(lib, "gone"), gone);
+    dcache_add(lib, "gone");
+    EXPECT_EQ(path_resolve(root, "/usr/local/lib/gone"), -1);
+    EXPECT_EQ(dcache_lookup(lib, "gone", nullptr), -1);
+}
+
+TEST_F(PathsTest, InvalidateSendsTheNextLookupToTheDirectory) {
+    ASSERT_EQ(path_resolve(root, "/usr/local"), local);
+    dcache_invalidate(usr, "local");
+
+    DCacheStats before;
+    dcache_stats(&before);
+    EXPECT_EQ(path_resolve(root, "/usr/local"), local);
+    DCacheStats after;
+    dcache_stats(&after);
+    EXPECT_EQ(after.misses - before.misses, 1u);
+}
+
+TEST_F(PathsTest, SmallBudgetEvictsButStaysCorrect) {
+    ASSERT_EQ(dcache_init(8), 0);
+
+    std::vector<int> dirs;
+    for (int i = 0; i < 40; i++) {
+        int d = make_dir(lib, "d" + std::to_string(i));
+        ASSERT_GE(d, 0);
+        dirs.push_back(d);
+    }
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 40; i++) {
+            EXPECT_EQ(path_resolve(root, ("/usr/local/lib/d" + std::to_string(i)).c_str()), dirs[i]);
+        }
+    }
+
+    DCacheStats stats;
+    dcache_stats(&stats);
+    EXPECT_GT(stats.evictions, 0u);
+}
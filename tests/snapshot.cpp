@@ -0,0 +1,303 @@
+// snapshot.cpp
+// GoogleTest tests for the copy-on-write image snapshots in Snapshot.c, run against the real
+// fs_core with and without a journal. A snapshot's contents are checked by exporting it and
+// mounting the export.
+//
+// Directories.h declares mkdir() which clashes with the libc prototype pulled in by gtest,
+// so it is renamed while the header is included.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Extents.h"
+#include "Paths.h"
+#include "Snapshot.h"
+#define mkdir dir_mkdir
+#include "DirIndex.h"
+#undef mkdir
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+int fs_truncate(uint32_t inum, uint64_t size);
+int fs_unlink(uint32_t parent, char *name);
+}
+
+static const char *IMAGE = "snapshot_test.bin";
+static const char *EXPORT = "snapshot_test_export.bin";
+
+class SnapshotTest : public ::testing::TestWithParam<int> {
+protected:
+    FsOptions opts;
+
+    void SetUp() override {
+        fs_default_options(&opts);
+        opts.journal = GetParam();
+        ASSERT_EQ(format_disk_opts(IMAGE, 8192, &opts), 0);
+        path_reset();
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+        std::remove(EXPORT);
+    }
+
+    void remount(const char *image = IMAGE) {
+        unmount_disk();
+        ASSERT_EQ(mount_disk_opts(image, &opts), 0);
+        path_reset();
+    }
+
+    // bytes that differ per seed and per offset
+    static std::string contents(const std::string &seed, size_t len) {
+        std::string data(len, '\0');
+        uint32_t h = 2166136261u;
+        for (char c : seed) h = (h ^ (unsigned char)c) * 16777619u;
+        for (size_t i = 0; i < len; i++) {
+            h = h * 1103515245u + 12345u;
+            data[i] = (char)(h >> 16);
+        }
+        return data;
+    }
+
+    static long make_file(const std::string &name, const std::string &data) {
+        std::string copy = name;
+        int inum = fs_creat(fs.sb.root_inode, &copy[0], IREG | IRUSR | IWUSR);
+        if (inum < 0) return -1;
+        if (fs_write((uint32_t)inum, 0, data.data(), data.size()) != (long)data.size()) return -1;
+        return inum;
+    }
+
+    static std::string read_file(const std::string &path) {
+        long inum = path_lookup(path.c_str());
+        if (inum == -1) return "<missing>";
+        Inode in;
+        read_inode((uint32_t)inum, &in);
+        std::string data(in.size, '\0');
+        if (fs_read((uint32_t)inum, 0, &data[0], in.size) != (long)in.size) return "<unreadable>";
+        return data;
+    }
+
+    // what path holds in snapshot id, read from a mounted export of it
+    std::string snapshot_file(int id, const std::string &path) {
+        EXPECT_EQ(fs_snapshot_export((uint32_t)id, EXPORT), 0);
+        remount(EXPORT);
+        std::string data = read_file(path);
+        remount();
+        return data;
+    }
+};
+
+TEST_P(SnapshotTest, OldContentsSurviveOverwriteTruncateAndUnlink) {
+    std::string big = contents("big", 40 * BLOCK_SIZE + 100);
+    std::string part = contents("part", 3 * BLOCK_SIZE);
+    std::string gone = contents("gone", 5 * BLOCK_SIZE);
+    long big_inum = make_file("big", big);
+    long part_inum = make_file("part", part);
+    ASSERT_NE(big_inum, -1);
+    ASSERT_NE(part_inum, -1);
+    ASSERT_NE(make_file("gone", gone), -1);
+
+    int id = fs_snapshot_create();
+    ASSERT_GT(id, 0);
+
+    // whole blocks, a partial block, a shorter file and a removed one
+    std::string fresh = contents("fresh", 40 * BLOCK_SIZE + 100);
+    ASSERT_EQ(fs_write((uint32_t)big_inum, 0, fresh.data(), fresh.size()), (long)fresh.size());
+    ASSERT_EQ(fs_write((uint32_t)part_inum, 10, "patched", 7), 7);
+    ASSERT_EQ(fs_truncate((uint32_t)part_inum, BLOCK_SIZE + 5), 0);
+    char name[] = "gone";
+    ASSERT_EQ(fs_unlink(fs.sb.root_inode, name), 0);
+    ASSERT_NE(make_file("later", contents("later", 9 * BLOCK_SIZE)), -1);
+
+    EXPECT_TRUE(read_file("/big") == fresh);
+    EXPECT_EQ(read_file("/gone"), "<missing>");
+    EXPECT_TRUE(snapshot_file(id, "/big") == big);
+    EXPECT_TRUE(snapshot_file(id, "/part") == part);
+    EXPECT_TRUE(snapshot_file(id, "/gone") == gone);
+    EXPECT_EQ(snapshot_file(id, "/later"), "<missing>");
+
+    // the live image is untouched by all that
+    EXPECT_TRUE(read_file("/big") == fresh);
+    EXPECT_EQ(read_file("/part").size(), (size_t)BLOCK_SIZE + 5);
+}
+
+TEST_P(SnapshotTest, CreationTakesAChunkAndCopiesNothing) {
+    for (int i = 0; i < 20; i++) ASSERT_NE(make_file("f" + std::to_string(i), contents("f", 2 * BLOCK_SIZE)), -1);
+    fs_sync();
+    uint32_t free_before = fs.sb.free_blocks;
+
+    int id = fs_snapshot_create();
+    ASSERT_GT(id, 0);
+    EXPECT_GE(free_before - fs.sb.free_blocks, 2u);
+    EXPECT_LE(free_before - fs.sb.free_blocks, 2u + SNAP_CHUNK_SLOTS); // the table and one chunk
+
+    SnapshotInfo info[SNAP_MAX];
+    ASSERT_EQ(fs_snapshot_list(info, SNAP_MAX), 1u);
+    EXPECT_EQ(info[0].id, (uint32_t)id);
+    EXPECT_EQ(info[0].copies, 0u);
+    EXPECT_FALSE(info[0].broken);
+
+    // one overwritten block gets one copy, the metadata it changes a few more
+    long inum = path_lookup("/f3");
+    ASSERT_EQ(fs_write((uint32_t)inum, 0, "x", 1), 1);
+    fs_sync();
+    fs_snapshot_list(info, SNAP_MAX);
+    EXPECT_GE(info[0].copies, 1u);
+    EXPECT_LT(info[0].copies, 10u);
+}
+
+TEST_P(SnapshotTest, BlocksReadAsTheyWere) {
+    std::string old = contents("old", BLOCK_SIZE);
+    long inum = make_file("f", old);
+    ASSERT_NE(inum, -1);
+    int id = fs_snapshot_create();
+    ASSERT_GT(id, 0);
+    std::string now = contents("now", BLOCK_SIZE);
+    ASSERT_EQ(fs_write((uint32_t)inum, 0, now.data(), now.size()), (long)now.size());
+
+    Inode in;
+    read_inode((uint32_t)inum, &in);
+    long block = (in.flags & INODE_EXTENTS) ? ext_map(&in, 0, nullptr) : (long)in.direct[0];
+    ASSERT_GT(block, 0);
+    std::vector<char> buf(BLOCK_SIZE);
+    ASSERT_EQ(fs_snapshot_read((uint32_t)id, (uint32_t)block, buf.data()), 0);
+    EXPECT_TRUE(std::string(buf.data(), BLOCK_SIZE) == old);
+    EXPECT_EQ(fs_snapshot_read((uint32_t)id + 1, (uint32_t)block, buf.data()), -1);
+}
+
+TEST_P(SnapshotTest, SurvivesRemount) {
+    std::string v1 = contents("v1", 6 * BLOCK_SIZE);
+    long inum = make_file("f", v1);
+    ASSERT_NE(inum, -1);
+    int id = fs_snapshot_create();
+    ASSERT_GT(id, 0);
+
+    std::string v2 = contents("v2", 6 * BLOCK_SIZE);
+    ASSERT_EQ(fs_write((uint32_t)inum, 0, v2.data(), 3 * BLOCK_SIZE), 3 * BLOCK_SIZE);
+    remount();
+
+    // blocks first written after the remount are still preserved
+    ASSERT_EQ(fs_write((uint32_t)inum, 0, v2.data(), v2.size()), (long)v2.size());
+    SnapshotInfo info[SNAP_MAX];
+    ASSERT_EQ(fs_snapshot_list(info, SNAP_MAX), 1u);
+    EXPECT_EQ(info[0].id, (uint32_t)id);
+    EXPECT_TRUE(snapshot_file(id, "/f") == v1);
+    EXPECT_TRUE(read_file("/f") == v2);
+}
+
+TEST_P(SnapshotTest, ChainKeepsEachVersionWhateverIsDeletedFirst) {
+    std::vector<std::string> versions;
+    std::vector<int> ids;
+    long inum = make_file("f", contents("v0", 8 * BLOCK_SIZE));
+    ASSERT_NE(inum, -1);
+    for (int v = 0; v < 4; v++) {
+        versions.push_back(read_file("/f"));
+        ids.push_back(fs_snapshot_create());
+        ASSERT_GT(ids.back(), 0);
+        // every version overwrites a different half of the file
+        std::string next = contents("v" + std::to_string(v + 1), 4 * BLOCK_SIZE);
+        ASSERT_EQ(fs_write((uint32_t)inum, (v % 2) * 4 * BLOCK_SIZE, next.data(), next.size()), (long)next.size());
+    }
+    for (int v = 0; v < 4; v++) EXPECT_TRUE(snapshot_file(ids[v], "/f") == versions[v]) << v;
+
+    // a middle one, then the newest, then the oldest
+    ASSERT_EQ(fs_snapshot_delete((uint32_t)ids[1]), 0);
+    EXPECT_EQ(fs_snapshot_delete((uint32_t)ids[1]), -1);
+    EXPECT_TRUE(snapshot_file(ids[0], "/f") == versions[0]);
+    EXPECT_TRUE(snapshot_file(ids[2], "/f") == versions[2]);
+    ASSERT_EQ(fs_snapshot_delete((uint32_t)ids[3]), 0);
+    EXPECT_TRUE(snapshot_file(ids[0], "/f") == versions[0]);
+    EXPECT_TRUE(snapshot_file(ids[2], "/f") == versions[2]);
+
+    // the one left still takes copies after the others went away
+    std::string last = contents("last", 8 * BLOCK_SIZE);
+    ASSERT_EQ(fs_write((uint32_t)inum, 0, last.data(), last.size()), (long)last.size());
+    ASSERT_EQ(fs_snapshot_delete((uint32_t)ids[0]), 0);
+    remount();
+    EXPECT_TRUE(snapshot_file(ids[2], "/f") == versions[2]);
+    EXPECT_TRUE(read_file("/f") == last);
+}
+
+TEST_P(SnapshotTest, DeletingGivesTheSpaceBack) {
+    long inum = make_file("f", contents("a", 30 * BLOCK_SIZE));
+    ASSERT_NE(inum, -1);
+    ASSERT_NE(make_file("g", contents("g", 20 * BLOCK_SIZE)), -1);
+    fs_sync();
+    uint32_t free_before = fs.sb.free_blocks;
+
+    int first = fs_snapshot_create();
+    std::string b = contents("b", 30 * BLOCK_SIZE);
+    ASSERT_EQ(fs_write((uint32_t)inum, 0, b.data(), b.size()), (long)b.size());
+    int second = fs_snapshot_create();
+    char name[] = "g";
+    ASSERT_EQ(fs_unlink(fs.sb.root_inode, name), 0); // its blocks stay with the snapshots
+    fs_sync();
+    EXPECT_LT(fs.sb.free_blocks, free_before);
+
+    ASSERT_EQ(fs_snapshot_delete((uint32_t)first), 0);
+    ASSERT_EQ(fs_snapshot_delete((uint32_t)second), 0);
+    fs_sync();
+    EXPECT_EQ(fs.sb.free_blocks, free_before + 20);
+    EXPECT_EQ(fs.sb.snap_table, 0u);
+    EXPECT_EQ(fs_snapshot_list(nullptr, 0), 0u);
+
+    remount();
+    EXPECT_EQ(fs.sb.free_blocks, free_before + 20);
+    EXPECT_TRUE(read_file("/f") == b);
+}
+
+TEST_P(SnapshotTest, TakenWhileWritersRunSeesWholeWrites) {
+    const int threads = 4, versions = 30;
+    const size_t len = 6 * BLOCK_SIZE;
+    std::vector<long> inums;
+    for (int t = 0; t < threads; t++) {
+        inums.push_back(make_file("w" + std::to_string(t), contents("w" + std::to_string(t) + "_0", len)));
+        ASSERT_NE(inums.back(), -1);
+    }
+
+    // each fs_write is one transaction, the snapshot falls between two of them
+    std::atomic<int> id{0};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+            for (int v = 1; v <= versions; v++) {
+                std::string data = contents("w" + std::to_string(t) + "_" + std::to_string(v), len);
+                fs_write((uint32_t)inums[t], 0, data.data(), data.size());
+                if (t == 0 && v == versions / 2) id = fs_snapshot_create();
+            }
+        });
+    }
+    for (auto &w : writers) w.join();
+    ASSERT_GT(id.load(), 0);
+
+    ASSERT_EQ(fs_snapshot_export((uint32_t)id.load(), EXPORT), 0);
+    remount(EXPORT);
+    for (int t = 0; t < threads; t++) {
+        std::string data = read_file("/w" + std::to_string(t));
+        int match = -1;
+        for (int v = 0; v <= versions && match == -1; v++) {
+            if (data == contents("w" + std::to_string(t) + "_" + std::to_string(v), len)) match = v;
+        }
+        EXPECT_NE(match, -1) << t;
+        if (t == 0) {
+            EXPECT_EQ(match, versions / 2);
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Journal, SnapshotTest, ::testing::Values(1, 0),
+                         [](const ::testing::TestParamInfo<int> &info) {
+                             return std::string(info.param ? "Journaled" : "Unjournaled");
+                         });
@@ -0,0 +1,183 @@
+// stats.cpp
+// GoogleTest tests for the per-operation counters and latency histograms in Stats.c, run
+// against the real fs_core.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "Stats.h"
+
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+long fs_read(uint32_t inum, uint64_t offset, void *buf, size_t len);
+long fs_write(uint32_t inum, uint64_t offset, const void *buf, size_t len);
+long path_resolve(uint32_t cwd, const char *path);
+}
+
+static const char *IMAGE = "stats_test.bin";
+
+class StatsTest : public ::testing::Test {
+protected:
+    FsOptions opts;
+
+    void SetUp() override {
+        fs_default_options(&opts);
+    }
+
+    void TearDown() override {
+        stats_enable(0);
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    void start(BlockDeviceType backend) {
+        opts.backend = backend;
+        ASSERT_EQ(format_disk_opts(IMAGE, 4096, &opts), 0);
+        stats_reset();
+        stats_enable(1);
+    }
+
+    static int mkdir_at(uint32_t parent, const std::string &name) {
+        std::string copy = name;
+        return fs_mkdir(parent, &copy[0]);
+    }
+
+    static FsStats snapshot() {
+        FsStats s;
+        stats_snapshot(&s);
+        return s;
+    }
+};
+
+TEST_F(StatsTest, DisabledCountsNothing) {
+    start(BDEV_STDIO);
+    stats_enable(0);
+    ASSERT_GE(mkdir_at(fs.sb.root_inode, "quiet"), 0);
+    ASSERT_GE(fs_sync(), 0);
+
+    FsStats s = snapshot();
+    FsStats zero;
+    std::memset(&zero, 0, sizeof(zero));
+    EXPECT_EQ(std::memcmp(&s, &zero, sizeof(s)), 0);
+}
+
+TEST_F(StatsTest, MkdirOwnsTheWorkOfItsNestedCalls) {
+    start(BDEV_STDIO);
+    ASSERT_GE(mkdir_at(fs.sb.root_inode, "a"), 0);
+
+    FsStats s = snapshot();
+    const OpStats &op = s.ops[OP_MKDIR];
+    EXPECT_EQ(op.calls, 1u);
+    EXPECT_EQ(s.ops[OP_DIR_ADD].calls, 0u); // its dir_adds are part of it
+    EXPECT_GE(op.io.allocs, 1u);            // the inode, the empty dir is inline
+    EXPECT_GT(op.io.alloc_words, 0u);
+    EXPECT_GT(op.io.sb_syncs, 0u);
+    EXPECT_GT(op.io.cache_hits + op.io.cache_misses, 0u);
+    EXPECT_GT(op.io.dev_writes, 0u);        // the commit
+    EXPECT_GT(op.total_ns, 0u);
+
+    // the totals hold everything an op counted
+    EXPECT_GE(s.io.allocs, op.io.allocs);
+    EXPECT_GE(s.io.dev_writes, op.io.dev_writes);
+}
+
+TEST_F(StatsTest, SeeksOnlyOnStdio) {
+    for (BlockDeviceType backend : {BDEV_STDIO, BDEV_PREAD}) {
+        start(backend);
+        for (int i = 0; i < 10; i++) ASSERT_GE(mkdir_at(fs.sb.root_inode, "d" + std::to_string(i)), 0);
+        ASSERT_GE(fs_sync(), 0);
+
+        FsStats s = snapshot();
+        EXPECT_GT(s.io.dev_writes, 0u) << bdev_type_name(backend);
+        EXPECT_EQ(s.io.bytes_written % BLOCK_SIZE, 0u);
+        if (backend == BDEV_STDIO) EXPECT_GT(s.io.seeks, 0u);
+        else EXPECT_EQ(s.io.seeks, 0u);
+
+        stats_enable(0);
+        unmount_disk();
+    }
+}
+
+TEST_F(StatsTest, HistogramAddsUpToTheCalls) {
+    start(BDEV_PREAD);
+    ASSERT_GE(mkdir_at(fs.sb.root_inode, "x"), 0);
+    for (int i = 0; i < 200; i++) ASSERT_NE(dir_lookup(fs.sb.root_inode, "x"), -1);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "missing"), -1);
+
+    FsStats s = snapshot();
+    const OpStats &op = s.ops[OP_DIR_LOOKUP];
+    EXPECT_EQ(op.calls, 201u);
+    uint64_t counted = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) counted += op.latency[i];
+    EXPECT_EQ(counted, op.calls);
+
+    uint64_t p50 = stats_percentile(&op, 0.5), p99 = stats_percentile(&op, 0.99);
+    EXPECT_GT(p50, 0u);
+    EXPECT_LE(p50, p99);
+    EXPECT_LE(op.total_ns / op.calls, op.max_ns);
+
+    stats_reset();
+    s = snapshot();
+    EXPECT_EQ(s.ops[OP_DIR_LOOKUP].calls, 0u);
+    EXPECT_EQ(stats_percentile(&s.ops[OP_DIR_LOOKUP], 0.5), 0u);
+}
+
+TEST_F(StatsTest, AsyncTransfersCountTowardsTheirRead) {
+    opts.io_uring = 0; // worker threads carry the reads out
+    start(BDEV_PREAD);
+    std::string a = "a", b = "b";
+    int fa = fs_creat(fs.sb.root_inode, &a[0], IREG | IRUSR | IWUSR);
+    int fb = fs_creat(fs.sb.root_inode, &b[0], IREG | IRUSR | IWUSR);
+    ASSERT_GE(fa, 0);
+    ASSERT_GE(fb, 0);
+
+    // interleaved appends leave a in many runs, one read of it batches them
+    std::vector<uint8_t> block(BLOCK_SIZE, 0x5A);
+    for (int i = 0; i < 16; i++) {
+        ASSERT_EQ(fs_write(fa, (uint64_t)i * BLOCK_SIZE, block.data(), BLOCK_SIZE), BLOCK_SIZE);
+        ASSERT_EQ(fs_write(fb, (uint64_t)i * BLOCK_SIZE, block.data(), BLOCK_SIZE), BLOCK_SIZE);
+    }
+    stats_reset();
+
+    std::vector<uint8_t> back(16 * BLOCK_SIZE);
+    ASSERT_EQ(fs_read(fa, 0, back.data(), back.size()), (long)back.size());
+
+    FsStats s = snapshot();
+    EXPECT_EQ(s.ops[OP_READ].calls, 1u);
+    EXPECT_GT(s.ops[OP_READ].io.dev_reads, 1u);
+    EXPECT_GE(s.ops[OP_READ].io.bytes_read, back.size());
+}
+
+TEST_F(StatsTest, ThreadsCountTheirOwnCalls) {
+    start(BDEV_PREAD);
+    const int threads = 4, per = 25;
+    std::vector<int> dirs(threads);
+    for (int t = 0; t < threads; t++) {
+        dirs[t] = mkdir_at(fs.sb.root_inode, "t" + std::to_string(t));
+        ASSERT_GE(dirs[t], 0);
+    }
+    stats_reset();
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            for (int i = 0; i < per; i++) mkdir_at((uint32_t)dirs[t], "d" + std::to_string(i));
+            for (int i = 0; i < per; i++) path_resolve(fs.sb.root_inode, ("/t" + std::to_string(t) + "/d0").c_str());
+        });
+    }
+    for (auto &th : pool) th.join();
+
+    FsStats s = snapshot();
+    EXPECT_EQ(s.ops[OP_MKDIR].calls, (uint64_t)threads * per);
+    EXPECT_EQ(s.ops[OP_RESOLVE].calls, (uint64_t)threads * per);
+    EXPECT_EQ(s.ops[OP_DIR_ADD].calls, 0u);
+}
@@ -0,0 +1,135 @@
+// transaction.cpp
+// GoogleTest tests for grouped metadata commits in Transaction.c, run against the real fs_core.
+//
+// Directories.h / Files.h declare mkdir()/creat() which clash with the libc prototypes
+// pulled in by gtest, so the directory functions used here are declared by hand.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "FileSystemStructure.h"
+#include "FileManagement.h"
+#include "Cache.h"
+#include "Transaction.h"
+
+long dir_lookup(uint32_t dir_num, const char *entry_name);
+int fs_mkdir(uint32_t parent_inum, char *child) __asm__("mkdir");
+int fs_creat(uint32_t parent, char *name, uint16_t mode) __asm__("creat");
+}
+
+static const char *IMAGE = "tx_test.bin";
+
+class TransactionTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // no journal, commits write straight to the home blocks
+        FsOptions opts;
+        fs_default_options(&opts);
+        opts.journal = 0;
+        ASSERT_EQ(format_disk_opts(IMAGE, 256, &opts), 0);
+        fs_sync();
+    }
+
+    void TearDown() override {
+        unmount_disk();
+        std::remove(IMAGE);
+    }
+
+    std::vector<uint8_t> raw_block(uint32_t bnum) {
+        std::vector<uint8_t> out(BLOCK_SIZE, 0);
+        FILE *f = std::fopen(IMAGE, "rb");
+        std::fseek(f, (long)bnum * BLOCK_SIZE, SEEK_SET);
+        std::fread(out.data(), 1, BLOCK_SIZE, f);
+        std::fclose(f);
+        return out;
+    }
+};
+
+TEST_F(TransactionTest, MkdirWritesEachBlockOnce) {
+    TxStats tx_before, tx_after;
+    CacheStats c_before, c_after;
+    tx_stats(&tx_before);
+    cache_stats(&c_before);
+
+    char name[] = "home";
+    int child = fs_mkdir(fs.sb.root_inode, name);
+    ASSERT_GE(child, 0);
+
+    tx_stats(&tx_after);
+    cache_stats(&c_after);
+
+    // superblock, group descriptors, block bitmap, inode bitmap, inode table, new dir block, root dir block
+    uint64_t written = c_after.writebacks - c_before.writebacks;
+    EXPECT_LE(written, 7u);
+    EXPECT_EQ(written, tx_after.blocks_written - tx_before.blocks_written);
+    EXPECT_EQ(tx_after.superblock_writes - tx_before.superblock_writes, 1u);
+    EXPECT_EQ(tx_after.commits - tx_before.commits, 1u); // nested commits don't count
+}
+
+TEST_F(TransactionTest, NothingReachesDiskBeforeOutermostCommit) {
+    std::vector<uint8_t> sb_before = raw_block(0);
+
+    tx_begin();
+    ASSERT_GE(create_inode(IREG | IRUSR), 0);
+    tx_begin();
+    ASSERT_GE(alloc_block(), 0);
+    EXPECT_EQ(tx_commit(), 0);
+
+    EXPECT_TRUE(tx_active());
+    EXPECT_EQ(raw_block(0), sb_before);
+
+    EXPECT_GT(tx_commit(), 0);
+    EXPECT_FALSE(tx_active());
+    EXPECT_NE(raw_block(0), sb_before);
+}
+
+TEST_F(TransactionTest, TouchedBlocksSurviveCachePressure) {
+    ASSERT_EQ(cache_init(8), 0);
+
+    std::vector<uint8_t> pattern(BLOCK_SIZE, 0x77);
+    tx_begin();
+    write_block(100, pattern.data());
+    for (uint32_t b = 150; b < 200; b++) {
+        Buffer *other = bread(b);
+        ASSERT_NE(other, nullptr);
+        brelse(other);
+    }
+    EXPECT_EQ(raw_block(100)[0], 0);    // pinned, not written back by eviction
+
+    EXPECT_EQ(tx_commit(), 1);
+    EXPECT_EQ(raw_block(100), pattern);
+}
+
+TEST_F(TransactionTest, BatchOfCreatesSharesOneCommit) {
+    CacheStats before, after;
+    cache_stats(&before);
+
+    tx_begin();
+    for (int i = 0; i < 50; i++) {
+        std::string name = "f" + std::to_string(i);
+        ASSERT_GE(fs_creat(fs.sb.root_inode, &name[0], IREG | IRUSR | IWUSR), 0);
+    }
+    tx_commit();
+
+    cache_stats(&after);
+    // 50 files fit in one dir block and two inode table blocks
+    EXPECT_LE(after.writebacks - before.writebacks, 8u);
+}
+
+TEST_F(TransactionTest, CommittedStateSurvivesRemount) {
+    char name[] = "etc";
+    int child = fs_mkdir(fs.sb.root_inode, name);
+    ASSERT_GE(child, 0);
+    uint32_t free_inodes = fs.sb.free_inodes;
+
+    unmount_disk();
+    ASSERT_EQ(mount_disk(IMAGE), 0);
+    EXPECT_EQ(fs.sb.free_inodes, free_inodes);
+    EXPECT_EQ(dir_lookup(fs.sb.root_inode, "etc"), child);
+    EXPECT_EQ(dir_lookup(child, ".."), (long)fs.sb.root_inode);
+}